@@ -0,0 +1,401 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/**
+ * @file  gstkoki.c
+ * @brief A GStreamer element that finds libkoki markers in video frames
+ *
+ * kokidetect passes GRAY8 and YUY2 frames through untouched, attaching the
+ * markers it finds to each buffer as a \c GstKokiMeta (and, if asked,
+ * posting them to the bus as an element message).  GRAY8 frames are read
+ * in place, through an \c IplImage header around the mapped buffer.  The
+ * luma of YUY2 frames is interleaved with the chroma, so it's extracted
+ * into a greyscale image the element keeps for the purpose.
+ *
+ * The buffers are mapped read-only, so no pixels are copied even when the
+ * memory is shared with other buffers.  Only the buffer's metadata is
+ * written.
+ *
+ * @code
+ *   gst-launch-1.0 v4l2src ! video/x-raw,format=YUY2 \
+ *       ! kokidetect marker-width=0.11 focal-length=571 post-messages=true \
+ *       ! fakesink -m
+ * @endcode
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <gst/video/gstvideofilter.h>
+#include <cv.h>
+
+#include "koki.h"
+
+#include "gstkokimeta.h"
+
+/* GST_PLUGIN_DEFINE() expects the package's name */
+#ifndef PACKAGE
+#define PACKAGE "libkoki"
+#endif
+
+#define GST_TYPE_KOKI (gst_koki_get_type())
+#define GST_KOKI(obj) \
+	(G_TYPE_CHECK_INSTANCE_CAST((obj), GST_TYPE_KOKI, GstKoki))
+
+#define DEFAULT_MARKER_WIDTH  0.11
+#define DEFAULT_FOCAL_LENGTH  571.0
+
+typedef struct {
+	GstVideoFilter parent;
+
+	koki_t *koki;
+	IplImage *luma;           /* the luma of YUY2 frames, or NULL */
+
+	/* properties, protected by the object lock */
+	gfloat marker_width;
+	gfloat focal_length;
+	gboolean decode_cache;
+	guint sparse_stride;
+	gboolean post_messages;
+	gboolean settings_changed; /* whether the context needs updating */
+} GstKoki;
+
+typedef struct {
+	GstVideoFilterClass parent_class;
+} GstKokiClass;
+
+GType gst_koki_get_type( void );
+
+G_DEFINE_TYPE( GstKoki, gst_koki, GST_TYPE_VIDEO_FILTER );
+
+enum {
+	PROP_0,
+	PROP_MARKER_WIDTH,
+	PROP_FOCAL_LENGTH,
+	PROP_DECODE_CACHE,
+	PROP_SPARSE_STRIDE,
+	PROP_POST_MESSAGES
+};
+
+#define KOKI_CAPS GST_VIDEO_CAPS_MAKE( "{ GRAY8, YUY2 }" )
+
+static GstStaticPadTemplate sink_template =
+	GST_STATIC_PAD_TEMPLATE( "sink", GST_PAD_SINK, GST_PAD_ALWAYS,
+				 GST_STATIC_CAPS( KOKI_CAPS ) );
+
+static GstStaticPadTemplate src_template =
+	GST_STATIC_PAD_TEMPLATE( "src", GST_PAD_SRC, GST_PAD_ALWAYS,
+				 GST_STATIC_CAPS( KOKI_CAPS ) );
+
+
+
+static void gst_koki_set_property( GObject *object, guint prop_id,
+				   const GValue *value, GParamSpec *pspec )
+{
+	GstKoki *self = GST_KOKI( object );
+
+	GST_OBJECT_LOCK( self );
+
+	switch( prop_id ) {
+	case PROP_MARKER_WIDTH:
+		self->marker_width = g_value_get_float( value );
+		break;
+	case PROP_FOCAL_LENGTH:
+		self->focal_length = g_value_get_float( value );
+		break;
+	case PROP_DECODE_CACHE:
+		self->decode_cache = g_value_get_boolean( value );
+		self->settings_changed = TRUE;
+		break;
+	case PROP_SPARSE_STRIDE:
+		self->sparse_stride = g_value_get_uint( value );
+		self->settings_changed = TRUE;
+		break;
+	case PROP_POST_MESSAGES:
+		self->post_messages = g_value_get_boolean( value );
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID( object, prop_id, pspec );
+		break;
+	}
+
+	GST_OBJECT_UNLOCK( self );
+}
+
+static void gst_koki_get_property( GObject *object, guint prop_id,
+				   GValue *value, GParamSpec *pspec )
+{
+	GstKoki *self = GST_KOKI( object );
+
+	GST_OBJECT_LOCK( self );
+
+	switch( prop_id ) {
+	case PROP_MARKER_WIDTH:
+		g_value_set_float( value, self->marker_width );
+		break;
+	case PROP_FOCAL_LENGTH:
+		g_value_set_float( value, self->focal_length );
+		break;
+	case PROP_DECODE_CACHE:
+		g_value_set_boolean( value, self->decode_cache );
+		break;
+	case PROP_SPARSE_STRIDE:
+		g_value_set_uint( value, self->sparse_stride );
+		break;
+	case PROP_POST_MESSAGES:
+		g_value_set_boolean( value, self->post_messages );
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID( object, prop_id, pspec );
+		break;
+	}
+
+	GST_OBJECT_UNLOCK( self );
+}
+
+
+
+static gboolean gst_koki_set_info( GstVideoFilter *filter,
+				   GstCaps *incaps, GstVideoInfo *in_info,
+				   GstCaps *outcaps, GstVideoInfo *out_info )
+{
+	GstKoki *self = GST_KOKI( filter );
+
+	if( self->luma != NULL )
+		cvReleaseImage( &self->luma );
+
+	if( GST_VIDEO_INFO_FORMAT( in_info ) == GST_VIDEO_FORMAT_YUY2 )
+		self->luma = cvCreateImage( cvSize( GST_VIDEO_INFO_WIDTH( in_info ),
+						    GST_VIDEO_INFO_HEIGHT( in_info ) ),
+					    IPL_DEPTH_8U, 1 );
+
+	return TRUE;
+}
+
+/**
+ * @brief posts the codes of the markers found in a frame to the bus
+ *
+ * @param self     the element
+ * @param buf      the frame's buffer
+ * @param markers  the markers found in it
+ */
+static void post_markers( GstKoki *self, GstBuffer *buf,
+			  const GPtrArray *markers )
+{
+	GString *codes = g_string_new( NULL );
+	GstStructure *s;
+
+	for( guint i=0; i<markers->len; i++ ) {
+		koki_marker_t *m = g_ptr_array_index( markers, i );
+		g_string_append_printf( codes, i > 0 ? ",%u" : "%u", m->code );
+	}
+
+	s = gst_structure_new( "koki-markers",
+			       "timestamp", G_TYPE_UINT64, GST_BUFFER_PTS( buf ),
+			       "count", G_TYPE_UINT, markers->len,
+			       "codes", G_TYPE_STRING, codes->str,
+			       NULL );
+	g_string_free( codes, TRUE );
+
+	gst_element_post_message( GST_ELEMENT( self ),
+				  gst_message_new_element( GST_OBJECT( self ), s ) );
+}
+
+static GstFlowReturn gst_koki_transform_ip( GstBaseTransform *trans,
+					    GstBuffer *buf )
+{
+	GstKoki *self = GST_KOKI( trans );
+	GstVideoFilter *filter = GST_VIDEO_FILTER( trans );
+	GstVideoFrame frame;
+	IplImage header, *img;
+	koki_camera_params_t params;
+	GPtrArray *markers;
+	gfloat marker_width;
+	gboolean post;
+	uint16_t w, h;
+
+	/* read-only, so that shared memory isn't copied */
+	if( !gst_video_frame_map( &frame, &filter->in_info, buf, GST_MAP_READ ) )
+		return GST_FLOW_ERROR;
+
+	w = GST_VIDEO_FRAME_WIDTH( &frame );
+	h = GST_VIDEO_FRAME_HEIGHT( &frame );
+
+	if( GST_VIDEO_FRAME_FORMAT( &frame ) == GST_VIDEO_FORMAT_GRAY8 ) {
+		cvInitImageHeader( &header, cvSize( w, h ), IPL_DEPTH_8U, 1,
+				   IPL_ORIGIN_TL, 4 );
+		header.widthStep = GST_VIDEO_FRAME_PLANE_STRIDE( &frame, 0 );
+		header.imageSize = header.widthStep * h;
+		header.imageData = header.imageDataOrigin =
+			GST_VIDEO_FRAME_PLANE_DATA( &frame, 0 );
+		img = &header;
+	} else {
+		const koki_simd_kernels_t *simd = koki_simd_kernels();
+		const uint8_t *yuyv = GST_VIDEO_FRAME_PLANE_DATA( &frame, 0 );
+		gint stride = GST_VIDEO_FRAME_PLANE_STRIDE( &frame, 0 );
+
+		img = self->luma;
+		for( uint16_t y=0; y<h; y++ )
+			simd->yuyv_to_grey( yuyv + stride * y,
+					    (uint8_t*)( img->imageData
+							+ img->widthStep * y ),
+					    w );
+	}
+
+	GST_OBJECT_LOCK( self );
+
+	if( self->settings_changed ) {
+		koki_set_decode_cache( self->koki, self->decode_cache );
+		koki_set_sparse_labelling( self->koki, self->sparse_stride );
+		self->settings_changed = FALSE;
+	}
+
+	params.size.x = w;
+	params.size.y = h;
+	params.principal_point.x = w / 2.0;
+	params.principal_point.y = h / 2.0;
+	params.focal_length.x = params.focal_length.y = self->focal_length;
+	marker_width = self->marker_width;
+	post = self->post_messages;
+
+	GST_OBJECT_UNLOCK( self );
+
+	markers = koki_find_markers( self->koki, img, marker_width, &params );
+
+	gst_video_frame_unmap( &frame );
+
+	if( markers == NULL )
+		return GST_FLOW_OK;
+
+	gst_buffer_add_koki_meta( buf, markers );
+
+	if( post )
+		post_markers( self, buf, markers );
+
+	koki_markers_free( markers );
+
+	return GST_FLOW_OK;
+}
+
+
+
+static void gst_koki_finalize( GObject *object )
+{
+	GstKoki *self = GST_KOKI( object );
+
+	if( self->luma != NULL )
+		cvReleaseImage( &self->luma );
+
+	koki_destroy( self->koki );
+
+	G_OBJECT_CLASS( gst_koki_parent_class )->finalize( object );
+}
+
+static void gst_koki_class_init( GstKokiClass *klass )
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS( klass );
+	GstElementClass *element_class = GST_ELEMENT_CLASS( klass );
+	GstBaseTransformClass *trans_class = GST_BASE_TRANSFORM_CLASS( klass );
+	GstVideoFilterClass *filter_class = GST_VIDEO_FILTER_CLASS( klass );
+
+	gobject_class->set_property = gst_koki_set_property;
+	gobject_class->get_property = gst_koki_get_property;
+	gobject_class->finalize = gst_koki_finalize;
+
+	g_object_class_install_property( gobject_class, PROP_MARKER_WIDTH,
+		g_param_spec_float( "marker-width", "Marker width",
+				    "The width of the markers' black squares, in metres",
+				    G_MINFLOAT, G_MAXFLOAT, DEFAULT_MARKER_WIDTH,
+				    G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS ) );
+
+	g_object_class_install_property( gobject_class, PROP_FOCAL_LENGTH,
+		g_param_spec_float( "focal-length", "Focal length",
+				    "The camera's focal length, in pixels at the "
+				    "negotiated resolution",
+				    0, G_MAXFLOAT, DEFAULT_FOCAL_LENGTH,
+				    G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS ) );
+
+	g_object_class_install_property( gobject_class, PROP_DECODE_CACHE,
+		g_param_spec_boolean( "decode-cache", "Decode cache",
+				      "Reuse the codes of markers that haven't moved",
+				      FALSE,
+				      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS ) );
+
+	g_object_class_install_property( gobject_class, PROP_SPARSE_STRIDE,
+		g_param_spec_uint( "sparse-stride", "Sparse stride",
+				   "Label only regions crossing every n-th row or "
+				   "column (0 labels every pixel)",
+				   0, G_MAXUINT16, 0,
+				   G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS ) );
+
+	g_object_class_install_property( gobject_class, PROP_POST_MESSAGES,
+		g_param_spec_boolean( "post-messages", "Post messages",
+				      "Post a koki-markers element message for "
+				      "each frame",
+				      FALSE,
+				      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS ) );
+
+	gst_element_class_add_pad_template( element_class,
+		gst_static_pad_template_get( &sink_template ) );
+	gst_element_class_add_pad_template( element_class,
+		gst_static_pad_template_get( &src_template ) );
+
+	gst_element_class_set_static_metadata( element_class,
+		"libkoki marker detector", "Filter/Analyzer/Video",
+		"Finds libkoki markers and attaches them to buffers as GstKokiMeta",
+		"libkoki contributors" );
+
+	/* the frame is mapped by transform_ip, rather than by GstVideoFilter,
+	   which would map it for writing */
+	trans_class->transform_ip = gst_koki_transform_ip;
+	trans_class->passthrough_on_same_caps = FALSE;
+	filter_class->set_info = gst_koki_set_info;
+}
+
+static void gst_koki_init( GstKoki *self )
+{
+	self->koki = koki_new();
+	self->luma = NULL;
+
+	self->marker_width = DEFAULT_MARKER_WIDTH;
+	self->focal_length = DEFAULT_FOCAL_LENGTH;
+	self->decode_cache = FALSE;
+	self->sparse_stride = 0;
+	self->post_messages = FALSE;
+	self->settings_changed = FALSE;
+
+	gst_base_transform_set_in_place( GST_BASE_TRANSFORM( self ), TRUE );
+}
+
+
+
+static gboolean plugin_init( GstPlugin *plugin )
+{
+	/* register the metadata now, so applications can look it up as soon
+	   as the plugin is loaded rather than after the first frame */
+	gst_koki_meta_api_get_type();
+	gst_koki_meta_get_info();
+
+	return gst_element_register( plugin, "kokidetect", GST_RANK_NONE,
+				     GST_TYPE_KOKI );
+}
+
+GST_PLUGIN_DEFINE( GST_VERSION_MAJOR, GST_VERSION_MINOR, koki,
+		   "Finds libkoki markers in video",
+		   plugin_init, "0.0.1", "GPL", "libkoki",
+		   "https://www.studentrobotics.org" )
@@ -0,0 +1,145 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/**
+ * @file  gstkokimeta.c
+ * @brief Implementation of the buffer metadata attached by the kokidetect
+ *        GStreamer element
+ */
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+#include "marker.h"
+
+#include "gstkokimeta.h"
+
+
+/**
+ * @brief returns the type of the \c GstKokiMeta API
+ *
+ * The tags mean that elements which change a frame's size or orientation
+ * drop the metadata, rather than pass on co-ordinates that no longer
+ * apply.  An application linking this file as well as loading the plugin
+ * has two copies of it, so an existing registration is reused.
+ */
+GType gst_koki_meta_api_get_type( void )
+{
+	static gsize type = 0;
+	static const gchar *tags[] = { GST_META_TAG_VIDEO_STR,
+				       GST_META_TAG_VIDEO_SIZE_STR,
+				       GST_META_TAG_VIDEO_ORIENTATION_STR,
+				       NULL };
+
+	if( g_once_init_enter( &type ) ) {
+		GType t = g_type_from_name( "GstKokiMetaAPI" );
+		if( t == 0 )
+			t = gst_meta_api_type_register( "GstKokiMetaAPI", tags );
+		g_once_init_leave( &type, t );
+	}
+
+	return type;
+}
+
+static gboolean gst_koki_meta_init( GstMeta *meta, gpointer params,
+				    GstBuffer *buffer )
+{
+	((GstKokiMeta*)meta)->markers = NULL;
+
+	return TRUE;
+}
+
+static void gst_koki_meta_free( GstMeta *meta, GstBuffer *buffer )
+{
+	GstKokiMeta *kmeta = (GstKokiMeta*)meta;
+
+	if( kmeta->markers != NULL )
+		g_array_free( kmeta->markers, TRUE );
+}
+
+static gboolean gst_koki_meta_transform( GstBuffer *dest, GstMeta *meta,
+					 GstBuffer *buffer, GQuark type,
+					 gpointer data )
+{
+	GstKokiMeta *src = (GstKokiMeta*)meta, *dst;
+
+	/* anything but a copy of the whole frame moves the markers */
+	if( !GST_META_TRANSFORM_IS_COPY( type ) )
+		return FALSE;
+
+	dst = (GstKokiMeta*)gst_buffer_add_meta( dest, GST_KOKI_META_INFO, NULL );
+	if( dst == NULL )
+		return FALSE;
+
+	dst->markers = g_array_sized_new( FALSE, FALSE, sizeof(koki_marker_t),
+					  src->markers->len );
+	g_array_append_vals( dst->markers, src->markers->data,
+			     src->markers->len );
+
+	return TRUE;
+}
+
+/**
+ * @brief returns the \c GstMetaInfo for \c GstKokiMeta, registering it
+ *        the first time unless another copy of this file already has
+ */
+const GstMetaInfo* gst_koki_meta_get_info( void )
+{
+	static const GstMetaInfo *info = NULL;
+
+	if( g_once_init_enter( (GstMetaInfo**)&info ) ) {
+		const GstMetaInfo *i = gst_meta_get_info( "GstKokiMeta" );
+		if( i == NULL )
+			i = gst_meta_register( GST_KOKI_META_API_TYPE,
+					       "GstKokiMeta",
+					       sizeof(GstKokiMeta),
+					       gst_koki_meta_init,
+					       gst_koki_meta_free,
+					       gst_koki_meta_transform );
+		g_once_init_leave( (GstMetaInfo**)&info, (GstMetaInfo*)i );
+	}
+
+	return info;
+}
+
+/**
+ * @brief attaches a copy of some markers to a buffer
+ *
+ * @param buffer   the (writable) buffer
+ * @param markers  the markers, as returned by koki_find_markers()
+ * @return         the new metadata
+ */
+GstKokiMeta* gst_buffer_add_koki_meta( GstBuffer *buffer,
+				       const GPtrArray *markers )
+{
+	GstKokiMeta *meta;
+
+	g_return_val_if_fail( GST_IS_BUFFER( buffer ), NULL );
+	g_return_val_if_fail( markers != NULL, NULL );
+
+	meta = (GstKokiMeta*)gst_buffer_add_meta( buffer, GST_KOKI_META_INFO,
+						  NULL );
+
+	meta->markers = g_array_sized_new( FALSE, FALSE, sizeof(koki_marker_t),
+					   markers->len );
+
+	for( guint i=0; i<markers->len; i++ )
+		g_array_append_vals( meta->markers,
+				     g_ptr_array_index( markers, i ), 1 );
+
+	return meta;
+}
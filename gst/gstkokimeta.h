@@ -0,0 +1,61 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+#ifndef _GST_KOKI_META_H_
+#define _GST_KOKI_META_H_
+
+/**
+ * @file  gstkokimeta.h
+ * @brief Header file for the buffer metadata attached by the kokidetect
+ *        GStreamer element
+ */
+
+#include <gst/gst.h>
+
+#include "marker.h"
+
+
+/**
+ * @brief the markers found in a video frame
+ *
+ * The marker co-ordinates are those of the frame the metadata is attached
+ * to, so elements that scale or rotate the frame drop the metadata.
+ */
+typedef struct {
+	GstMeta meta;      /**< the parent metadata */
+	GArray *markers;   /**< a \c GArray of \c koki_marker_t */
+} GstKokiMeta;
+
+
+GType gst_koki_meta_api_get_type( void );
+#define GST_KOKI_META_API_TYPE (gst_koki_meta_api_get_type())
+
+const GstMetaInfo* gst_koki_meta_get_info( void );
+#define GST_KOKI_META_INFO (gst_koki_meta_get_info())
+
+/**
+ * @brief gets the markers attached to a buffer
+ *
+ * @param buf  the buffer
+ * @return     the \c GstKokiMeta*, or NULL if there isn't one
+ */
+#define gst_buffer_get_koki_meta(buf) \
+	((GstKokiMeta*)gst_buffer_get_meta((buf), GST_KOKI_META_API_TYPE))
+
+GstKokiMeta* gst_buffer_add_koki_meta( GstBuffer *buffer,
+				       const GPtrArray *markers );
+
+#endif /* _GST_KOKI_META_H_ */
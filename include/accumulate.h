@@ -0,0 +1,76 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+#ifndef _KOKI_ACCUMULATE_H_
+#define _KOKI_ACCUMULATE_H_
+
+/**
+ * @file  accumulate.h
+ * @brief Header file for decoding small markers from samples accumulated
+ *        over several frames
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <glib.h>
+#include <cv.h>
+
+#include "points.h"
+#include "code_grid.h"
+#include "marker.h"
+
+/* how many frames a quad can go unseen before it's forgotten */
+#define KOKI_ACCUMULATE_MAX_AGE 3
+
+/* the fewest frames a code is recovered from */
+#define KOKI_ACCUMULATE_MIN_FRAMES 2
+
+
+/**
+ * @brief a quad that's failed to decode, followed from frame to frame
+ */
+typedef struct {
+	koki_point2Df_t vertices[4]; /**< where the quad was last seen, in the
+				          order it was first seen in */
+	float cells[KOKI_MARKER_GRID_WIDTH][KOKI_MARKER_GRID_WIDTH];
+	                             /**< the sum of each cell's normalised
+				          brightness over the frames, 0 for
+				          the border's black and 1 for the
+				          surround's white */
+	uint16_t frames;             /**< the number of frames summed */
+	uint16_t age;                /**< frames since the quad was last seen */
+} koki_accumulator_track_t;
+
+
+/**
+ * @brief the tracks of quads too small to decode from a single frame
+ */
+typedef struct koki_accumulator {
+	GArray *tracks;    /**< a \c GArray of \c koki_accumulator_track_t */
+	uint32_t decoded;  /**< the number of markers decoded from tracks */
+} koki_accumulator_t;
+
+
+koki_accumulator_t* koki_accumulator_new(void);
+
+void koki_accumulator_free(koki_accumulator_t *acc);
+
+void koki_accumulator_age(koki_accumulator_t *acc);
+
+bool koki_accumulator_decode(koki_accumulator_t *acc, koki_marker_t *marker,
+			     const IplImage *frame);
+
+#endif /* _KOKI_ACCUMULATE_H_ */
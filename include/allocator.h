@@ -0,0 +1,89 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+#ifndef _KOKI_ALLOCATOR_H_
+#define _KOKI_ALLOCATOR_H_
+
+/**
+ * @file  allocator.h
+ * @brief Header file for libkoki's pluggable memory allocation
+ *
+ * libkoki's own allocations (markers, quads, contours, labelled and
+ * integral images) are made with koki_malloc() and released with
+ * koki_free().  These use the allocator of the scope the calling thread
+ * is in: the context's allocator while inside koki_find_markers() and the
+ * other functions that take a context, or the default (malloc/free)
+ * allocator otherwise.  Each block remembers the allocator it came from,
+ * so it may be freed from anywhere.
+ *
+ * The pixels each candidate is unwarped and thresholded into come from
+ * koki_malloc() too.  Memory allocated by glib containers, and the OpenCV
+ * images made once per frame, is not covered.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/**
+ * @brief a structure to contain function pointers for an allocator
+ */
+typedef struct {
+
+	void* (*alloc) ( size_t size, size_t alignment,
+			 void* userdata ); /**< allocates \c size bytes aligned
+					        to \c alignment (a power of
+					        two), returning NULL on
+					        failure */
+
+	void (*free) ( void* ptr, size_t size,
+		       void* userdata );   /**< frees a block of \c size bytes
+					        returned by \c alloc */
+} koki_allocator_t;
+
+extern const koki_allocator_t koki_default_allocator;
+
+
+/**
+ * @brief an allocation scope, which lives on the stack of the function
+ *        that entered it
+ */
+typedef struct koki_alloc_scope {
+	const koki_allocator_t *allocator; /**< the allocator to use */
+	void *userdata;                    /**< the allocator's userdata */
+	uint32_t allocations;              /**< allocations made in the scope,
+					        including nested scopes */
+	uint64_t bytes;                    /**< bytes requested in the scope,
+					        including nested scopes */
+	struct koki_alloc_scope *parent;   /**< the enclosing scope */
+} koki_alloc_scope_t;
+
+
+void koki_alloc_scope_enter( koki_alloc_scope_t *scope,
+			     const koki_allocator_t *allocator,
+			     void *userdata );
+
+void koki_alloc_scope_leave( koki_alloc_scope_t *scope );
+
+void* koki_malloc_aligned( size_t size, size_t alignment );
+
+void* koki_malloc( size_t size );
+
+void* koki_calloc( size_t n, size_t size );
+
+void koki_free( void *ptr );
+
+#endif /* _KOKI_ALLOCATOR_H_ */
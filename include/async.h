@@ -0,0 +1,120 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+#ifndef _KOKI_ASYNC_H_
+#define _KOKI_ASYNC_H_
+
+/**
+ * @file  async.h
+ * @brief Header file for finding markers on a pool of worker threads
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <glib.h>
+#include <cv.h>
+
+#include "context.h"
+#include "camera.h"
+
+
+/**
+ * @brief the outcome of a frame submitted with koki_find_markers_async()
+ */
+typedef struct {
+	GPtrArray *markers;       /**< the markers found (free with
+				       koki_markers_free()), or NULL if the
+				       frame couldn't be processed */
+	IplImage *frame;          /**< the submitted frame, which the caller
+				       may now reuse */
+	koki_frame_stats_t stats; /**< the frame's statistics, with \c
+				       frame_id being the submission number */
+	koki_perf_frame_t perf;   /**< the frame's performance counts, all 0
+				       unless the pool's creator was reading
+				       them (see koki_set_perf_counters()) */
+	void *userdata;           /**< the userdata given on submission */
+} koki_async_result_t;
+
+
+/**
+ * @brief a completion callback, called on the worker thread that
+ *        processed the frame
+ *
+ * The callback takes ownership of \c result->markers.
+ */
+typedef void (*koki_async_callback_t)( koki_async_result_t *result );
+
+
+struct koki_async;
+
+/**
+ * @brief a worker thread of a \c koki_async_t
+ */
+typedef struct {
+	struct koki_async *async; /**< the pool the worker belongs to */
+	koki_t *koki;             /**< the worker's own context */
+	GThread *thread;          /**< the worker's thread */
+	uint16_t index;           /**< the worker's number within the pool */
+	uint8_t sched_status;     /**< the \c koki_thread_status_t flags from
+				       applying the worker's scheduling */
+	bool perf;                /**< whether to read performance counters,
+				       which the worker has to open itself */
+} koki_async_worker_t;
+
+/**
+ * @brief a pool of worker threads finding markers
+ */
+typedef struct koki_async {
+	koki_async_worker_t *workers; /**< the workers */
+	uint16_t num_workers;         /**< the number of workers */
+
+	GAsyncQueue *jobs;      /**< frames waiting for a worker */
+
+	GMutex lock;            /**< protects the fields below */
+	GCond started;          /**< signalled as each worker starts */
+	uint16_t num_started;   /**< the number of workers started */
+	GQueue results;         /**< completed frames without a callback,
+				     waiting to be polled */
+	uint16_t in_flight;     /**< frames submitted but not yet
+				     delivered */
+	uint16_t max_in_flight; /**< the most frames that may be in flight */
+	uint32_t submitted;     /**< the number of frames ever submitted */
+
+	int fd;                 /**< an eventfd counting the results
+				     waiting to be polled, written and
+				     read holding \c lock */
+} koki_async_t;
+
+
+koki_async_t* koki_async_new( const koki_t *koki, uint16_t num_workers,
+			      uint16_t max_in_flight );
+
+void koki_async_free( koki_async_t *async );
+
+bool koki_find_markers_async( koki_async_t *async,
+			      IplImage *frame,
+			      float marker_width,
+			      const koki_camera_params_t *params,
+			      koki_async_callback_t callback,
+			      void *userdata );
+
+int koki_async_get_fd( koki_async_t *async );
+
+bool koki_async_poll( koki_async_t *async, koki_async_result_t *result );
+
+uint16_t koki_async_in_flight( koki_async_t *async );
+
+#endif /* _KOKI_ASYNC_H_ */
@@ -0,0 +1,68 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+#ifndef _KOKI_BAYER_H_
+#define _KOKI_BAYER_H_
+
+/**
+ * @file  bayer.h
+ * @brief Header file for finding markers in raw Bayer sensor data
+ */
+
+#include <stdint.h>
+#include <cv.h>
+#include <glib.h>
+
+#include "context.h"
+#include "camera.h"
+
+
+/**
+ * @brief the colour of the top-left pixels of a Bayer mosaic's 2x2 blocks,
+ *        in reading order
+ */
+typedef enum {
+	KOKI_BAYER_RGGB = 0,
+	KOKI_BAYER_GRBG,
+	KOKI_BAYER_GBRG,
+	KOKI_BAYER_BGGR
+} koki_bayer_pattern_t;
+
+
+/**
+ * @brief how each 2x2 block of a mosaic becomes a greyscale pixel
+ */
+typedef enum {
+	KOKI_BAYER_BIN = 0, /**< the mean of all four pixels, which is
+			         (R + 2G + B) / 4 */
+	KOKI_BAYER_GREEN    /**< the mean of the two green pixels, which
+			         have the most light and the least noise */
+} koki_bayer_luma_t;
+
+
+IplImage* koki_bayer_to_grey( const uint8_t *bayer, uint16_t w, uint16_t h,
+			      uint32_t stride, koki_bayer_pattern_t pattern,
+			      koki_bayer_luma_t luma );
+
+GPtrArray* koki_find_markers_bayer( koki_t *koki,
+				    const uint8_t *bayer,
+				    uint16_t w, uint16_t h, uint32_t stride,
+				    koki_bayer_pattern_t pattern,
+				    koki_bayer_luma_t luma,
+				    float marker_width,
+				    const koki_camera_params_t *params );
+
+#endif /* _KOKI_BAYER_H_ */
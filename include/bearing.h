@@ -24,10 +24,15 @@
 
 #include "points.h"
 #include "marker.h"
+#include "fixed.h"
 
 
 koki_bearing_t koki_bearing_estimate_point(koki_point3Df_t point);
 
 void koki_bearing_estimate(koki_marker_t *marker);
 
+koki_fixed_point3_t koki_bearing_estimate_point_fixed(koki_fixed_point3_t point);
+
+void koki_bearing_estimate_fixed(koki_marker_t *marker);
+
 #endif /* _KOKI_BEARING_H_ */
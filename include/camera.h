@@ -39,4 +39,9 @@ typedef struct {
 } koki_camera_params_t;
 
 
+void koki_camera_params_scale(const koki_camera_params_t *src,
+			      uint16_t width, uint16_t height,
+			      koki_camera_params_t *dst);
+
+
 #endif /* _KOKI_CAMERA_H_ */
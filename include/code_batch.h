@@ -0,0 +1,42 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+#ifndef _KOKI_CODE_BATCH_H_
+#define _KOKI_CODE_BATCH_H_
+
+/**
+ * @file  code_batch.h
+ * @brief Header file for recovering the codes of several markers at once
+ */
+
+#include <stdint.h>
+#include <cv.h>
+
+#include "code_grid.h"
+#include "marker.h"
+#include "simd.h"
+
+
+/* the most markers decoded together */
+#define KOKI_CODE_BATCH_SIZE KOKI_HOMOGRAPHY_BATCH
+
+
+void koki_code_recover_batch(const IplImage *frame,
+			     koki_marker_t *const *markers, uint8_t n,
+			     int16_t *codes, float *rotation_offsets,
+			     koki_grid_t *grids);
+
+#endif /* _KOKI_CODE_BATCH_H_ */
@@ -61,6 +61,10 @@ void koki_grid_print(koki_grid_t *grid);
 
 IplImage *koki_code_sub_image(IplImage *unwarped_frame);
 
+uint64_t koki_code_grid_cells(const koki_grid_t *grid);
+
+int16_t koki_code_recover_from_cells(uint64_t cells, float *rotation_offset);
+
 int16_t koki_code_recover_from_grid(koki_grid_t *grid, float *rotation_offset);
 
 int16_t koki_code_translation(int code);
@@ -22,9 +22,56 @@
  * @brief Header file for libkoki context functions
  */
 
+#include <stdint.h>
+#include <stdbool.h>
 #include <glib.h>
 
 #include "logger.h"
+#include "allocator.h"
+#include "simd.h"
+#include "threads.h"
+#include "perf.h"
+
+struct koki_decode_cache;
+struct koki_accumulator;
+struct koki_tracer;
+
+/**
+ * @brief statistics about the most recently processed frame
+ */
+typedef struct {
+	uint32_t frame_id;           /**< the number of frames processed by
+				          the context, including this one */
+	uint32_t candidates;         /**< the number of regions that were
+				          useable as marker candidates */
+	uint32_t skipped_candidates; /**< the number of candidates left
+				          unprocessed because all of the
+				          expected codes had been found */
+	uint32_t nested_candidates;  /**< the number of candidates skipped
+				          because they lay within a marker
+				          already found */
+	uint32_t duplicate_markers;  /**< the number of decoded markers
+				          dropped as duplicates of another */
+	uint32_t edge_quads;         /**< the number of quads found by the
+				          gradient-based detector, if it ran */
+	uint32_t accumulated_markers;/**< the number of markers decoded from
+				          samples accumulated over several
+				          frames */
+	uint32_t allocations;        /**< the number of blocks libkoki
+				          allocated for the frame */
+	uint64_t allocated_bytes;    /**< the total size of those blocks */
+} koki_frame_stats_t;
+
+/**
+ * @brief when to run the gradient-based quad detector
+ *        (see koki_set_edge_quads())
+ */
+typedef enum {
+	KOKI_EDGE_QUADS_OFF = 0,  /**< never */
+	KOKI_EDGE_QUADS_FALLBACK, /**< on frames where labelling found no
+				       markers */
+	KOKI_EDGE_QUADS_ALWAYS    /**< on every frame, after labelling */
+} koki_edge_quads_mode_t;
 
 /**
  * @brief a libkoki context structure
@@ -32,6 +79,46 @@
 typedef struct {
 	logger_callbacks_t logger; /**< the logger callbacks */
 	void *logger_userdata;	   /**< the userdata to pass to the logger callbacks */
+
+	struct koki_decode_cache *decode_cache; /**< the cache of decoded quads,
+						     or NULL if disabled */
+
+	uint8_t expected_codes[256 / 8]; /**< a bitmap of the codes expected
+					      to be in view */
+	uint16_t num_expected_codes;     /**< the number of expected codes,
+					      0 if they're not known */
+
+	koki_allocator_t allocator; /**< the allocator for internal allocations */
+	void *allocator_userdata;   /**< the userdata to pass to the allocator */
+
+	koki_frame_stats_t stats; /**< statistics for the last frame */
+
+	struct koki_tracer *tracer; /**< the stage tracer, or NULL if
+				         tracing is disabled */
+
+	bool reference; /**< whether to use the reference implementations
+			     (see koki_set_reference_mode()) */
+
+	uint16_t label_stride; /**< the scanline spacing for sparse labelling,
+				    or 0 to label every pixel */
+
+	koki_edge_quads_mode_t edge_quads; /**< when to run the gradient-based
+					        quad detector */
+
+	bool batch_decode; /**< whether to decode candidates in batches
+			        (see koki_set_batch_decode()) */
+
+	struct koki_accumulator *accumulator; /**< the tracks of quads too
+					           small to decode, or NULL if
+					           accumulation is disabled */
+
+	uint16_t num_workers; /**< the number of detection workers, or 0 for
+			           one per processor */
+	koki_thread_config_t threads[KOKI_THREAD_NUM_ROLES];
+	                      /**< the scheduling of each role's threads */
+
+	koki_perf_t *perf; /**< the performance counters, or NULL if
+			        they're not being read */
 } koki_t;
 
 koki_t* koki_new( void );
@@ -40,6 +127,39 @@ void koki_set_logger( koki_t* koki, const logger_callbacks_t *logger, void* user
 
 void koki_destroy( koki_t* koki );
 
+void koki_set_allocator( koki_t* koki, const koki_allocator_t *allocator, void* userdata );
+
+void koki_set_decode_cache( koki_t* koki, bool enabled );
+
+void koki_set_tracing( koki_t* koki, uint32_t events_per_thread );
+
+void koki_set_reference_mode( koki_t* koki, bool enabled );
+
+void koki_set_sparse_labelling( koki_t* koki, uint16_t stride );
+
+void koki_set_edge_quads( koki_t* koki, koki_edge_quads_mode_t mode );
+
+void koki_set_batch_decode( koki_t* koki, bool enabled );
+
+void koki_set_accumulation( koki_t* koki, bool enabled );
+
+void koki_set_worker_threads( koki_t* koki, uint16_t num_workers );
+
+void koki_set_thread_config( koki_t* koki, koki_thread_role_t role,
+			     const koki_thread_config_t *config );
+
+bool koki_write_trace( koki_t* koki, const char *filename );
+
+bool koki_set_perf_counters( koki_t* koki, bool enabled );
+
+const koki_perf_frame_t* koki_get_perf_counters( koki_t* koki );
+
+void koki_set_expected_codes( koki_t* koki, const uint8_t *codes, uint16_t n );
+
+bool koki_is_expected_code( koki_t* koki, uint8_t code );
+
+const koki_frame_stats_t* koki_get_frame_stats( koki_t* koki );
+
 void koki_log( koki_t* koki, const char* text, IplImage* img );
 
 gboolean koki_is_logging( koki_t* koki );
@@ -0,0 +1,74 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+#ifndef _KOKI_DECODE_CACHE_H_
+#define _KOKI_DECODE_CACHE_H_
+
+/**
+ * @file  decode_cache.h
+ * @brief Header file for caching decoded codes of tracked quads
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <glib.h>
+#include <cv.h>
+
+#include "points.h"
+#include "code_grid.h"
+#include "marker.h"
+
+
+/**
+ * @brief a single decoded quad remembered from a previous frame
+ */
+typedef struct {
+	koki_point2Df_t vertices[4]; /**< where the quad was last seen */
+	uint8_t code;                /**< the (translated) marker code */
+	float rotation_offset;       /**< the grid rotation, as per
+				          \c koki_marker_t */
+	uint8_t cells[KOKI_MARKER_GRID_WIDTH][KOKI_MARKER_GRID_WIDTH];
+	                             /**< the thresholded cell values from
+				          the full decode, \c 0 for black */
+	uint16_t age;                /**< frames since the quad was last seen */
+} koki_decode_cache_entry_t;
+
+
+/**
+ * @brief a cache of recently decoded quads
+ */
+typedef struct koki_decode_cache {
+	GArray *entries;  /**< a \c GArray of \c koki_decode_cache_entry_t */
+	uint32_t hits;    /**< the number of successful verifications */
+	uint32_t misses;  /**< the number of lookups needing a full decode */
+} koki_decode_cache_t;
+
+
+koki_decode_cache_t* koki_decode_cache_new(void);
+
+void koki_decode_cache_free(koki_decode_cache_t *cache);
+
+void koki_decode_cache_age(koki_decode_cache_t *cache);
+
+bool koki_decode_cache_verify(koki_decode_cache_t *cache,
+			      koki_marker_t *marker,
+			      const IplImage *frame);
+
+void koki_decode_cache_store(koki_decode_cache_t *cache,
+			     const koki_marker_t *marker,
+			     const koki_grid_t *grid);
+
+#endif /* _KOKI_DECODE_CACHE_H_ */
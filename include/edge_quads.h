@@ -0,0 +1,36 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+#ifndef _KOKI_EDGE_QUADS_H_
+#define _KOKI_EDGE_QUADS_H_
+
+/**
+ * @file  edge_quads.h
+ * @brief Header file for finding marker quads from image gradients
+ */
+
+#include <glib.h>
+#include <cv.h>
+
+#include "context.h"
+#include "quad.h"
+
+GPtrArray* koki_edge_quads_find( koki_t *koki, const IplImage *frame,
+				 const CvRect *roi );
+
+void koki_edge_quads_free( GPtrArray *quads );
+
+#endif /* _KOKI_EDGE_QUADS_H_ */
@@ -0,0 +1,88 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+#ifndef _KOKI_EXPOSURE_H_
+#define _KOKI_EXPOSURE_H_
+
+/**
+ * @file  exposure.h
+ * @brief Header file for controlling camera exposure to limit motion blur
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <glib.h>
+#include <cv.h>
+
+#include "marker.h"
+
+
+/**
+ * @brief the range and current value of a V4L2 control
+ */
+typedef struct {
+	bool supported;  /**< whether the camera has the control */
+	int32_t value;   /**< the current value */
+	int32_t min;     /**< the minimum value */
+	int32_t max;     /**< the maximum value */
+	int32_t step;    /**< the control's step size */
+} koki_exposure_control_t;
+
+
+/**
+ * @brief image statistics gathered for exposure control
+ */
+typedef struct {
+	float contrast;      /**< the lowest border contrast of any marker,
+			          or a negative number if there were none */
+	float mean;          /**< the mean grey level of the frame */
+	float clipped;       /**< the fraction of saturated pixels */
+} koki_exposure_stats_t;
+
+
+/**
+ * @brief a controller holding the shortest exposure that still gives
+ *        markers enough contrast to threshold reliably
+ */
+typedef struct {
+	int fd;                           /**< the camera's file descriptor */
+	int32_t original_auto;            /**< the auto exposure mode to
+					       restore when freed */
+	koki_exposure_control_t exposure; /**< the absolute exposure control */
+	koki_exposure_control_t gain;     /**< the gain control */
+
+	uint8_t target_contrast;          /**< the border contrast markers
+					       need for reliable decoding */
+	uint16_t interval;                /**< frames between adjustments,
+					       letting the camera settle */
+	uint16_t frame_count;             /**< frames since the last
+					       adjustment */
+	koki_exposure_stats_t stats;      /**< the last gathered statistics */
+} koki_exposure_ctrl_t;
+
+
+koki_exposure_ctrl_t* koki_exposure_ctrl_new(int fd, uint8_t target_contrast);
+
+void koki_exposure_ctrl_free(koki_exposure_ctrl_t *ctrl);
+
+void koki_exposure_stats(const IplImage *frame, const GPtrArray *markers,
+			 koki_exposure_stats_t *stats);
+
+bool koki_exposure_ctrl_update(koki_exposure_ctrl_t *ctrl,
+			       const IplImage *frame,
+			       const GPtrArray *markers);
+
+#endif /* _KOKI_EXPOSURE_H_ */
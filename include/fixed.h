@@ -0,0 +1,145 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+#ifndef _KOKI_FIXED_H_
+#define _KOKI_FIXED_H_
+
+/**
+ * @file  fixed.h
+ * @brief Header file for Q16.16 fixed-point arithmetic
+ *
+ * These are used for the fixed-point geometry path (quad refinement,
+ * unwarping, pose, rotation and bearing) which is selected at compile
+ * time with \c KOKI_FIXED_POINT, for targets without a (fast) FPU.  The
+ * fixed-point functions are always built, so that they can be compared
+ * against the float ones.
+ *
+ * Values are signed Q16.16, which limits image co-ordinates to +/- 16383
+ * pixels once intermediate products are accounted for.  Intermediates
+ * are carried in 64 bits wherever they'd otherwise overflow.
+ *
+ * Accuracy against the float path (checked by test/fixed_accuracy):
+ *   - koki_fixed_atan2(), koki_fixed_asin():  within 2^-14 radians
+ *   - koki_fixed_sin(), koki_fixed_cos():     within 2^-14
+ *   - koki_fixed_sqrt():                      within 2^-16
+ *   - refined quad vertices:                  within 1/64 pixel
+ *   - homography mapping:                     within 1/64 pixel
+ *   - unwarped pixels:                        within 1 grey level of
+ *                                           koki_homography_sample()
+ *   - pose (world co-ordinates, distance):    within 0.1%
+ *   - rotation and bearing:                   within 0.05 degrees
+ */
+
+#include <stdint.h>
+
+#include "points.h"
+
+
+/**
+ * @brief a signed Q16.16 fixed-point number
+ */
+typedef int32_t koki_fixed_t;
+
+
+/**
+ * @brief a fixed-point valued point in 2D space
+ */
+typedef struct {
+	koki_fixed_t x;  /**< the X co-ordinate */
+	koki_fixed_t y;  /**< the Y co-ordinate */
+} koki_fixed_point2_t;
+
+
+/**
+ * @brief a fixed-point valued point in 3D space
+ */
+typedef struct {
+	koki_fixed_t x;  /**< the X co-ordinate */
+	koki_fixed_t y;  /**< the Y co-ordinate */
+	koki_fixed_t z;  /**< the Z co-ordinate */
+} koki_fixed_point3_t;
+
+
+#define KOKI_FIXED_SHIFT 16
+#define KOKI_FIXED_ONE   ((koki_fixed_t)1 << KOKI_FIXED_SHIFT)
+#define KOKI_FIXED_HALF  (KOKI_FIXED_ONE >> 1)
+
+/* pi, pi/2 and 180/pi in Q16.16 */
+#define KOKI_FIXED_PI     205887
+#define KOKI_FIXED_PI_2   102944
+#define KOKI_FIXED_DEG    3754936
+
+#define KOKI_FIXED_FROM_INT(i) ((koki_fixed_t)((i) * KOKI_FIXED_ONE))
+
+
+/**
+ * @brief converts a float to fixed-point, rounding to nearest
+ */
+static inline koki_fixed_t koki_fixed_from_float(float f)
+{
+	return (koki_fixed_t)(f * KOKI_FIXED_ONE + (f < 0 ? -0.5f : 0.5f));
+}
+
+
+/**
+ * @brief converts a fixed-point number to a float
+ */
+static inline float koki_fixed_to_float(koki_fixed_t x)
+{
+	return (float)x / KOKI_FIXED_ONE;
+}
+
+
+/**
+ * @brief multiplies two fixed-point numbers, rounding to nearest
+ */
+static inline koki_fixed_t koki_fixed_mul(koki_fixed_t a, koki_fixed_t b)
+{
+	return (koki_fixed_t)(((int64_t)a * b + KOKI_FIXED_HALF)
+			      >> KOKI_FIXED_SHIFT);
+}
+
+
+/**
+ * @brief divides two fixed-point numbers (\c b must be non-zero)
+ */
+static inline koki_fixed_t koki_fixed_div(koki_fixed_t a, koki_fixed_t b)
+{
+	return (koki_fixed_t)((int64_t)a * KOKI_FIXED_ONE / b);
+}
+
+
+int64_t koki_fixed_div64(int64_t num, int64_t den, uint8_t frac_bits);
+
+uint32_t koki_fixed_isqrt64(uint64_t v);
+
+koki_fixed_t koki_fixed_sqrt(koki_fixed_t x);
+
+int64_t koki_fixed_hypot64(int64_t x, int64_t y);
+
+koki_fixed_t koki_fixed_atan2_64(int64_t y, int64_t x);
+
+koki_fixed_t koki_fixed_atan2(koki_fixed_t y, koki_fixed_t x);
+
+koki_fixed_t koki_fixed_asin(koki_fixed_t x);
+
+void koki_fixed_sincos(koki_fixed_t angle, koki_fixed_t *s, koki_fixed_t *c);
+
+koki_fixed_t koki_fixed_sin(koki_fixed_t angle);
+
+koki_fixed_t koki_fixed_cos(koki_fixed_t angle);
+
+#endif /* _KOKI_FIXED_H_ */
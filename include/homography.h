@@ -0,0 +1,90 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+#ifndef _KOKI_HOMOGRAPHY_H_
+#define _KOKI_HOMOGRAPHY_H_
+
+/**
+ * @file  homography.h
+ * @brief Header file for mapping the unit square on to a quad
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <cv.h>
+
+#include "points.h"
+#include "fixed.h"
+
+
+/**
+ * @brief a projective mapping from the unit square to an image quad
+ *
+ * A point \c (u, v) in the unit square maps to the image point:
+ *
+ * @code
+ *   x = (a*u + b*v + c) / (g*u + h*v + 1)
+ *   y = (d*u + e*v + f) / (g*u + h*v + 1)
+ * @endcode
+ *
+ * The corners \c (0,0), \c (1,0), \c (1,1) and \c (0,1) map to the quad's
+ * vertices 0, 1, 2 and 3 respectively -- the same correspondence that
+ * koki_unwarp_marker() uses.
+ */
+typedef struct {
+	float a, b, c;  /**< the x numerator coefficients */
+	float d, e, f;  /**< the y numerator coefficients */
+	float g, h;     /**< the denominator coefficients */
+} koki_homography_t;
+
+
+/**
+ * @brief the fixed-point equivalent of \c koki_homography_t
+ *
+ * The numerator coefficients are Q16.16.  The denominator coefficients
+ * are small numbers that need more precision, so they're kept with
+ * \c KOKI_HOMOGRAPHY_GH_SHIFT fractional bits.
+ */
+typedef struct {
+	koki_fixed_t a, b, c;  /**< the x numerator coefficients */
+	koki_fixed_t d, e, f;  /**< the y numerator coefficients */
+	int32_t g, h;          /**< the denominator coefficients */
+} koki_homography_fixed_t;
+
+#define KOKI_HOMOGRAPHY_GH_SHIFT 24
+
+
+bool koki_homography_from_quad(const koki_point2Df_t quad[4],
+			       koki_homography_t *H);
+
+koki_point2Df_t koki_homography_map(const koki_homography_t *H,
+				    float u, float v);
+
+uint8_t koki_homography_sample(const koki_homography_t *H,
+			       const IplImage *frame,
+			       float u, float v);
+
+bool koki_homography_fixed_from_quad(const koki_fixed_point2_t quad[4],
+				     koki_homography_fixed_t *H);
+
+koki_fixed_point2_t koki_homography_fixed_map(const koki_homography_fixed_t *H,
+					      koki_fixed_t u, koki_fixed_t v);
+
+uint8_t koki_homography_fixed_sample(const koki_homography_fixed_t *H,
+				     const IplImage *frame,
+				     koki_fixed_t u, koki_fixed_t v);
+
+#endif /* _KOKI_HOMOGRAPHY_H_ */
@@ -26,4 +26,8 @@
 
 void koki_image_free(IplImage *image);
 
+void koki_image_init(IplImage *image, CvSize size, int depth, int channels);
+
+void koki_image_release_data(IplImage *image);
+
 #endif /* _KOKI_IMAGE_H_ */
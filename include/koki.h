@@ -24,10 +24,12 @@
 
 #include "context.h"
 #include "logger.h"
+#include "allocator.h"
 #include "html-logger.h"
 #include "text-logger.h"
 #include "debug.h"
 #include "points.h"
+#include "fixed.h"
 #include "labelling.h"
 #include "contour.h"
 #include "quad.h"
@@ -42,5 +44,19 @@
 #include <sys/time.h> /* needed for videodev2.h */
 #include "v4l.h"
 #include "yaml_config.h"
+#include "homography.h"
+#include "decode_cache.h"
+#include "accumulate.h"
+#include "resolution.h"
+#include "exposure.h"
+#include "simd.h"
+#include "trace.h"
+#include "edge_quads.h"
+#include "async.h"
+#include "threads.h"
+#include "bayer.h"
+#include "mjpeg.h"
+#include "perf.h"
+#include "code_batch.h"
 
 #endif /* _KOKI_H_ */
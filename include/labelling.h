@@ -150,4 +150,15 @@ koki_labelled_image_t* koki_label_adaptive( koki_t *koki,
 					    uint16_t window_size,
 					    int16_t thresh_margin );
 
+koki_labelled_image_t* koki_label_reference( koki_t *koki,
+					     const IplImage *frame,
+					     uint16_t window_size,
+					     int16_t thresh_margin );
+
+koki_labelled_image_t* koki_label_sparse( koki_t *koki,
+					  const IplImage *frame,
+					  uint16_t window_size,
+					  int16_t thresh_margin,
+					  uint16_t stride );
+
 #endif /* _KOKI_LABELLING_H_ */
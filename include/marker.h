@@ -99,6 +99,8 @@ GPtrArray* koki_find_markers_fp( koki_t *koki,
 				 float (*fp)(int),
 				 koki_camera_params_t *params );
 
+void koki_prepare( koki_t *koki, uint16_t width, uint16_t height );
+
 void koki_markers_free(GPtrArray *markers);
 
 
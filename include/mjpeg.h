@@ -0,0 +1,45 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+#ifndef _KOKI_MJPEG_H_
+#define _KOKI_MJPEG_H_
+
+/**
+ * @file  mjpeg.h
+ * @brief Header file for decoding the luma of MJPEG camera frames
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <cv.h>
+
+
+struct koki_mjpeg;
+
+/**
+ * @brief a reusable MJPEG frame decoder (see koki_mjpeg_new())
+ */
+typedef struct koki_mjpeg koki_mjpeg_t;
+
+
+koki_mjpeg_t* koki_mjpeg_new(uint8_t scale_denom);
+
+void koki_mjpeg_free(koki_mjpeg_t *mjpeg);
+
+IplImage* koki_mjpeg_decode(koki_mjpeg_t *mjpeg,
+			    const uint8_t *data, size_t length);
+
+#endif /* _KOKI_MJPEG_H_ */
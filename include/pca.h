@@ -26,10 +26,15 @@
 #include <stdint.h>
 
 #include "points.h"
+#include "fixed.h"
 
 int8_t koki_pca(GSList *start, GSList *end,
 		koki_point2Df_t eigen_vectors[2],
 		float eigen_values[2], koki_point2Df_t *averages);
 
+int8_t koki_pca_fixed(GSList *start, GSList *end,
+		      koki_fixed_point2_t eigen_vectors[2],
+		      int64_t eigen_values[2], koki_fixed_point2_t *averages);
+
 
 #endif /* _KOKI_PCA_H_ */
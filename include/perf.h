@@ -0,0 +1,135 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+#ifndef _KOKI_PERF_H_
+#define _KOKI_PERF_H_
+
+/**
+ * @file  perf.h
+ * @brief Header file for reading hardware performance counters around the
+ *        pipeline's stages
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+/**
+ * @brief the stages that counts are gathered for
+ */
+typedef enum {
+	KOKI_PERF_FRAME = 0,    /**< the whole of koki_find_markers() */
+	KOKI_PERF_LABEL,        /**< thresholding and labelling */
+	KOKI_PERF_CONTOUR,      /**< contour tracing */
+	KOKI_PERF_QUAD,         /**< finding and refining quad vertices */
+	KOKI_PERF_DECODE,       /**< unwarping and decoding */
+	KOKI_PERF_POSE,         /**< pose, rotation and bearing estimation */
+	KOKI_PERF_EDGE_QUADS,   /**< the gradient-based quad detector */
+	KOKI_PERF_NUM_STAGES
+} koki_perf_stage_t;
+
+
+/**
+ * @brief the counters that are read
+ */
+typedef enum {
+	KOKI_PERF_CYCLES = 0,   /**< CPU cycles */
+	KOKI_PERF_INSTRUCTIONS, /**< instructions retired */
+	KOKI_PERF_CACHE_MISSES, /**< last level cache misses */
+	KOKI_PERF_BRANCH_MISSES,/**< mispredicted branches */
+	KOKI_PERF_NUM_COUNTERS
+} koki_perf_counter_t;
+
+
+/**
+ * @brief the counts for a single stage
+ */
+typedef struct {
+	uint64_t counts[KOKI_PERF_NUM_COUNTERS]; /**< the counts, summed over
+						      every run of the stage */
+	uint32_t runs;                           /**< how many times the stage
+						      ran */
+} koki_perf_stage_counts_t;
+
+
+/**
+ * @brief the counts for a frame
+ */
+typedef struct {
+	uint8_t available; /**< a bitmask, by \c koki_perf_counter_t, of the
+			        counters the system provides; the others
+			        always read 0 */
+	koki_perf_stage_counts_t stages[KOKI_PERF_NUM_STAGES];
+	                   /**< the counts for each stage */
+} koki_perf_frame_t;
+
+
+/**
+ * @brief a group of counters, counting for the thread that opened them
+ */
+typedef struct koki_perf {
+	int fds[KOKI_PERF_NUM_COUNTERS]; /**< the counters' file descriptors,
+					      or -1 where unavailable */
+	int leader;                      /**< the group leader's file
+					      descriptor */
+	uint8_t num_open;                /**< the number of open counters */
+	uint64_t start[KOKI_PERF_NUM_STAGES][KOKI_PERF_NUM_COUNTERS];
+	                                 /**< the counts when each stage
+					      began */
+	koki_perf_frame_t frame;         /**< the counts for the current or
+					      last frame */
+} koki_perf_t;
+
+
+/**
+ * @brief reads the counters at the start of a stage, if the context is
+ *        counting
+ *
+ * @param koki   the libkoki context
+ * @param stage  the \c koki_perf_stage_t
+ */
+#define KOKI_PERF_BEGIN(koki, stage)				\
+	do {							\
+		if ((koki)->perf != NULL)			\
+			koki_perf_begin((koki)->perf, stage);	\
+	} while (0)
+
+/**
+ * @brief reads the counters at the end of a stage, and adds the
+ *        difference to the stage's counts, if the context is counting
+ */
+#define KOKI_PERF_END(koki, stage)				\
+	do {							\
+		if ((koki)->perf != NULL)			\
+			koki_perf_end((koki)->perf, stage);	\
+	} while (0)
+
+
+koki_perf_t* koki_perf_new(void);
+
+void koki_perf_free(koki_perf_t *perf);
+
+void koki_perf_reset(koki_perf_t *perf);
+
+void koki_perf_begin(koki_perf_t *perf, koki_perf_stage_t stage);
+
+void koki_perf_end(koki_perf_t *perf, koki_perf_stage_t stage);
+
+const char* koki_perf_stage_name(koki_perf_stage_t stage);
+
+const char* koki_perf_counter_name(koki_perf_counter_t counter);
+
+#endif /* _KOKI_PERF_H_ */
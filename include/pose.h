@@ -26,6 +26,7 @@
 #include "points.h"
 #include "camera.h"
 #include "marker.h"
+#include "fixed.h"
 
 void koki_pose_estimate_arrays(koki_point2Df_t img[4],
 			       koki_point3Df_t world[4],
@@ -37,4 +38,12 @@ void koki_pose_estimate(koki_marker_t *marker,
 			koki_camera_params_t *params);
 
 
+void koki_pose_estimate_arrays_fixed(const koki_fixed_point2_t img[4],
+				     koki_fixed_point3_t world[4],
+				     koki_fixed_t marker_width,
+				     koki_fixed_t focal_length);
+
+void koki_pose_estimate_fixed(koki_marker_t *marker, float marker_width,
+			      koki_camera_params_t *params);
+
 #endif /* _KOKI_POSE_H_ */
@@ -0,0 +1,75 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+#ifndef _KOKI_PROBES_H_
+#define _KOKI_PROBES_H_
+
+/**
+ * @file  probes.h
+ * @brief Header file defining the USDT static tracepoints
+ *
+ * When built with systemtap's \c sys/sdt.h available, libkoki carries
+ * probes in the \c libkoki provider that perf, bpftrace and systemtap can
+ * attach to at runtime.  Each probe is a single nop until something
+ * attaches to it.  For example:
+ *
+ * \code
+ * bpftrace -e 'usdt:/usr/lib/libkoki.so:libkoki:candidate
+ *              { @reasons[arg2] = count(); }'
+ * \endcode
+ *
+ * The probes are:
+ *
+ *  - \c frame__start (frame id, width, height)
+ *  - \c label__done (frame id, number of labels, number of candidates)
+ *  - \c candidate (frame id, label, reject reason -- a
+ *    \c koki_probe_reject_t, 0 if the candidate was accepted)
+ *  - \c decode__done (frame id, label, code, or -1 if decoding failed)
+ *  - \c pose__done (frame id, code, distance in millimetres)
+ *  - \c frame__end (frame id, number of markers found, number of
+ *    candidates skipped because all the expected codes had been found)
+ */
+
+#ifdef KOKI_HAVE_SDT
+
+#include <sys/sdt.h>
+
+#define KOKI_PROBE3(name, a, b, c)		\
+	DTRACE_PROBE3(libkoki, name, a, b, c)
+
+#else
+
+/* the arguments are never evaluated, so probes cost nothing at all */
+#define KOKI_PROBE3(name, a, b, c)				\
+	do { if (0) { (void)(a); (void)(b); (void)(c); } } while (0)
+
+#endif
+
+
+/**
+ * @brief the reasons a candidate region can be rejected
+ */
+typedef enum {
+	KOKI_PROBE_ACCEPTED = 0,  /**< the candidate became a marker */
+	KOKI_PROBE_REJECT_QUAD,   /**< no quadrilateral fitted the contour */
+	KOKI_PROBE_REJECT_DECODE, /**< no valid code could be read */
+	KOKI_PROBE_REJECT_NESTED, /**< the region lies within a marker
+				       already found */
+	KOKI_PROBE_REJECT_DUPLICATE /**< the marker duplicated a bigger one
+				         with the same code */
+} koki_probe_reject_t;
+
+#endif /* _KOKI_PROBES_H_ */
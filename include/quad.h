@@ -45,6 +45,8 @@ koki_quad_t* koki_quad_find_vertices(GSList *contour);
 
 void koki_quad_refine_vertices(koki_quad_t *quad);
 
+void koki_quad_refine_vertices_fixed(koki_quad_t *quad);
+
 void koki_quad_free(koki_quad_t *quad);
 
 void koki_quad_draw(IplImage *frame, koki_quad_t *quad);
@@ -0,0 +1,108 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+#ifndef _KOKI_RESOLUTION_H_
+#define _KOKI_RESOLUTION_H_
+
+/**
+ * @file  resolution.h
+ * @brief Header file for adapting the capture resolution to marker sizes
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <glib.h>
+#include <cv.h>
+
+#include "camera.h"
+#include <sys/time.h> /* needed for videodev2.h */
+#include "v4l.h"
+
+
+/**
+ * @brief a capture resolution the controller may switch to
+ */
+typedef struct {
+	uint16_t width;   /**< the frame width */
+	uint16_t height;  /**< the frame height */
+} koki_resolution_t;
+
+
+/**
+ * @brief the outcome of koki_resolution_ctrl_update()
+ */
+typedef enum {
+	KOKI_RESOLUTION_UNCHANGED = 0, /**< the resolution was left alone */
+	KOKI_RESOLUTION_CHANGED,       /**< the resolution was switched */
+	KOKI_RESOLUTION_ERROR          /**< the camera failed to switch */
+} koki_resolution_change_t;
+
+
+/**
+ * @brief a controller that switches a V4L2 camera between resolutions
+ *        depending on how large the markers in view appear
+ *
+ * The controller owns the camera's capture buffers, as they have to be
+ * reallocated whenever the format changes.
+ */
+typedef struct {
+	int fd;                           /**< the camera's file descriptor */
+	koki_buffer_t *buffers;           /**< the memory-mapped buffers */
+	int num_buffers;                  /**< the number of buffers */
+
+	koki_resolution_t *modes;         /**< the resolutions to choose from,
+					       smallest first */
+	uint8_t num_modes;                /**< the number of modes */
+	uint8_t current;                  /**< the index of the current mode */
+	koki_resolution_t size;           /**< the actual current frame size */
+
+	koki_camera_params_t calibration; /**< the calibrated camera params */
+	koki_camera_params_t params;      /**< the params for the current size */
+
+	float min_side;                   /**< the marker side length, in
+					       pixels, below which to switch up */
+	float max_side;                   /**< the marker side length, in
+					       pixels, above which a lower
+					       resolution may be used */
+	uint16_t hold_frames;             /**< frames a condition must hold
+					       before switching */
+	uint16_t down_count;              /**< consecutive frames in which a
+					       lower resolution would do */
+	uint16_t empty_count;             /**< consecutive frames without
+					       any markers */
+	uint16_t up_count;                /**< consecutive frames with a
+					       marker below \c min_side since
+					       a switch up failed, or
+					       \c G_MAXUINT16 if none has */
+} koki_resolution_ctrl_t;
+
+
+koki_resolution_ctrl_t* koki_resolution_ctrl_new(int fd,
+						 const koki_resolution_t *modes,
+						 uint8_t num_modes,
+						 const koki_camera_params_t *calibration,
+						 float min_side, float max_side);
+
+void koki_resolution_ctrl_free(koki_resolution_ctrl_t *ctrl);
+
+IplImage* koki_resolution_ctrl_get_frame(koki_resolution_ctrl_t *ctrl);
+
+koki_camera_params_t* koki_resolution_ctrl_get_params(koki_resolution_ctrl_t *ctrl);
+
+koki_resolution_change_t koki_resolution_ctrl_update(koki_resolution_ctrl_t *ctrl,
+						     const GPtrArray *markers);
+
+#endif /* _KOKI_RESOLUTION_H_ */
@@ -24,10 +24,15 @@
 
 #include "points.h"
 #include "marker.h"
+#include "fixed.h"
 
 
 koki_marker_rotation_t koki_rotation_estimate_array(koki_point3Df_t points[4]);
 
 void koki_rotation_estimate(koki_marker_t *marker);
 
+koki_fixed_point3_t koki_rotation_estimate_array_fixed(const koki_fixed_point3_t points[4]);
+
+void koki_rotation_estimate_fixed(koki_marker_t *marker);
+
 #endif /* _KOKI_ROTATION_H_ */
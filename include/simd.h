@@ -0,0 +1,143 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+#ifndef _KOKI_SIMD_H_
+#define _KOKI_SIMD_H_
+
+/**
+ * @file  simd.h
+ * @brief Header file for the vectorised pixel kernels and their runtime
+ *        dispatch
+ *
+ * Each kernel is built for several instruction sets, and the best one the
+ * CPU supports is picked the first time a context is created.  Setting
+ * the \c KOKI_SIMD environment variable to one of "scalar", "sse2",
+ * "avx2" or "neon" forces a particular variant.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+/**
+ * @brief the instruction sets kernels are built for
+ */
+typedef enum {
+	KOKI_SIMD_SCALAR = 0,
+	KOKI_SIMD_SSE2,
+	KOKI_SIMD_AVX2,
+	KOKI_SIMD_NEON,
+	KOKI_SIMD_NUM_LEVELS
+} koki_simd_level_t;
+
+
+/* the number of homographies in a koki_homography_batch_t */
+#define KOKI_HOMOGRAPHY_BATCH 8
+
+
+/**
+ * @brief a batch of homographies (see \c koki_homography_t), stored
+ *        coefficient by coefficient so that each can be loaded into a
+ *        vector of the homographies' lanes
+ */
+typedef struct {
+	float a[KOKI_HOMOGRAPHY_BATCH], b[KOKI_HOMOGRAPHY_BATCH],
+		c[KOKI_HOMOGRAPHY_BATCH];  /**< the x numerator coefficients */
+	float d[KOKI_HOMOGRAPHY_BATCH], e[KOKI_HOMOGRAPHY_BATCH],
+		f[KOKI_HOMOGRAPHY_BATCH];  /**< the y numerator coefficients */
+	float g[KOKI_HOMOGRAPHY_BATCH],
+		h[KOKI_HOMOGRAPHY_BATCH];  /**< the denominator coefficients */
+} koki_homography_batch_t;
+
+
+/**
+ * @brief a set of kernels built for one instruction set
+ */
+typedef struct {
+	koki_simd_level_t level; /**< the instruction set */
+	const char *name;        /**< the name, as accepted by \c KOKI_SIMD */
+
+	/**
+	 * @brief extracts the luma of \c n pixels from packed YUYV data
+	 */
+	void (*yuyv_to_grey)(const uint8_t *yuyv, uint8_t *grey, uint32_t n);
+
+	/**
+	 * @brief sets each of \c n pixels to 255 if it's greater than
+	 *        \c threshold, or 0 otherwise
+	 */
+	void (*threshold)(const uint8_t *src, uint8_t *dst, uint32_t n,
+			  uint8_t threshold);
+
+	/**
+	 * @brief computes a row of an integral image
+	 *
+	 * Each of the \c n pixels is added to its column sum in \c col_sum,
+	 * and \c out receives the running total of the column sums.
+	 */
+	void (*integral_row)(const uint8_t *src, uint32_t *col_sum,
+			     uint32_t *out, uint32_t n);
+
+	/**
+	 * @brief adds each of \c n pixels to the matching 16-bit accumulator
+	 */
+	void (*accumulate_row)(const uint8_t *src, uint16_t *acc, uint32_t n);
+
+	/**
+	 * @brief averages 2x2 blocks of pixels from two rows into \c n
+	 *        pixels, rounding to nearest
+	 */
+	void (*bin_2x2)(const uint8_t *row0, const uint8_t *row1,
+			uint8_t *dst, uint32_t n);
+
+	/**
+	 * @brief maps the \c n points \c (u0 + i*du, v) of the unit square
+	 *        through every homography of a batch, rounding to the nearest
+	 *        pixel within \c [0,max_x] x \c [0,max_y]
+	 *
+	 * Point \c i through homography \c j is stored at \c
+	 * xs[i * KOKI_HOMOGRAPHY_BATCH + j], and likewise in \c ys.
+	 */
+	void (*project_row)(const koki_homography_batch_t *H,
+			    float u0, float du, float v, uint32_t n,
+			    int32_t max_x, int32_t max_y,
+			    int32_t *xs, int32_t *ys);
+
+} koki_simd_kernels_t;
+
+
+/* The variants, where built for this architecture */
+extern const koki_simd_kernels_t koki_simd_scalar;
+
+#if defined(__x86_64__) || defined(__i386__)
+extern const koki_simd_kernels_t koki_simd_sse2;
+extern const koki_simd_kernels_t koki_simd_avx2;
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+extern const koki_simd_kernels_t koki_simd_neon;
+#endif
+
+
+const koki_simd_kernels_t* koki_simd_select( void );
+
+const koki_simd_kernels_t* koki_simd_kernels( void );
+
+bool koki_simd_supported( koki_simd_level_t level );
+
+bool koki_simd_set_level( koki_simd_level_t level );
+
+#endif /* _KOKI_SIMD_H_ */
@@ -0,0 +1,88 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+#ifndef _KOKI_THREADS_H_
+#define _KOKI_THREADS_H_
+
+/**
+ * @file  threads.h
+ * @brief Header file for configuring the scheduling of libkoki's threads
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+/**
+ * @brief the roles a thread can have, each configured separately
+ */
+typedef enum {
+	KOKI_THREAD_WORKER = 0, /**< detection workers (see koki_async_new()) */
+	KOKI_THREAD_CAPTURE,    /**< threads capturing frames */
+	KOKI_THREAD_LOGGER,     /**< threads writing logs and traces */
+	KOKI_THREAD_NUM_ROLES
+} koki_thread_role_t;
+
+
+/**
+ * @brief a scheduling policy
+ */
+typedef enum {
+	KOKI_SCHED_INHERIT = 0, /**< leave the thread's policy alone */
+	KOKI_SCHED_OTHER,       /**< the normal, time-shared policy */
+	KOKI_SCHED_FIFO         /**< the first-in, first-out real-time
+				     policy */
+} koki_sched_policy_t;
+
+
+/**
+ * @brief how to schedule the threads of a role
+ */
+typedef struct {
+	koki_sched_policy_t policy; /**< the scheduling policy */
+	int priority;               /**< the real-time priority (1 to 99),
+				         for \c KOKI_SCHED_FIFO */
+	int nice;                   /**< the nice value for \c
+				         KOKI_SCHED_OTHER, and for \c
+				         KOKI_SCHED_FIFO if it's not
+				         permitted */
+	uint64_t cpus;              /**< the CPUs the threads may run on, as
+				         a bit per CPU, or 0 for any */
+	bool spread;                /**< whether to pin the role's n-th
+				         thread to the n-th CPU in \c cpus,
+				         rather than letting each thread use
+				         all of them */
+} koki_thread_config_t;
+
+
+/**
+ * @brief the parts of a thread configuration that couldn't be applied
+ */
+typedef enum {
+	KOKI_THREAD_SCHED_FALLBACK = 1 << 0, /**< the policy wasn't permitted,
+					          so \c KOKI_SCHED_OTHER was
+					          used instead */
+	KOKI_THREAD_NICE_FAILED    = 1 << 1, /**< the nice value wasn't
+					          permitted */
+	KOKI_THREAD_CPUS_FAILED    = 1 << 2  /**< none of the CPUs were
+					          available */
+} koki_thread_status_t;
+
+
+uint8_t koki_thread_config_apply( const koki_thread_config_t *config,
+				  uint16_t index );
+
+#endif /* _KOKI_THREADS_H_ */
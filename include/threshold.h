@@ -38,6 +38,9 @@ uint16_t koki_threshold_global(IplImage *frame);
 IplImage* koki_threshold_adaptive(IplImage *frame, uint16_t window_size,
 				  int16_t c, uint8_t method);
 
+void koki_threshold_adaptive_to(IplImage *frame, IplImage *output,
+				uint16_t window_size, int16_t c, uint8_t method);
+
 bool koki_threshold_adaptive_pixel( const IplImage *frame,
 				    const koki_integral_image_t *iimg,
 				    const CvRect *roi,
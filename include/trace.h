@@ -0,0 +1,101 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+#ifndef _KOKI_TRACE_H_
+#define _KOKI_TRACE_H_
+
+/**
+ * @file  trace.h
+ * @brief Header file for recording per-stage timelines in Chrome's
+ *        trace-event format
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+
+/**
+ * @brief a single begin or end event
+ */
+typedef struct {
+	const char *name; /**< the stage name, which must be a static string */
+	uint64_t ts;      /**< the time, in nanoseconds */
+	int32_t arg;      /**< the candidate's label, or -1 */
+	char phase;       /**< 'B' for begin or 'E' for end */
+} koki_trace_event_t;
+
+
+/**
+ * @brief a ring of events written by a single thread
+ *
+ * Only the owning thread writes to a ring, so no locking is needed.  When
+ * the ring is full the oldest events are overwritten.
+ */
+typedef struct koki_trace_ring {
+	koki_trace_event_t *events;   /**< the events */
+	uint32_t mask;                /**< the ring's capacity, minus one */
+	uint32_t head;                /**< the number of events ever written */
+	uint32_t tid;                 /**< the owning thread's ID */
+	struct koki_trace_ring *next; /**< the next thread's ring */
+} koki_trace_ring_t;
+
+
+/**
+ * @brief a tracer, holding one ring of events per thread
+ */
+typedef struct koki_tracer {
+	uint32_t id;              /**< a unique ID, used to tell tracers
+				       apart in each thread's cached ring */
+	uint32_t capacity;        /**< the capacity of each ring */
+	koki_trace_ring_t *rings; /**< the list of rings, added to without
+				       locking */
+} koki_tracer_t;
+
+
+/**
+ * @brief records the start of a stage, if the context is tracing
+ *
+ * @param koki  the libkoki context
+ * @param name  the stage name (a string literal)
+ * @param arg   the candidate's label, or -1
+ */
+#define KOKI_TRACE_BEGIN(koki, name, arg)				\
+	do {								\
+		if ((koki)->tracer != NULL)				\
+			koki_tracer_event((koki)->tracer, name, 'B', arg); \
+	} while (0)
+
+/**
+ * @brief records the end of a stage, if the context is tracing
+ */
+#define KOKI_TRACE_END(koki, name, arg)					\
+	do {								\
+		if ((koki)->tracer != NULL)				\
+			koki_tracer_event((koki)->tracer, name, 'E', arg); \
+	} while (0)
+
+
+koki_tracer_t* koki_tracer_new(uint32_t capacity);
+
+void koki_tracer_free(koki_tracer_t *tracer);
+
+void koki_tracer_event(koki_tracer_t *tracer, const char *name,
+		       char phase, int32_t arg);
+
+void koki_tracer_write_json(const koki_tracer_t *tracer, FILE *f);
+
+#endif /* _KOKI_TRACE_H_ */
@@ -23,6 +23,7 @@
  */
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <cv.h>
 
 #include "koki.h"
@@ -31,5 +32,14 @@
 IplImage* koki_unwarp_marker( koki_t* koki, koki_marker_t *marker, IplImage *frame,
 			      uint16_t unwarped_width );
 
+bool koki_unwarp_marker_to( koki_t* koki, koki_marker_t *marker, IplImage *frame,
+			    IplImage *dst );
+
+IplImage* koki_unwarp_marker_fixed(koki_marker_t *marker, IplImage *frame,
+				   uint16_t unwarped_width);
+
+bool koki_unwarp_marker_fixed_to(koki_marker_t *marker, IplImage *frame,
+				 IplImage *dst);
+
 
 #endif /* _KOKI_UNWARP_H_ */
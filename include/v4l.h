@@ -25,6 +25,9 @@
 #include <sys/time.h> /* needed by videodev2.h */
 #include <linux/videodev2.h>
 #include <stdint.h>
+#include <cv.h>
+
+#include "bayer.h"
 
 /**
  * @brief a structure for representing a memory-mapped buffer
@@ -46,6 +49,13 @@ int koki_v4l_set_format(int fd, struct v4l2_format fmt);
 
 struct v4l2_format koki_v4l_create_YUYV_format(unsigned int w, unsigned int h);
 
+struct v4l2_format koki_v4l_create_MJPEG_format(unsigned int w, unsigned int h);
+
+struct v4l2_format koki_v4l_create_bayer_format(unsigned int w, unsigned int h,
+						koki_bayer_pattern_t pattern);
+
+int koki_v4l_bayer_pattern(uint32_t pixelformat);
+
 struct v4l2_capability koki_v4l_get_capability(int fd);
 
 void koki_v4l_print_capability(struct v4l2_capability cap);
@@ -54,6 +64,9 @@ int koki_v4l_get_control(int fd, unsigned int id);
 
 int koki_v4l_set_control(int fd, unsigned int id, unsigned int value);
 
+int koki_v4l_query_control(int fd, unsigned int id,
+			   struct v4l2_queryctrl *query);
+
 koki_buffer_t* koki_v4l_prepare_buffers(int fd, int *count);
 
 void koki_v4l_free_buffers(koki_buffer_t *buffers, int count);
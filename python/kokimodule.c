@@ -0,0 +1,533 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/**
+ * @file  kokimodule.c
+ * @brief Python bindings for libkoki
+ *
+ * A \c koki.Detector wraps a libkoki context.  Its \c detect() method
+ * takes any 2D array of bytes that supports the buffer protocol (a numpy
+ * \c uint8 array, a \c memoryview, ...), wraps an \c IplImage header
+ * around it without copying, and returns the markers found as a numpy
+ * structured array with one row per marker.  The GIL is released while
+ * the markers are found, so detectors in different threads run in
+ * parallel; calls on the same detector are serialised by its lock.
+ *
+ * numpy is only needed at run time, to build the result array.
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <pythread.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <limits.h>
+#include <cv.h>
+
+#include "koki.h"
+
+
+/**
+ * @brief a marker, as laid out in a row of the result array
+ *
+ * Every field is 4 bytes wide, so there's no padding, and the numpy dtype
+ * built in \c make_dtype() matches it field for field.
+ */
+typedef struct {
+	int32_t code;
+	float vertices[4][2];
+	float vertices_world[4][3];
+	float centre[2];
+	float centre_world[3];
+	float distance;
+	float rotation[3];
+	float bearing[3];
+	float rotation_offset;
+} marker_record_t;
+
+
+/* numpy.frombuffer, and the dtype of the result array */
+static PyObject *np_frombuffer = NULL;
+static PyObject *marker_dtype = NULL;
+
+
+typedef struct {
+	PyObject_HEAD
+	koki_t *koki;
+	PyThread_type_lock lock;          /* held while koki is in use */
+	koki_camera_params_t params;
+	bool centred;                     /* whether the principal point is
+					     the centre of each image */
+} DetectorObject;
+
+
+
+/**
+ * @brief copies a marker into a row of the result array
+ *
+ * @param m    the marker
+ * @param rec  the row to fill in
+ */
+static void marker_to_record(const koki_marker_t *m, marker_record_t *rec)
+{
+
+	rec->code = m->code;
+
+	for (uint8_t i=0; i<4; i++){
+		rec->vertices[i][0] = m->vertices[i].image.x;
+		rec->vertices[i][1] = m->vertices[i].image.y;
+		rec->vertices_world[i][0] = m->vertices[i].world.x;
+		rec->vertices_world[i][1] = m->vertices[i].world.y;
+		rec->vertices_world[i][2] = m->vertices[i].world.z;
+	}
+
+	rec->centre[0] = m->centre.image.x;
+	rec->centre[1] = m->centre.image.y;
+	rec->centre_world[0] = m->centre.world.x;
+	rec->centre_world[1] = m->centre.world.y;
+	rec->centre_world[2] = m->centre.world.z;
+
+	rec->distance = m->distance;
+	rec->rotation[0] = m->rotation.x;
+	rec->rotation[1] = m->rotation.y;
+	rec->rotation[2] = m->rotation.z;
+	rec->bearing[0] = m->bearing.x;
+	rec->bearing[1] = m->bearing.y;
+	rec->bearing[2] = m->bearing.z;
+	rec->rotation_offset = m->rotation_offset;
+
+}
+
+
+
+/**
+ * @brief reads a pair of floats, or a single float for both
+ *
+ * @param obj  the Python number or 2-sequence
+ * @param p    where to store the pair
+ * @return     0 on success, -1 with an exception set on failure
+ */
+static int parse_pair(PyObject *obj, koki_point2Df_t *p)
+{
+
+	if (PyNumber_Check(obj)){
+		p->x = p->y = PyFloat_AsDouble(obj);
+		return PyErr_Occurred() ? -1 : 0;
+	}
+
+	PyObject *t = PySequence_Check(obj) ? PySequence_Tuple(obj) : NULL;
+	int ok = t != NULL && PyArg_ParseTuple(t, "ff", &p->x, &p->y);
+
+	Py_XDECREF(t);
+
+	if (!ok){
+		PyErr_Clear();
+		PyErr_SetString(PyExc_TypeError,
+				"expected a number or a pair of numbers");
+		return -1;
+	}
+
+	return 0;
+
+}
+
+
+
+static int Detector_init(DetectorObject *self, PyObject *args, PyObject *kw)
+{
+
+	static char *kwlist[] = { "focal_length", "principal_point",
+				  "decode_cache", "sparse_stride",
+				  "expected_codes", NULL };
+	PyObject *focal, *principal = Py_None, *expected = Py_None;
+	int decode_cache = 0;
+	unsigned short stride = 0;
+	koki_camera_params_t params;
+	bool centred;
+	uint8_t codes[256];
+	Py_ssize_t n = 0;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kw, "O|OpHO:Detector", kwlist,
+					 &focal, &principal, &decode_cache,
+					 &stride, &expected))
+		return -1;
+
+	memset(&params, 0, sizeof(params));
+
+	if (parse_pair(focal, &params.focal_length) < 0)
+		return -1;
+
+	centred = principal == Py_None;
+	if (!centred && parse_pair(principal, &params.principal_point) < 0)
+		return -1;
+
+	if (expected != Py_None){
+
+		PyObject *seq = PySequence_Fast(expected,
+						"expected_codes must be a sequence");
+
+		if (seq == NULL)
+			return -1;
+
+		n = PySequence_Fast_GET_SIZE(seq);
+		if (n > 256){
+			Py_DECREF(seq);
+			PyErr_SetString(PyExc_ValueError, "too many expected codes");
+			return -1;
+		}
+
+		for (Py_ssize_t i=0; i<n; i++){
+			long c = PyLong_AsLong(PySequence_Fast_GET_ITEM(seq, i));
+			if (c < 0 || c > 255){
+				Py_DECREF(seq);
+				if (!PyErr_Occurred())
+					PyErr_SetString(PyExc_ValueError,
+							"marker codes are 0-255");
+				return -1;
+			}
+			codes[i] = c;
+		}
+
+		Py_DECREF(seq);
+
+	}
+
+	/* another thread may be using the context in detect() */
+	Py_BEGIN_ALLOW_THREADS
+	PyThread_acquire_lock(self->lock, WAIT_LOCK);
+	Py_END_ALLOW_THREADS
+
+	self->params = params;
+	self->centred = centred;
+
+	if (self->koki == NULL)
+		self->koki = koki_new();
+
+	koki_set_decode_cache(self->koki, decode_cache);
+	koki_set_sparse_labelling(self->koki, stride);
+	koki_set_expected_codes(self->koki, n > 0 ? codes : NULL, n);
+
+	PyThread_release_lock(self->lock);
+
+	return 0;
+
+}
+
+
+
+static PyObject* Detector_new(PyTypeObject *type, PyObject *args, PyObject *kw)
+{
+
+	DetectorObject *self = (DetectorObject*)type->tp_alloc(type, 0);
+
+	if (self == NULL)
+		return NULL;
+
+	self->lock = PyThread_allocate_lock();
+	if (self->lock == NULL){
+		Py_DECREF(self);
+		return PyErr_NoMemory();
+	}
+
+	return (PyObject*)self;
+
+}
+
+
+
+static void Detector_dealloc(DetectorObject *self)
+{
+
+	if (self->koki != NULL)
+		koki_destroy(self->koki);
+
+	if (self->lock != NULL)
+		PyThread_free_lock(self->lock);
+
+	Py_TYPE(self)->tp_free((PyObject*)self);
+
+}
+
+
+
+/**
+ * @brief checks that a buffer is a 2D array of bytes with contiguous rows
+ *
+ * @param view  the buffer
+ * @return      0 if it's useable as a greyscale image, -1 with an
+ *              exception set otherwise
+ */
+static int check_image_buffer(const Py_buffer *view)
+{
+
+	if (view->ndim != 2){
+		PyErr_SetString(PyExc_ValueError,
+				"the image must be a 2D (greyscale) array");
+		return -1;
+	}
+
+	/* "B", or "B" with a byte order prefix */
+	if (view->itemsize != 1
+	    || (view->format != NULL
+		&& strcmp(view->format + strspn(view->format, "@=<>!"), "B") != 0)){
+		PyErr_SetString(PyExc_ValueError,
+				"the image must be an array of unsigned bytes");
+		return -1;
+	}
+
+	if (view->strides[1] != 1 || view->strides[0] < view->shape[1]){
+		PyErr_SetString(PyExc_ValueError,
+				"the image's rows must be contiguous and in order");
+		return -1;
+	}
+
+	if (view->shape[0] < 1 || view->shape[1] < 1
+	    || view->shape[0] > 0xffff || view->shape[1] > 0xffff
+	    || view->strides[0] > INT_MAX / view->shape[0]){
+		PyErr_SetString(PyExc_ValueError, "unsupported image size");
+		return -1;
+	}
+
+	return 0;
+
+}
+
+
+
+PyDoc_STRVAR(Detector_detect_doc,
+"detect(image, marker_width) -> numpy structured array\n\n"
+"Finds the markers in a greyscale image, which may be any 2D array of\n"
+"bytes supporting the buffer protocol whose rows are contiguous.  The\n"
+"image isn't copied, and mustn't be modified until detect() returns.\n"
+"marker_width is the width of the markers' black squares, in metres.\n"
+"There is one row per marker; see koki.marker_dtype for the fields.");
+
+static PyObject* Detector_detect(DetectorObject *self, PyObject *args,
+				 PyObject *kw)
+{
+
+	static char *kwlist[] = { "image", "marker_width", NULL };
+	PyObject *image, *bytes, *result;
+	Py_buffer view;
+	float marker_width;
+	IplImage frame;
+	koki_camera_params_t params;
+	GPtrArray *markers;
+	marker_record_t *records = NULL;
+	guint n = 0;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kw, "Of:detect", kwlist,
+					 &image, &marker_width))
+		return NULL;
+
+	/* __new__() without __init__() */
+	if (self->koki == NULL){
+		PyErr_SetString(PyExc_RuntimeError,
+				"the Detector hasn't been initialised");
+		return NULL;
+	}
+
+	if (PyObject_GetBuffer(image, &view, PyBUF_STRIDES | PyBUF_FORMAT) < 0)
+		return NULL;
+
+	if (check_image_buffer(&view) < 0){
+		PyBuffer_Release(&view);
+		return NULL;
+	}
+
+	/* an image header around the caller's pixels */
+	cvInitImageHeader(&frame, cvSize(view.shape[1], view.shape[0]),
+			  IPL_DEPTH_8U, 1, IPL_ORIGIN_TL, 4);
+	frame.widthStep = view.strides[0];
+	frame.imageSize = view.strides[0] * view.shape[0];
+	frame.imageData = frame.imageDataOrigin = view.buf;
+
+	Py_BEGIN_ALLOW_THREADS
+
+	PyThread_acquire_lock(self->lock, WAIT_LOCK);
+
+	/* __init__() may be changing these too */
+	params = self->params;
+	params.size.x = frame.width;
+	params.size.y = frame.height;
+	if (self->centred){
+		params.principal_point.x = frame.width / 2.0;
+		params.principal_point.y = frame.height / 2.0;
+	}
+
+	markers = koki_find_markers(self->koki, &frame, marker_width, &params);
+
+	if (markers != NULL){
+
+		n = markers->len;
+		records = malloc(n * sizeof(marker_record_t) + 1);
+
+		if (records != NULL)
+			for (guint i=0; i<n; i++)
+				marker_to_record(g_ptr_array_index(markers, i),
+						 &records[i]);
+
+		koki_markers_free(markers);
+
+	}
+
+	PyThread_release_lock(self->lock);
+
+	Py_END_ALLOW_THREADS
+
+	PyBuffer_Release(&view);
+
+	if (markers != NULL && records == NULL)
+		return PyErr_NoMemory();
+
+	/* the array takes a reference to the bytearray it views */
+	bytes = PyByteArray_FromStringAndSize((const char*)records,
+					      n * sizeof(marker_record_t));
+	free(records);
+
+	if (bytes == NULL)
+		return NULL;
+
+	result = PyObject_CallFunctionObjArgs(np_frombuffer, bytes,
+					      marker_dtype, NULL);
+	Py_DECREF(bytes);
+
+	return result;
+
+}
+
+
+
+static PyMethodDef Detector_methods[] = {
+	{ "detect", (PyCFunction)Detector_detect, METH_VARARGS | METH_KEYWORDS,
+	  Detector_detect_doc },
+	{ NULL }
+};
+
+PyDoc_STRVAR(Detector_doc,
+"Detector(focal_length, principal_point=None, decode_cache=False,\n"
+"         sparse_stride=0, expected_codes=None)\n\n"
+"Finds libkoki markers.  focal_length and principal_point are in pixels,\n"
+"either a single number or an (x, y) pair; the principal point defaults\n"
+"to the centre of each image.  decode_cache, sparse_stride and\n"
+"expected_codes correspond to koki_set_decode_cache(),\n"
+"koki_set_sparse_labelling() and koki_set_expected_codes().\n\n"
+"A detector can be shared between threads, but only finds the markers\n"
+"in one image at a time; use one per thread to use several cores.");
+
+static PyTypeObject DetectorType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	.tp_name = "koki.Detector",
+	.tp_basicsize = sizeof(DetectorObject),
+	.tp_dealloc = (destructor)Detector_dealloc,
+	.tp_flags = Py_TPFLAGS_DEFAULT,
+	.tp_doc = Detector_doc,
+	.tp_methods = Detector_methods,
+	.tp_init = (initproc)Detector_init,
+	.tp_new = Detector_new,
+};
+
+
+
+/**
+ * @brief builds the numpy dtype matching \c marker_record_t
+ *
+ * @param numpy  the numpy module
+ * @return       the dtype, or NULL with an exception set
+ */
+static PyObject* make_dtype(PyObject *numpy)
+{
+
+	PyObject *spec, *dtype, *itemsize;
+	Py_ssize_t size;
+
+	spec = Py_BuildValue("[(ss)(ss(ii))(ss(ii))(ss(i))(ss(i))"
+			     "(ss)(ss(i))(ss(i))(ss)]",
+			     "code", "i4",
+			     "vertices", "f4", 4, 2,
+			     "vertices_world", "f4", 4, 3,
+			     "centre", "f4", 2,
+			     "centre_world", "f4", 3,
+			     "distance", "f4",
+			     "rotation", "f4", 3,
+			     "bearing", "f4", 3,
+			     "rotation_offset", "f4");
+	if (spec == NULL)
+		return NULL;
+
+	dtype = PyObject_CallMethod(numpy, "dtype", "(O)", spec);
+	Py_DECREF(spec);
+
+	if (dtype == NULL)
+		return NULL;
+
+	itemsize = PyObject_GetAttrString(dtype, "itemsize");
+	size = itemsize != NULL ? PyLong_AsSsize_t(itemsize) : -1;
+	Py_XDECREF(itemsize);
+	if (size != sizeof(marker_record_t)){
+		Py_DECREF(dtype);
+		PyErr_SetString(PyExc_SystemError,
+				"marker dtype doesn't match marker_record_t");
+		return NULL;
+	}
+
+	return dtype;
+
+}
+
+
+
+static struct PyModuleDef koki_module = {
+	PyModuleDef_HEAD_INIT,
+	.m_name = "koki",
+	.m_doc = "Python bindings for libkoki, for finding libkoki markers.",
+	.m_size = -1,
+};
+
+PyMODINIT_FUNC PyInit_koki(void)
+{
+
+	PyObject *m, *numpy;
+
+	if (PyType_Ready(&DetectorType) < 0)
+		return NULL;
+
+	numpy = PyImport_ImportModule("numpy");
+	if (numpy == NULL)
+		return NULL;
+
+	np_frombuffer = PyObject_GetAttrString(numpy, "frombuffer");
+	marker_dtype = np_frombuffer != NULL ? make_dtype(numpy) : NULL;
+	Py_DECREF(numpy);
+
+	if (marker_dtype == NULL)
+		return NULL;
+
+	m = PyModule_Create(&koki_module);
+	if (m == NULL)
+		return NULL;
+
+	Py_INCREF(&DetectorType);
+	PyModule_AddObject(m, "Detector", (PyObject*)&DetectorType);
+
+	Py_INCREF(marker_dtype);
+	PyModule_AddObject(m, "marker_dtype", marker_dtype);
+
+	return m;
+
+}
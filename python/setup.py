@@ -0,0 +1,20 @@
+"""Builds the libkoki Python bindings against an installed libkoki."""
+
+import subprocess
+from setuptools import setup, Extension
+
+def pkg_config(*args):
+    out = subprocess.check_output(("pkg-config",) + args + ("libkoki",))
+    return out.decode().split()
+
+koki = Extension("koki",
+                 sources = ["kokimodule.c"],
+                 include_dirs = [f[2:] for f in pkg_config("--cflags-only-I")],
+                 extra_compile_args = ["-std=gnu99"],
+                 libraries = [f[2:] for f in pkg_config("--libs-only-l")],
+                 library_dirs = [f[2:] for f in pkg_config("--libs-only-L")])
+
+setup(name = "koki",
+      version = "0.0.1",
+      description = "Python bindings for libkoki",
+      ext_modules = [koki])
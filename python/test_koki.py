@@ -0,0 +1,191 @@
+# Copyright 2013 libkoki contributors
+#
+# This file is part of libkoki
+#
+# libkoki is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# libkoki is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with libkoki.  If not, see <http://www.gnu.org/licenses/>.
+
+"""Tests the koki extension module.
+
+The checks on argument handling, uninitialised detectors and
+reconfiguring a detector while other threads use it need no images.
+Each binary PGM given on the command line must also give the same,
+non-empty, set of markers from every thread and after being
+reconfigured to expect only the codes found in it.
+
+Run it from the root of the tree once the module is built:
+
+    ./shell -c "PYTHONPATH=python python3 python/test_koki.py [IMAGE.pgm...]"
+"""
+
+import sys
+import threading
+import unittest
+
+import numpy as np
+
+import koki
+
+FOCAL = 571
+WIDTH = 0.11
+
+images = []
+
+
+def read_pgm(path):
+    """Reads a binary (P5) 8-bit PGM into a 2D uint8 array."""
+
+    with open(path, "rb") as f:
+        data = f.read()
+
+    fields = []
+    pos = 0
+    while len(fields) < 4:
+        while data[pos:pos + 1].isspace():
+            pos += 1
+        if data[pos:pos + 1] == b"#":
+            pos = data.index(b"\n", pos)
+            continue
+        end = pos
+        while not data[end:end + 1].isspace():
+            end += 1
+        fields.append(data[pos:end])
+        pos = end
+
+    if fields[0] != b"P5" or int(fields[3]) != 255:
+        raise ValueError("{0} isn't an 8-bit binary PGM".format(path))
+
+    w, h = int(fields[1]), int(fields[2])
+    pixels = np.frombuffer(data, np.uint8, w * h, pos + 1)
+    return pixels.reshape(h, w)
+
+
+def noise(h=240, w=320, seed=1):
+    return np.random.RandomState(seed).randint(0, 256, (h, w)).astype(np.uint8)
+
+
+def codes(markers):
+    return sorted(int(c) for c in markers["code"])
+
+
+def run_threads(target, n=4):
+    errors = []
+
+    def wrap():
+        try:
+            target()
+        except Exception as e:
+            errors.append(e)
+
+    threads = [threading.Thread(target=wrap) for i in range(n)]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+
+    return errors
+
+
+class Arguments(unittest.TestCase):
+
+    def test_uninitialised(self):
+        det = koki.Detector.__new__(koki.Detector)
+        with self.assertRaises(RuntimeError):
+            det.detect(noise(), WIDTH)
+
+    def test_bad_detector_args(self):
+        with self.assertRaises(TypeError):
+            koki.Detector("far")
+        with self.assertRaises(TypeError):
+            koki.Detector(FOCAL, principal_point=(1, 2, 3))
+        with self.assertRaises(ValueError):
+            koki.Detector(FOCAL, expected_codes=[300])
+        with self.assertRaises(ValueError):
+            koki.Detector(FOCAL, expected_codes=range(257))
+
+    def test_bad_images(self):
+        det = koki.Detector(FOCAL)
+        img = noise()
+
+        with self.assertRaises(ValueError):
+            det.detect(np.dstack([img, img]), WIDTH)
+        with self.assertRaises(ValueError):
+            det.detect(img.astype(np.uint16), WIDTH)
+        with self.assertRaises(ValueError):
+            det.detect(img[:, ::2], WIDTH)
+        with self.assertRaises(ValueError):
+            det.detect(img[::-1], WIDTH)
+        with self.assertRaises(ValueError):
+            det.detect(img[:0], WIDTH)
+
+    def test_blank(self):
+        det = koki.Detector(FOCAL, decode_cache=True, sparse_stride=4)
+        markers = det.detect(np.full((240, 320), 255, np.uint8), WIDTH)
+        self.assertEqual(markers.dtype, koki.marker_dtype)
+        self.assertEqual(len(markers), 0)
+
+    def test_reinit_while_detecting(self):
+        det = koki.Detector(FOCAL)
+        img = noise()
+        done = threading.Event()
+        errors = []
+
+        def detect():
+            try:
+                while not done.is_set():
+                    det.detect(img, WIDTH)
+            except Exception as e:
+                errors.append(e)
+
+        threads = [threading.Thread(target=detect) for i in range(3)]
+        for t in threads:
+            t.start()
+
+        try:
+            for i in range(200):
+                det.__init__(FOCAL + i, principal_point=(160, 120),
+                             decode_cache=i % 2 == 0, sparse_stride=i % 5,
+                             expected_codes=range(i % 20))
+        finally:
+            done.set()
+            for t in threads:
+                t.join()
+
+        self.assertEqual(errors, [])
+
+
+class Images(unittest.TestCase):
+
+    def test_images(self):
+        for path in images:
+            with self.subTest(image=path):
+                self.check(read_pgm(path))
+
+    def check(self, img):
+        det = koki.Detector(FOCAL)
+        found = codes(det.detect(img, WIDTH))
+        self.assertNotEqual(found, [])
+
+        results = []
+        errors = run_threads(lambda: results.append(
+            codes(det.detect(img, WIDTH))))
+        self.assertEqual(errors, [])
+        self.assertEqual(results, [found] * len(results))
+
+        det.__init__(FOCAL, expected_codes=found)
+        self.assertEqual(codes(det.detect(img, WIDTH)), found)
+
+
+if __name__ == "__main__":
+    images = sys.argv[1:]
+    unittest.main(argv=sys.argv[:1])
@@ -0,0 +1,452 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/**
+ * @file  accumulate.c
+ * @brief Implementation of decoding small markers from samples accumulated
+ *        over several frames
+ *
+ * A distant marker may only be a couple of pixels per cell, and between
+ * sensor noise and blur no single frame thresholds cleanly.  The quad
+ * itself is usually still found though, and it lands on slightly
+ * different pixels every frame.  Each quad that fails to decode is
+ * followed from frame to frame; its cells are sampled directly from the
+ * frame, normalised against its black border and the white surround, and
+ * summed.  Once every code cell's average is clearly black or white, the
+ * averages are thresholded and decoded as usual.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <glib.h>
+#include <cv.h>
+
+#include "points.h"
+#include "code_grid.h"
+#include "homography.h"
+#include "marker.h"
+
+#include "accumulate.h"
+
+
+/* quads with a side longer than this, in pixels, are big enough to decode
+   from a single frame, and aren't followed */
+#define KOKI_ACCUMULATE_MAX_SIDE 48
+
+/* the most quads followed at once */
+#define KOKI_ACCUMULATE_MAX_TRACKS 64
+
+/* once this many frames have been summed, the sums are halved, so that
+   old frames fade out */
+#define KOKI_ACCUMULATE_MAX_FRAMES 8
+
+/* how far, as a fraction of the quad's side, a vertex can move between
+   frames for the quad to be considered the same one */
+#define KOKI_ACCUMULATE_MAX_MOTION 0.25
+
+/* how far outside the quad, as a fraction of its side, to sample the white
+   surround */
+#define KOKI_ACCUMULATE_SURROUND 0.1
+
+/* the minimum difference in grey level between the border and the surround
+   for a frame to be used */
+#define KOKI_ACCUMULATE_MIN_CONTRAST 20
+
+/* how far from 0.5 every code cell's average must be before decoding */
+#define KOKI_ACCUMULATE_MIN_MARGIN 0.1
+
+/* samples per cell along each axis, spread over the middle of the cell
+   (as a fraction of its width) to stay clear of its neighbours */
+#define KOKI_ACCUMULATE_CELL_SAMPLES 3
+#define KOKI_ACCUMULATE_CELL_SPREAD 0.5
+
+#define track_index(arr, i) g_array_index(arr, koki_accumulator_track_t, i)
+
+
+
+/**
+ * @brief creates a new accumulator, following no quads
+ *
+ * @return  the new accumulator
+ */
+koki_accumulator_t* koki_accumulator_new(void)
+{
+
+	koki_accumulator_t *acc;
+
+	acc = g_malloc(sizeof(koki_accumulator_t));
+
+	acc->tracks = g_array_new(FALSE, FALSE,
+				  sizeof(koki_accumulator_track_t));
+	acc->decoded = 0;
+
+	return acc;
+
+}
+
+
+
+/**
+ * @brief frees an accumulator
+ *
+ * @param acc  the accumulator to free
+ */
+void koki_accumulator_free(koki_accumulator_t *acc)
+{
+
+	if (acc == NULL)
+		return;
+
+	g_array_free(acc->tracks, TRUE);
+	g_free(acc);
+
+}
+
+
+
+/**
+ * @brief marks the start of a new frame, forgetting any quads that haven't
+ *        been seen for a while
+ *
+ * @param acc  the accumulator to age
+ */
+void koki_accumulator_age(koki_accumulator_t *acc)
+{
+
+	assert(acc != NULL);
+
+	for (guint i=acc->tracks->len; i>0; i--){
+
+		koki_accumulator_track_t *t = &track_index(acc->tracks, i-1);
+
+		t->age++;
+
+		if (t->age > KOKI_ACCUMULATE_MAX_AGE)
+			g_array_remove_index_fast(acc->tracks, i-1);
+
+	}
+
+}
+
+
+
+/**
+ * @brief calculates the mean side length of a quad
+ *
+ * @param v  the quad's vertices
+ * @return   the mean side length, in pixels
+ */
+static float mean_side(const koki_point2Df_t v[4])
+{
+
+	float sum = 0;
+
+	for (uint8_t i=0; i<4; i++)
+		sum += hypotf(v[(i+1)%4].x - v[i].x, v[(i+1)%4].y - v[i].y);
+
+	return sum / 4;
+
+}
+
+
+
+/**
+ * @brief finds the track a quad continues, and how its vertices line up
+ *
+ * A quad's first vertex is its top-left one, so a marker turning through
+ * 45 degrees changes which of its corners comes first.  The vertices are
+ * compared at each of the four cyclic shifts, and the quad's vertex
+ * <tt>(i + shift) % 4</tt> corresponds to the track's vertex \c i.
+ *
+ * @param acc       the accumulator
+ * @param vertices  the quad's vertices
+ * @param shift     where to store the vertex shift
+ * @return          the index of the track, or -1 if there's none close
+ *                  enough
+ */
+static int find_track(koki_accumulator_t *acc,
+		      const koki_point2Df_t vertices[4], uint8_t *shift)
+{
+
+	float best = -1;
+	int ret = -1;
+
+	for (guint i=0; i<acc->tracks->len; i++){
+
+		const koki_accumulator_track_t *t = &track_index(acc->tracks, i);
+		float limit = mean_side(t->vertices) * KOKI_ACCUMULATE_MAX_MOTION;
+
+		for (uint8_t s=0; s<4; s++){
+
+			float d = 0;
+
+			for (uint8_t j=0; j<4; j++)
+				d = MAX(d, hypotf(vertices[(j+s)%4].x - t->vertices[j].x,
+						  vertices[(j+s)%4].y - t->vertices[j].y));
+
+			if (d <= limit && (ret < 0 || d < best)){
+				best = d;
+				ret = i;
+				*shift = s;
+			}
+
+		}
+
+	}
+
+	return ret;
+
+}
+
+
+
+/**
+ * @brief samples the mean grey level of a single cell
+ *
+ * @param H      the mapping from the unit square to the quad
+ * @param frame  the frame to sample
+ * @param row    the cell's row
+ * @param col    the cell's column
+ * @return       the mean grey level
+ */
+static float sample_cell(const koki_homography_t *H, const IplImage *frame,
+			 uint8_t row, uint8_t col)
+{
+
+	const uint8_t n = KOKI_ACCUMULATE_CELL_SAMPLES;
+	const float spread = KOKI_ACCUMULATE_CELL_SPREAD;
+	uint32_t sum = 0;
+
+	for (uint8_t i=0; i<n; i++){
+
+		float v = row + 0.5 + spread * ((i + 0.5) / n - 0.5);
+
+		for (uint8_t j=0; j<n; j++){
+
+			float u = col + 0.5 + spread * ((j + 0.5) / n - 0.5);
+
+			sum += koki_homography_sample(H, frame,
+						      u / KOKI_MARKER_GRID_WIDTH,
+						      v / KOKI_MARKER_GRID_WIDTH);
+
+		}
+
+	}
+
+	return (float)sum / (n * n);
+
+}
+
+
+
+/**
+ * @brief samples every cell of a quad, normalised so that the border's
+ *        black is \c 0 and the surround's white is \c 1
+ *
+ * @param vertices  the quad's vertices, in the track's order
+ * @param frame     the frame to sample
+ * @param cells     where to store the normalised cells
+ * @return          FALSE if the quad didn't have enough contrast to use
+ */
+static bool sample_quad(const koki_point2Df_t vertices[4],
+			const IplImage *frame,
+			float cells[KOKI_MARKER_GRID_WIDTH][KOKI_MARKER_GRID_WIDTH])
+{
+
+	koki_homography_t H;
+	float black = 0, white = 0;
+	uint16_t num_black = 0;
+	const float out = -KOKI_ACCUMULATE_SURROUND;
+	const float pos[3] = { 0.25, 0.5, 0.75 };
+
+	if (!koki_homography_from_quad(vertices, &H))
+		return FALSE;
+
+	for (uint8_t row=0; row<KOKI_MARKER_GRID_WIDTH; row++){
+		for (uint8_t col=0; col<KOKI_MARKER_GRID_WIDTH; col++){
+
+			cells[row][col] = sample_cell(&H, frame, row, col);
+
+			/* the inner ring of the border is the least blurred
+			   by the white outside */
+			if ((row == 1 || row == KOKI_MARKER_GRID_WIDTH - 2
+			     || col == 1 || col == KOKI_MARKER_GRID_WIDTH - 2)
+			    && row > 0 && row < KOKI_MARKER_GRID_WIDTH - 1
+			    && col > 0 && col < KOKI_MARKER_GRID_WIDTH - 1){
+				black += cells[row][col];
+				num_black++;
+			}
+
+		}
+	}
+
+	for (uint8_t i=0; i<3; i++){
+		white += koki_homography_sample(&H, frame, pos[i], out);
+		white += koki_homography_sample(&H, frame, pos[i], 1 - out);
+		white += koki_homography_sample(&H, frame, out, pos[i]);
+		white += koki_homography_sample(&H, frame, 1 - out, pos[i]);
+	}
+
+	black /= num_black;
+	white /= 12;
+
+	if (white < black + KOKI_ACCUMULATE_MIN_CONTRAST)
+		return FALSE;
+
+	for (uint8_t row=0; row<KOKI_MARKER_GRID_WIDTH; row++)
+		for (uint8_t col=0; col<KOKI_MARKER_GRID_WIDTH; col++)
+			cells[row][col] = CLAMP((cells[row][col] - black)
+						/ (white - black), 0, 1);
+
+	return TRUE;
+
+}
+
+
+
+/**
+ * @brief tries to recover a code from a track's summed cells
+ *
+ * @param t                the track
+ * @param rotation_offset  where to store the rotation offset, relative to
+ *                         the track's vertex order
+ * @return                 the code, or \c -1 if there isn't enough evidence
+ *                         yet
+ */
+static int16_t recover_track(const koki_accumulator_track_t *t,
+			     float *rotation_offset)
+{
+
+	uint8_t border_width = (KOKI_MARKER_GRID_WIDTH -
+				KOKI_CODE_GRID_WIDTH) / 2;
+	uint64_t cells = 0;
+
+	if (t->frames < KOKI_ACCUMULATE_MIN_FRAMES)
+		return -1;
+
+	for (uint8_t row=0; row<KOKI_CODE_GRID_WIDTH; row++){
+		for (uint8_t col=0; col<KOKI_CODE_GRID_WIDTH; col++){
+
+			float mean = t->cells[border_width+row][border_width+col]
+				/ t->frames;
+
+			if (fabsf(mean - 0.5) < KOKI_ACCUMULATE_MIN_MARGIN)
+				return -1;
+
+			if (mean > 0.5)
+				cells |= (uint64_t)1 << (row * KOKI_CODE_GRID_WIDTH + col);
+
+		}
+	}
+
+	return koki_code_recover_from_cells(cells, rotation_offset);
+
+}
+
+
+
+/**
+ * @brief adds a frame's samples of a quad that failed to decode to its
+ *        track, and recovers its code if the evidence is now sufficient
+ *
+ * Quads that are too big to benefit, or that don't have enough contrast in
+ * this frame, are ignored.  A quad not matching any track starts a new one
+ * (unless too many are being followed already).
+ *
+ * @param acc     the accumulator
+ * @param marker  the marker whose code couldn't be recovered from this
+ *                frame alone
+ * @param frame   the greyscale frame the marker is in
+ * @return        TRUE if the marker's code and rotation offset were
+ *                recovered
+ */
+bool koki_accumulator_decode(koki_accumulator_t *acc, koki_marker_t *marker,
+			     const IplImage *frame)
+{
+
+	koki_point2Df_t vertices[4];
+	float cells[KOKI_MARKER_GRID_WIDTH][KOKI_MARKER_GRID_WIDTH];
+	koki_accumulator_track_t *t;
+	float rotation;
+	uint8_t shift = 0;
+	int16_t code;
+	int i;
+
+	assert(acc != NULL);
+	assert(marker != NULL);
+	assert(frame != NULL && frame->nChannels == 1);
+
+	for (uint8_t j=0; j<4; j++)
+		vertices[j] = marker->vertices[j].image;
+
+	if (mean_side(vertices) > KOKI_ACCUMULATE_MAX_SIDE)
+		return FALSE;
+
+	i = find_track(acc, vertices, &shift);
+
+	if (i < 0){
+
+		koki_accumulator_track_t track;
+
+		if (acc->tracks->len >= KOKI_ACCUMULATE_MAX_TRACKS)
+			return FALSE;
+
+		memset(&track, 0, sizeof(track));
+		g_array_append_val(acc->tracks, track);
+		i = acc->tracks->len - 1;
+
+	}
+
+	t = &track_index(acc->tracks, i);
+
+	/* follow the quad, keeping the track's vertex order */
+	for (uint8_t j=0; j<4; j++)
+		t->vertices[j] = vertices[(j+shift)%4];
+	t->age = 0;
+
+	if (!sample_quad(t->vertices, frame, cells))
+		return FALSE;
+
+	if (t->frames >= KOKI_ACCUMULATE_MAX_FRAMES){
+		for (uint8_t row=0; row<KOKI_MARKER_GRID_WIDTH; row++)
+			for (uint8_t col=0; col<KOKI_MARKER_GRID_WIDTH; col++)
+				t->cells[row][col] /= 2;
+		t->frames /= 2;
+	}
+
+	for (uint8_t row=0; row<KOKI_MARKER_GRID_WIDTH; row++)
+		for (uint8_t col=0; col<KOKI_MARKER_GRID_WIDTH; col++)
+			t->cells[row][col] += cells[row][col];
+	t->frames++;
+
+	code = recover_track(t, &rotation);
+
+	if (code < 0)
+		return FALSE;
+
+	marker->code = koki_code_translation(code);
+
+	/* the track's first vertex is the marker's vertex 'shift' */
+	marker->rotation_offset = fmodf(rotation + shift * 90, 360);
+
+	acc->decoded++;
+
+	return TRUE;
+
+}
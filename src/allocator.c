@@ -0,0 +1,210 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/**
+ * @file  allocator.c
+ * @brief Implementation of libkoki's pluggable memory allocation
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "allocator.h"
+
+
+/* the alignment used by koki_malloc(), enough for any scalar or SSE type */
+#define KOKI_ALLOC_ALIGNMENT 16
+
+/**
+ * @brief the header stored just before each block, recording how to free
+ *        it (rather than the allocator itself, which may not outlive it)
+ */
+typedef struct {
+	void (*free) ( void* ptr, size_t size, void* userdata );
+	void *userdata;
+	void *base;   /* what the allocator returned */
+	size_t size;  /* what was asked of the allocator */
+} block_header_t;
+
+/* the scope the current thread is in, or NULL for the default */
+static __thread koki_alloc_scope_t *current = NULL;
+
+
+
+static void* default_alloc( size_t size, size_t alignment, void* userdata )
+{
+	void *ptr;
+
+	if( alignment <= sizeof(void*) * 2 )
+		/* malloc's own alignment will do */
+		return malloc( size );
+
+	if( posix_memalign( &ptr, alignment, size ) != 0 )
+		return NULL;
+
+	return ptr;
+}
+
+static void default_free( void* ptr, size_t size, void* userdata )
+{
+	free( ptr );
+}
+
+const koki_allocator_t koki_default_allocator = {
+	.alloc = default_alloc,
+	.free = default_free,
+};
+
+
+
+/**
+ * @brief make an allocator the current thread's allocator, until
+ *        koki_alloc_scope_leave() is called
+ *
+ * Scopes nest, and must be left in the reverse order they're entered.
+ *
+ * @param scope      the scope, usually on the caller's stack
+ * @param allocator  the allocator to use
+ * @param userdata   the userdata to pass to the allocator
+ */
+void koki_alloc_scope_enter( koki_alloc_scope_t *scope,
+			     const koki_allocator_t *allocator,
+			     void *userdata )
+{
+	assert( scope != NULL && allocator != NULL );
+
+	scope->allocator = allocator;
+	scope->userdata = userdata;
+	scope->allocations = 0;
+	scope->bytes = 0;
+	scope->parent = current;
+
+	current = scope;
+}
+
+/**
+ * @brief return to the allocator in use before the scope was entered
+ *
+ * The scope's counts are added to those of the enclosing scope.
+ *
+ * @param scope  the scope, which must be the innermost one
+ */
+void koki_alloc_scope_leave( koki_alloc_scope_t *scope )
+{
+	assert( scope == current );
+
+	current = scope->parent;
+
+	if( current != NULL ) {
+		current->allocations += scope->allocations;
+		current->bytes += scope->bytes;
+	}
+}
+
+/**
+ * @brief allocate an aligned block with the current allocator
+ *
+ * @param size       the number of bytes
+ * @param alignment  the alignment, a power of two
+ * @return           the block, which must be freed with koki_free(); the
+ *                   process is aborted if the allocator fails, as with
+ *                   g_malloc()
+ */
+void* koki_malloc_aligned( size_t size, size_t alignment )
+{
+	const koki_allocator_t *allocator = &koki_default_allocator;
+	void *userdata = NULL;
+	block_header_t *header;
+	size_t offset;
+	uint8_t *base;
+
+	assert( alignment > 0 && (alignment & (alignment - 1)) == 0 );
+
+	if( alignment < KOKI_ALLOC_ALIGNMENT )
+		alignment = KOKI_ALLOC_ALIGNMENT;
+
+	if( current != NULL ) {
+		allocator = current->allocator;
+		userdata = current->userdata;
+		current->allocations++;
+		current->bytes += size;
+	}
+
+	/* leave room for the header, without upsetting the alignment */
+	offset = (sizeof(block_header_t) + alignment - 1) & ~(alignment - 1);
+
+	base = allocator->alloc( offset + size, alignment, userdata );
+	if( base == NULL )
+		abort();
+
+	header = (block_header_t*)(base + offset) - 1;
+	header->free = allocator->free;
+	header->userdata = userdata;
+	header->base = base;
+	header->size = offset + size;
+
+	return base + offset;
+}
+
+/**
+ * @brief allocate a block with the current allocator
+ *
+ * @param size  the number of bytes
+ * @return      the block, which must be freed with koki_free()
+ */
+void* koki_malloc( size_t size )
+{
+	return koki_malloc_aligned( size, KOKI_ALLOC_ALIGNMENT );
+}
+
+/**
+ * @brief allocate a zeroed array with the current allocator
+ *
+ * @param n     the number of elements
+ * @param size  the size of each element
+ * @return      the block, which must be freed with koki_free()
+ */
+void* koki_calloc( size_t n, size_t size )
+{
+	void *ptr;
+
+	assert( size == 0 || n <= SIZE_MAX / size );
+
+	ptr = koki_malloc( n * size );
+	memset( ptr, 0, n * size );
+
+	return ptr;
+}
+
+/**
+ * @brief free a block allocated by koki_malloc() and friends, with the
+ *        allocator it came from
+ *
+ * @param ptr  the block, or NULL
+ */
+void koki_free( void *ptr )
+{
+	block_header_t *header;
+
+	if( ptr == NULL )
+		return;
+
+	header = (block_header_t*)ptr - 1;
+	header->free( header->base, header->size, header->userdata );
+}
@@ -0,0 +1,460 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/**
+ * @file  async.c
+ * @brief Implementation of finding markers on a pool of worker threads
+ *
+ * koki_find_markers() doesn't return until every candidate has been
+ * looked at, which an event-driven program can't afford to wait for.
+ * Here frames are queued for a pool of workers instead, and each result
+ * is handed to a callback on the worker's thread, or queued to be polled
+ * with an eventfd to wake the program's event loop.
+ *
+ * A context is only safe to use from one thread at a time, so each
+ * worker has its own, configured like the one the pool was made from.
+ * The number of frames in flight is bounded, and a frame that would go
+ * over the bound is refused rather than waited for, so the caller never
+ * blocks and can decide for itself whether to drop or retry it.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+#include <sys/eventfd.h>
+#include <glib.h>
+#include <cv.h>
+
+#include "context.h"
+#include "camera.h"
+#include "marker.h"
+#include "decode_cache.h"
+#include "accumulate.h"
+#include "threads.h"
+
+#include "async.h"
+
+
+/**
+ * @brief a frame waiting for, or being processed by, a worker
+ */
+typedef struct {
+	koki_async_result_t result;     /**< the frame, and later what was
+					     found in it */
+	float marker_width;             /**< the marker width, in metres */
+	koki_camera_params_t params;    /**< the camera params */
+	koki_async_callback_t callback; /**< the completion callback, or NULL
+					     to queue the result */
+} async_job_t;
+
+/* queued once per worker to tell it to stop */
+static async_job_t stop_job;
+
+
+
+/**
+ * @brief makes a worker's context, configured like the pool's
+ *
+ * The logger isn't copied, as loggers aren't expected to be called from
+ * several threads at once.  The tracer is shared, as it keeps a ring of
+ * events per thread anyway.
+ *
+ * @param koki  the context to copy the configuration of
+ * @return      the new context
+ */
+static koki_t* worker_context( const koki_t *koki )
+{
+	koki_t *w = koki_new();
+
+	w->allocator = koki->allocator;
+	w->allocator_userdata = koki->allocator_userdata;
+
+	if (koki->decode_cache != NULL)
+		w->decode_cache = koki_decode_cache_new();
+
+	memcpy( w->expected_codes, koki->expected_codes,
+		sizeof(w->expected_codes) );
+	w->num_expected_codes = koki->num_expected_codes;
+
+	w->tracer = koki->tracer;
+	w->reference = koki->reference;
+	w->label_stride = koki->label_stride;
+	w->edge_quads = koki->edge_quads;
+	w->batch_decode = koki->batch_decode;
+
+	if (koki->accumulator != NULL)
+		w->accumulator = koki_accumulator_new();
+
+	w->num_workers = koki->num_workers;
+	memcpy( w->threads, koki->threads, sizeof(w->threads) );
+
+	return w;
+}
+
+/**
+ * @brief hands a frame's result over, and lets another frame in
+ *
+ * @param async  the pool
+ * @param job    the finished job
+ */
+static void deliver( koki_async_t *async, async_job_t *job )
+{
+	uint64_t one = 1;
+
+	if (job->callback != NULL){
+
+		job->callback( &job->result );
+		g_slice_free( async_job_t, job );
+
+		g_mutex_lock( &async->lock );
+		async->in_flight--;
+		g_mutex_unlock( &async->lock );
+
+		return;
+	}
+
+	/* the frame stays in flight until it's polled; signalling under the
+	   lock keeps the eventfd's count equal to the queue's length, so a
+	   poll never takes a result that hasn't been signalled yet */
+	g_mutex_lock( &async->lock );
+	g_queue_push_tail( &async->results, job );
+	if (write( async->fd, &one, sizeof(one) ) != sizeof(one))
+		fprintf( stderr, "koki: failed to signal a result's completion\n" );
+	g_mutex_unlock( &async->lock );
+}
+
+/**
+ * @brief a worker thread's main loop
+ *
+ * @param data  the worker
+ * @return      NULL
+ */
+static gpointer worker_main( gpointer data )
+{
+	koki_async_worker_t *worker = data;
+	koki_async_t *async = worker->async;
+
+	worker->sched_status = koki_thread_config_apply(
+		&worker->koki->threads[KOKI_THREAD_WORKER], worker->index );
+
+	/* counters count the thread that opens them */
+	if (worker->perf)
+		koki_set_perf_counters( worker->koki, TRUE );
+
+	g_mutex_lock( &async->lock );
+	async->num_started++;
+	g_cond_signal( &async->started );
+	g_mutex_unlock( &async->lock );
+
+	while (TRUE){
+
+		async_job_t *job = g_async_queue_pop( async->jobs );
+		uint32_t frame_id;
+
+		if (job == &stop_job)
+			break;
+
+		job->result.markers = koki_find_markers( worker->koki,
+							 job->result.frame,
+							 job->marker_width,
+							 &job->params );
+
+		/* number the frame by submission, rather than by worker */
+		frame_id = job->result.stats.frame_id;
+		job->result.stats = worker->koki->stats;
+		job->result.stats.frame_id = frame_id;
+
+		if (worker->koki->perf != NULL)
+			job->result.perf = worker->koki->perf->frame;
+		else
+			memset( &job->result.perf, 0, sizeof(job->result.perf) );
+
+		deliver( async, job );
+
+	}//while
+
+	return NULL;
+}
+
+
+
+/**
+ * @brief starts a pool of worker threads for koki_find_markers_async()
+ *
+ * Each worker gets its own context, configured like \c koki at the time
+ * of the call (except for its logger, which isn't used), so later changes
+ * to \c koki don't affect the pool.  If \c koki has a decode cache, each
+ * worker has its own, which only hits on the frames that worker sees
+ * (and the same goes for accumulating samples of small markers).
+ * Likewise, if \c koki is reading performance counters, each worker
+ * opens its own, and each result carries its frame's counts.  Any
+ * allocator set on \c koki must be safe to call from several threads
+ * at once.
+ *
+ * The workers are scheduled as configured for \c KOKI_THREAD_WORKER (see
+ * koki_set_thread_config()), and have done so by the time this returns,
+ * so each worker's \c sched_status says whether that was permitted.
+ *
+ * @param koki           the context whose configuration to copy
+ * @param num_workers    the number of worker threads, or 0 for the
+ *                       context's number (see koki_set_worker_threads())
+ * @param max_in_flight  the most frames that may be submitted but not yet
+ *                       delivered (at least 1)
+ * @return               the pool, or NULL if the eventfd couldn't be made
+ */
+koki_async_t* koki_async_new( const koki_t *koki, uint16_t num_workers,
+			      uint16_t max_in_flight )
+{
+	koki_async_t *async;
+
+	assert(koki != NULL && max_in_flight > 0);
+
+	if (num_workers == 0)
+		num_workers = koki->num_workers;
+	if (num_workers == 0)
+		num_workers = MAX( g_get_num_processors(), 1 );
+
+	async = g_malloc0( sizeof(koki_async_t) );
+
+	async->fd = eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK | EFD_SEMAPHORE );
+	if (async->fd < 0){
+		g_free( async );
+		return NULL;
+	}
+
+	async->jobs = g_async_queue_new();
+	g_mutex_init( &async->lock );
+	g_cond_init( &async->started );
+	g_queue_init( &async->results );
+	async->max_in_flight = max_in_flight;
+
+	async->num_workers = num_workers;
+	async->workers = g_malloc0( num_workers * sizeof(koki_async_worker_t) );
+
+	for (uint16_t i=0; i<num_workers; i++){
+
+		koki_async_worker_t *worker = &async->workers[i];
+
+		worker->async = async;
+		worker->koki = worker_context( koki );
+		worker->index = i;
+		worker->perf = koki->perf != NULL;
+		worker->thread = g_thread_new( "koki-worker", worker_main, worker );
+
+	}
+
+	g_mutex_lock( &async->lock );
+	while (async->num_started < num_workers)
+		g_cond_wait( &async->started, &async->lock );
+	g_mutex_unlock( &async->lock );
+
+	return async;
+}
+
+
+
+/**
+ * @brief waits for the frames in flight, then stops the workers and frees
+ *        the pool
+ *
+ * Callbacks are still called for the frames in flight.  Results waiting
+ * to be polled are freed, markers and all.
+ *
+ * @param async  the pool to free
+ */
+void koki_async_free( koki_async_t *async )
+{
+	async_job_t *job;
+
+	if (async == NULL)
+		return;
+
+	for (uint16_t i=0; i<async->num_workers; i++)
+		g_async_queue_push( async->jobs, &stop_job );
+
+	for (uint16_t i=0; i<async->num_workers; i++){
+
+		koki_async_worker_t *worker = &async->workers[i];
+
+		g_thread_join( worker->thread );
+
+		/* the tracer belongs to the pool's creator */
+		worker->koki->tracer = NULL;
+		koki_destroy( worker->koki );
+
+	}
+
+	while ((job = g_queue_pop_head( &async->results )) != NULL){
+		koki_markers_free( job->result.markers );
+		g_slice_free( async_job_t, job );
+	}
+
+	g_async_queue_unref( async->jobs );
+	g_mutex_clear( &async->lock );
+	g_cond_clear( &async->started );
+	close( async->fd );
+
+	g_free( async->workers );
+	g_free( async );
+}
+
+
+
+/**
+ * @brief queues a frame for the pool to find the markers in
+ *
+ * This never blocks.  If \c max_in_flight frames are already in flight,
+ * the frame is refused, and it's up to the caller whether to drop it or
+ * to try again once a frame has been delivered.
+ *
+ * The frame and its pixels must be left untouched until the frame is
+ * delivered, either to \c callback or by koki_async_poll().  The callback
+ * is called on a worker thread, and a frame stays in flight until it
+ * returns.  Frames may be delivered in a different order to the one they
+ * were submitted in.
+ *
+ * @param async         the pool
+ * @param frame         the greyscale frame
+ * @param marker_width  the width, in metres, of the marker(s) in the frame
+ * @param params        the camera params for the camera at \c frame's
+ *                      resolution (copied, so needn't outlive the call)
+ * @param callback      the function to hand the result to, or NULL to
+ *                      queue it for koki_async_poll()
+ * @param userdata      passed back in the result
+ * @return              TRUE if the frame was queued, FALSE if too many
+ *                      frames are in flight
+ */
+bool koki_find_markers_async( koki_async_t *async,
+			      IplImage *frame,
+			      float marker_width,
+			      const koki_camera_params_t *params,
+			      koki_async_callback_t callback,
+			      void *userdata )
+{
+	async_job_t *job;
+	uint32_t frame_id;
+
+	assert(async != NULL && frame != NULL && params != NULL);
+
+	g_mutex_lock( &async->lock );
+
+	if (async->in_flight >= async->max_in_flight){
+		g_mutex_unlock( &async->lock );
+		return FALSE;
+	}
+
+	async->in_flight++;
+	frame_id = ++async->submitted;
+
+	g_mutex_unlock( &async->lock );
+
+	job = g_slice_new0( async_job_t );
+	job->result.frame = frame;
+	job->result.stats.frame_id = frame_id;
+	job->result.userdata = userdata;
+	job->marker_width = marker_width;
+	job->params = *params;
+	job->callback = callback;
+
+	g_async_queue_push( async->jobs, job );
+
+	return TRUE;
+}
+
+
+
+/**
+ * @brief returns the eventfd that's readable while results are waiting
+ *        to be polled
+ *
+ * Add it to the event loop, and call koki_async_poll() when it's
+ * readable.  The pool reads it as results are polled, so the caller
+ * mustn't.
+ *
+ * @param async  the pool
+ * @return       the file descriptor
+ */
+int koki_async_get_fd( koki_async_t *async )
+{
+	assert(async != NULL);
+
+	return async->fd;
+}
+
+
+
+/**
+ * @brief takes the next result that was queued for polling, without
+ *        blocking
+ *
+ * @param async   the pool
+ * @param result  where to store the result, whose markers the caller must
+ *                free
+ * @return        TRUE if there was a result, FALSE if none are waiting
+ */
+bool koki_async_poll( koki_async_t *async, koki_async_result_t *result )
+{
+	async_job_t *job;
+	uint64_t count;
+
+	assert(async != NULL && result != NULL);
+
+	g_mutex_lock( &async->lock );
+
+	job = g_queue_pop_head( &async->results );
+	if (job == NULL){
+		g_mutex_unlock( &async->lock );
+		return FALSE;
+	}
+
+	async->in_flight--;
+
+	/* a semaphore eventfd counts down one per read */
+	if (read( async->fd, &count, sizeof(count) ) != sizeof(count))
+		fprintf( stderr, "koki: failed to clear a result's completion\n" );
+
+	g_mutex_unlock( &async->lock );
+
+	*result = job->result;
+	g_slice_free( async_job_t, job );
+
+	return TRUE;
+}
+
+
+
+/**
+ * @brief returns the number of frames submitted but not yet delivered
+ *
+ * @param async  the pool
+ * @return       the number of frames in flight
+ */
+uint16_t koki_async_in_flight( koki_async_t *async )
+{
+	uint16_t n;
+
+	assert(async != NULL);
+
+	g_mutex_lock( &async->lock );
+	n = async->in_flight;
+	g_mutex_unlock( &async->lock );
+
+	return n;
+}
@@ -0,0 +1,170 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/**
+ * @file  bayer.c
+ * @brief Implementation of finding markers in raw Bayer sensor data
+ *
+ * Demosaicing a full frame only to throw the colour away again costs more
+ * than finding the markers.  The detector only needs luma, and every 2x2
+ * block of a Bayer mosaic holds one red, two green and one blue pixel,
+ * whatever the pattern, so averaging each block gives a half-resolution
+ * greyscale image directly.  At half resolution the markers are found in
+ * roughly a quarter of the time, and their corners are mapped back to
+ * full-resolution co-ordinates afterwards.
+ */
+
+#include <stdint.h>
+#include <assert.h>
+#include <cv.h>
+#include <glib.h>
+
+#include "context.h"
+#include "camera.h"
+#include "marker.h"
+#include "simd.h"
+
+#include "bayer.h"
+
+
+/**
+ * @brief maps a point from the half-resolution image back to the mosaic
+ *
+ * A half-resolution pixel's centre is the centre of its 2x2 block.
+ */
+static void unbin_point( koki_point2Df_t *p )
+{
+	p->x = p->x * 2 + 0.5;
+	p->y = p->y * 2 + 0.5;
+}
+
+
+
+/**
+ * @brief makes a half-resolution greyscale image from a Bayer mosaic
+ *
+ * @param bayer    the mosaic, 8 bits per pixel
+ * @param w        the mosaic's width
+ * @param h        the mosaic's height
+ * @param stride   the number of bytes between the starts of rows
+ * @param pattern  the mosaic's pattern
+ * @param luma     how to make each greyscale pixel
+ * @return         a \c w/2 by \c h/2 greyscale image, to be freed with
+ *                 cvReleaseImage()
+ */
+IplImage* koki_bayer_to_grey( const uint8_t *bayer, uint16_t w, uint16_t h,
+			      uint32_t stride, koki_bayer_pattern_t pattern,
+			      koki_bayer_luma_t luma )
+{
+	const koki_simd_kernels_t *simd = koki_simd_kernels();
+	IplImage *grey;
+	uint8_t g0;
+
+	assert(bayer != NULL && w >= 2 && h >= 2);
+
+	grey = cvCreateImage( cvSize( w / 2, h / 2 ), IPL_DEPTH_8U, 1 );
+	assert(grey != NULL);
+
+	/* the column of the green pixel in a block's top row */
+	g0 = pattern == KOKI_BAYER_GRBG || pattern == KOKI_BAYER_GBRG ? 0 : 1;
+
+	for (uint16_t y=0; y<h/2; y++){
+
+		const uint8_t *row0 = bayer + stride * y * 2;
+		const uint8_t *row1 = row0 + stride;
+		uint8_t *dst = (uint8_t*)(grey->imageData + grey->widthStep * y);
+
+		if (luma == KOKI_BAYER_BIN){
+			simd->bin_2x2( row0, row1, dst, w / 2 );
+			continue;
+		}
+
+		/* the other green is diagonally opposite */
+		for (uint16_t x=0; x<w/2; x++)
+			dst[x] = (row0[x * 2 + g0] + row1[x * 2 + 1 - g0] + 1) >> 1;
+
+	}//for
+
+	return grey;
+}
+
+
+
+/**
+ * @brief finds the markers in a Bayer mosaic
+ *
+ * The markers are found in a half-resolution image (see
+ * koki_bayer_to_grey()), using camera parameters rescaled to match, and
+ * their image co-ordinates are then mapped back to the mosaic's.  Their
+ * poses are those the full-resolution image would give, though with the
+ * corner accuracy of the half-resolution one.
+ *
+ * @param koki          the libkoki context
+ * @param bayer         the mosaic, 8 bits per pixel
+ * @param w             the mosaic's width
+ * @param h             the mosaic's height
+ * @param stride        the number of bytes between the starts of rows
+ * @param pattern       the mosaic's pattern
+ * @param luma          how to make the greyscale image
+ * @param marker_width  the width, in metres, of the marker(s)
+ * @param params        the camera params for the mosaic's resolution
+ * @return              a \c GPtrArray* of the markers found, or NULL on
+ *                      failure
+ */
+GPtrArray* koki_find_markers_bayer( koki_t *koki,
+				    const uint8_t *bayer,
+				    uint16_t w, uint16_t h, uint32_t stride,
+				    koki_bayer_pattern_t pattern,
+				    koki_bayer_luma_t luma,
+				    float marker_width,
+				    const koki_camera_params_t *params )
+{
+	koki_camera_params_t half;
+	IplImage *grey;
+	GPtrArray *markers;
+
+	assert(koki != NULL && params != NULL);
+
+	grey = koki_bayer_to_grey( bayer, w, h, stride, pattern, luma );
+
+	/* the inverse of unbin_point() */
+	half.principal_point.x = (params->principal_point.x - 0.5) / 2;
+	half.principal_point.y = (params->principal_point.y - 0.5) / 2;
+	half.focal_length.x = params->focal_length.x / 2;
+	half.focal_length.y = params->focal_length.y / 2;
+	half.size.x = grey->width;
+	half.size.y = grey->height;
+
+	markers = koki_find_markers( koki, grey, marker_width, &half );
+
+	cvReleaseImage( &grey );
+
+	if (markers == NULL)
+		return NULL;
+
+	for (guint m=0; m<markers->len; m++){
+
+		koki_marker_t *marker = g_ptr_array_index( markers, m );
+
+		unbin_point( &marker->centre.image );
+		for (uint8_t v=0; v<4; v++)
+			unbin_point( &marker->vertices[v].image );
+
+	}
+
+	return markers;
+}
@@ -21,9 +21,11 @@
  */
 
 #include <math.h>
+#include <assert.h>
 
 #include "points.h"
 #include "marker.h"
+#include "fixed.h"
 
 #include "bearing.h"
 
@@ -90,3 +92,58 @@ void koki_bearing_estimate(koki_marker_t *marker)
 	marker->bearing = bearing;
 
 }
+
+
+
+/**
+ * @brief the fixed-point equivalent of koki_bearing_estimate_point()
+ *
+ * @param point  the 3D point to get the relative bearing to
+ * @return       the bearing to the point, in radians
+ */
+koki_fixed_point3_t koki_bearing_estimate_point_fixed(koki_fixed_point3_t point)
+{
+
+	koki_fixed_point3_t bearing;
+	int64_t r;
+
+	bearing.y = koki_fixed_atan2(point.x, point.z);
+
+	r = koki_fixed_hypot64(koki_fixed_hypot64(point.x, point.y), point.z);
+	bearing.x = r == 0 ? 0
+		: koki_fixed_asin(koki_fixed_div64(point.y, r, KOKI_FIXED_SHIFT));
+
+	bearing.z = 0; /* not used (yet) */
+
+	return bearing;
+
+}
+
+
+
+/**
+ * @brief the fixed-point equivalent of koki_bearing_estimate()
+ *
+ * @param marker  the marker to calculate the relative bearing to and to
+ *                store the result in
+ */
+void koki_bearing_estimate_fixed(koki_marker_t *marker)
+{
+
+	koki_fixed_point3_t centre, bearing;
+
+	assert(marker != NULL);
+
+	centre.x = koki_fixed_from_float(marker->centre.world.x);
+	centre.y = koki_fixed_from_float(marker->centre.world.y);
+	centre.z = koki_fixed_from_float(marker->centre.world.z);
+
+	bearing = koki_bearing_estimate_point_fixed(centre);
+
+	marker->bearing.x = koki_fixed_to_float(koki_fixed_mul(bearing.x,
+							       KOKI_FIXED_DEG));
+	marker->bearing.y = koki_fixed_to_float(koki_fixed_mul(bearing.y,
+							       KOKI_FIXED_DEG));
+	marker->bearing.z = 0;
+
+}
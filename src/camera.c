@@ -0,0 +1,67 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/**
+ * @file  camera.c
+ * @brief Implementation for camera related activities
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "points.h"
+
+#include "camera.h"
+
+
+/**
+ * @brief rescales camera parameters for a different capture resolution
+ *
+ * The principal point and focal length are scaled in proportion to the
+ * change in image size.  This is only valid when the new resolution
+ * covers the same field of view as the one the parameters were
+ * calibrated at (i.e. the camera scales or bins, rather than crops).
+ *
+ * @param src     the parameters, including the size they're valid for
+ * @param width   the new image width
+ * @param height  the new image height
+ * @param dst     where to store the rescaled parameters (may be \c src)
+ */
+void koki_camera_params_scale(const koki_camera_params_t *src,
+			      uint16_t width, uint16_t height,
+			      koki_camera_params_t *dst)
+{
+
+	float sx, sy;
+
+	assert(src != NULL && dst != NULL);
+	assert(src->size.x > 0 && src->size.y > 0);
+
+	sx = (float)width / src->size.x;
+	sy = (float)height / src->size.y;
+
+	dst->principal_point.x = src->principal_point.x * sx;
+	dst->principal_point.y = src->principal_point.y * sy;
+
+	dst->focal_length.x = src->focal_length.x * sx;
+	dst->focal_length.y = src->focal_length.y * sy;
+
+	dst->size.x = width;
+	dst->size.y = height;
+
+}
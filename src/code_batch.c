@@ -0,0 +1,283 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/**
+ * @file  code_batch.c
+ * @brief Implementation of recovering the codes of several markers at once
+ *
+ * Rather than unwarping each marker into an image of its own and
+ * thresholding that, the cells of a batch of markers are sampled straight
+ * from the frame.  The sample points are mapped through all of the
+ * batch's homographies together by the \c project_row kernel, one vector
+ * lane per marker, and the per-marker steps that follow (summing cells,
+ * thresholding them and packing the code bits) work across the batch's
+ * lanes too.  The codes are then recovered from the packed bits with
+ * table lookups (see koki_code_recover_from_cells()).
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+#include <cv.h>
+
+#include "homography.h"
+#include "labelling.h" /* for KOKI_IPLIMAGE_GS_ELEM */
+#include "simd.h"
+
+#include "code_batch.h"
+
+
+/* each cell is sampled on an n x n grid of points */
+#define KOKI_CODE_BATCH_CELL_SAMPLES 3
+
+/* the samples across the whole marker */
+#define SAMPLES (KOKI_MARKER_GRID_WIDTH * KOKI_CODE_BATCH_CELL_SAMPLES)
+
+/* the number of cells, and those of them in the border */
+#define NUM_CELLS (KOKI_MARKER_GRID_WIDTH * KOKI_MARKER_GRID_WIDTH)
+#define NUM_CODE_CELLS (KOKI_CODE_GRID_WIDTH * KOKI_CODE_GRID_WIDTH)
+#define NUM_BORDER_CELLS (NUM_CELLS - NUM_CODE_CELLS)
+
+/* the least difference in mean grey level between the black border and
+   the code's white cells that's worth decoding */
+#define KOKI_CODE_BATCH_MIN_CONTRAST 20
+
+
+
+/**
+ * @brief determines whether a cell lies within the code, rather than in
+ *        the border
+ *
+ * @param row  the cell's row
+ * @param col  the cell's column
+ * @return     TRUE if the cell is a code cell
+ */
+static inline bool is_code_cell(uint8_t row, uint8_t col)
+{
+
+	const uint8_t b = (KOKI_MARKER_GRID_WIDTH - KOKI_CODE_GRID_WIDTH) / 2;
+
+	return row >= b && row < b + KOKI_CODE_GRID_WIDTH
+		&& col >= b && col < b + KOKI_CODE_GRID_WIDTH;
+
+}
+
+
+
+/**
+ * @brief fills in one lane of a batch of homographies from a marker
+ *
+ * As with koki_unwarp_marker(), a marker with a vertex outside the frame
+ * isn't decoded, as its cells would be sampled from the frame's edge.
+ *
+ * @param H       the batch
+ * @param j       the lane
+ * @param marker  the marker, or NULL to leave the lane mapping everything
+ *                to the origin
+ * @param frame   the frame the marker is in
+ * @return        FALSE if the marker's quad is degenerate or isn't
+ *                within the frame
+ */
+static bool set_lane(koki_homography_batch_t *H, uint8_t j,
+		     const koki_marker_t *marker, const IplImage *frame)
+{
+
+	koki_point2Df_t vertices[4];
+	koki_homography_t h;
+	bool inside = TRUE;
+
+	memset(&h, 0, sizeof(h));
+
+	if (marker != NULL){
+
+		for (uint8_t i=0; i<4; i++){
+			vertices[i] = marker->vertices[i].image;
+			inside = inside && vertices[i].x >= 0 && vertices[i].y >= 0
+				&& vertices[i].x < frame->width
+				&& vertices[i].y < frame->height;
+		}
+
+		if (!inside || !koki_homography_from_quad(vertices, &h)){
+			memset(&h, 0, sizeof(h));
+			marker = NULL;
+		}
+
+	}
+
+	H->a[j] = h.a; H->b[j] = h.b; H->c[j] = h.c;
+	H->d[j] = h.d; H->e[j] = h.e; H->f[j] = h.f;
+	H->g[j] = h.g; H->h[j] = h.h;
+
+	return marker != NULL;
+
+}
+
+
+
+/**
+ * @brief recovers the codes of up to \c KOKI_CODE_BATCH_SIZE markers
+ *
+ * Each cell is thresholded half way between the mean of the marker's
+ * black border and the mean of its brighter code cells, so a marker
+ * without enough contrast between the two isn't decoded.  Nor is one with
+ * a vertex outside the frame.
+ *
+ * @param frame             the greyscale frame the markers are in
+ * @param markers           the markers
+ * @param n                 the number of markers, at most \c
+ *                          KOKI_CODE_BATCH_SIZE
+ * @param codes             where to store each marker's code, as returned
+ *                          by koki_code_recover_from_grid() (i.e. before
+ *                          translation), or \c -1 if there isn't one
+ * @param rotation_offsets  where to store each marker's rotation offset,
+ *                          for those with a code
+ * @param grids             where to store each marker's thresholded grid,
+ *                          or NULL if they're not wanted
+ */
+void koki_code_recover_batch(const IplImage *frame,
+			     koki_marker_t *const *markers, uint8_t n,
+			     int16_t *codes, float *rotation_offsets,
+			     koki_grid_t *grids)
+{
+
+	const koki_simd_kernels_t *simd = koki_simd_kernels();
+	koki_homography_batch_t H;
+	bool valid[KOKI_CODE_BATCH_SIZE];
+	int32_t xs[SAMPLES * KOKI_CODE_BATCH_SIZE];
+	int32_t ys[SAMPLES * KOKI_CODE_BATCH_SIZE];
+
+	/* cell sums, by cell then lane; 9 samples of 255 fit in 16 bits */
+	uint16_t sums[NUM_CELLS][KOKI_CODE_BATCH_SIZE];
+	uint32_t black[KOKI_CODE_BATCH_SIZE], white[KOKI_CODE_BATCH_SIZE];
+	uint32_t mean[KOKI_CODE_BATCH_SIZE], num_white[KOKI_CODE_BATCH_SIZE];
+	uint64_t cells[KOKI_CODE_BATCH_SIZE];
+
+	assert(frame != NULL && frame->nChannels == 1);
+	assert(markers != NULL && codes != NULL && rotation_offsets != NULL);
+	assert(n <= KOKI_CODE_BATCH_SIZE);
+
+	for (uint8_t j=0; j<KOKI_CODE_BATCH_SIZE; j++)
+		valid[j] = set_lane(&H, j, j < n ? markers[j] : NULL, frame);
+
+	memset(sums, 0, sizeof(sums));
+
+	/* sample each row of points through every homography at once */
+	for (uint16_t sy=0; sy<SAMPLES; sy++){
+
+		uint8_t row = sy / KOKI_CODE_BATCH_CELL_SAMPLES;
+
+		simd->project_row(&H, 0.5f / SAMPLES, 1.0f / SAMPLES,
+				  (sy + 0.5f) / SAMPLES, SAMPLES,
+				  frame->width - 1, frame->height - 1, xs, ys);
+
+		for (uint16_t sx=0; sx<SAMPLES; sx++){
+
+			uint16_t *cell = sums[row * KOKI_MARKER_GRID_WIDTH
+					      + sx / KOKI_CODE_BATCH_CELL_SAMPLES];
+			const int32_t *x = xs + sx * KOKI_CODE_BATCH_SIZE;
+			const int32_t *y = ys + sx * KOKI_CODE_BATCH_SIZE;
+
+			for (uint8_t j=0; j<n; j++)
+				cell[j] += KOKI_IPLIMAGE_GS_ELEM(frame, x[j], y[j]);
+
+		}//for sx
+	}//for sy
+
+	/* the border's mean, and the code cells' mean */
+	memset(black, 0, sizeof(black));
+	memset(mean, 0, sizeof(mean));
+
+	for (uint8_t row=0; row<KOKI_MARKER_GRID_WIDTH; row++)
+		for (uint8_t col=0; col<KOKI_MARKER_GRID_WIDTH; col++){
+
+			uint16_t *cell = sums[row * KOKI_MARKER_GRID_WIDTH + col];
+			uint32_t *acc = is_code_cell(row, col) ? mean : black;
+
+			for (uint8_t j=0; j<KOKI_CODE_BATCH_SIZE; j++)
+				acc[j] += cell[j];
+
+		}//for
+
+	for (uint8_t j=0; j<KOKI_CODE_BATCH_SIZE; j++){
+		black[j] /= NUM_BORDER_CELLS;
+		mean[j] /= NUM_CODE_CELLS;
+	}
+
+	/* the mean of the code cells brighter than that */
+	memset(white, 0, sizeof(white));
+	memset(num_white, 0, sizeof(num_white));
+
+	for (uint16_t c=0; c<NUM_CELLS; c++){
+
+		if (!is_code_cell(c / KOKI_MARKER_GRID_WIDTH,
+				  c % KOKI_MARKER_GRID_WIDTH))
+			continue;
+
+		for (uint8_t j=0; j<KOKI_CODE_BATCH_SIZE; j++){
+			bool bright = sums[c][j] > mean[j];
+			white[j] += bright ? sums[c][j] : 0;
+			num_white[j] += bright;
+		}
+
+	}//for
+
+	/* threshold the cells, and pack the code cells' bits */
+	for (uint8_t j=0; j<n; j++){
+
+		uint32_t threshold;
+		uint8_t bit = 0;
+
+		codes[j] = -1;
+
+		if (!valid[j] || num_white[j] == 0)
+			continue;
+
+		white[j] /= num_white[j];
+
+		if (white[j] < black[j] + KOKI_CODE_BATCH_MIN_CONTRAST
+		    * KOKI_CODE_BATCH_CELL_SAMPLES * KOKI_CODE_BATCH_CELL_SAMPLES)
+			continue;
+
+		threshold = (black[j] + white[j]) / 2;
+		cells[j] = 0;
+
+		for (uint8_t row=0; row<KOKI_MARKER_GRID_WIDTH; row++)
+			for (uint8_t col=0; col<KOKI_MARKER_GRID_WIDTH; col++){
+
+				uint16_t sum = sums[row * KOKI_MARKER_GRID_WIDTH + col][j];
+				uint8_t val = sum > threshold;
+
+				if (grids != NULL){
+					koki_cell_t *cell = &grids[j].data[row][col];
+					cell->sum = sum;
+					cell->num_pixels = KOKI_CODE_BATCH_CELL_SAMPLES
+						* KOKI_CODE_BATCH_CELL_SAMPLES;
+					cell->val = val;
+				}
+
+				if (is_code_cell(row, col))
+					cells[j] |= (uint64_t)val << bit++;
+
+			}//for
+
+		codes[j] = koki_code_recover_from_cells(cells[j],
+							&rotation_offsets[j]);
+
+	}//for j
+
+}
@@ -21,33 +21,53 @@
  */
 
 #include <stdint.h>
+#include <string.h>
 #include <cv.h>
 #include <stdio.h>
 
 #include "labelling.h"
 #include "crc12.h"
+#include "simd.h"
 
 #include "code_grid.h"
 
 #include "code_table.h" /* int fwd_code_table[256]... */
 
 
-#define ROT_000(grid, gw, bw, x, y)		\
-	(grid->data[bw+y][bw+x].val)
+/* the value of a code cell, from the cells packed by koki_code_grid_cells() */
+#define CELL(cells, row, col)					\
+	((uint8_t)((cells) >> ((row) * KOKI_CODE_GRID_WIDTH + (col))) & 0x1)
 
-#define ROT_090(grid, gw, bw, x, y)		\
-	(grid->data[bw+x][bw+(gw-1)-y].val)
+#define ROT_000(cells, gw, x, y)		\
+	CELL(cells, y, x)
 
-#define ROT_180(grid, gw, bw, x, y)			\
-	(grid->data[bw+(gw-1)-y][bw+(gw-1)-x].val)
+#define ROT_090(cells, gw, x, y)		\
+	CELL(cells, x, (gw-1)-y)
 
-#define ROT_270(grid, gw, bw, x, y)		\
-	(grid->data[bw+(gw-1)-x][bw+y].val)
+#define ROT_180(cells, gw, x, y)		\
+	CELL(cells, (gw-1)-y, (gw-1)-x)
+
+#define ROT_270(cells, gw, x, y)		\
+	CELL(cells, (gw-1)-x, y)
 
 #define MARKER_NUM(code) (code & 0xFF)
 #define MARKER_CRC(code) ((code >> 8) & 0xFFF)
 
 
+/* the data nibble for each received Hamming(7,4) block, after correcting
+   the bit its syndrome points at (see hamming_decode()) */
+static const uint8_t hamming_table[128] = {
+	0, 0, 0, 1, 0, 1, 1, 1, 0, 2, 4, 8, 9, 5, 3, 1,
+	0, 2, 10, 6, 7, 11, 3, 1, 2, 2, 3, 2, 3, 2, 3, 3,
+	0, 12, 4, 6, 7, 5, 13, 1, 4, 5, 4, 4, 5, 5, 4, 5,
+	7, 6, 6, 6, 7, 7, 7, 6, 14, 2, 4, 6, 7, 5, 3, 15,
+	0, 12, 10, 8, 9, 11, 13, 1, 9, 8, 8, 8, 9, 9, 9, 8,
+	10, 11, 10, 10, 11, 11, 10, 11, 14, 2, 10, 8, 9, 11, 3, 15,
+	12, 12, 13, 12, 13, 12, 13, 13, 14, 12, 4, 8, 9, 5, 13, 15,
+	14, 12, 10, 6, 7, 11, 13, 15, 14, 14, 14, 15, 14, 15, 15, 15
+};
+
+
 /**
  * @brief sets all fields in a grid to \c 0
  *
@@ -82,8 +102,9 @@ void koki_grid_from_image(IplImage *unwarped_frame, uint16_t threshold,
 			     koki_grid_t *grid)
 {
 
+	const koki_simd_kernels_t *simd = koki_simd_kernels();
 	uint8_t cell_pixel_width;
-	uint16_t x, y, v;
+	uint16_t y;
 	uint16_t avg;
 
 	/* ensure the image is square and that it can be chunked into
@@ -100,22 +121,32 @@ void koki_grid_from_image(IplImage *unwarped_frame, uint16_t threshold,
 	/* clear the grid */
 	zero_grid(grid);
 
+	/* column sums for a row of cells; a cell is at most 255 pixels
+	   tall, so these can't overflow */
+	uint16_t col_sums[unwarped_frame->width];
+
 	for (uint8_t row=0; row<KOKI_MARKER_GRID_WIDTH; row++){
-		for (uint8_t col=0; col<KOKI_MARKER_GRID_WIDTH; col++){
 
-			for (uint8_t i=0; i<cell_pixel_width; i++){
-				for (uint8_t j=0; j<cell_pixel_width; j++){
+		memset(col_sums, 0, sizeof(col_sums));
 
-					x = col * cell_pixel_width + i;
-					y = row * cell_pixel_width + j;
+		for (uint8_t j=0; j<cell_pixel_width; j++){
 
-					v = KOKI_IPLIMAGE_GS_ELEM(unwarped_frame, x, y);
+			y = row * cell_pixel_width + j;
 
-					grid->data[row][col].sum += v;
-					grid->data[row][col].num_pixels++;
+			simd->accumulate_row((uint8_t*)unwarped_frame->imageData
+					     + unwarped_frame->widthStep * y,
+					     col_sums, unwarped_frame->width);
 
-				}//for j
-			}//for i
+		}//for j
+
+		for (uint8_t col=0; col<KOKI_MARKER_GRID_WIDTH; col++){
+
+			for (uint8_t i=0; i<cell_pixel_width; i++)
+				grid->data[row][col].sum +=
+					col_sums[col * cell_pixel_width + i];
+
+			grid->data[row][col].num_pixels =
+				cell_pixel_width * cell_pixel_width;
 
 			/* threshold the cell */
 			avg = grid->data[row][col].sum / grid->data[row][col].num_pixels;
@@ -204,8 +235,38 @@ IplImage *koki_code_sub_image(IplImage *unwarped_frame)
 
 
 /**
- * @brief recoveres sequences of blocks/chunks from the grid in all 4 possible
- *        rotations so that the code can be recovered
+ * @brief packs the thresholded code cells of a grid (i.e. those inside the
+ *        border) into a bit mask
+ *
+ * Bit \c (row * KOKI_CODE_GRID_WIDTH + col) holds the value of the code
+ * cell at \c (col, row), \c 1 for white.
+ *
+ * @param grid  the thresholded grid
+ * @return      the code cells
+ */
+uint64_t koki_code_grid_cells(const koki_grid_t *grid)
+{
+
+	uint8_t border_width = (KOKI_MARKER_GRID_WIDTH -
+				KOKI_CODE_GRID_WIDTH) / 2;
+	uint64_t cells = 0;
+
+	assert(grid != NULL);
+
+	for (uint8_t row=0; row<KOKI_CODE_GRID_WIDTH; row++)
+		for (uint8_t col=0; col<KOKI_CODE_GRID_WIDTH; col++)
+			if (grid->data[border_width+row][border_width+col].val)
+				cells |= (uint64_t)1 << (row * KOKI_CODE_GRID_WIDTH + col);
+
+	return cells;
+
+}
+
+
+
+/**
+ * @brief recoveres sequences of blocks/chunks from the code cells in all 4
+ *        possible rotations so that the code can be recovered
  *
  * For a single code, there are 5 blocks.  The top left of the marker
  * \c (0, 0) contains block 0 bit 0, \c (1, 0) contains block 1 bit 0, etc...
@@ -216,16 +277,14 @@ IplImage *koki_code_sub_image(IplImage *unwarped_frame)
  * This info is extracted for all 4 possible rotations of the grid, using the
  * macros defined above.
  *
- * @param grid   the grid to extract the rotations from
+ * @param cells  the code cells, as packed by koki_code_grid_cells()
  * @param codes  the array to store the results in
  */
-static void code_rotations(koki_grid_t *grid, uint8_t codes[4][5])
+static void code_rotations(uint64_t cells, uint8_t codes[4][5])
 {
 
 	uint8_t block_no, block_index;
-	uint8_t grid_width   = KOKI_CODE_GRID_WIDTH;
-	uint8_t border_width = (KOKI_MARKER_GRID_WIDTH -
-				KOKI_CODE_GRID_WIDTH) / 2;
+	uint8_t grid_width = KOKI_CODE_GRID_WIDTH;
 
 	/* zero code chunks */
 	for (uint8_t i=0; i<4; i++)
@@ -247,23 +306,19 @@ static void code_rotations(koki_grid_t *grid, uint8_t codes[4][5])
 			block_index = (y * KOKI_CODE_GRID_WIDTH + x) / 5;
 
 			/* rotate 000 */
-			codes[0][block_no] |= ROT_000(grid, grid_width,
-						      border_width,
+			codes[0][block_no] |= ROT_000(cells, grid_width,
 						      x, y) << block_index;
 
 			/* rotate 090 */
-			codes[1][block_no] |= ROT_090(grid, grid_width,
-						      border_width,
+			codes[1][block_no] |= ROT_090(cells, grid_width,
 						      x, y) << block_index;
 
 			/* rotate 180 */
-			codes[2][block_no] |= ROT_180(grid, grid_width,
-						      border_width,
+			codes[2][block_no] |= ROT_180(cells, grid_width,
 						      x, y) << block_index;
 
 			/* rotate 270 */
-			codes[3][block_no] |= ROT_270(grid, grid_width,
-						      border_width,
+			codes[3][block_no] |= ROT_270(cells, grid_width,
 						      x, y) << block_index;
 
 		}//for
@@ -279,89 +334,6 @@ static void code_rotations(koki_grid_t *grid, uint8_t codes[4][5])
 
 
 
-/**
- * @brief computes the syndrome of the received chunk/block
- *
- * A syndrome of \c 0 means no errors, anything else means there were
- * errors which could *perhaps* be correct.  The syndrome is the 1-based
- * index for the bit to flip to possible correct the received block.
- *
- * @param r  the recieved block, as a 7x1 column matrix
- * @return   the syndrome
- */
-static uint8_t hamming_syndrome(CvMat *r)
-{
-
-	uint8_t syndrome = 0;
-	CvMat *z = cvCreateMat(3, 1, CV_32FC1);
-	CvMat *H = cvCreateMat(3, 7, CV_32FC1);
-
-	/* fill H */
-	cvmSet(H, 0, 0, 1);
-	cvmSet(H, 0, 1, 0);
-	cvmSet(H, 0, 2, 1);
-	cvmSet(H, 0, 3, 0);
-	cvmSet(H, 0, 4, 1);
-	cvmSet(H, 0, 5, 0);
-	cvmSet(H, 0, 6, 1);
-
-	cvmSet(H, 1, 0, 0);
-	cvmSet(H, 1, 1, 1);
-	cvmSet(H, 1, 2, 1);
-	cvmSet(H, 1, 3, 0);
-	cvmSet(H, 1, 4, 0);
-	cvmSet(H, 1, 5, 1);
-	cvmSet(H, 1, 6, 1);
-
-	cvmSet(H, 2, 0, 0);
-	cvmSet(H, 2, 1, 0);
-	cvmSet(H, 2, 2, 0);
-	cvmSet(H, 2, 3, 1);
-	cvmSet(H, 2, 4, 1);
-	cvmSet(H, 2, 5, 1);
-	cvmSet(H, 2, 6, 1);
-
-	/* calculate syndrome */
-	cvMatMulAdd(H, r, NULL, z);
-
-	/* get syndrome from bits in maxtrix */
-	syndrome |= (((uint8_t)cvmGet(z, 0, 0)) & 0x1) << 0;
-	syndrome |= (((uint8_t)cvmGet(z, 1, 0)) & 0x1) << 1;
-	syndrome |= (((uint8_t)cvmGet(z, 2, 0)) & 0x1) << 2;
-
-	/* clean up */
-	cvReleaseMat(&z);
-	cvReleaseMat(&H);
-
-	return syndrome;
-
-}
-
-
-
-/**
- * @brief given a syndrome and the received block (as a 7x1 column matrix),
- *        this function corrects (flips) the erroneous bit is there is one
- *
- * @param syndrome  the syndrome, as output by \c hamming_syndrome()
- * @param r         the recieved matrix to possibly modify
- */
-static void hamming_correct(uint8_t syndrome, CvMat *r)
-{
-
-	if (syndrome == 0 || syndrome > 7)
-		return;
-
-	/* might be wrong, correct and hope for the
-	   best -- that's all we can do */
-
-	/* invert the bit */
-	cvmSet(r, syndrome-1, 0, ~((uint8_t)cvmGet(r, syndrome-1, 0)) & 0x1);
-
-}
-
-
-
 /**
  * @brief decodes, i.e. extracts the original data, from the received block
  *
@@ -370,73 +342,18 @@ static void hamming_correct(uint8_t syndrome, CvMat *r)
  *
  *   http://en.wikipedia.org/wiki/Hamming(7,4)
  *
+ * The syndrome of the block, the parities of bits \c {0,2,4,6}, \c
+ * {1,2,5,6} and \c {3,4,5,6}, is the 1-based index of the bit to flip to
+ * (perhaps) correct it.  The data is then bits 2, 4, 5 and 6.  As there
+ * are only 128 possible blocks, the results are tabulated.
+ *
  * @param block  the block with the received data in it (7 bits)
  * @return       the decoded data nibble (4 bits) in a \c uint8_t
  */
 static uint8_t hamming_decode(uint8_t block)
 {
 
-	uint8_t syndrome, data = 0;
-	CvMat *r     = cvCreateMat(7, 1, CV_32FC1);
-	CvMat *R_mat = cvCreateMat(4, 7, CV_32FC1);
-	CvMat *pr    = cvCreateMat(4, 1, CV_32FC1);
-
-	/* fill R */
-	assert(R_mat != NULL);
-	cvmSet(R_mat, 0, 0, 0);
-	cvmSet(R_mat, 0, 1, 0);
-	cvmSet(R_mat, 0, 2, 1);
-	cvmSet(R_mat, 0, 3, 0);
-	cvmSet(R_mat, 0, 4, 0);
-	cvmSet(R_mat, 0, 5, 0);
-	cvmSet(R_mat, 0, 6, 0);
-
-	cvmSet(R_mat, 1, 0, 0);
-	cvmSet(R_mat, 1, 1, 0);
-	cvmSet(R_mat, 1, 2, 0);
-	cvmSet(R_mat, 1, 3, 0);
-	cvmSet(R_mat, 1, 4, 1);
-	cvmSet(R_mat, 1, 5, 0);
-	cvmSet(R_mat, 1, 6, 0);
-
-	cvmSet(R_mat, 2, 0, 0);
-	cvmSet(R_mat, 2, 1, 0);
-	cvmSet(R_mat, 2, 2, 0);
-	cvmSet(R_mat, 2, 3, 0);
-	cvmSet(R_mat, 2, 4, 0);
-	cvmSet(R_mat, 2, 5, 1);
-	cvmSet(R_mat, 2, 6, 0);
-
-	cvmSet(R_mat, 3, 0, 0);
-	cvmSet(R_mat, 3, 1, 0);
-	cvmSet(R_mat, 3, 2, 0);
-	cvmSet(R_mat, 3, 3, 0);
-	cvmSet(R_mat, 3, 4, 0);
-	cvmSet(R_mat, 3, 5, 0);
-	cvmSet(R_mat, 3, 6, 1);
-
-	/* fill r with bits from block */
-	for (uint8_t i=0; i<7; i++)
-		cvmSet(r, i, 0, (block >> i) & 0x1);
-
-	/* correct any errors -- this will break the code more if it's
-	   got too many errors, but that doesn't matter */
-	syndrome = hamming_syndrome(r);
-	hamming_correct(syndrome, r);
-
-	/* get data out */
-	cvMatMulAdd(R_mat, r, NULL, pr);
-
-	/* get bits from matrix */
-	for (uint8_t i=0; i<4; i++)
-		data |= (((uint8_t)cvmGet(pr, i, 0)) & 0x1) << i;
-
-	/* clean up */
-	cvReleaseMat(&r);
-	cvReleaseMat(&R_mat);
-	cvReleaseMat(&pr);
-
-	return data;
+	return hamming_table[block & 0x7F];
 
 }
 
@@ -464,15 +381,16 @@ static bool crc_check(uint8_t num, uint16_t crc)
 
 
 /**
- * @brief recovers the code, if there is one, from the given grid
+ * @brief recovers the code, if there is one, from a marker's code cells
  *
- * @param grid             the populated input grid
+ * @param cells            the code cells, as packed by
+ *                         koki_code_grid_cells()
  * @param rotation_offset  a pointer to a \c float in which a multiple of 90
  *                         degrees will be stored, representing the number
  *                         of times the grid had to be rotated to make it 'fit'
  * @return                 the code, if the is one, \c -1 otherwise
  */
-int16_t koki_code_recover_from_grid(koki_grid_t *grid, float *rotation_offset)
+int16_t koki_code_recover_from_cells(uint64_t cells, float *rotation_offset)
 {
 
 	uint8_t codes[4][5];
@@ -480,10 +398,8 @@ int16_t koki_code_recover_from_grid(koki_grid_t *grid, float *rotation_offset)
 	uint8_t marker_num;
 	uint16_t marker_crc;
 
-	assert(grid != NULL);
-
 	/* get rotations */
-	code_rotations(grid, codes);
+	code_rotations(cells, codes);
 
 	/* get data from chunks */
 	for (uint8_t i=0; i<4; i++){
@@ -520,6 +436,27 @@ int16_t koki_code_recover_from_grid(koki_grid_t *grid, float *rotation_offset)
 
 
 
+/**
+ * @brief recovers the code, if there is one, from the given grid
+ *
+ * @param grid             the populated input grid
+ * @param rotation_offset  a pointer to a \c float in which a multiple of 90
+ *                         degrees will be stored, representing the number
+ *                         of times the grid had to be rotated to make it 'fit'
+ * @return                 the code, if the is one, \c -1 otherwise
+ */
+int16_t koki_code_recover_from_grid(koki_grid_t *grid, float *rotation_offset)
+{
+
+	assert(grid != NULL);
+
+	return koki_code_recover_from_cells(koki_code_grid_cells(grid),
+					    rotation_offset);
+
+}
+
+
+
 /**
  * @brief translates between from marker code space to user code space
  *
@@ -20,9 +20,15 @@
  * @brief Implementation of libkoki context functions
  */
 
+#include <stdio.h>
+#include <string.h>
 #include <glib.h>
 
 #include "context.h"
+#include "decode_cache.h"
+#include "accumulate.h"
+#include "trace.h"
+#include "perf.h"
 
 /**
  * @brief create a libkoki context
@@ -35,6 +41,49 @@ koki_t* koki_new( void )
 
 	/* By default, use the null logger (i.e. throw everything away) */
 	koki->logger = koki_null_logger;
+	koki->logger_userdata = NULL;
+
+	/* Allocate with malloc() until told otherwise */
+	koki->allocator = koki_default_allocator;
+	koki->allocator_userdata = NULL;
+
+	/* Decoded quads aren't cached unless asked for */
+	koki->decode_cache = NULL;
+
+	/* Nor are stages traced */
+	koki->tracer = NULL;
+
+	/* Nothing in particular is expected to be in view */
+	koki_set_expected_codes( koki, NULL, 0 );
+
+	memset( &koki->stats, 0, sizeof(koki_frame_stats_t) );
+
+	/* Pick the fastest pixel kernels this CPU can run (the choice is
+	   process-wide, and looked up by each stage as it runs) */
+	koki_simd_select();
+
+	/* And the optimised stages over the reference ones */
+	koki->reference = FALSE;
+
+	/* Every pixel is labelled */
+	koki->label_stride = 0;
+
+	/* And quads only come from labelled regions */
+	koki->edge_quads = KOKI_EDGE_QUADS_OFF;
+
+	/* Each candidate is unwarped and decoded on its own */
+	koki->batch_decode = FALSE;
+
+	/* Quads that fail to decode are simply dropped */
+	koki->accumulator = NULL;
+
+	/* Threads are started one per processor, and scheduled as their
+	   creator was */
+	koki->num_workers = 0;
+	memset( koki->threads, 0, sizeof(koki->threads) );
+
+	/* Performance counters are only read when asked for */
+	koki->perf = NULL;
 
 	return koki;
 }
@@ -57,14 +106,382 @@ void koki_set_logger( koki_t* koki,
 	koki->logger_userdata = userdata;
 }
 
+/**
+ * @brief set the allocator to use for libkoki's internal allocations
+ *
+ * The allocator is used for allocations made while processing frames with
+ * this context, including the markers returned by koki_find_markers().
+ * Blocks are returned to the allocator they came from, so it must remain
+ * usable until everything allocated from it has been freed.  The number
+ * of blocks allocated for each frame is recorded in the frame statistics.
+ *
+ * @param koki       the libkoki context
+ * @param allocator  the allocator callbacks
+ * @param userdata   the userdata to pass to the allocator callbacks
+ */
+void koki_set_allocator( koki_t* koki,
+			 const koki_allocator_t *allocator,
+			 void *userdata )
+{
+	g_assert( koki != NULL );
+	g_assert( allocator != NULL );
+
+	koki->allocator = *allocator;
+	koki->allocator_userdata = userdata;
+}
+
 /**
  * @brief destroy a libkoki context
  */
 void koki_destroy( koki_t* koki )
 {
+	koki_decode_cache_free( koki->decode_cache );
+	koki_accumulator_free( koki->accumulator );
+	koki_tracer_free( koki->tracer );
+	koki_perf_free( koki->perf );
 	g_free( koki );
 }
 
+/**
+ * @brief enable or disable caching of decoded quads between frames
+ *
+ * With the cache enabled, a quad overlapping one decoded in a recent
+ * frame only has a few of its cells checked against the cached grid,
+ * rather than being unwarped and fully decoded again.
+ *
+ * @param koki     the libkoki context
+ * @param enabled  whether to use the decode cache
+ */
+void koki_set_decode_cache( koki_t* koki, bool enabled )
+{
+	g_assert( koki != NULL );
+
+	if( enabled && koki->decode_cache == NULL )
+		koki->decode_cache = koki_decode_cache_new();
+
+	else if( !enabled && koki->decode_cache != NULL ) {
+		koki_decode_cache_free( koki->decode_cache );
+		koki->decode_cache = NULL;
+	}
+}
+
+/**
+ * @brief enable or disable tracing of the time spent in each stage
+ *
+ * Each thread that uses the context records begin and end events for
+ * labelling, contour tracing, quad fitting, decoding and pose estimation
+ * into its own ring of \c events_per_thread events, which
+ * koki_write_trace() writes out.  When disabled, tracing costs a single
+ * test per stage.  Tracing shouldn't be toggled while frames are being
+ * processed.
+ *
+ * @param koki               the libkoki context
+ * @param events_per_thread  the number of events to keep for each thread,
+ *                           or 0 to disable tracing and discard the events
+ */
+void koki_set_tracing( koki_t* koki, uint32_t events_per_thread )
+{
+	g_assert( koki != NULL );
+
+	koki_tracer_free( koki->tracer );
+	koki->tracer = NULL;
+
+	if( events_per_thread > 0 )
+		koki->tracer = koki_tracer_new( events_per_thread );
+}
+
+/**
+ * @brief switch between the optimised and the reference implementations of
+ *        the pipeline's stages
+ *
+ * The reference mode keeps the straightforward implementations callable,
+ * so that optimised ones can be checked against them: the frame is
+ * thresholded with koki_threshold_adaptive() and then labelled with
+ * koki_label_image(), every candidate region is decoded in order (the
+ * decode cache, the expected codes, accumulation and the skipping of
+ * nested regions and duplicate markers are all off), and the geometry is
+ * done in floating point even in a fixed-point build.  The pixel kernels
+ * are process-wide, so aren't affected; koki_simd_set_level() selects the
+ * scalar ones.
+ *
+ * @param koki     the libkoki context
+ * @param enabled  whether to use the reference implementations
+ */
+void koki_set_reference_mode( koki_t* koki, bool enabled )
+{
+	g_assert( koki != NULL );
+
+	koki->reference = enabled;
+}
+
+/**
+ * @brief label only the regions that cross a sparse grid of scanlines
+ *
+ * Rather than thresholding every pixel, koki_find_markers() thresholds
+ * every \c stride-th row and column, and grows regions from the dark
+ * pixels it finds there (see koki_label_sparse()).  Regions smaller than
+ * \c (stride-1)^2 pixels may be missed, so a stride of up to 8 finds
+ * every candidate the full labelling does; larger strides trade the
+ * recall of small (distant) markers for speed.
+ *
+ * @param koki    the libkoki context
+ * @param stride  the scanline spacing, or 0 to label every pixel
+ */
+void koki_set_sparse_labelling( koki_t* koki, uint16_t stride )
+{
+	g_assert( koki != NULL );
+
+	koki->label_stride = stride;
+}
+
+/**
+ * @brief choose when to look for quads with the gradient-based detector
+ *
+ * Motion blur and defocus smear a marker's border until thresholding
+ * breaks it up or merges it with its surroundings, leaving no region to
+ * take a contour of.  The gradient-based detector (see
+ * koki_edge_quads_find()) instead fits lines to the edges and joins them
+ * into quads, so keeps finding markers well past that point, at some
+ * extra cost.  It can be run only on frames where labelling found no
+ * markers, or on every frame to catch blurred markers alongside sharp
+ * ones.
+ *
+ * @param koki  the libkoki context
+ * @param mode  when to run the detector
+ */
+void koki_set_edge_quads( koki_t* koki, koki_edge_quads_mode_t mode )
+{
+	g_assert( koki != NULL );
+
+	koki->edge_quads = mode;
+}
+
+/**
+ * @brief decode candidates in batches, sampling their cells straight from
+ *        the frame
+ *
+ * Rather than unwarping each candidate into an image of its own and
+ * adaptively thresholding that, up to \c KOKI_CODE_BATCH_SIZE candidates
+ * are decoded together by koki_code_recover_batch(), which maps the
+ * sample points through all of their homographies with one vector
+ * operation per point.  A candidate's cells are thresholded against the
+ * mean of its border, which copes less well than the adaptive threshold
+ * with light falling unevenly across a large marker.  The reference mode
+ * always decodes candidates one at a time.
+ *
+ * @param koki     the libkoki context
+ * @param enabled  whether to decode candidates in batches
+ */
+void koki_set_batch_decode( koki_t* koki, bool enabled )
+{
+	g_assert( koki != NULL );
+
+	koki->batch_decode = enabled;
+}
+
+/**
+ * @brief enable or disable decoding small markers over several frames
+ *
+ * A marker only a few pixels across may be found as a quad but fail to
+ * decode in every single frame.  With accumulation enabled, such quads
+ * are followed from frame to frame, and their cells' brightness is
+ * summed until every code cell is clearly black or white.  The marker is
+ * then reported, from the frame its code became clear onwards.  Only
+ * quads up to a few dozen pixels across are followed.  The reference
+ * mode never accumulates.
+ *
+ * @param koki     the libkoki context
+ * @param enabled  whether to accumulate samples of undecoded quads
+ */
+void koki_set_accumulation( koki_t* koki, bool enabled )
+{
+	g_assert( koki != NULL );
+
+	if( enabled && koki->accumulator == NULL )
+		koki->accumulator = koki_accumulator_new();
+
+	else if( !enabled && koki->accumulator != NULL ) {
+		koki_accumulator_free( koki->accumulator );
+		koki->accumulator = NULL;
+	}
+}
+
+/**
+ * @brief set the number of detection workers started by koki_async_new()
+ *
+ * @param koki         the libkoki context
+ * @param num_workers  the number of workers, or 0 for one per processor
+ */
+void koki_set_worker_threads( koki_t* koki, uint16_t num_workers )
+{
+	g_assert( koki != NULL );
+
+	koki->num_workers = num_workers;
+}
+
+/**
+ * @brief set how the threads of a role are scheduled
+ *
+ * Detection workers apply their role's configuration as they start (see
+ * koki_async_new()).  libkoki doesn't start capture or logging threads of
+ * its own, so threads in those roles should call
+ * koki_thread_config_apply() with the context's configuration themselves.
+ *
+ * Where \c KOKI_SCHED_FIFO isn't permitted, threads fall back to \c
+ * KOKI_SCHED_OTHER at the configured nice value, rather than failing.
+ *
+ * @param koki    the libkoki context
+ * @param role    the role to configure
+ * @param config  the configuration, which is copied
+ */
+void koki_set_thread_config( koki_t* koki, koki_thread_role_t role,
+			     const koki_thread_config_t *config )
+{
+	g_assert( koki != NULL && config != NULL );
+	g_assert( role < KOKI_THREAD_NUM_ROLES );
+
+	koki->threads[role] = *config;
+}
+
+/**
+ * @brief write the traced events to a file as Chrome trace-event JSON
+ *
+ * The file can be loaded into chrome://tracing or Perfetto.
+ *
+ * @param koki      the libkoki context
+ * @param filename  the file to write to
+ * @return          FALSE if tracing isn't enabled or the file couldn't be
+ *                  written, TRUE otherwise
+ */
+bool koki_write_trace( koki_t* koki, const char *filename )
+{
+	FILE *f;
+	bool ok;
+
+	g_assert( koki != NULL && filename != NULL );
+
+	if( koki->tracer == NULL )
+		return FALSE;
+
+	f = fopen( filename, "w" );
+	if( f == NULL )
+		return FALSE;
+
+	koki_tracer_write_json( koki->tracer, f );
+
+	ok = !ferror( f );
+	return fclose( f ) == 0 && ok;
+}
+
+/**
+ * @brief start or stop reading hardware performance counters around each
+ *        stage
+ *
+ * Cycles, instructions, cache misses and branch misses are read at the
+ * start and end of each stage of koki_find_markers(), and summed per
+ * stage over each frame (see koki_get_perf_counters()).  Each read is a
+ * system call, so this is a profiling mode: expect it to slow down the
+ * per-candidate stages noticeably.  The counters only count the thread
+ * that enabled them, in user space, so the context must then be used on
+ * that thread.
+ *
+ * Where perf events aren't available at all, counting stays disabled;
+ * counters the CPU doesn't provide are left out and read as 0.
+ *
+ * @param koki     the libkoki context
+ * @param enabled  whether to read the counters
+ * @return         FALSE if they were asked for but aren't available,
+ *                 TRUE otherwise
+ */
+bool koki_set_perf_counters( koki_t* koki, bool enabled )
+{
+	g_assert( koki != NULL );
+
+	koki_perf_free( koki->perf );
+	koki->perf = NULL;
+
+	if( !enabled )
+		return TRUE;
+
+	koki->perf = koki_perf_new();
+
+	return koki->perf != NULL;
+}
+
+/**
+ * @brief get the performance counts for the last frame
+ *
+ * @param koki  the libkoki context
+ * @return      the counts for each stage, or NULL if the counters aren't
+ *              being read (see koki_set_perf_counters())
+ */
+const koki_perf_frame_t* koki_get_perf_counters( koki_t* koki )
+{
+	g_assert( koki != NULL );
+
+	if( koki->perf == NULL )
+		return NULL;
+
+	return &koki->perf->frame;
+}
+
+/**
+ * @brief set the codes that are expected to be in view
+ *
+ * When the expected codes are known, koki_find_markers() examines the
+ * largest candidate regions first, and stops as soon as every expected
+ * code has been found.  Any candidates left over are counted in the
+ * frame statistics' \c skipped_candidates.  Markers with unexpected codes
+ * are still reported if they're found before the search stops.
+ *
+ * @param koki   the libkoki context
+ * @param codes  the expected marker codes -- can be NULL if \c n is 0
+ * @param n      the number of codes in \c codes, or 0 to process every
+ *               candidate as normal
+ */
+void koki_set_expected_codes( koki_t* koki, const uint8_t *codes, uint16_t n )
+{
+	g_assert( koki != NULL );
+	g_assert( codes != NULL || n == 0 );
+
+	memset( koki->expected_codes, 0, sizeof(koki->expected_codes) );
+	koki->num_expected_codes = 0;
+
+	for( uint16_t i=0; i<n; i++ ) {
+		if( koki_is_expected_code( koki, codes[i] ) )
+			/* Ignore duplicates */
+			continue;
+
+		koki->expected_codes[ codes[i] / 8 ] |= 1 << (codes[i] % 8);
+		koki->num_expected_codes++;
+	}
+}
+
+/**
+ * @brief report whether a code is one of the expected codes
+ *
+ * @param koki  the libkoki context
+ * @param code  the marker code
+ * @return TRUE if \c code was passed to koki_set_expected_codes()
+ */
+bool koki_is_expected_code( koki_t* koki, uint8_t code )
+{
+	return koki->expected_codes[ code / 8 ] & (1 << (code % 8));
+}
+
+/**
+ * @brief get the statistics for the most recently processed frame
+ *
+ * @param koki  the libkoki context
+ * @return the frame statistics, owned by the context
+ */
+const koki_frame_stats_t* koki_get_frame_stats( koki_t* koki )
+{
+	g_assert( koki != NULL );
+
+	return &koki->stats;
+}
+
 /**
  * @brief send a log message out to the logger
  *
@@ -25,6 +25,7 @@
 
 #include "labelling.h"
 #include "points.h"
+#include "allocator.h"
 
 #include "contour.h"
 
@@ -34,6 +35,15 @@
 #define KOKI_CONTOUR_BLUE  255
 
 
+/**
+ * @brief a contour's list link and the point it holds, allocated together
+ */
+typedef struct {
+	GSList link;           /**< the list link, which must come first */
+	koki_point2Di_t point; /**< the point \c link.data points to */
+} contour_node_t;
+
+
 /**
  * @brief identifies the most extreme point on the top row of the clip region
  *
@@ -48,17 +58,14 @@
  *                        labelled_image
  * @return                a pointer to the first labelled point on the top row
  */
-static koki_point2Di_t* first_labeled_on_top_row(koki_labelled_image_t *labelled_image,
-						 label_t region)
+static bool first_labeled_on_top_row(koki_labelled_image_t *labelled_image,
+				     label_t region, koki_point2Di_t *point)
 {
 
 	koki_clip_region_t clip;
-	koki_point2Di_t *ret = NULL, *point;
+	bool ret = FALSE;
 	uint16_t width;
 
-	point = g_slice_new(koki_point2Di_t);
-	assert(point != NULL);
-
 	assert(region < labelled_image->clips->len);
 	clip = g_array_index(labelled_image->clips, koki_clip_region_t, region);
 
@@ -86,7 +93,7 @@ static koki_point2Di_t* first_labeled_on_top_row(koki_labelled_image_t *labelled
 
 				point->x = clip.min.x + i;
 				point->y = clip.min.y;
-				ret = point;
+				ret = TRUE;
 				break;
 
 			}
@@ -108,7 +115,7 @@ static koki_point2Di_t* first_labeled_on_top_row(koki_labelled_image_t *labelled
 
 				point->x = clip.max.x - i;
 				point->y = clip.min.y;
-				ret = point;
+				ret = TRUE;
 				break;
 
 			}
@@ -117,9 +124,6 @@ static koki_point2Di_t* first_labeled_on_top_row(koki_labelled_image_t *labelled
 
 	}//for
 
-	if (ret == NULL)
-		g_slice_free(koki_point2Di_t, point);
-
 	return ret;
 
 }
@@ -191,21 +195,24 @@ static enum DIRECTION get_opposite_direction(enum DIRECTION dir)
 
 
 /**
- * @brief allocates and initialises a new \c koki_point2Di_t in memory
+ * @brief prepends a new point to a contour
  *
- * @param x  the X co-ordinate of the point
- * @param y  the Y co-ordinate of the point
- * @return   a pointer to the newly allocated \c koki_point2Di_t
+ * @param contour  the contour
+ * @param x        the X co-ordinate of the point
+ * @param y        the Y co-ordinate of the point
+ * @return         the new start of the contour
  */
-static koki_point2Di_t* point2Di_new(uint16_t x, uint16_t y)
+static GSList* contour_prepend(GSList *contour, uint16_t x, uint16_t y)
 {
 
-	koki_point2Di_t *p;
-	p = g_slice_new(koki_point2Di_t);
-	assert(p != NULL);
-	p->x = x;
-	p->y = y;
-	return p;
+	contour_node_t *node = koki_malloc(sizeof(contour_node_t));
+
+	node->point.x = x;
+	node->point.y = y;
+	node->link.data = &node->point;
+	node->link.next = contour;
+
+	return &node->link;
 
 }
 
@@ -225,20 +232,21 @@ GSList* koki_contour_find(koki_labelled_image_t *labelled_image,
 {
 
 	GSList *contour = NULL;
-	koki_point2Di_t *first_point, current, check;
+	koki_point2Di_t first_point, current, check;
+	bool found;
 
 	/* get the first point in the chain */
-	first_point = first_labeled_on_top_row(labelled_image, region);
-	assert(first_point != NULL);
+	found = first_labeled_on_top_row(labelled_image, region, &first_point);
+	assert(found);
 
 	/* prepend it (will be reversed later) */
-	contour = g_slist_prepend(contour, first_point);
+	contour = contour_prepend(contour, first_point.x, first_point.y);
 
 	enum DIRECTION dir = N;
 	bool first_run = TRUE;
 	label_t label;
 
-	current = *first_point;
+	current = first_point;
 
 	while (TRUE){
 
@@ -257,9 +265,7 @@ GSList* koki_contour_find(koki_labelled_image_t *labelled_image,
 				/* prepend it to the list (prepend
 				   for speed -- no walking to end
 				   necessary) */
-				koki_point2Di_t *p;
-				p = point2Di_new(check.x, check.y);
-				contour = g_slist_prepend(contour, p);
+				contour = contour_prepend(contour, check.x, check.y);
 
 				break;
 
@@ -271,8 +277,8 @@ GSList* koki_contour_find(koki_labelled_image_t *labelled_image,
 
 		/* check to see if we've done a full circle */
 		if (!first_run
-		    && current.x == first_point->x
-		    && current.y == first_point->y)
+		    && current.x == first_point.x
+		    && current.y == first_point.y)
 			break;
 
 		current = check;
@@ -295,25 +301,23 @@ GSList* koki_contour_find(koki_labelled_image_t *labelled_image,
 
 
 /**
- * @brief frees a contour \c GSList and it's associated allocated gslices
+ * @brief frees a contour \c GSList and the points it holds
  *
  * @param contour  the GSList of a contour to free
  */
 void koki_contour_free(GSList *contour)
 {
 
-	if (contour == NULL)
-		return;
+	GSList *next;
 
-	GSList *l = contour;
+	for (GSList *l = contour; l != NULL; l = next){
 
-	do {
-		g_slice_free(koki_point2Di_t, l->data);
-		l = l->next;
+		next = l->next;
 
-	} while (l != NULL);
+		/* the link is the start of its contour_node_t */
+		koki_free(l);
 
-	g_slist_free(contour);
+	}
 
 }
 
@@ -0,0 +1,399 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/**
+ * @file  decode_cache.c
+ * @brief Implementation of caching decoded codes of tracked quads
+ *
+ * Once a quad has been fully decoded, the thresholded grid is kept along
+ * with the quad's position.  In subsequent frames, a quad that overlaps a
+ * cached one only has a handful of its cells sampled straight from the
+ * frame; if they still match the cached grid, the cached code is reused
+ * and the unwarp, adaptive threshold and Hamming/CRC decode are skipped.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <glib.h>
+#include <cv.h>
+
+#include "points.h"
+#include "code_grid.h"
+#include "homography.h"
+#include "marker.h"
+
+#include "decode_cache.h"
+
+
+/* the minimum bounding box intersection-over-union for a quad to be
+   considered the same one as a cached quad */
+#define KOKI_DECODE_CACHE_MIN_OVERLAP 0.5
+
+/* how many frames a quad can go unseen before it's forgotten */
+#define KOKI_DECODE_CACHE_MAX_AGE 3
+
+/* the minimum difference between the average sampled black and white
+   cells for a verification to be trusted */
+#define KOKI_DECODE_CACHE_MIN_CONTRAST 20
+
+#define entry_index(arr, i) g_array_index(arr, koki_decode_cache_entry_t, i)
+
+
+/**
+ * @brief the cells sampled during verification, as (row, col) pairs
+ *
+ * The four corners of the inner ring of the black border, followed by
+ * every third cell of the code area.
+ */
+static const uint8_t verify_cells[][2] = {
+	{1, 1}, {1, 8}, {8, 8}, {8, 1},
+	{2, 2}, {2, 5}, {3, 4}, {3, 7},
+	{4, 3}, {4, 6}, {5, 2}, {5, 5},
+	{6, 4}, {6, 7}, {7, 3}, {7, 6},
+};
+
+#define NUM_VERIFY_CELLS (sizeof(verify_cells) / sizeof(verify_cells[0]))
+
+
+
+/**
+ * @brief creates a new, empty decode cache
+ *
+ * @return  the new cache
+ */
+koki_decode_cache_t* koki_decode_cache_new(void)
+{
+
+	koki_decode_cache_t *cache;
+
+	cache = g_malloc(sizeof(koki_decode_cache_t));
+
+	cache->entries = g_array_new(FALSE, FALSE,
+				     sizeof(koki_decode_cache_entry_t));
+	cache->hits = 0;
+	cache->misses = 0;
+
+	return cache;
+
+}
+
+
+
+/**
+ * @brief frees a decode cache
+ *
+ * @param cache  the cache to free
+ */
+void koki_decode_cache_free(koki_decode_cache_t *cache)
+{
+
+	if (cache == NULL)
+		return;
+
+	g_array_free(cache->entries, TRUE);
+	g_free(cache);
+
+}
+
+
+
+/**
+ * @brief marks the start of a new frame, forgetting any quads that haven't
+ *        been seen for a while
+ *
+ * @param cache  the cache to age
+ */
+void koki_decode_cache_age(koki_decode_cache_t *cache)
+{
+
+	assert(cache != NULL);
+
+	for (guint i=cache->entries->len; i>0; i--){
+
+		koki_decode_cache_entry_t *e = &entry_index(cache->entries, i-1);
+
+		e->age++;
+
+		if (e->age > KOKI_DECODE_CACHE_MAX_AGE)
+			g_array_remove_index_fast(cache->entries, i-1);
+
+	}
+
+}
+
+
+
+/**
+ * @brief calculates the intersection-over-union of the bounding boxes of
+ *        two quads
+ *
+ * @param a  the vertices of the first quad
+ * @param b  the vertices of the second quad
+ * @return   the overlap, in the range \c 0-1
+ */
+static float quad_overlap(const koki_point2Df_t a[4], const koki_point2Df_t b[4])
+{
+
+	float a_min_x, a_min_y, a_max_x, a_max_y;
+	float b_min_x, b_min_y, b_max_x, b_max_y;
+	float iw, ih, inter, uni;
+
+	a_min_x = a_max_x = a[0].x;
+	a_min_y = a_max_y = a[0].y;
+	b_min_x = b_max_x = b[0].x;
+	b_min_y = b_max_y = b[0].y;
+
+	for (uint8_t i=1; i<4; i++){
+		a_min_x = MIN(a_min_x, a[i].x);
+		a_max_x = MAX(a_max_x, a[i].x);
+		a_min_y = MIN(a_min_y, a[i].y);
+		a_max_y = MAX(a_max_y, a[i].y);
+		b_min_x = MIN(b_min_x, b[i].x);
+		b_max_x = MAX(b_max_x, b[i].x);
+		b_min_y = MIN(b_min_y, b[i].y);
+		b_max_y = MAX(b_max_y, b[i].y);
+	}
+
+	iw = MIN(a_max_x, b_max_x) - MAX(a_min_x, b_min_x);
+	ih = MIN(a_max_y, b_max_y) - MAX(a_min_y, b_min_y);
+
+	if (iw <= 0 || ih <= 0)
+		return 0;
+
+	inter = iw * ih;
+	uni = (a_max_x - a_min_x) * (a_max_y - a_min_y)
+		+ (b_max_x - b_min_x) * (b_max_y - b_min_y)
+		- inter;
+
+	return uni > 0 ? inter / uni : 0;
+
+}
+
+
+
+/**
+ * @brief finds the cached quad overlapping the given vertices the most
+ *
+ * @param cache     the cache to search
+ * @param vertices  the vertices of the quad to look for
+ * @return          the index of the best entry, or -1 if none overlap
+ *                  sufficiently
+ */
+static int find_entry(koki_decode_cache_t *cache,
+		      const koki_point2Df_t vertices[4])
+{
+
+	float best = KOKI_DECODE_CACHE_MIN_OVERLAP;
+	int ret = -1;
+
+	for (guint i=0; i<cache->entries->len; i++){
+
+		float o = quad_overlap(entry_index(cache->entries, i).vertices,
+				       vertices);
+
+		if (o >= best){
+			best = o;
+			ret = i;
+		}
+
+	}
+
+	return ret;
+
+}
+
+
+
+/**
+ * @brief copies the image vertices of a marker into a point array
+ *
+ * @param marker    the marker
+ * @param vertices  the array to copy into
+ */
+static void marker_vertices(const koki_marker_t *marker,
+			    koki_point2Df_t vertices[4])
+{
+
+	for (uint8_t i=0; i<4; i++)
+		vertices[i] = marker->vertices[i].image;
+
+}
+
+
+
+/**
+ * @brief samples a few cells of a cached quad's grid directly from the
+ *        frame to check the marker there hasn't changed
+ *
+ * @param entry  the cached entry
+ * @param H      the mapping from the unit square to the new quad
+ * @param frame  the frame to sample
+ * @return       TRUE if the samples agree with the cached grid
+ */
+static bool verify_entry(const koki_decode_cache_entry_t *entry,
+			 const koki_homography_t *H,
+			 const IplImage *frame)
+{
+
+	uint8_t samples[NUM_VERIFY_CELLS];
+	uint32_t sum_black = 0, sum_white = 0;
+	uint16_t num_black = 0, num_white = 0, threshold;
+
+	for (uint8_t i=0; i<NUM_VERIFY_CELLS; i++){
+
+		uint8_t row = verify_cells[i][0];
+		uint8_t col = verify_cells[i][1];
+
+		/* sample the centre of the cell */
+		samples[i] = koki_homography_sample(H, frame,
+						    (col + 0.5) / KOKI_MARKER_GRID_WIDTH,
+						    (row + 0.5) / KOKI_MARKER_GRID_WIDTH);
+
+		if (entry->cells[row][col]){
+			sum_white += samples[i];
+			num_white++;
+		} else {
+			sum_black += samples[i];
+			num_black++;
+		}
+
+	}
+
+	/* can't say anything useful without both colours */
+	if (num_black == 0 || num_white == 0)
+		return FALSE;
+
+	sum_black /= num_black;
+	sum_white /= num_white;
+
+	if (sum_white < sum_black + KOKI_DECODE_CACHE_MIN_CONTRAST)
+		return FALSE;
+
+	threshold = (sum_black + sum_white) / 2;
+
+	for (uint8_t i=0; i<NUM_VERIFY_CELLS; i++){
+
+		uint8_t row = verify_cells[i][0];
+		uint8_t col = verify_cells[i][1];
+
+		if ((samples[i] > threshold) != entry->cells[row][col])
+			return FALSE;
+
+	}
+
+	return TRUE;
+
+}
+
+
+
+/**
+ * @brief attempts to recover a marker's code from the cache
+ *
+ * If a cached quad overlaps the marker's quad and a sample of its cells
+ * still matches, the marker's code and rotation offset are filled in from
+ * the cache and the entry is updated to track the marker's new position.
+ *
+ * @param cache   the cache
+ * @param marker  the marker to recover the code for
+ * @param frame   the greyscale frame the marker is in
+ * @return        TRUE if the marker's code was recovered, FALSE if a full
+ *                decode is required
+ */
+bool koki_decode_cache_verify(koki_decode_cache_t *cache,
+			      koki_marker_t *marker,
+			      const IplImage *frame)
+{
+
+	koki_point2Df_t vertices[4];
+	koki_decode_cache_entry_t *entry;
+	koki_homography_t H;
+	int i;
+
+	assert(cache != NULL);
+	assert(marker != NULL);
+	assert(frame != NULL && frame->nChannels == 1);
+
+	marker_vertices(marker, vertices);
+
+	i = find_entry(cache, vertices);
+
+	if (i < 0
+	    || !koki_homography_from_quad(vertices, &H)
+	    || !verify_entry(&entry_index(cache->entries, i), &H, frame)){
+
+		cache->misses++;
+		return FALSE;
+
+	}
+
+	entry = &entry_index(cache->entries, i);
+
+	marker->code = entry->code;
+	marker->rotation_offset = entry->rotation_offset;
+
+	/* follow the quad */
+	for (uint8_t j=0; j<4; j++)
+		entry->vertices[j] = vertices[j];
+	entry->age = 0;
+
+	cache->hits++;
+
+	return TRUE;
+
+}
+
+
+
+/**
+ * @brief remembers a freshly decoded marker
+ *
+ * Any cached quad overlapping the marker is replaced.
+ *
+ * @param cache   the cache
+ * @param marker  the marker, with its code recovered
+ * @param grid    the thresholded grid the code was recovered from
+ */
+void koki_decode_cache_store(koki_decode_cache_t *cache,
+			     const koki_marker_t *marker,
+			     const koki_grid_t *grid)
+{
+
+	koki_decode_cache_entry_t entry;
+	int i;
+
+	assert(cache != NULL);
+	assert(marker != NULL);
+	assert(grid != NULL);
+
+	marker_vertices(marker, entry.vertices);
+	entry.code = marker->code;
+	entry.rotation_offset = marker->rotation_offset;
+	entry.age = 0;
+
+	for (uint8_t row=0; row<KOKI_MARKER_GRID_WIDTH; row++)
+		for (uint8_t col=0; col<KOKI_MARKER_GRID_WIDTH; col++)
+			entry.cells[row][col] = grid->data[row][col].val;
+
+	i = find_entry(cache, entry.vertices);
+
+	if (i < 0)
+		g_array_append_val(cache->entries, entry);
+	else
+		entry_index(cache->entries, i) = entry;
+
+}
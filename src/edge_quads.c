@@ -0,0 +1,1072 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/**
+ * @file  edge_quads.c
+ * @brief Implementation of finding marker quads from image gradients
+ *
+ * The labelling path needs each marker's border to threshold into a dark
+ * region of its own.  Under motion blur the border bleeds into its
+ * surroundings and that region never forms, but the border's edges still
+ * have strong, consistent gradients.  This follows the approach of
+ * AprilTag's detector:
+ *
+ *  - the gradient of every pixel is taken with a Sobel operator, and
+ *    pixels with too weak a gradient are discarded;
+ *  - neighbouring edge pixels are clustered, strongest agreement first,
+ *    for as long as the spread of each cluster's gradient directions stays
+ *    small;
+ *  - a line segment is fitted to each elongated cluster, directed so that
+ *    the dark side is on its right (in image co-ordinates), and segments
+ *    that carry on along the same line are joined;
+ *  - chains of four segments, each starting near where the last ended and
+ *    turning clockwise, are closed loops around dark quadrilaterals, whose
+ *    corners are the intersections of consecutive segments' lines.
+ *
+ * The corners are extrapolated from the lines, so they don't suffer from
+ * the rounding that blur gives a marker's corners.  They're within 1.5
+ * pixels of a marker's while the blur stays well within the width of its
+ * border (see test/edge_accuracy.c); beyond that, the border's inner edges
+ * pull on its outer ones.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include <assert.h>
+#include <glib.h>
+#include <cv.h>
+
+#include "points.h"
+#include "quad.h"
+#include "labelling.h" /* for KOKI_IPLIMAGE_GS_ELEM */
+#include "allocator.h"
+
+#include "edge_quads.h"
+
+
+/* pixels with a weaker Sobel gradient magnitude than this aren't edges */
+#define KOKI_EDGE_MIN_MAGNITUDE 32
+
+/* the largest difference, in radians, between the gradient directions of
+   neighbouring pixels in the same cluster */
+#define KOKI_EDGE_MAX_THETA_DIFF 0.5
+
+/* a cluster's gradient directions may spread this much further, divided
+   by its size, than they already do, so small clusters merge easily while
+   big ones stay straight */
+#define KOKI_EDGE_THETA_K 40
+
+/* the number of buckets edges are sorted into by direction difference */
+#define KOKI_EDGE_COST_BUCKETS 64
+
+/* the fewest pixels a cluster needs to become a segment */
+#define KOKI_EDGE_MIN_PIXELS 12
+
+/* the shortest segment, in pixels */
+#define KOKI_EDGE_MIN_LENGTH 8
+
+/* segments must be at least this many times longer than they are wide
+   (as a ratio of the variances along and across them) */
+#define KOKI_EDGE_MIN_ELONGATION 9
+
+/* the sine of the smallest angle between consecutive sides of a quad */
+#define KOKI_EDGE_MIN_CORNER_SIN 0.5
+
+/* the gap allowed between consecutive segments, as a fraction of the
+   longer one's length, plus a constant number of pixels; heavy blur eats
+   into both ends of a side */
+#define KOKI_EDGE_GAP_FRACTION 0.4
+#define KOKI_EDGE_GAP_PIXELS   2
+
+/* collinear segments are joined if the directions' dot product is at
+   least this, and the shorter's ends are this close to the longer's line */
+#define KOKI_EDGE_COLLINEAR_COS    0.99
+#define KOKI_EDGE_COLLINEAR_PIXELS 2
+
+/* the most successors followed from each segment, the nearest first */
+#define KOKI_EDGE_MAX_SUCCESSORS 4
+
+/* the size, in pixels, of the grid cells segments are sorted into by where
+   they start, when looking for successors */
+#define KOKI_EDGE_SUCCESSOR_CELL 16
+
+/* the smallest quad, in square pixels */
+#define KOKI_EDGE_MIN_AREA 144
+
+
+/**
+ * @brief a line segment fitted to a cluster of edge pixels
+ */
+typedef struct {
+	koki_point2Df_t start;   /**< the start, with the dark side on the right */
+	koki_point2Df_t end;     /**< the end */
+	koki_point2Df_t mean;    /**< a point on the segment's line */
+	koki_point2Df_t dir;     /**< the unit direction, from start to end */
+	float length;            /**< the length, in pixels */
+	guint succ[KOKI_EDGE_MAX_SUCCESSORS]; /**< segments that can follow */
+	uint8_t num_succ;        /**< the number of successors */
+} edge_segment_t;
+
+/**
+ * @brief the moments of a cluster, for fitting a segment to it
+ */
+typedef struct {
+	double w, x, y, xx, xy, yy;  /**< magnitude-weighted moments */
+	double gx, gy;               /**< the summed gradient */
+	float tmin, tmax;            /**< the extent along the fitted line */
+	int32_t segment;             /**< the index of the fitted segment, or
+				          -1 if there isn't one */
+} edge_cluster_t;
+
+/**
+ * @brief the working state of the clustering
+ */
+typedef struct {
+	uint32_t *parent;   /* union-find forest over the pixels */
+	uint32_t *size;     /* the size of each tree, at its root */
+	float *theta;       /* each pixel's gradient direction, and then
+			       each root's direction range */
+	float *tmin, *tmax;
+} edge_forest_t;
+
+
+
+/**
+ * @brief finds the root of a pixel's cluster, compressing the path to it
+ */
+static uint32_t forest_find( edge_forest_t *f, uint32_t i )
+{
+	uint32_t root = i;
+
+	while (f->parent[root] != root)
+		root = f->parent[root];
+
+	while (f->parent[i] != root){
+		uint32_t next = f->parent[i];
+		f->parent[i] = root;
+		i = next;
+	}
+
+	return root;
+}
+
+/**
+ * @brief merges two clusters, unless the result's gradient directions
+ *        would spread too far
+ *
+ * As in AprilTag, the allowed spread depends on the clusters' existing
+ * spreads plus a term that shrinks as they grow.  A fixed limit either
+ * splits the stair-stepped edges of sharp, slanted sides or lets the
+ * gentle bend of a blurred corner join two sides together.
+ */
+static void forest_merge( edge_forest_t *f, uint32_t a, uint32_t b )
+{
+	float amid, bmid, shift = 0, lo, hi;
+
+	a = forest_find( f, a );
+	b = forest_find( f, b );
+
+	if (a == b)
+		return;
+
+	/* b's range, shifted by a turn if need be to lie alongside a's */
+	amid = (f->tmin[a] + f->tmax[a]) / 2;
+	bmid = (f->tmin[b] + f->tmax[b]) / 2;
+	if (bmid - amid > M_PI)
+		shift = -2 * M_PI;
+	else if (amid - bmid > M_PI)
+		shift = 2 * M_PI;
+
+	lo = MIN( f->tmin[a], f->tmin[b] + shift );
+	hi = MAX( f->tmax[a], f->tmax[b] + shift );
+
+	if (hi - lo > MIN( f->tmax[a] - f->tmin[a] + KOKI_EDGE_THETA_K
+			   / (float)f->size[a],
+			   f->tmax[b] - f->tmin[b] + KOKI_EDGE_THETA_K
+			   / (float)f->size[b] ))
+		return;
+
+	/* the bigger tree becomes the root, keeping the trees shallow */
+	if (f->size[a] < f->size[b]){
+		uint32_t t = a;
+		a = b;
+		b = t;
+		lo -= shift;
+		hi -= shift;
+	}
+
+	f->parent[b] = a;
+	f->size[a] += f->size[b];
+	f->tmin[a] = lo;
+	f->tmax[a] = hi;
+}
+
+/**
+ * @brief returns the difference between two directions, in radians
+ */
+static float theta_diff( float a, float b )
+{
+	float d = fabsf( a - b );
+
+	return d > M_PI ? 2 * M_PI - d : d;
+}
+
+/**
+ * @brief finds the point where two segments' lines cross
+ *
+ * @param a  the first segment
+ * @param b  the second segment, which mustn't be parallel to the first
+ * @return   the point of intersection
+ */
+static koki_point2Df_t intersect( const edge_segment_t *a,
+				  const edge_segment_t *b )
+{
+	koki_point2Df_t p;
+	float k;
+
+	k = ( b->dir.y * (b->mean.x - a->mean.x)
+	      - b->dir.x * (b->mean.y - a->mean.y) )
+		/ ( a->dir.x * b->dir.y - a->dir.y * b->dir.x );
+
+	p.x = a->mean.x + a->dir.x * k;
+	p.y = a->mean.y + a->dir.y * k;
+
+	return p;
+}
+
+static float distance( koki_point2Df_t a, koki_point2Df_t b )
+{
+	return hypotf( a.x - b.x, a.y - b.y );
+}
+
+/**
+ * @brief the distance of a point from a segment's line
+ */
+static float line_distance( const edge_segment_t *s, koki_point2Df_t p )
+{
+	return fabsf( (p.x - s->mean.x) * s->dir.y - (p.y - s->mean.y) * s->dir.x );
+}
+
+/**
+ * @brief works out whether segment \c b carries on from the end of segment
+ *        \c a along the same line
+ *
+ * @param a    the first segment
+ * @param b    the second segment
+ * @param gap  where to store the distance from \c a's end to \c b's start
+ * @return     whether \c b carries on from \c a
+ */
+static bool segments_continue( const edge_segment_t *a, const edge_segment_t *b,
+			       float *gap )
+{
+	float tol;
+
+	if (a->dir.x * b->dir.x + a->dir.y * b->dir.y < KOKI_EDGE_COLLINEAR_COS)
+		return FALSE;
+
+	tol = KOKI_EDGE_GAP_FRACTION * MAX( a->length, b->length )
+		+ KOKI_EDGE_GAP_PIXELS;
+
+	/* b must carry on from a's end */
+	*gap = distance( a->end, b->start );
+	if (*gap > tol
+	    || (b->start.x - a->end.x) * a->dir.x
+	    + (b->start.y - a->end.y) * a->dir.y < -tol)
+		return FALSE;
+
+	/* the longer segment's line is the better fitted */
+	if (a->length < b->length){
+		const edge_segment_t *t = a;
+		a = b;
+		b = t;
+	}
+
+	return line_distance( a, b->start ) <= KOKI_EDGE_COLLINEAR_PIXELS
+		&& line_distance( a, b->end ) <= KOKI_EDGE_COLLINEAR_PIXELS;
+}
+
+/**
+ * @brief a segment's place in the order of directions
+ */
+typedef struct {
+	float theta;   /**< the segment's direction */
+	guint index;   /**< the segment's index */
+} edge_order_t;
+
+static gint compare_theta( gconstpointer a, gconstpointer b )
+{
+	float ta = ((const edge_order_t*)a)->theta;
+	float tb = ((const edge_order_t*)b)->theta;
+
+	return ta < tb ? -1 : ta > tb;
+}
+
+/**
+ * @brief joins segments that continue one another along the same line
+ *
+ * The stair-stepped edges of sharp, slanted sides, and sides crossed by
+ * glare, break into several collinear clusters, which would otherwise
+ * need more than four segments to go round a quad.
+ *
+ * With the segments sorted by direction, only the few either side of each
+ * can be collinear with it.  Each segment is linked to the nearest of
+ * those that carries on from it, keeping the nearest where several link
+ * to the same one, and the resulting chains are then merged in one pass.
+ *
+ * @param segments  the \c GArray of \c edge_segment_t to join up
+ */
+static void join_collinear( GArray *segments )
+{
+	const guint n = segments->len;
+	const float max_dtheta = acosf( KOKI_EDGE_COLLINEAR_COS );
+	GArray *order;
+	int32_t *next, *prev;
+	float *gaps;
+	bool *merged;
+	guint kept = 0;
+
+	if (n < 2)
+		return;
+
+	order = g_array_sized_new( FALSE, FALSE, sizeof(edge_order_t), n );
+	for (guint i=0; i<n; i++){
+		const edge_segment_t *s = &g_array_index( segments, edge_segment_t, i );
+		edge_order_t o = { atan2f( s->dir.y, s->dir.x ), i };
+		g_array_append_val( order, o );
+	}
+	g_array_sort( order, compare_theta );
+
+	next = koki_malloc( n * sizeof(int32_t) );
+	prev = koki_malloc( n * sizeof(int32_t) );
+	gaps = koki_malloc( n * sizeof(float) );
+	merged = koki_malloc( n * sizeof(bool) );
+
+	for (guint i=0; i<n; i++){
+		next[i] = prev[i] = -1;
+		merged[i] = FALSE;
+	}
+
+	/* link each segment to the nearest one carrying on from it, looking
+	   either way round the sorted directions until they differ too much */
+	for (guint p=0; p<n; p++){
+
+		const edge_order_t *o = &g_array_index( order, edge_order_t, p );
+		const edge_segment_t *a =
+			&g_array_index( segments, edge_segment_t, o->index );
+		float best = G_MAXFLOAT;
+		guint ahead = 0;
+
+		for (int dir=1; dir>=-1; dir-=2)
+			for (guint k=1; k<n - (dir < 0 ? ahead : 0); k++){
+
+				const edge_order_t *q = &g_array_index( order, edge_order_t,
+									(p + n + dir * (int)k) % n );
+				float gap;
+
+				if (theta_diff( o->theta, q->theta ) > max_dtheta)
+					break;
+
+				if (dir > 0)
+					ahead = k;
+
+				if (segments_continue( a, &g_array_index( segments,
+									  edge_segment_t, q->index ), &gap )
+				    && gap < best){
+					best = gap;
+					next[o->index] = q->index;
+				}
+
+			}//for
+
+		gaps[o->index] = best;
+
+	}//for
+
+	/* where several segments carry on into the same one, the nearest
+	   keeps it */
+	for (guint i=0; i<n; i++)
+		if (next[i] >= 0 && (prev[next[i]] < 0
+				     || gaps[i] < gaps[prev[next[i]]]))
+			prev[next[i]] = i;
+
+	for (guint i=0; i<n; i++)
+		if (next[i] >= 0 && prev[next[i]] != (int32_t)i)
+			next[i] = -1;
+
+	/* merge each chain into its first segment, starting a new chain
+	   wherever the merged segment has drifted off the next one's line;
+	   the second pass breaks any loops, which have no first segment */
+	for (int pass=0; pass<2; pass++)
+		for (guint i=0; i<n; i++){
+
+			edge_segment_t *a = &g_array_index( segments, edge_segment_t, i );
+			int32_t j;
+
+			if (merged[i] || (pass == 0 && prev[i] >= 0))
+				continue;
+
+			for (j=next[i]; j >= 0 && j != (int32_t)i && !merged[j];
+			     j=next[j]){
+
+				const edge_segment_t *b =
+					&g_array_index( segments, edge_segment_t, j );
+				float gap;
+
+				if (!segments_continue( a, b, &gap ))
+					break;
+
+				a->end = b->end;
+				a->length = distance( a->start, a->end );
+				a->dir.x = (a->end.x - a->start.x) / a->length;
+				a->dir.y = (a->end.y - a->start.y) / a->length;
+				a->mean.x = (a->start.x + a->end.x) / 2;
+				a->mean.y = (a->start.y + a->end.y) / 2;
+				merged[j] = TRUE;
+
+			}//for
+
+			/* the rest of the chain starts afresh */
+			if (j >= 0 && j != (int32_t)i && !merged[j])
+				prev[j] = -1;
+
+		}//for
+
+	for (guint i=0; i<n; i++)
+		if (!merged[i])
+			g_array_index( segments, edge_segment_t, kept++ ) =
+				g_array_index( segments, edge_segment_t, i );
+	g_array_set_size( segments, kept );
+
+	koki_free( next );
+	koki_free( prev );
+	koki_free( gaps );
+	koki_free( merged );
+	g_array_free( order, TRUE );
+}
+
+/**
+ * @brief works out whether segment \c b can follow segment \c a around a
+ *        dark quadrilateral
+ *
+ * It must turn clockwise by a reasonable angle, start near where \c a
+ * ends, and their lines must meet near there too.
+ */
+static bool segments_join( const edge_segment_t *a, const edge_segment_t *b )
+{
+	float tol, cross;
+	koki_point2Df_t corner;
+
+	cross = a->dir.x * b->dir.y - a->dir.y * b->dir.x;
+	if (cross < KOKI_EDGE_MIN_CORNER_SIN)
+		return FALSE;
+
+	tol = KOKI_EDGE_GAP_FRACTION * MAX( a->length, b->length )
+		+ KOKI_EDGE_GAP_PIXELS;
+
+	if (distance( a->end, b->start ) > tol)
+		return FALSE;
+
+	corner = intersect( a, b );
+
+	return distance( corner, a->end ) <= tol
+		&& distance( corner, b->start ) <= tol;
+}
+
+
+
+/**
+ * @brief clusters the edge pixels of the region of interest
+ *
+ * @param frame  the greyscale frame
+ * @param roi    the region of interest
+ * @param f      the forest to fill in, over the region's pixels
+ * @param gx     where to store the horizontal gradients
+ * @param gy     where to store the vertical gradients
+ */
+static void cluster_edges( const IplImage *frame, const CvRect *roi,
+			   edge_forest_t *f, int16_t *gx, int16_t *gy )
+{
+	const uint32_t w = roi->width, h = roi->height;
+	const int32_t min_mag2 = KOKI_EDGE_MIN_MAGNITUDE * KOKI_EDGE_MIN_MAGNITUDE;
+	uint32_t counts[KOKI_EDGE_COST_BUCKETS] = { 0 };
+	uint32_t starts[KOKI_EDGE_COST_BUCKETS];
+	uint32_t num_edges = 0, *edges;
+	static const int8_t nx[4] = { 1, 1, 0, -1 }, ny[4] = { 0, 1, 1, 1 };
+
+	/* gradients, skipping the frame's outermost pixels */
+	for (uint32_t y=0; y<h; y++)
+		for (uint32_t x=0; x<w; x++){
+
+			uint32_t i = y * w + x;
+			int32_t fx = roi->x + x, fy = roi->y + y;
+
+			f->parent[i] = i;
+			f->size[i] = 1;
+			gx[i] = gy[i] = 0;
+
+			if (fx < 1 || fy < 1 || fx >= frame->width - 1
+			    || fy >= frame->height - 1)
+				continue;
+
+#define P(dx, dy) ((int32_t)KOKI_IPLIMAGE_GS_ELEM(frame, fx + (dx), fy + (dy)))
+			gx[i] = P(1,-1) + 2*P(1,0) + P(1,1)
+				- P(-1,-1) - 2*P(-1,0) - P(-1,1);
+			gy[i] = P(-1,1) + 2*P(0,1) + P(1,1)
+				- P(-1,-1) - 2*P(0,-1) - P(1,-1);
+#undef P
+
+			if ((int32_t)gx[i] * gx[i] + (int32_t)gy[i] * gy[i] < min_mag2){
+				gx[i] = gy[i] = 0;
+				continue;
+			}
+
+			f->theta[i] = atan2f( gy[i], gx[i] );
+			f->tmin[i] = f->tmax[i] = f->theta[i];
+
+		}//for
+
+	/* count the edges between neighbouring edge pixels, by how much
+	   their directions differ */
+	for (int pass=0; pass<2; pass++){
+
+		if (pass == 1){
+			starts[0] = 0;
+			for (uint8_t b=1; b<KOKI_EDGE_COST_BUCKETS; b++)
+				starts[b] = starts[b-1] + counts[b-1];
+			edges = koki_malloc( num_edges * 2 * sizeof(uint32_t) );
+		}
+
+		for (uint32_t y=0; y<h; y++)
+			for (uint32_t x=0; x<w; x++){
+
+				uint32_t i = y * w + x;
+
+				if (gx[i] == 0 && gy[i] == 0)
+					continue;
+
+				for (uint8_t n=0; n<4; n++){
+
+					int32_t x2 = x + nx[n], y2 = y + ny[n];
+					uint32_t j = y2 * w + x2;
+					float d;
+					uint8_t b;
+
+					if (x2 < 0 || x2 >= (int32_t)w || y2 >= (int32_t)h
+					    || (gx[j] == 0 && gy[j] == 0))
+						continue;
+
+					d = theta_diff( f->theta[i], f->theta[j] );
+					if (d > KOKI_EDGE_MAX_THETA_DIFF)
+						continue;
+
+					b = d * (KOKI_EDGE_COST_BUCKETS - 1)
+						/ KOKI_EDGE_MAX_THETA_DIFF;
+
+					if (pass == 0){
+						counts[b]++;
+						num_edges++;
+					} else {
+						edges[starts[b] * 2] = i;
+						edges[starts[b] * 2 + 1] = j;
+						starts[b]++;
+					}
+
+				}//for
+
+			}//for
+
+	}//for
+
+	/* merge, the most similar first */
+	for (uint32_t e=0; e<num_edges; e++)
+		forest_merge( f, edges[e * 2], edges[e * 2 + 1] );
+
+	koki_free( edges );
+}
+
+/**
+ * @brief fits segments to the clusters that are big and straight enough
+ *
+ * @param roi       the region of interest
+ * @param f         the clustered forest
+ * @param gx        the horizontal gradients
+ * @param gy        the vertical gradients
+ * @param segments  the \c GArray of \c edge_segment_t to append to
+ */
+static void fit_segments( const CvRect *roi, edge_forest_t *f,
+			  const int16_t *gx, const int16_t *gy,
+			  GArray *segments )
+{
+	const uint32_t n = roi->width * roi->height;
+	GArray *clusters = g_array_new( FALSE, TRUE, sizeof(edge_cluster_t) );
+	int32_t *cluster_of = koki_malloc( n * sizeof(int32_t) );
+
+	for (uint32_t i=0; i<n; i++)
+		cluster_of[i] = -1;
+
+	/* accumulate the moments of each big enough cluster, relative to
+	   the region of interest */
+	for (uint32_t i=0; i<n; i++){
+
+		uint32_t r;
+		edge_cluster_t *c;
+		double mag, x, y;
+
+		if (gx[i] == 0 && gy[i] == 0)
+			continue;
+
+		r = forest_find( f, i );
+		if (f->size[r] < KOKI_EDGE_MIN_PIXELS)
+			continue;
+
+		if (cluster_of[r] < 0){
+			cluster_of[r] = clusters->len;
+			g_array_set_size( clusters, clusters->len + 1 );
+		}
+
+		c = &g_array_index( clusters, edge_cluster_t, cluster_of[r] );
+
+		mag = hypot( gx[i], gy[i] );
+		x = i % roi->width;
+		y = i / roi->width;
+
+		c->w += mag;
+		c->x += mag * x;
+		c->y += mag * y;
+		c->xx += mag * x * x;
+		c->xy += mag * x * y;
+		c->yy += mag * y * y;
+		c->gx += gx[i];
+		c->gy += gy[i];
+
+	}//for
+
+	/* fit a line to each, keeping only the elongated ones */
+	for (guint k=0; k<clusters->len; k++){
+
+		edge_cluster_t *c = &g_array_index( clusters, edge_cluster_t, k );
+		edge_segment_t seg;
+		double cxx, cxy, cyy, mid, r, theta;
+
+		c->segment = -1;
+
+		seg.mean.x = c->x / c->w;
+		seg.mean.y = c->y / c->w;
+		cxx = c->xx / c->w - seg.mean.x * seg.mean.x;
+		cxy = c->xy / c->w - seg.mean.x * seg.mean.y;
+		cyy = c->yy / c->w - seg.mean.y * seg.mean.y;
+
+		/* the eigen values of the covariance are mid +/- r */
+		mid = (cxx + cyy) / 2;
+		r = hypot( (cxx - cyy) / 2, cxy );
+		if (mid + r < KOKI_EDGE_MIN_ELONGATION * (mid - r))
+			continue;
+
+		theta = atan2( 2 * cxy, cxx - cyy ) / 2;
+		seg.dir.x = cos( theta );
+		seg.dir.y = sin( theta );
+
+		/* with the gradient pointing from dark to light, turning it
+		   anticlockwise (on screen) leaves the dark side on the right */
+		if (seg.dir.x * -c->gy + seg.dir.y * c->gx < 0){
+			seg.dir.x = -seg.dir.x;
+			seg.dir.y = -seg.dir.y;
+		}
+
+		seg.num_succ = 0;
+		c->tmin = G_MAXFLOAT;
+		c->tmax = -G_MAXFLOAT;
+		c->segment = segments->len;
+		g_array_append_val( segments, seg );
+
+	}//for
+
+	/* find the extent of each segment along its line */
+	for (uint32_t i=0; i<n; i++){
+
+		edge_cluster_t *c;
+		edge_segment_t *seg;
+		float t;
+
+		if (gx[i] == 0 && gy[i] == 0)
+			continue;
+
+		if (cluster_of[forest_find( f, i )] < 0)
+			continue;
+
+		c = &g_array_index( clusters, edge_cluster_t,
+				    cluster_of[forest_find( f, i )] );
+		if (c->segment < 0)
+			continue;
+
+		seg = &g_array_index( segments, edge_segment_t, c->segment );
+		t = (float)(i % roi->width - seg->mean.x) * seg->dir.x
+			+ (float)(i / roi->width - seg->mean.y) * seg->dir.y;
+
+		c->tmin = MIN( c->tmin, t );
+		c->tmax = MAX( c->tmax, t );
+
+	}//for
+
+	/* finally, move the segments into frame co-ordinates, dropping the
+	   short ones */
+	for (guint k=0; k<clusters->len; k++){
+
+		edge_cluster_t *c = &g_array_index( clusters, edge_cluster_t, k );
+		edge_segment_t *seg;
+
+		if (c->segment < 0)
+			continue;
+
+		seg = &g_array_index( segments, edge_segment_t, c->segment );
+		seg->length = c->tmax - c->tmin;
+
+		seg->mean.x += roi->x;
+		seg->mean.y += roi->y;
+		seg->start.x = seg->mean.x + seg->dir.x * c->tmin;
+		seg->start.y = seg->mean.y + seg->dir.y * c->tmin;
+		seg->end.x = seg->mean.x + seg->dir.x * c->tmax;
+		seg->end.y = seg->mean.y + seg->dir.y * c->tmax;
+
+	}//for
+
+	for (guint k=segments->len; k>0; k--)
+		if (g_array_index( segments, edge_segment_t, k-1 ).length
+		    < KOKI_EDGE_MIN_LENGTH)
+			g_array_remove_index_fast( segments, k-1 );
+
+	g_array_free( clusters, TRUE );
+	koki_free( cluster_of );
+}
+
+/**
+ * @brief links each segment to those that can follow it round a quad,
+ *        keeping the ones that start nearest its end
+ *
+ * A successor must start within the gap allowed by segments_join(), which
+ * is at most that allowed with the longest segment, so the segments are
+ * sorted into a grid by where they start and only the cells that near
+ * each segment's end are searched.  Ties are broken by index, so the
+ * successors don't depend on the order the cells are searched in.
+ *
+ * @param segments  the \c GArray of \c edge_segment_t to link
+ */
+static void link_successors( GArray *segments )
+{
+	const guint n = segments->len;
+	const float cell = KOKI_EDGE_SUCCESSOR_CELL;
+	float x0 = G_MAXFLOAT, y0 = G_MAXFLOAT, x1 = -G_MAXFLOAT, y1 = -G_MAXFLOAT;
+	float max_length = 0;
+	uint32_t cols, rows, *starts, *order;
+
+	if (n == 0)
+		return;
+
+	for (guint i=0; i<n; i++){
+		const edge_segment_t *s = &g_array_index( segments, edge_segment_t, i );
+		x0 = MIN( x0, s->start.x );
+		y0 = MIN( y0, s->start.y );
+		x1 = MAX( x1, s->start.x );
+		y1 = MAX( y1, s->start.y );
+		max_length = MAX( max_length, s->length );
+	}
+
+	cols = (uint32_t)((x1 - x0) / cell) + 1;
+	rows = (uint32_t)((y1 - y0) / cell) + 1;
+
+	/* sort the segments by the cell they start in, keeping them in order
+	   within each */
+	starts = koki_malloc( (cols * rows + 1) * sizeof(uint32_t) );
+	order = koki_malloc( n * sizeof(uint32_t) );
+
+	for (uint32_t c=0; c<=cols * rows; c++)
+		starts[c] = 0;
+
+	for (guint i=0; i<n; i++){
+		const edge_segment_t *s = &g_array_index( segments, edge_segment_t, i );
+		starts[(uint32_t)((s->start.y - y0) / cell) * cols
+		       + (uint32_t)((s->start.x - x0) / cell) + 1]++;
+	}
+
+	for (uint32_t c=1; c<=cols * rows; c++)
+		starts[c] += starts[c-1];
+
+	for (guint i=0; i<n; i++){
+		const edge_segment_t *s = &g_array_index( segments, edge_segment_t, i );
+		order[starts[(uint32_t)((s->start.y - y0) / cell) * cols
+			     + (uint32_t)((s->start.x - x0) / cell)]++] = i;
+	}
+
+	/* each cell's end is now the next one's start */
+	for (uint32_t c=cols * rows; c>0; c--)
+		starts[c] = starts[c-1];
+	starts[0] = 0;
+
+	for (guint i=0; i<n; i++){
+
+		edge_segment_t *a = &g_array_index( segments, edge_segment_t, i );
+		float gaps[KOKI_EDGE_MAX_SUCCESSORS];
+		float reach = KOKI_EDGE_GAP_FRACTION * MAX( a->length, max_length )
+			+ KOKI_EDGE_GAP_PIXELS;
+		int32_t cx0, cy0, cx1, cy1;
+
+		cx0 = MAX( (int32_t)floorf( (a->end.x - reach - x0) / cell ), 0 );
+		cy0 = MAX( (int32_t)floorf( (a->end.y - reach - y0) / cell ), 0 );
+		cx1 = MIN( (int32_t)floorf( (a->end.x + reach - x0) / cell ),
+			   (int32_t)cols - 1 );
+		cy1 = MIN( (int32_t)floorf( (a->end.y + reach - y0) / cell ),
+			   (int32_t)rows - 1 );
+
+		for (int32_t cy=cy0; cy<=cy1; cy++)
+			for (int32_t cx=cx0; cx<=cx1; cx++)
+				for (uint32_t o=starts[cy * cols + cx];
+				     o<starts[cy * cols + cx + 1]; o++){
+
+					const guint j = order[o];
+					const edge_segment_t *b =
+						&g_array_index( segments, edge_segment_t, j );
+					float gap;
+					uint8_t k;
+
+					if (j == i || !segments_join( a, b ))
+						continue;
+
+					gap = distance( a->end, b->start );
+					if (a->num_succ == KOKI_EDGE_MAX_SUCCESSORS
+					    && (gap > gaps[KOKI_EDGE_MAX_SUCCESSORS - 1]
+						|| (gap == gaps[KOKI_EDGE_MAX_SUCCESSORS - 1]
+						    && j > a->succ[KOKI_EDGE_MAX_SUCCESSORS - 1])))
+						continue;
+
+					/* insert it in order, dropping the furthest if
+					   need be */
+					k = MIN( a->num_succ, KOKI_EDGE_MAX_SUCCESSORS - 1 );
+					for (; k > 0 && (gaps[k-1] > gap
+							 || (gaps[k-1] == gap
+							     && a->succ[k-1] > j)); k--){
+						gaps[k] = gaps[k-1];
+						a->succ[k] = a->succ[k-1];
+					}
+					gaps[k] = gap;
+					a->succ[k] = j;
+
+					if (a->num_succ < KOKI_EDGE_MAX_SUCCESSORS)
+						a->num_succ++;
+
+				}//for
+
+	}//for
+
+	koki_free( starts );
+	koki_free( order );
+}
+
+/**
+ * @brief makes a quad from a loop of four segments, if it's a sensible one
+ *
+ * @param loop   the segments, in order around the quad
+ * @param frame  the frame, whose bounds the quad must lie within
+ * @return       the quad, with its vertices clockwise (on screen) from the
+ *               one between the last and first segments, or NULL
+ */
+static koki_quad_t* quad_from_loop( const edge_segment_t *loop[4],
+				    const IplImage *frame )
+{
+	koki_point2Df_t v[4];
+	koki_quad_t *quad;
+	float area = 0;
+
+	for (uint8_t i=0; i<4; i++){
+
+		v[i] = intersect( loop[(i+3) % 4], loop[i] );
+
+		if (v[i].x < 0 || v[i].y < 0 || v[i].x >= frame->width
+		    || v[i].y >= frame->height)
+			return NULL;
+
+	}
+
+	/* it must be convex, turning clockwise at every corner */
+	for (uint8_t i=0; i<4; i++){
+
+		koki_point2Df_t a = v[i], b = v[(i+1) % 4], c = v[(i+2) % 4];
+
+		if ((b.x - a.x) * (c.y - b.y) - (b.y - a.y) * (c.x - b.x) <= 0)
+			return NULL;
+
+		area += a.x * b.y - b.x * a.y;
+
+	}
+
+	if (area / 2 < KOKI_EDGE_MIN_AREA)
+		return NULL;
+
+	quad = koki_malloc( sizeof(koki_quad_t) );
+
+	for (uint8_t i=0; i<4; i++){
+		quad->vertices[i] = v[i];
+		quad->links[i] = NULL;
+	}
+
+	return quad;
+}
+
+
+
+/**
+ * @brief finds dark quadrilaterals, such as markers, from the gradients
+ *        of an image
+ *
+ * This doesn't depend on thresholding, so finds the borders of markers
+ * that are too blurred for the labeller to separate from their
+ * surroundings.  It's considerably slower than labelling, though, so is
+ * best kept for the frames or regions where labelling finds nothing (see
+ * koki_set_edge_quads()).
+ *
+ * The quads have no contour links, so can't be refined with
+ * koki_quad_refine_vertices(), but their vertices are the intersections
+ * of lines fitted to whole sides, so don't need to be.
+ *
+ * @param koki   the libkoki context
+ * @param frame  the greyscale frame
+ * @param roi    the region of the frame to search, or NULL for all of it
+ * @return       a \c GPtrArray of \c koki_quad_t*, in frame co-ordinates
+ */
+GPtrArray* koki_edge_quads_find( koki_t *koki, const IplImage *frame,
+				 const CvRect *roi )
+{
+	CvRect r = cvRect( 0, 0, frame->width, frame->height );
+	koki_alloc_scope_t scope;
+	edge_forest_t f;
+	int16_t *gx, *gy;
+	GArray *segments;
+	GPtrArray *quads;
+	uint32_t n;
+
+	assert(frame != NULL && frame->nChannels == 1);
+
+	if (roi != NULL){
+		r.x = MAX( roi->x, 0 );
+		r.y = MAX( roi->y, 0 );
+		r.width = MIN( roi->x + roi->width, frame->width ) - r.x;
+		r.height = MIN( roi->y + roi->height, frame->height ) - r.y;
+	}
+
+	quads = g_ptr_array_new();
+	if (r.width < 3 || r.height < 3)
+		return quads;
+
+	koki_alloc_scope_enter( &scope, &koki->allocator,
+				koki->allocator_userdata );
+
+	n = r.width * r.height;
+	f.parent = koki_malloc( n * sizeof(uint32_t) );
+	f.size = koki_malloc( n * sizeof(uint32_t) );
+	f.theta = koki_malloc( n * sizeof(float) );
+	f.tmin = koki_malloc( n * sizeof(float) );
+	f.tmax = koki_malloc( n * sizeof(float) );
+	gx = koki_malloc( n * sizeof(int16_t) );
+	gy = koki_malloc( n * sizeof(int16_t) );
+
+	cluster_edges( frame, &r, &f, gx, gy );
+
+	segments = g_array_new( FALSE, FALSE, sizeof(edge_segment_t) );
+	fit_segments( &r, &f, gx, gy, segments );
+	join_collinear( segments );
+
+	koki_free( f.parent );
+	koki_free( f.size );
+	koki_free( f.theta );
+	koki_free( f.tmin );
+	koki_free( f.tmax );
+	koki_free( gx );
+	koki_free( gy );
+
+	link_successors( segments );
+
+	/* follow chains of four back to their start; starting each at its
+	   lowest numbered segment finds every loop once */
+	for (guint i=0; i<segments->len; i++){
+
+		const edge_segment_t *loop[4];
+
+		loop[0] = &g_array_index( segments, edge_segment_t, i );
+
+		for (uint8_t a=0; a<loop[0]->num_succ; a++){
+
+			if (loop[0]->succ[a] < i)
+				continue;
+			loop[1] = &g_array_index( segments, edge_segment_t,
+						  loop[0]->succ[a] );
+
+			for (uint8_t b=0; b<loop[1]->num_succ; b++){
+
+				if (loop[1]->succ[b] < i)
+					continue;
+				loop[2] = &g_array_index( segments, edge_segment_t,
+							  loop[1]->succ[b] );
+
+				for (uint8_t c=0; c<loop[2]->num_succ; c++){
+
+					if (loop[2]->succ[c] < i)
+						continue;
+					loop[3] = &g_array_index( segments, edge_segment_t,
+								  loop[2]->succ[c] );
+
+					for (uint8_t d=0; d<loop[3]->num_succ; d++){
+
+						koki_quad_t *quad;
+
+						if (loop[3]->succ[d] != i)
+							continue;
+
+						quad = quad_from_loop( loop, frame );
+						if (quad != NULL)
+							g_ptr_array_add( quads, quad );
+
+					}//for
+
+				}//for
+
+			}//for
+
+		}//for
+
+	}//for
+
+	g_array_free( segments, TRUE );
+
+	koki_alloc_scope_leave( &scope );
+
+	return quads;
+}
+
+
+
+/**
+ * @brief frees the quads returned by koki_edge_quads_find()
+ *
+ * @param quads  the quads
+ */
+void koki_edge_quads_free( GPtrArray *quads )
+{
+	for (guint i=0; i<quads->len; i++)
+		koki_quad_free( g_ptr_array_index( quads, i ) );
+
+	g_ptr_array_free( quads, TRUE );
+}
@@ -0,0 +1,405 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/**
+ * @file  exposure.c
+ * @brief Implementation of controlling camera exposure to limit motion blur
+ *
+ * Auto exposure aims for a nicely lit picture, which on a moving robot
+ * usually means an exposure long enough to smear the markers.  All the
+ * detector actually needs is enough contrast between a marker's black
+ * border and its white surround to threshold it.  This controller takes
+ * over from auto exposure and, using the markers that were decoded plus a
+ * sparse histogram of the frame, keeps the exposure as short as possible
+ * -- making up for the lost light with gain first, and only lengthening
+ * the exposure once the gain is exhausted.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <glib.h>
+#include <cv.h>
+
+#include "marker.h"
+#include "homography.h"
+#include "code_grid.h"
+#include "labelling.h" /* for KOKI_IPLIMAGE_GS_ELEM */
+#include <sys/time.h> /* needed for videodev2.h */
+#include "v4l.h"
+
+#include "exposure.h"
+
+
+/* frames between adjustments, giving the camera time to apply them */
+#define KOKI_EXPOSURE_INTERVAL 4
+
+/* without any markers to go on, keep the frame's mean in this range */
+#define KOKI_EXPOSURE_MIN_MEAN  70
+#define KOKI_EXPOSURE_MAX_MEAN 150
+
+/* grey levels at or above this are considered saturated */
+#define KOKI_EXPOSURE_SATURATED 250
+
+/* shorten the exposure if more than this fraction of pixels saturate */
+#define KOKI_EXPOSURE_MAX_CLIPPED 0.05
+
+/* only every n-th pixel of every n-th row is used for the histogram */
+#define KOKI_EXPOSURE_SUBSAMPLE 4
+
+/* how far outside a marker, as a fraction of its width, to sample the
+   white surround */
+#define KOKI_EXPOSURE_SURROUND 0.1
+
+
+
+/**
+ * @brief reads the range and current value of a control
+ *
+ * @param fd       the camera's file descriptor
+ * @param id       the V4L2 control ID
+ * @param control  where to store the details
+ */
+static void read_control(int fd, unsigned int id,
+			 koki_exposure_control_t *control)
+{
+
+	struct v4l2_queryctrl query;
+
+	control->supported = koki_v4l_query_control(fd, id, &query) >= 0;
+
+	if (!control->supported)
+		return;
+
+	control->min = query.minimum;
+	control->max = query.maximum;
+	control->step = query.step > 0 ? query.step : 1;
+	control->value = koki_v4l_get_control(fd, id);
+
+}
+
+
+
+/**
+ * @brief sets a control to a new value, clamped to its range
+ *
+ * @param fd       the camera's file descriptor
+ * @param id       the V4L2 control ID
+ * @param control  the control's details, updated on success
+ * @param value    the value to set
+ * @return         TRUE if the control's value changed
+ */
+static bool write_control(int fd, unsigned int id,
+			  koki_exposure_control_t *control, int32_t value)
+{
+
+	value = CLAMP(value, control->min, control->max);
+
+	if (value == control->value)
+		return FALSE;
+
+	if (koki_v4l_set_control(fd, id, value) < 0)
+		return FALSE;
+
+	control->value = value;
+
+	return TRUE;
+
+}
+
+
+
+/**
+ * @brief takes manual control of a camera's exposure
+ *
+ * @param fd               the camera's file descriptor
+ * @param target_contrast  the difference in grey level between a marker's
+ *                         border and its surround that's needed for
+ *                         reliable decoding (e.g. 40)
+ * @return                 the new controller, or NULL if the camera doesn't
+ *                         support manual exposure
+ */
+koki_exposure_ctrl_t* koki_exposure_ctrl_new(int fd, uint8_t target_contrast)
+{
+
+	koki_exposure_ctrl_t *ctrl;
+	struct v4l2_queryctrl query;
+
+	if (koki_v4l_query_control(fd, V4L2_CID_EXPOSURE_AUTO, &query) < 0)
+		return NULL;
+
+	ctrl = g_malloc0(sizeof(koki_exposure_ctrl_t));
+
+	ctrl->fd = fd;
+	ctrl->target_contrast = target_contrast;
+	ctrl->interval = KOKI_EXPOSURE_INTERVAL;
+	ctrl->stats.contrast = -1;
+
+	ctrl->original_auto = koki_v4l_get_control(fd, V4L2_CID_EXPOSURE_AUTO);
+
+	if (koki_v4l_set_control(fd, V4L2_CID_EXPOSURE_AUTO,
+				 V4L2_EXPOSURE_MANUAL) < 0){
+		g_free(ctrl);
+		return NULL;
+	}
+
+	read_control(fd, V4L2_CID_EXPOSURE_ABSOLUTE, &ctrl->exposure);
+	read_control(fd, V4L2_CID_GAIN, &ctrl->gain);
+
+	if (!ctrl->exposure.supported){
+		koki_exposure_ctrl_free(ctrl);
+		return NULL;
+	}
+
+	return ctrl;
+
+}
+
+
+
+/**
+ * @brief hands exposure control back to the camera and frees the
+ *        controller
+ *
+ * @param ctrl  the controller to free
+ */
+void koki_exposure_ctrl_free(koki_exposure_ctrl_t *ctrl)
+{
+
+	if (ctrl == NULL)
+		return;
+
+	koki_v4l_set_control(ctrl->fd, V4L2_CID_EXPOSURE_AUTO,
+			     ctrl->original_auto);
+
+	g_free(ctrl);
+
+}
+
+
+
+/**
+ * @brief measures the contrast between a marker's black border and the
+ *        white surround just outside it
+ *
+ * @param marker  the marker
+ * @param frame   the greyscale frame the marker was found in
+ * @return        the difference in mean grey level, or a negative number
+ *                if it couldn't be measured
+ */
+static float marker_contrast(const koki_marker_t *marker,
+			     const IplImage *frame)
+{
+
+	koki_point2Df_t quad[4];
+	koki_homography_t H;
+	uint32_t border = 0, surround = 0;
+	const float in = 1.0 / KOKI_MARKER_GRID_WIDTH;
+	const float out = -KOKI_EXPOSURE_SURROUND;
+
+	/* points around the middle of the border, and just outside it */
+	const float pos[3] = { 0.25, 0.5, 0.75 };
+
+	for (uint8_t i=0; i<4; i++)
+		quad[i] = marker->vertices[i].image;
+
+	if (!koki_homography_from_quad(quad, &H))
+		return -1;
+
+	for (uint8_t i=0; i<3; i++){
+
+		/* top, bottom, left and right */
+		border   += koki_homography_sample(&H, frame, pos[i], in);
+		border   += koki_homography_sample(&H, frame, pos[i], 1 - in);
+		border   += koki_homography_sample(&H, frame, in, pos[i]);
+		border   += koki_homography_sample(&H, frame, 1 - in, pos[i]);
+
+		surround += koki_homography_sample(&H, frame, pos[i], out);
+		surround += koki_homography_sample(&H, frame, pos[i], 1 - out);
+		surround += koki_homography_sample(&H, frame, out, pos[i]);
+		surround += koki_homography_sample(&H, frame, 1 - out, pos[i]);
+
+	}
+
+	return ((float)surround - (float)border) / 12;
+
+}
+
+
+
+/**
+ * @brief gathers the statistics used for exposure control
+ *
+ * @param frame    the greyscale frame
+ * @param markers  the markers found in the frame (may be NULL)
+ * @param stats    where to store the statistics
+ */
+void koki_exposure_stats(const IplImage *frame, const GPtrArray *markers,
+			 koki_exposure_stats_t *stats)
+{
+
+	uint32_t sum = 0, clipped = 0, n = 0;
+
+	assert(frame != NULL && frame->nChannels == 1);
+	assert(stats != NULL);
+
+	/* a sparse histogram is plenty for this */
+	for (uint16_t y=0; y<frame->height; y+=KOKI_EXPOSURE_SUBSAMPLE){
+		for (uint16_t x=0; x<frame->width; x+=KOKI_EXPOSURE_SUBSAMPLE){
+
+			uint8_t v = KOKI_IPLIMAGE_GS_ELEM(frame, x, y);
+
+			sum += v;
+			if (v >= KOKI_EXPOSURE_SATURATED)
+				clipped++;
+			n++;
+
+		}//for
+	}//for
+
+	stats->mean = n > 0 ? (float)sum / n : 0;
+	stats->clipped = n > 0 ? (float)clipped / n : 0;
+	stats->contrast = -1;
+
+	if (markers == NULL)
+		return;
+
+	/* the marker with the least contrast is the one at risk */
+	for (guint i=0; i<markers->len; i++){
+
+		float c = marker_contrast(g_ptr_array_index(markers, i), frame);
+
+		if (c < 0)
+			continue;
+
+		if (stats->contrast < 0 || c < stats->contrast)
+			stats->contrast = c;
+
+	}
+
+}
+
+
+
+/**
+ * @brief lets more light in, preferring gain over a longer exposure
+ *
+ * @param ctrl  the controller
+ * @return      TRUE if anything changed
+ */
+static bool brighten(koki_exposure_ctrl_t *ctrl)
+{
+
+	koki_exposure_control_t *e = &ctrl->exposure, *g = &ctrl->gain;
+
+	if (g->supported && g->value < g->max)
+		return write_control(ctrl->fd, V4L2_CID_GAIN, g,
+				     g->value + MAX(g->step, (g->max - g->min) / 10));
+
+	return write_control(ctrl->fd, V4L2_CID_EXPOSURE_ABSOLUTE, e,
+			     e->value + MAX(e->step, e->value / 4));
+
+}
+
+
+
+/**
+ * @brief lets less light in, preferring a shorter exposure over less gain
+ *
+ * @param ctrl  the controller
+ * @return      TRUE if anything changed
+ */
+static bool darken(koki_exposure_ctrl_t *ctrl)
+{
+
+	koki_exposure_control_t *e = &ctrl->exposure, *g = &ctrl->gain;
+
+	if (e->value > e->min)
+		return write_control(ctrl->fd, V4L2_CID_EXPOSURE_ABSOLUTE, e,
+				     e->value - MAX(e->step, e->value / 5));
+
+	if (g->supported)
+		return write_control(ctrl->fd, V4L2_CID_GAIN, g,
+				     g->value - MAX(g->step, (g->max - g->min) / 10));
+
+	return FALSE;
+
+}
+
+
+
+/**
+ * @brief considers the latest frame, and adjusts the exposure if required
+ *
+ * Adjustments are only made every few frames, so that the effect of the
+ * previous one can be seen.  The statistics are only gathered on those
+ * frames too, keeping the cost of the controller small.
+ *
+ * When markers are in view, the exposure is shortened for as long as the
+ * least contrasting marker keeps half as much again as the target
+ * contrast, and lengthened (via gain first) if it drops below it.  With
+ * no markers to go on, the mean grey level is kept within a sensible
+ * range instead.  Heavy saturation always shortens the exposure.
+ *
+ * @param ctrl     the controller
+ * @param frame    the greyscale frame
+ * @param markers  the markers found in the frame (may be NULL)
+ * @return         TRUE if the camera's settings were changed
+ */
+bool koki_exposure_ctrl_update(koki_exposure_ctrl_t *ctrl,
+			       const IplImage *frame,
+			       const GPtrArray *markers)
+{
+
+	koki_exposure_stats_t *s = &ctrl->stats;
+	bool too_dark, too_bright;
+
+	assert(ctrl != NULL);
+
+	if (++ctrl->frame_count < ctrl->interval)
+		return FALSE;
+
+	ctrl->frame_count = 0;
+
+	koki_exposure_stats(frame, markers, s);
+
+	if (s->contrast >= 0){
+
+		too_dark = s->contrast < ctrl->target_contrast;
+		too_bright = s->contrast > ctrl->target_contrast * 3 / 2;
+
+	} else {
+
+		too_dark = s->mean < KOKI_EXPOSURE_MIN_MEAN;
+		too_bright = s->mean > KOKI_EXPOSURE_MAX_MEAN;
+
+	}
+
+	if (s->clipped > KOKI_EXPOSURE_MAX_CLIPPED){
+		too_dark = FALSE;
+		too_bright = TRUE;
+	}
+
+	if (too_dark)
+		return brighten(ctrl);
+
+	if (too_bright)
+		return darken(ctrl);
+
+	return FALSE;
+
+}
@@ -0,0 +1,438 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/**
+ * @file  fixed.c
+ * @brief Implementation of Q16.16 fixed-point arithmetic
+ *
+ * The trigonometric functions use CORDIC, which needs nothing more than
+ * shifts and adds.  Internally the CORDIC works on 64 bit values
+ * normalised to a fixed magnitude, with angles in Q2.30, so that the
+ * result is accurate to well within Q16.16's resolution regardless of
+ * the scale of the inputs.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <glib.h>
+
+#include "fixed.h"
+
+
+#define KOKI_CORDIC_ITERATIONS 24
+
+/* atan(2^-i) in Q2.30 */
+static const int32_t cordic_atan[KOKI_CORDIC_ITERATIONS] = {
+	843314857, 497837829, 263043837, 133525159, 67021687, 33543516,
+	16775851, 8388437, 4194283, 2097149, 1048576, 524288, 262144,
+	131072, 65536, 32768, 16384, 8192, 4096, 2048, 1024, 512, 256, 128
+};
+
+/* the reciprocal of the CORDIC gain, prod(cos(atan(2^-i))), in Q2.30 */
+#define KOKI_CORDIC_GAIN_INV 652032874
+
+/* inputs to vectoring mode are normalised so that the larger of the two
+   has this many bits, leaving plenty of headroom for the CORDIC gain */
+#define KOKI_CORDIC_BITS 40
+
+/* pi in Q2.30 doesn't fit in 32 bits, so is only used as an int64_t */
+#define KOKI_CORDIC_PI 3373259426LL
+
+
+
+/**
+ * @brief divides two 64 bit integers, giving a result with the requested
+ *        number of fractional bits
+ *
+ * This is for when shifting the numerator up front would overflow.  The
+ * denominator must be non-zero and below 2^62; the integer part of the
+ * result is the caller's responsibility.
+ *
+ * @param num        the numerator
+ * @param den        the denominator
+ * @param frac_bits  the number of fractional bits in the result
+ * @return           \c num / \c den, with \c frac_bits fractional bits
+ */
+int64_t koki_fixed_div64(int64_t num, int64_t den, uint8_t frac_bits)
+{
+
+	bool neg = (num < 0) != (den < 0);
+	uint64_t n = num < 0 ? -(uint64_t)num : (uint64_t)num;
+	uint64_t d = den < 0 ? -(uint64_t)den : (uint64_t)den;
+	uint64_t q, r;
+
+	assert(d != 0);
+
+	q = n / d;
+	r = n % d;
+
+	/* long division for the fractional bits */
+	for (uint8_t i=0; i<frac_bits; i++){
+
+		q <<= 1;
+		r <<= 1;
+
+		if (r >= d){
+			r -= d;
+			q |= 1;
+		}
+
+	}//for
+
+	return neg ? -(int64_t)q : (int64_t)q;
+
+}
+
+
+
+/**
+ * @brief calculates the integer square root of a 64 bit number
+ *
+ * @param v  the number
+ * @return   floor(sqrt(v))
+ */
+uint32_t koki_fixed_isqrt64(uint64_t v)
+{
+
+	uint64_t r = 0, b = (uint64_t)1 << 62;
+
+	while (b > v)
+		b >>= 2;
+
+	while (b != 0){
+
+		if (v >= r + b){
+			v -= r + b;
+			r = (r >> 1) + b;
+		} else {
+			r >>= 1;
+		}
+
+		b >>= 2;
+
+	}//while
+
+	return (uint32_t)r;
+
+}
+
+
+
+/**
+ * @brief calculates the square root of a fixed-point number
+ *
+ * @param x  the number, which must not be negative
+ * @return   sqrt(x)
+ */
+koki_fixed_t koki_fixed_sqrt(koki_fixed_t x)
+{
+
+	assert(x >= 0);
+
+	return (koki_fixed_t)koki_fixed_isqrt64((uint64_t)x << KOKI_FIXED_SHIFT);
+
+}
+
+
+
+/**
+ * @brief scales a vector so that its larger component has
+ *        \c KOKI_CORDIC_BITS bits
+ *
+ * @param x  the X component, which must not be negative
+ * @param y  the Y component
+ * @return   the number of bits the vector was shifted left by (negative
+ *           for a right shift)
+ */
+static int8_t cordic_normalise(int64_t *x, int64_t *y)
+{
+
+	uint64_t ay = *y < 0 ? -(uint64_t)*y : (uint64_t)*y;
+	uint64_t m = (uint64_t)*x > ay ? (uint64_t)*x : ay;
+	int8_t shift = 0;
+
+	while (m >= (uint64_t)1 << KOKI_CORDIC_BITS){
+		m >>= 1;
+		shift--;
+	}
+
+	while (m < (uint64_t)1 << (KOKI_CORDIC_BITS - 1)){
+		m <<= 1;
+		shift++;
+	}
+
+	if (shift > 0){
+		*x *= (int64_t)1 << shift;
+		*y *= (int64_t)1 << shift;
+	} else {
+		*x >>= -shift;
+		*y >>= -shift;
+	}
+
+	return shift;
+
+}
+
+
+
+/**
+ * @brief runs CORDIC in vectoring mode, rotating a vector on to the
+ *        positive X axis
+ *
+ * @param x  the X component, which must not be negative; on return holds
+ *           the vector's magnitude multiplied by the CORDIC gain
+ * @param y  the Y component; on return holds the residual (close to 0)
+ * @return   the angle rotated through, in Q2.30
+ */
+static int32_t cordic_vector(int64_t *x, int64_t *y)
+{
+
+	int64_t t;
+	int32_t z = 0;
+
+	for (uint8_t i=0; i<KOKI_CORDIC_ITERATIONS; i++){
+
+		if (*y > 0){
+			t = *x + (*y >> i);
+			*y -= *x >> i;
+			z += cordic_atan[i];
+		} else {
+			t = *x - (*y >> i);
+			*y += *x >> i;
+			z -= cordic_atan[i];
+		}
+
+		*x = t;
+
+	}//for
+
+	return z;
+
+}
+
+
+
+/**
+ * @brief calculates the magnitude of a 2D vector
+ *
+ * @param x  the X component
+ * @param y  the Y component
+ * @return   sqrt(x^2 + y^2), in the same units as \c x and \c y
+ */
+int64_t koki_fixed_hypot64(int64_t x, int64_t y)
+{
+
+	int8_t shift;
+
+	if (x == 0 && y == 0)
+		return 0;
+
+	if (x < 0)
+		x = -x;
+
+	shift = cordic_normalise(&x, &y);
+	cordic_vector(&x, &y);
+
+	/* remove the CORDIC gain (dropping some of the normalised value's
+	   bits first, so the product fits), then the normalisation */
+	x = ((x >> 10) * KOKI_CORDIC_GAIN_INV + (1 << 19)) >> 20;
+
+	if (shift > 0)
+		return (x + ((int64_t)1 << (shift - 1))) >> shift;
+
+	return x * ((int64_t)1 << -shift);
+
+}
+
+
+
+/**
+ * @brief calculates the angle of a 2D vector, as atan2() does
+ *
+ * The components may be in any (common) fixed-point format.
+ *
+ * @param y  the Y component
+ * @param x  the X component
+ * @return   the angle from the positive X axis, in radians, in the range
+ *           -pi < angle <= pi
+ */
+koki_fixed_t koki_fixed_atan2_64(int64_t y, int64_t x)
+{
+
+	int64_t offset = 0, z;
+
+	if (x == 0 && y == 0)
+		return 0;
+
+	/* CORDIC only converges for the right half-plane */
+	if (x < 0){
+		offset = y >= 0 ? KOKI_CORDIC_PI : -KOKI_CORDIC_PI;
+		x = -x;
+		y = -y;
+	}
+
+	cordic_normalise(&x, &y);
+	z = cordic_vector(&x, &y) + offset;
+
+	return (koki_fixed_t)((z + (1 << 13)) >> 14);
+
+}
+
+
+
+/**
+ * @brief calculates the angle of a 2D vector, as atan2() does
+ *
+ * @param y  the Y component
+ * @param x  the X component
+ * @return   the angle from the positive X axis, in radians
+ */
+koki_fixed_t koki_fixed_atan2(koki_fixed_t y, koki_fixed_t x)
+{
+
+	return koki_fixed_atan2_64(y, x);
+
+}
+
+
+
+/**
+ * @brief calculates the arc sine of a fixed-point number
+ *
+ * @param x  the number, clamped to the range [-1, 1]
+ * @return   asin(x), in radians
+ */
+koki_fixed_t koki_fixed_asin(koki_fixed_t x)
+{
+
+	int64_t y, c;
+
+	if (x > KOKI_FIXED_ONE)
+		x = KOKI_FIXED_ONE;
+	if (x < -KOKI_FIXED_ONE)
+		x = -KOKI_FIXED_ONE;
+
+	/* asin(x) = atan2(x, sqrt(1 - x^2)), with both in Q2.30 */
+	y = (int64_t)x * (1 << 14);
+	c = koki_fixed_isqrt64(((uint64_t)1 << 60)
+			       - ((uint64_t)((int64_t)x * x) << 28));
+
+	return koki_fixed_atan2_64(y, c);
+
+}
+
+
+
+/**
+ * @brief calculates the sine and cosine of an angle
+ *
+ * @param angle  the angle, in radians
+ * @param s      where to store the sine (may be NULL)
+ * @param c      where to store the cosine (may be NULL)
+ */
+void koki_fixed_sincos(koki_fixed_t angle, koki_fixed_t *s, koki_fixed_t *c)
+{
+
+	int64_t x = KOKI_CORDIC_GAIN_INV, y = 0, t;
+	int32_t z;
+	bool negate = FALSE;
+
+	/* bring the angle into -pi/2 <= angle <= pi/2, where CORDIC
+	   converges, noting that sin and cos change sign with each half
+	   turn */
+	while (angle > KOKI_FIXED_PI_2){
+		angle -= KOKI_FIXED_PI;
+		negate = !negate;
+	}
+
+	while (angle < -KOKI_FIXED_PI_2){
+		angle += KOKI_FIXED_PI;
+		negate = !negate;
+	}
+
+	z = angle * (1 << 14);
+
+	for (uint8_t i=0; i<KOKI_CORDIC_ITERATIONS; i++){
+
+		if (z >= 0){
+			t = x - (y >> i);
+			y += x >> i;
+			z -= cordic_atan[i];
+		} else {
+			t = x + (y >> i);
+			y -= x >> i;
+			z += cordic_atan[i];
+		}
+
+		x = t;
+
+	}//for
+
+	x = (x + (1 << 13)) >> 14;
+	y = (y + (1 << 13)) >> 14;
+
+	if (negate){
+		x = -x;
+		y = -y;
+	}
+
+	if (s != NULL)
+		*s = (koki_fixed_t)y;
+
+	if (c != NULL)
+		*c = (koki_fixed_t)x;
+
+}
+
+
+
+/**
+ * @brief calculates the sine of an angle
+ *
+ * @param angle  the angle, in radians
+ * @return       sin(angle)
+ */
+koki_fixed_t koki_fixed_sin(koki_fixed_t angle)
+{
+
+	koki_fixed_t s;
+
+	koki_fixed_sincos(angle, &s, NULL);
+
+	return s;
+
+}
+
+
+
+/**
+ * @brief calculates the cosine of an angle
+ *
+ * @param angle  the angle, in radians
+ * @return       cos(angle)
+ */
+koki_fixed_t koki_fixed_cos(koki_fixed_t angle)
+{
+
+	koki_fixed_t c;
+
+	koki_fixed_sincos(angle, NULL, &c);
+
+	return c;
+
+}
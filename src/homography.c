@@ -0,0 +1,335 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/**
+ * @file  homography.c
+ * @brief Implementation of mapping the unit square on to a quad
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include <cv.h>
+#include <glib.h>
+
+#include "points.h"
+#include "fixed.h"
+#include "labelling.h" /* for KOKI_IPLIMAGE_GS_ELEM */
+
+#include "homography.h"
+
+
+/**
+ * @brief computes the projective mapping of the unit square on to a quad
+ *
+ * This is the closed form square-to-quad mapping from Heckbert's
+ * "Fundamentals of Texture Mapping and Image Warping" (1989), which is
+ * considerably cheaper than solving the general 8x8 system that
+ * \c cvGetPerspectiveTransform() does.
+ *
+ * @param quad  the 4 vertices, clockwise, corresponding to the unit
+ *              square's corners \c (0,0), \c (1,0), \c (1,1), \c (0,1)
+ * @param H     where to store the mapping
+ * @return      FALSE if the quad is degenerate, TRUE otherwise
+ */
+bool koki_homography_from_quad(const koki_point2Df_t quad[4],
+			       koki_homography_t *H)
+{
+
+	float sx, sy, dx1, dx2, dy1, dy2, den;
+
+	assert(quad != NULL && H != NULL);
+
+	sx = quad[0].x - quad[1].x + quad[2].x - quad[3].x;
+	sy = quad[0].y - quad[1].y + quad[2].y - quad[3].y;
+
+	dx1 = quad[1].x - quad[2].x;
+	dx2 = quad[3].x - quad[2].x;
+	dy1 = quad[1].y - quad[2].y;
+	dy2 = quad[3].y - quad[2].y;
+
+	den = dx1 * dy2 - dx2 * dy1;
+
+	if (fabsf(den) < 1e-6)
+		return FALSE;
+
+	/* sx == sy == 0 is the affine case, where g and h come out as 0 */
+	H->g = (sx * dy2 - dx2 * sy) / den;
+	H->h = (dx1 * sy - sx * dy1) / den;
+
+	H->a = quad[1].x - quad[0].x + H->g * quad[1].x;
+	H->b = quad[3].x - quad[0].x + H->h * quad[3].x;
+	H->c = quad[0].x;
+
+	H->d = quad[1].y - quad[0].y + H->g * quad[1].y;
+	H->e = quad[3].y - quad[0].y + H->h * quad[3].y;
+	H->f = quad[0].y;
+
+	return TRUE;
+
+}
+
+
+
+/**
+ * @brief maps a point in the unit square to the image
+ *
+ * @param H  the mapping
+ * @param u  the X co-ordinate in the unit square
+ * @param v  the Y co-ordinate in the unit square
+ * @return   the corresponding image point
+ */
+koki_point2Df_t koki_homography_map(const koki_homography_t *H,
+				    float u, float v)
+{
+
+	koki_point2Df_t p;
+	float w;
+
+	w = H->g * u + H->h * v + 1;
+
+	p.x = (H->a * u + H->b * v + H->c) / w;
+	p.y = (H->d * u + H->e * v + H->f) / w;
+
+	return p;
+
+}
+
+
+
+/**
+ * @brief samples a greyscale image at the image point corresponding to a
+ *        point in the unit square, using bilinear interpolation
+ *
+ * Points falling outside the image are clamped to its edge.
+ *
+ * @param H      the mapping
+ * @param frame  the greyscale image to sample
+ * @param u      the X co-ordinate in the unit square
+ * @param v      the Y co-ordinate in the unit square
+ * @return       the interpolated grey level
+ */
+uint8_t koki_homography_sample(const koki_homography_t *H,
+			       const IplImage *frame,
+			       float u, float v)
+{
+
+	koki_point2Df_t p;
+	int x0, y0, x1, y1;
+	float fx, fy, top, bottom;
+
+	assert(frame != NULL && frame->nChannels == 1);
+
+	p = koki_homography_map(H, u, v);
+
+	if (p.x < 0)
+		p.x = 0;
+	if (p.y < 0)
+		p.y = 0;
+	if (p.x > frame->width - 1)
+		p.x = frame->width - 1;
+	if (p.y > frame->height - 1)
+		p.y = frame->height - 1;
+
+	x0 = (int)p.x;
+	y0 = (int)p.y;
+	x1 = x0 + 1 < frame->width  ? x0 + 1 : x0;
+	y1 = y0 + 1 < frame->height ? y0 + 1 : y0;
+
+	fx = p.x - x0;
+	fy = p.y - y0;
+
+	top    = KOKI_IPLIMAGE_GS_ELEM(frame, x0, y0) * (1 - fx)
+		+ KOKI_IPLIMAGE_GS_ELEM(frame, x1, y0) * fx;
+	bottom = KOKI_IPLIMAGE_GS_ELEM(frame, x0, y1) * (1 - fx)
+		+ KOKI_IPLIMAGE_GS_ELEM(frame, x1, y1) * fx;
+
+	return (uint8_t)(top * (1 - fy) + bottom * fy + 0.5f);
+
+}
+
+
+
+/**
+ * @brief checks whether a 64 bit intermediate fits in a \c koki_fixed_t
+ */
+static bool fits_fixed(int64_t v)
+{
+
+	return v >= INT32_MIN && v <= INT32_MAX;
+
+}
+
+
+
+/**
+ * @brief computes the projective mapping of the unit square on to a quad,
+ *        in fixed-point
+ *
+ * This is koki_homography_from_quad() with 64 bit intermediates.
+ *
+ * @param quad  the 4 vertices, as for koki_homography_from_quad()
+ * @param H     where to store the mapping
+ * @return      FALSE if the quad is degenerate or the mapping can't be
+ *              represented, TRUE otherwise
+ */
+bool koki_homography_fixed_from_quad(const koki_fixed_point2_t quad[4],
+				     koki_homography_fixed_t *H)
+{
+
+	int64_t sx, sy, dx1, dx2, dy1, dy2, den, g, h, v[6];
+
+	assert(quad != NULL && H != NULL);
+
+	sx = (int64_t)quad[0].x - quad[1].x + quad[2].x - quad[3].x;
+	sy = (int64_t)quad[0].y - quad[1].y + quad[2].y - quad[3].y;
+
+	dx1 = (int64_t)quad[1].x - quad[2].x;
+	dx2 = (int64_t)quad[3].x - quad[2].x;
+	dy1 = (int64_t)quad[1].y - quad[2].y;
+	dy2 = (int64_t)quad[3].y - quad[2].y;
+
+	/* Q32 */
+	den = dx1 * dy2 - dx2 * dy1;
+
+	if (den == 0)
+		return FALSE;
+
+	g = koki_fixed_div64(sx * dy2 - dx2 * sy, den, KOKI_HOMOGRAPHY_GH_SHIFT);
+	h = koki_fixed_div64(dx1 * sy - sx * dy1, den, KOKI_HOMOGRAPHY_GH_SHIFT);
+
+	if (!fits_fixed(g) || !fits_fixed(h))
+		return FALSE;
+
+	v[0] = quad[1].x - (int64_t)quad[0].x
+		+ (g * quad[1].x >> KOKI_HOMOGRAPHY_GH_SHIFT);
+	v[1] = quad[3].x - (int64_t)quad[0].x
+		+ (h * quad[3].x >> KOKI_HOMOGRAPHY_GH_SHIFT);
+	v[2] = quad[1].y - (int64_t)quad[0].y
+		+ (g * quad[1].y >> KOKI_HOMOGRAPHY_GH_SHIFT);
+	v[3] = quad[3].y - (int64_t)quad[0].y
+		+ (h * quad[3].y >> KOKI_HOMOGRAPHY_GH_SHIFT);
+
+	for (uint8_t i=0; i<4; i++)
+		if (!fits_fixed(v[i]))
+			return FALSE;
+
+	H->a = v[0];
+	H->b = v[1];
+	H->c = quad[0].x;
+
+	H->d = v[2];
+	H->e = v[3];
+	H->f = quad[0].y;
+
+	H->g = g;
+	H->h = h;
+
+	return TRUE;
+
+}
+
+
+
+/**
+ * @brief maps a point in the unit square to the image, in fixed-point
+ *
+ * @param H  the mapping
+ * @param u  the X co-ordinate in the unit square
+ * @param v  the Y co-ordinate in the unit square
+ * @return   the corresponding image point, or the quad's first vertex if
+ *           the point is beyond the quad's horizon
+ */
+koki_fixed_point2_t koki_homography_fixed_map(const koki_homography_fixed_t *H,
+					      koki_fixed_t u, koki_fixed_t v)
+{
+
+	koki_fixed_point2_t p;
+	int64_t w, x, y;
+
+	/* Q24 */
+	w = ((int64_t)1 << KOKI_HOMOGRAPHY_GH_SHIFT)
+		+ (((int64_t)H->g * u + (int64_t)H->h * v) >> KOKI_FIXED_SHIFT);
+
+	if (w <= 0){
+		p.x = H->c;
+		p.y = H->f;
+		return p;
+	}
+
+	/* Q16 */
+	x = (((int64_t)H->a * u + (int64_t)H->b * v) >> KOKI_FIXED_SHIFT) + H->c;
+	y = (((int64_t)H->d * u + (int64_t)H->e * v) >> KOKI_FIXED_SHIFT) + H->f;
+
+	x = x * ((int64_t)1 << KOKI_HOMOGRAPHY_GH_SHIFT) / w;
+	y = y * ((int64_t)1 << KOKI_HOMOGRAPHY_GH_SHIFT) / w;
+
+	p.x = CLAMP(x, INT32_MIN, INT32_MAX);
+	p.y = CLAMP(y, INT32_MIN, INT32_MAX);
+
+	return p;
+
+}
+
+
+
+/**
+ * @brief samples a greyscale image at the image point corresponding to a
+ *        point in the unit square, using bilinear interpolation, in
+ *        fixed-point
+ *
+ * The interpolation weights have 8 bits.  Points falling outside the
+ * image are clamped to its edge.
+ *
+ * @param H      the mapping
+ * @param frame  the greyscale image to sample
+ * @param u      the X co-ordinate in the unit square
+ * @param v      the Y co-ordinate in the unit square
+ * @return       the interpolated grey level
+ */
+uint8_t koki_homography_fixed_sample(const koki_homography_fixed_t *H,
+				     const IplImage *frame,
+				     koki_fixed_t u, koki_fixed_t v)
+{
+
+	koki_fixed_point2_t p;
+	int x0, y0, x1, y1;
+	uint32_t fx, fy, top, bottom;
+
+	assert(frame != NULL && frame->nChannels == 1);
+
+	p = koki_homography_fixed_map(H, u, v);
+
+	p.x = CLAMP(p.x, 0, KOKI_FIXED_FROM_INT(frame->width - 1));
+	p.y = CLAMP(p.y, 0, KOKI_FIXED_FROM_INT(frame->height - 1));
+
+	x0 = p.x >> KOKI_FIXED_SHIFT;
+	y0 = p.y >> KOKI_FIXED_SHIFT;
+	x1 = x0 + 1 < frame->width  ? x0 + 1 : x0;
+	y1 = y0 + 1 < frame->height ? y0 + 1 : y0;
+
+	fx = (p.x >> 8) & 0xFF;
+	fy = (p.y >> 8) & 0xFF;
+
+	top    = KOKI_IPLIMAGE_GS_ELEM(frame, x0, y0) * (256 - fx)
+		+ KOKI_IPLIMAGE_GS_ELEM(frame, x1, y0) * fx;
+	bottom = KOKI_IPLIMAGE_GS_ELEM(frame, x0, y1) * (256 - fx)
+		+ KOKI_IPLIMAGE_GS_ELEM(frame, x1, y1) * fx;
+
+	return (top * (256 - fy) + bottom * fy + (1 << 15)) >> 16;
+
+}
@@ -22,6 +22,8 @@
 
 #include <cv.h>
 
+#include "allocator.h"
+
 #include "image.h"
 
 /**
@@ -36,3 +38,45 @@ void koki_image_free(IplImage *image)
 	cvReleaseImage(&image);
 
 }
+
+
+
+/**
+ * @brief initialises an image header, usually on the stack, with pixels
+ *        allocated by koki_malloc()
+ *
+ * Unlike an image from \c cvCreateImage(), this is released with
+ * koki_image_release_data(), never \c cvReleaseImage().
+ *
+ * @param image     the header to initialise
+ * @param size      the image's size
+ * @param depth     the pixel depth, e.g. \c IPL_DEPTH_8U
+ * @param channels  the number of channels
+ */
+void koki_image_init(IplImage *image, CvSize size, int depth, int channels)
+{
+
+	assert(image != NULL);
+
+	cvInitImageHeader(image, size, depth, channels, IPL_ORIGIN_TL, 4);
+	image->imageData = image->imageDataOrigin =
+		koki_malloc(image->imageSize);
+
+}
+
+
+
+/**
+ * @brief frees the pixels of an image initialised by koki_image_init()
+ *
+ * @param image  the image, whose header is left for the caller
+ */
+void koki_image_release_data(IplImage *image)
+{
+
+	assert(image != NULL);
+
+	koki_free(image->imageDataOrigin);
+	image->imageData = image->imageDataOrigin = NULL;
+
+}
@@ -23,6 +23,8 @@
 
 #include "integral-image.h"
 #include "labelling.h"
+#include "simd.h"
+#include "allocator.h"
 
 /* Within this file it's useful to have this macro available */
 #define ii_pix( img, x, y ) koki_integral_image_pixel( img, x, y )
@@ -40,20 +42,17 @@ koki_integral_image_t* koki_integral_image_new( const IplImage *src,
 {
 	koki_integral_image_t *ii;
 
-	ii = malloc( sizeof(koki_integral_image_t) );
-	assert( ii != NULL );
+	ii = koki_malloc( sizeof(koki_integral_image_t) );
 
 	ii->src = src;
 	ii->w = src->width;
 	ii->h = src->height;
-	ii->data = malloc( sizeof(uint32_t) * ii->w * ii->h );
-	assert( ii->data != NULL );
+	ii->data = koki_malloc( sizeof(uint32_t) * ii->w * ii->h );
 
 	ii->complete_x = 0;
 	ii->complete_y = 0;
 
-	ii->sum = calloc( ii->w, sizeof(uint32_t) );
-	assert( ii->sum != NULL );
+	ii->sum = koki_calloc( ii->w, sizeof(uint32_t) );
 
 	if( complete_now )
 		koki_integral_image_advance( ii, ii->w - 1, ii->h - 1 );
@@ -68,12 +67,9 @@ koki_integral_image_t* koki_integral_image_new( const IplImage *src,
  */
 void koki_integral_image_free( koki_integral_image_t *ii )
 {
-	free( ii->data );
-
-	if( ii->sum != NULL )
-		free( ii->sum );
-
-	free( ii );
+	koki_free( ii->data );
+	koki_free( ii->sum );
+	koki_free( ii );
 }
 
 /**
@@ -109,6 +105,7 @@ static void update_pixel( koki_integral_image_t *ii,
 void koki_integral_image_advance( koki_integral_image_t *ii,
 				  uint16_t target_x, uint16_t target_y )
 {
+	const koki_simd_kernels_t *simd = koki_simd_kernels();
 	uint16_t x, y;
 	assert( target_x < ii->w );
 	assert( target_y < ii->h );
@@ -119,10 +116,13 @@ void koki_integral_image_advance( koki_integral_image_t *ii,
 			update_pixel( ii, x, y );
 	ii->complete_x = target_x + 1;
 
-	/* Now advance in the y-direction */
-	for( x=0; x < ii->complete_x; x++ )
-		for( y = ii->complete_y; y <= target_y; y++ )
-			update_pixel( ii, x, y );
+	/* Now advance in the y-direction, a row at a time */
+	for( y = ii->complete_y; y <= target_y; y++ )
+		simd->integral_row( (const uint8_t*)ii->src->imageData
+				    + ii->src->widthStep * y,
+				    ii->sum,
+				    &koki_integral_image_pixel( ii, 0, y ),
+				    ii->complete_x );
 	ii->complete_y = target_y + 1;
 }
 
@@ -24,10 +24,12 @@
 #include <glib.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 #include <cv.h>
 
 #include "labelling.h"
 #include "integral-image.h"
+#include "allocator.h"
 #include "threshold.h"
 
 #define KOKI_MIN_REGION_MASS 64
@@ -49,16 +51,14 @@ koki_labelled_image_t* koki_labelled_image_new(uint16_t w, uint16_t h)
 
 	/* allocate space for a labelled image */
 	koki_labelled_image_t *labelled_image;
-	labelled_image = malloc(sizeof(koki_labelled_image_t));
-	assert(labelled_image != NULL);
+	labelled_image = koki_malloc(sizeof(koki_labelled_image_t));
 
 	labelled_image->w = w;
 	labelled_image->h = h;
 
 	/* alocate the label data array */
 	uint32_t data_size = (w+2) * (h+2) * sizeof(label_t);
-	labelled_image->data = malloc(data_size);
-	assert(labelled_image->data != NULL);
+	labelled_image->data = koki_malloc(data_size);
 
 	/* init a GArray for label aliases */
 	labelled_image->aliases = g_array_new(FALSE,
@@ -99,10 +99,10 @@ koki_labelled_image_t* koki_labelled_image_new(uint16_t w, uint16_t h)
 void koki_labelled_image_free(koki_labelled_image_t *labelled_image)
 {
 
-	free(labelled_image->data);
+	koki_free(labelled_image->data);
 	g_array_free(labelled_image->aliases, TRUE);
 	g_array_free(labelled_image->clips, TRUE);
-	free(labelled_image);
+	koki_free(labelled_image);
 
 }
 
@@ -511,9 +511,13 @@ koki_labelled_image_t* koki_label_adaptive( koki_t *koki,
 	koki_integral_image_t *iimg;
 	koki_labelled_image_t *lmg;
 	IplImage *thresh_img = NULL;
+	koki_alloc_scope_t scope;
 
 	assert(frame != NULL && frame->nChannels == 1);
 
+	koki_alloc_scope_enter( &scope, &koki->allocator,
+				koki->allocator_userdata );
+
 	iimg = koki_integral_image_new( frame, false );
 	lmg = koki_labelled_image_new( frame->width, frame->height );
 
@@ -567,5 +571,261 @@ koki_labelled_image_t* koki_label_adaptive( koki_t *koki,
 
 	koki_integral_image_free( iimg );
 
+	koki_alloc_scope_leave( &scope );
+
+	return lmg;
+}
+
+/**
+ * @brief threshold and label the provided image, the straightforward way
+ *
+ * This is the reference for koki_label_adaptive(), which it should match
+ * exactly: the whole frame is thresholded with \c koki_threshold_adaptive
+ * and then labelled with \c koki_label_image.
+ *
+ * @param koki           the libkoki context
+ * @param frame          the input image to label
+ * @param window_size    the size of window to use around the threshold
+ * @param thresh_margin  the margin around the adaptively-calculated threshold
+ *                       to accept
+ * @return the labelled image
+ */
+koki_labelled_image_t* koki_label_reference( koki_t *koki,
+					     const IplImage *frame,
+					     uint16_t window_size,
+					     int16_t thresh_margin )
+{
+	koki_labelled_image_t *lmg;
+	IplImage *thresh_img;
+	koki_alloc_scope_t scope;
+
+	assert(frame != NULL && frame->nChannels == 1);
+
+	koki_alloc_scope_enter( &scope, &koki->allocator,
+				koki->allocator_userdata );
+
+	/* the thresholder doesn't modify the frame */
+	thresh_img = koki_threshold_adaptive( (IplImage*)frame, window_size,
+					      thresh_margin, KOKI_ADAPTIVE_MEAN );
+
+	koki_log( koki, "thresholded image\n", thresh_img );
+
+	/* thresholded pixels are either 0 or 255 */
+	lmg = koki_label_image( thresh_img, 127 );
+
+	cvReleaseImage( &thresh_img );
+
+	koki_alloc_scope_leave( &scope );
+
 	return lmg;
 }
+
+/**
+ * @brief the working state of koki_label_sparse()
+ */
+typedef struct {
+	const IplImage *frame;
+	koki_integral_image_t *iimg;
+	koki_labelled_image_t *lmg;
+	uint16_t window_size;
+	int16_t thresh_margin;
+	uint8_t *tested;      /* whether each pixel has been thresholded yet */
+	GArray *stack;        /* offsets of the pixels left to grow from */
+	IplImage *thresh_img; /* the thresholded image to log, or NULL */
+} sparse_state_t;
+
+/**
+ * @brief thresholds a pixel for koki_label_sparse(), marking it as tested
+ *
+ * @param st  the sparse labelling state
+ * @param x   the X co-ordinate
+ * @param y   the Y co-ordinate
+ * @return    TRUE if the pixel is dark
+ */
+static bool sparse_test_pixel( sparse_state_t *st, uint16_t x, uint16_t y )
+{
+	CvRect win;
+	bool light;
+
+	st->tested[ y * st->frame->width + x ] = 1;
+
+	koki_threshold_adaptive_calc_window( st->frame, &win,
+					     st->window_size, x, y );
+	light = koki_threshold_adaptive_pixel( st->frame, st->iimg, &win,
+					       x, y, st->thresh_margin );
+
+	if( st->thresh_img != NULL )
+		KOKI_IPLIMAGE_GS_ELEM( st->thresh_img, x, y ) = light ? 0xff : 0;
+
+	return !light;
+}
+
+/**
+ * @brief labels the whole 8-connected dark region containing a seed pixel
+ *
+ * The region's neighbours are thresholded as it grows, so only the region
+ * and the pixels bordering it are looked at.  The region gets a label of
+ * its own, which is its own alias, and its clip region is filled in as it
+ * goes.
+ *
+ * @param st  the sparse labelling state
+ * @param x   the X co-ordinate of the (dark) seed pixel
+ * @param y   the Y co-ordinate of the seed pixel
+ */
+static void sparse_grow_region( sparse_state_t *st, uint16_t x, uint16_t y )
+{
+	koki_labelled_image_t *lmg = st->lmg;
+	const uint16_t w = lmg->w, h = lmg->h;
+	koki_clip_region_t clip;
+	label_t label;
+	uint32_t i;
+
+	/* Check we do not exceed the maximum number of labels */
+	assert( lmg->aliases->len != KOKI_LABEL_MAX );
+
+	label = lmg->aliases->len + 1;
+	g_array_append_val( lmg->aliases, label );
+
+	clip.mass = 0;
+	clip.min.x = clip.max.x = x;
+	clip.min.y = clip.max.y = y;
+
+	KOKI_LABELLED_IMAGE_LABEL( lmg, x, y ) = label;
+	i = y * w + x;
+	g_array_append_val( st->stack, i );
+
+	while( st->stack->len > 0 ) {
+		uint16_t px, py;
+
+		i = g_array_index( st->stack, uint32_t, st->stack->len - 1 );
+		g_array_set_size( st->stack, st->stack->len - 1 );
+
+		px = i % w;
+		py = i / w;
+
+		clip.mass++;
+		if (px > clip.max.x)
+			clip.max.x = px;
+		if (py > clip.max.y)
+			clip.max.y = py;
+		if (px < clip.min.x)
+			clip.min.x = px;
+		if (py < clip.min.y)
+			clip.min.y = py;
+
+		for( int8_t dy=-1; dy<=1; dy++ )
+			for( int8_t dx=-1; dx<=1; dx++ ) {
+				int32_t nx = px + dx, ny = py + dy;
+
+				if( nx < 0 || ny < 0 || nx >= w || ny >= h
+				    || st->tested[ ny * w + nx ] )
+					continue;
+
+				if( !sparse_test_pixel( st, nx, ny ) )
+					continue;
+
+				KOKI_LABELLED_IMAGE_LABEL( lmg, nx, ny ) = label;
+				i = ny * w + nx;
+				g_array_append_val( st->stack, i );
+			}
+	}
+
+	g_array_append_val( lmg->clips, clip );
+}
+
+/**
+ * @brief threshold and label only the regions of the provided image that
+ *        cross a sparse grid of scanlines
+ *
+ * Only every \c stride-th row and every \c stride-th column is thresholded
+ * to begin with.  Each dark pixel found on them seeds a region, which is
+ * grown outwards, thresholding only the pixels it reaches.  In a frame that
+ * is mostly background, most pixels are never thresholded or labelled.
+ *
+ * A connected region that misses every scanline lies within a single
+ * cell of the grid, so has at most \c (stride-1)^2 pixels.  Every region
+ * of that size or more is labelled exactly as koki_label_adaptive() would,
+ * with the same mass and clip region, and so with a \c stride of up to 8
+ * every region that koki_label_useable() accepts is found.  Larger strides
+ * can only miss regions smaller than \c (stride-1)^2 pixels, which suits
+ * scenes where the markers are known to be bigger than that.
+ *
+ * Regions are labelled in the order their first scanline pixel is met,
+ * row by row, and each label is its own alias.  Unvisited pixels are
+ * labelled \c 0, as are light ones; in the logged thresholded image they
+ * are grey.
+ *
+ * @param koki           the libkoki context
+ * @param frame          the input image to label
+ * @param window_size    the size of window to use around the threshold
+ * @param thresh_margin  the margin around the adaptively-calculated threshold
+ *                       to accept
+ * @param stride         the spacing of the scanlines, in pixels
+ * @return the labelled image
+ */
+koki_labelled_image_t* koki_label_sparse( koki_t *koki,
+					  const IplImage *frame,
+					  uint16_t window_size,
+					  int16_t thresh_margin,
+					  uint16_t stride )
+{
+	sparse_state_t st;
+	koki_alloc_scope_t scope;
+
+	assert(frame != NULL && frame->nChannels == 1);
+	assert(stride > 0);
+
+	koki_alloc_scope_enter( &scope, &koki->allocator,
+				koki->allocator_userdata );
+
+	st.frame = frame;
+	st.window_size = window_size;
+	st.thresh_margin = thresh_margin;
+
+	/* regions can grow anywhere, so the integral image is needed in full */
+	st.iimg = koki_integral_image_new( frame, true );
+
+	st.lmg = koki_labelled_image_new( frame->width, frame->height );
+	memset( st.lmg->data, 0,
+		(frame->width+2) * (frame->height+2) * sizeof(label_t) );
+
+	st.tested = koki_calloc( frame->width * frame->height, sizeof(uint8_t) );
+	st.stack = g_array_new( FALSE, FALSE, sizeof(uint32_t) );
+
+	st.thresh_img = NULL;
+	if( koki_is_logging( koki ) ) {
+		st.thresh_img = cvCreateImage( cvSize( frame->width,
+						       frame->height ),
+					       IPL_DEPTH_8U, 1 );
+		g_assert( st.thresh_img != NULL );
+
+		memset( st.thresh_img->imageData, 0x80,
+			st.thresh_img->widthStep * frame->height );
+	}
+
+	for( uint16_t y=0; y<frame->height; y++ ) {
+		/* every pixel of a scanline, otherwise just the columns */
+		uint16_t step = y % stride == 0 ? 1 : stride;
+
+		for( uint32_t x=0; x<frame->width; x+=step ) {
+			if( st.tested[ y * frame->width + x ] )
+				continue;
+
+			if( sparse_test_pixel( &st, x, y ) )
+				sparse_grow_region( &st, x, y );
+		}
+	}
+
+	if( st.thresh_img != NULL ) {
+		koki_log( koki, "thresholded image\n", st.thresh_img );
+		cvReleaseImage( &st.thresh_img );
+	}
+
+	g_array_free( st.stack, TRUE );
+	koki_free( st.tested );
+	koki_integral_image_free( st.iimg );
+
+	koki_alloc_scope_leave( &scope );
+
+	return st.lmg;
+}
@@ -22,6 +22,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <math.h>
 #include <cv.h>
 #include <glib.h>
 
@@ -29,13 +30,22 @@
 #include "code_grid.h"
 #include "unwarp.h"
 #include "threshold.h"
+#include "image.h"
 #include "camera.h"
 #include "labelling.h"
 #include "contour.h"
 #include "pose.h"
 #include "rotation.h"
 #include "bearing.h"
+#include "decode_cache.h"
+#include "accumulate.h"
 #include "debug.h"
+#include "probes.h"
+#include "trace.h"
+#include "perf.h"
+#include "allocator.h"
+#include "edge_quads.h"
+#include "code_batch.h"
 
 #include "marker.h"
 
@@ -53,8 +63,7 @@ koki_marker_t* koki_marker_new(koki_quad_t *quad)
 	koki_marker_t *marker;
 	float sum[2] = {0, 0};
 
-	marker = malloc(sizeof(koki_marker_t));
-	assert(marker != NULL);
+	marker = koki_malloc(sizeof(koki_marker_t));
 
 	/* copy quad vertex values over */
 	for (uint8_t i=0; i<4; i++){
@@ -104,57 +113,68 @@ koki_marker_t* koki_marker_new(koki_quad_t *quad)
 void koki_marker_free(koki_marker_t *marker)
 {
 
-	free(marker);
+	koki_free(marker);
 
 }
 
 
 
 /**
- * @brief recovers the code from a marker, if possible
+ * @brief unwarps and decodes a marker, keeping the thresholded grid
  *
  * @param koki    the libkoki context
  * @param marker  the marker to try and get the code for
  * @param frame   the original image, used to extract the marker's pixels from
- * @return        TRUE if a good code is found, indicating the marker structure
- *                has been changed to reflect this; FALSE if no success
+ * @param grid    where to store the thresholded grid of the marker
+ * @return        TRUE if a good code is found, FALSE otherwise
  */
-bool koki_marker_recover_code( koki_t* koki, koki_marker_t *marker, IplImage *frame )
+static bool recover_code( koki_t* koki, koki_marker_t *marker, IplImage *frame,
+			  koki_grid_t *grid )
 {
 
-	IplImage *unwarped;
-	IplImage *res;
-	koki_grid_t grid;
+	IplImage unwarped;
+	IplImage res;
 	float rotation;
 	int16_t code;
+	bool ok;
 
 	assert(marker != NULL);
 	assert(frame != NULL && frame->nChannels == 1);
 
-	/* unwarp */
-	unwarped = koki_unwarp_marker( koki, marker, frame, 100 );
+	/* unwarp, into pixels from the context's allocator */
+	koki_image_init( &unwarped, cvSize( 100, 100 ), frame->depth, 1 );
+
+#ifdef KOKI_FIXED_POINT
+	if (!koki->reference)
+		ok = koki_unwarp_marker_fixed_to( marker, frame, &unwarped );
+	else
+#endif
+	ok = koki_unwarp_marker_to( koki, marker, frame, &unwarped );
 
 	/* can we continue? */
-	if (unwarped == NULL)
+	if (!ok){
+		koki_image_release_data( &unwarped );
 		return FALSE;
+	}
 
-	koki_log( koki, "unwarped marker\n", unwarped );
+	koki_log( koki, "unwarped marker\n", &unwarped );
 
 	/* Adaptively threshold the marker */
-	res = koki_threshold_adaptive( unwarped, 21, 3, KOKI_ADAPTIVE_MEAN );
-	koki_log( koki, "unwarped and thresholded marker\n", res );
+	koki_image_init( &res, cvSize( 100, 100 ), frame->depth, 1 );
+	koki_threshold_adaptive_to( &unwarped, &res, 21, 3, KOKI_ADAPTIVE_MEAN );
+	koki_log( koki, "unwarped and thresholded marker\n", &res );
 
 	/* Resulting image is already b&w, so a threshold of 127 will do */
-	koki_grid_from_image(res, 127, &grid);
+	koki_grid_from_image(&res, 127, grid);
 
 	/* recover code */
-	code = koki_code_recover_from_grid(&grid, &rotation);
+	code = koki_code_recover_from_grid(grid, &rotation);
 
 	if (code < 0){ /* code not recovered */
 		koki_log( koki, "Failed to recover code from unwarped marker -- discarding\n", NULL );
 
-		cvReleaseImage(&unwarped);
-		cvReleaseImage(&res);
+		koki_image_release_data(&unwarped);
+		koki_image_release_data(&res);
 
 		return FALSE;
 	}
@@ -166,13 +186,587 @@ bool koki_marker_recover_code( koki_t* koki, koki_marker_t *marker, IplImage *fr
 	marker->rotation_offset = rotation;
 
 	/* clean up */
-	cvReleaseImage(&unwarped);
-	cvReleaseImage(&res);
+	koki_image_release_data(&unwarped);
+	koki_image_release_data(&res);
 
 	return TRUE;
 
 }
 
+/**
+ * @brief recovers the code from a marker, if possible
+ *
+ * @param koki    the libkoki context
+ * @param marker  the marker to try and get the code for
+ * @param frame   the original image, used to extract the marker's pixels from
+ * @return        TRUE if a good code is found, indicating the marker structure
+ *                has been changed to reflect this; FALSE if no success
+ */
+bool koki_marker_recover_code( koki_t* koki, koki_marker_t *marker, IplImage *frame )
+{
+
+	koki_grid_t grid;
+	koki_alloc_scope_t scope;
+	bool ret;
+
+	koki_alloc_scope_enter( &scope, &koki->allocator,
+				koki->allocator_userdata );
+	ret = recover_code( koki, marker, frame, &grid );
+	koki_alloc_scope_leave( &scope );
+
+	return ret;
+
+}
+
+/**
+ * @brief recovers the code from a marker, using the context's decode cache
+ *        when it's enabled
+ *
+ * @param koki    the libkoki context
+ * @param marker  the marker to try and get the code for
+ * @param frame   the original image, used to extract the marker's pixels from
+ * @return        TRUE if a good code is found, FALSE otherwise
+ */
+static bool decode_marker( koki_t* koki, koki_marker_t *marker, IplImage *frame )
+{
+
+	koki_grid_t grid;
+
+	if (koki->decode_cache == NULL || koki->reference)
+		return koki_marker_recover_code( koki, marker, frame );
+
+	/* a quick check against a recently decoded quad may be enough */
+	if (koki_decode_cache_verify( koki->decode_cache, marker, frame ))
+		return TRUE;
+
+	if (!recover_code( koki, marker, frame, &grid ))
+		return FALSE;
+
+	koki_decode_cache_store( koki->decode_cache, marker, &grid );
+
+	return TRUE;
+
+}
+
+/**
+ * @brief a comparison function for sorting region numbers by the mass of
+ *        their regions, largest first
+ *
+ * @param a      a pointer to the first \c label_t region number
+ * @param b      a pointer to the second \c label_t region number
+ * @param clips  the \c GArray of \c koki_clip_region_t the regions index
+ * @return       a negative number if \c a's region is larger than \c b's,
+ *               0 if they are the same, positive otherwise
+ */
+static gint compare_region_mass( gconstpointer a, gconstpointer b,
+				 gpointer clips )
+{
+	const koki_clip_region_t *ca, *cb;
+
+	ca = &g_array_index( (GArray*)clips, koki_clip_region_t, *(const label_t*)a );
+	cb = &g_array_index( (GArray*)clips, koki_clip_region_t, *(const label_t*)b );
+
+	return (gint)cb->mass - (gint)ca->mass;
+}
+
+/**
+ * @brief determines whether one clip region lies within another
+ *
+ * @param outer  the enclosing clip region
+ * @param inner  the clip region that may be enclosed
+ * @return       TRUE if \c inner lies within \c outer
+ */
+static bool clip_contains( const koki_clip_region_t *outer,
+			   const koki_clip_region_t *inner )
+{
+	return inner->min.x >= outer->min.x && inner->min.y >= outer->min.y
+		&& inner->max.x <= outer->max.x && inner->max.y <= outer->max.y;
+}
+
+/**
+ * @brief moves the candidates whose clip region lies within another
+ *        candidate's to the end of the list
+ *
+ * The dark code cells of a marker are regions of their own, within the
+ * clip region of the marker's border.  Deferring them means the border is
+ * always decoded first, after which they can be skipped (see
+ * region_in_marker()).  Otherwise, the order of the candidates is kept.
+ *
+ * @param candidates  the \c GArray of \c label_t candidate regions
+ * @param clips       the \c GArray of \c koki_clip_region_t they index
+ */
+static void defer_nested_candidates( GArray *candidates, GArray *clips )
+{
+	GArray *outer, *nested;
+
+	outer = g_array_sized_new( FALSE, FALSE, sizeof(label_t),
+				   candidates->len );
+	nested = g_array_new( FALSE, FALSE, sizeof(label_t) );
+
+	/* there are rarely more than a few hundred candidates, and each
+	   pair costs a handful of comparisons */
+	for (guint c=0; c<candidates->len; c++){
+
+		label_t i = g_array_index( candidates, label_t, c );
+		const koki_clip_region_t *ci, *cj;
+		bool is_nested = FALSE;
+
+		ci = &g_array_index( clips, koki_clip_region_t, i );
+
+		for (guint d=0; d<candidates->len && !is_nested; d++){
+			label_t j = g_array_index( candidates, label_t, d );
+			cj = &g_array_index( clips, koki_clip_region_t, j );
+
+			is_nested = j != i && clip_contains( cj, ci )
+				&& !clip_contains( ci, cj );
+		}
+
+		if (is_nested)
+			g_array_append_val( nested, i );
+		else
+			g_array_append_val( outer, i );
+
+	}//for
+
+	g_array_set_size( candidates, 0 );
+	g_array_append_vals( candidates, outer->data, outer->len );
+	g_array_append_vals( candidates, nested->data, nested->len );
+
+	g_array_free( outer, TRUE );
+	g_array_free( nested, TRUE );
+}
+
+/**
+ * @brief determines whether a point lies within a marker's quadrilateral
+ *
+ * @param marker  the marker
+ * @param x       the point's X co-ordinate in the image
+ * @param y       the point's Y co-ordinate in the image
+ * @return        TRUE if the point is inside (or on the edge of) the quad
+ */
+static bool marker_contains_point( const koki_marker_t *marker,
+				   float x, float y )
+{
+	bool pos = FALSE, neg = FALSE;
+
+	/* the quad is convex, so the point must be on the same side of
+	   every edge */
+	for (uint8_t v=0; v<4; v++){
+		const koki_point2Df_t *a = &marker->vertices[v].image;
+		const koki_point2Df_t *b = &marker->vertices[(v+1) % 4].image;
+		float cross = (b->x - a->x) * (y - a->y) - (b->y - a->y) * (x - a->x);
+
+		if (cross > 0)
+			pos = TRUE;
+		else if (cross < 0)
+			neg = TRUE;
+	}
+
+	return !(pos && neg);
+}
+
+/**
+ * @brief returns the area of a marker's quadrilateral in the image
+ *
+ * @param marker  the marker
+ * @return        the area, in square pixels
+ */
+static float marker_area( const koki_marker_t *marker )
+{
+	float area = 0;
+
+	for (uint8_t v=0; v<4; v++){
+		const koki_point2Df_t *a = &marker->vertices[v].image;
+		const koki_point2Df_t *b = &marker->vertices[(v+1) % 4].image;
+		area += a->x * b->y - b->x * a->y;
+	}
+
+	return fabsf(area) / 2;
+}
+
+/**
+ * @brief determines whether a candidate region belongs to a marker that
+ *        has already been found
+ *
+ * That's the case when the region's clip region lies entirely within the
+ * marker's quad, as the marker's code cells do, or when the centre of the
+ * clip region lies within the quad and the clip region overlaps the
+ * quad's bounding box by more than half, as a second, slightly different
+ * quad around the same marker does.
+ *
+ * @param markers  the markers found so far
+ * @param clip     the candidate's clip region
+ * @return         TRUE if the candidate can be skipped
+ */
+static bool region_in_marker( GPtrArray *markers,
+			      const koki_clip_region_t *clip )
+{
+	float cx = (clip->min.x + clip->max.x) / 2.0;
+	float cy = (clip->min.y + clip->max.y) / 2.0;
+	float clip_area = (float)(clip->max.x - clip->min.x + 1)
+		* (clip->max.y - clip->min.y + 1);
+
+	for (guint m=0; m<markers->len; m++){
+
+		const koki_marker_t *marker = g_ptr_array_index( markers, m );
+		float min_x, min_y, max_x, max_y, overlap;
+
+		if (!marker_contains_point( marker, cx, cy ))
+			continue;
+
+		if (marker_contains_point( marker, clip->min.x, clip->min.y )
+		    && marker_contains_point( marker, clip->max.x, clip->min.y )
+		    && marker_contains_point( marker, clip->min.x, clip->max.y )
+		    && marker_contains_point( marker, clip->max.x, clip->max.y ))
+			return TRUE;
+
+		min_x = max_x = marker->vertices[0].image.x;
+		min_y = max_y = marker->vertices[0].image.y;
+		for (uint8_t v=1; v<4; v++){
+			min_x = MIN( min_x, marker->vertices[v].image.x );
+			max_x = MAX( max_x, marker->vertices[v].image.x );
+			min_y = MIN( min_y, marker->vertices[v].image.y );
+			max_y = MAX( max_y, marker->vertices[v].image.y );
+		}
+
+		overlap = MAX( 0, MIN( max_x, clip->max.x + 1 ) - MAX( min_x, clip->min.x ) )
+			* MAX( 0, MIN( max_y, clip->max.y + 1 ) - MAX( min_y, clip->min.y ) );
+
+		if (overlap > clip_area / 2)
+			return TRUE;
+
+	}//for
+
+	return FALSE;
+}
+
+/**
+ * @brief finds a marker that duplicates another
+ *
+ * Two markers are the same if they have the same code and either one's
+ * centre lies within the other's quad.
+ *
+ * @param markers  the markers found so far
+ * @param marker   the newly decoded marker
+ * @return         the index of the duplicate in \c markers, or -1 if
+ *                 there isn't one
+ */
+static gint find_duplicate( GPtrArray *markers, const koki_marker_t *marker )
+{
+	for (guint m=0; m<markers->len; m++){
+
+		const koki_marker_t *other = g_ptr_array_index( markers, m );
+
+		if (other->code != marker->code)
+			continue;
+
+		if (marker_contains_point( other, marker->centre.image.x,
+					   marker->centre.image.y )
+		    || marker_contains_point( marker, other->centre.image.x,
+					      other->centre.image.y ))
+			return m;
+
+	}
+
+	return -1;
+}
+
+/**
+ * @brief decodes a single candidate marker
+ *
+ * @param koki    the libkoki context
+ * @param frame   the input image
+ * @param marker  the candidate
+ * @param i       the candidate's number, for tracing
+ * @return        TRUE if the candidate's code was recovered
+ */
+static bool decode_candidate( koki_t *koki, IplImage *frame,
+			      koki_marker_t *marker, uint32_t i )
+{
+	bool decoded;
+
+	KOKI_TRACE_BEGIN( koki, "recover_code", i );
+	KOKI_PERF_BEGIN( koki, KOKI_PERF_DECODE );
+	decoded = decode_marker(koki, marker, frame);
+	KOKI_PERF_END( koki, KOKI_PERF_DECODE );
+	KOKI_TRACE_END( koki, "recover_code", i );
+
+	return decoded;
+}
+
+/**
+ * @brief if a candidate marker was decoded, estimates its pose and adds it
+ *        to the markers found so far
+ *
+ * @param koki           the libkoki context
+ * @param frame          the input image
+ * @param markers        the markers found so far
+ * @param marker         the candidate, which is either taken over by
+ *                       \c markers or freed
+ * @param i              the candidate's number, for tracing and probes
+ * @param decoded        whether the candidate's code was recovered from
+ *                       this frame alone
+ * @param fp             the marker size function, or NULL
+ * @param marker_width   the marker size to use if \c fp is NULL
+ * @param params         the camera params
+ * @param found          which expected codes have been found
+ * @param expected_left  the number of expected codes yet to be found
+ */
+static void process_marker( koki_t *koki, IplImage *frame,
+			    GPtrArray *markers, koki_marker_t *marker,
+			    uint32_t i, bool decoded,
+			    float (*fp)(int), float marker_width,
+			    koki_camera_params_t *params, bool found[256],
+			    uint16_t *expected_left )
+{
+	uint32_t frame_id = koki->stats.frame_id;
+	gint dup;
+
+	/* a small marker may only become clear over several frames */
+	if (!decoded && koki->accumulator != NULL && !koki->reference){
+
+		KOKI_TRACE_BEGIN( koki, "accumulate", i );
+		decoded = koki_accumulator_decode( koki->accumulator,
+						   marker, frame );
+		KOKI_TRACE_END( koki, "accumulate", i );
+
+		if (decoded)
+			koki->stats.accumulated_markers++;
+	}
+
+	/* keep the bigger of two quads around the same marker */
+	dup = decoded && !koki->reference
+		? find_duplicate( markers, marker ) : -1;
+
+	if (dup >= 0 && marker_area( marker )
+	    <= marker_area( g_ptr_array_index( markers, dup ) )){
+
+		KOKI_PROBE3( decode__done, frame_id, i, marker->code );
+		KOKI_PROBE3( candidate, frame_id, i,
+			     KOKI_PROBE_REJECT_DUPLICATE );
+
+		koki->stats.duplicate_markers++;
+		koki_marker_free(marker);
+
+	} else if (decoded){
+		float size;
+		assert(marker != NULL);
+
+		KOKI_PROBE3( decode__done, frame_id, i, marker->code );
+
+		if( fp == NULL )
+			size = marker_width;
+		else
+			size = fp(marker->code);
+
+		KOKI_TRACE_BEGIN( koki, "pose", i );
+		KOKI_PERF_BEGIN( koki, KOKI_PERF_POSE );
+#ifdef KOKI_FIXED_POINT
+		if (!koki->reference){
+			koki_pose_estimate_fixed(marker, size, params);
+			koki_rotation_estimate_fixed(marker);
+			koki_bearing_estimate_fixed(marker);
+		} else
+#endif
+		{
+			koki_pose_estimate(marker, size, params);
+			koki_rotation_estimate(marker);
+			koki_bearing_estimate(marker);
+		}
+		KOKI_PERF_END( koki, KOKI_PERF_POSE );
+		KOKI_TRACE_END( koki, "pose", i );
+
+		KOKI_PROBE3( pose__done, frame_id, marker->code,
+			     (int32_t)(marker->distance * 1000) );
+		KOKI_PROBE3( candidate, frame_id, i, KOKI_PROBE_ACCEPTED );
+
+		if (*expected_left > 0
+		    && koki_is_expected_code(koki, marker->code)
+		    && !found[marker->code]){
+			found[marker->code] = TRUE;
+			(*expected_left)--;
+		}
+
+		/* append the marker to the output array, or have it
+		   replace the smaller duplicate */
+		if (dup >= 0){
+			koki_marker_free( g_ptr_array_index( markers, dup ) );
+			g_ptr_array_index( markers, dup ) = marker;
+			koki->stats.duplicate_markers++;
+		} else {
+			g_ptr_array_add(markers, marker);
+		}
+
+	} else {
+
+		KOKI_PROBE3( decode__done, frame_id, i, -1 );
+		KOKI_PROBE3( candidate, frame_id, i, KOKI_PROBE_REJECT_DECODE );
+
+		/* not a useful marker, free it */
+		koki_marker_free(marker);
+
+	}
+}
+
+/**
+ * @brief candidates waiting to be decoded together
+ */
+typedef struct {
+	GPtrArray *markers;                 /**< the candidates */
+	uint32_t ids[KOKI_CODE_BATCH_SIZE]; /**< their numbers, for tracing
+					         and probes */
+} decode_batch_t;
+
+/**
+ * @brief decodes the candidates waiting in a batch together, then
+ *        processes each of them in turn
+ *
+ * Candidates that the decode cache verifies aren't decoded again.
+ *
+ * @param koki           the libkoki context
+ * @param frame          the input image
+ * @param batch          the batch, which is left empty
+ * @param markers        the markers found so far
+ * @param fp             the marker size function, or NULL
+ * @param marker_width   the marker size to use if \c fp is NULL
+ * @param params         the camera params
+ * @param found          which expected codes have been found
+ * @param expected_left  the number of expected codes yet to be found
+ */
+static void flush_batch( koki_t *koki, IplImage *frame, decode_batch_t *batch,
+			 GPtrArray *markers, float (*fp)(int),
+			 float marker_width, koki_camera_params_t *params,
+			 bool found[256], uint16_t *expected_left )
+{
+	koki_marker_t *todo[KOKI_CODE_BATCH_SIZE];
+	uint8_t todo_index[KOKI_CODE_BATCH_SIZE], num_todo = 0;
+	bool decoded[KOKI_CODE_BATCH_SIZE];
+	int16_t codes[KOKI_CODE_BATCH_SIZE];
+	float rotations[KOKI_CODE_BATCH_SIZE];
+	koki_grid_t grids[KOKI_CODE_BATCH_SIZE];
+
+	if (batch->markers->len == 0)
+		return;
+
+	KOKI_TRACE_BEGIN( koki, "recover_code", -1 );
+	KOKI_PERF_BEGIN( koki, KOKI_PERF_DECODE );
+
+	for (guint k=0; k<batch->markers->len; k++){
+
+		koki_marker_t *marker = g_ptr_array_index( batch->markers, k );
+
+		decoded[k] = koki->decode_cache != NULL
+			&& koki_decode_cache_verify( koki->decode_cache,
+						     marker, frame );
+
+		if (!decoded[k]){
+			todo_index[num_todo] = k;
+			todo[num_todo++] = marker;
+		}
+
+	}//for
+
+	koki_code_recover_batch( frame, todo, num_todo, codes, rotations,
+				 koki->decode_cache != NULL ? grids : NULL );
+
+	for (uint8_t t=0; t<num_todo; t++){
+
+		if (codes[t] < 0)
+			continue;
+
+		todo[t]->code = koki_code_translation( codes[t] );
+		todo[t]->rotation_offset = rotations[t];
+		decoded[todo_index[t]] = TRUE;
+
+		if (koki->decode_cache != NULL)
+			koki_decode_cache_store( koki->decode_cache, todo[t],
+						 &grids[t] );
+
+	}//for
+
+	KOKI_PERF_END( koki, KOKI_PERF_DECODE );
+	KOKI_TRACE_END( koki, "recover_code", -1 );
+
+	for (guint k=0; k<batch->markers->len; k++)
+		process_marker( koki, frame, markers,
+				g_ptr_array_index( batch->markers, k ),
+				batch->ids[k], decoded[k], fp, marker_width,
+				params, found, expected_left );
+
+	g_ptr_array_set_size( batch->markers, 0 );
+}
+
+/**
+ * @brief finds markers among the quads of the gradient-based detector
+ *
+ * Quads centred within a marker that's already been found are skipped.
+ * The quads' vertices are intersections of lines fitted to whole sides,
+ * so aren't refined.
+ *
+ * @param koki           the libkoki context
+ * @param frame          the input image
+ * @param markers        the markers found so far
+ * @param first_id       the number to give the first quad, for tracing
+ *                       and probes
+ * @param fp             the marker size function, or NULL
+ * @param marker_width   the marker size to use if \c fp is NULL
+ * @param params         the camera params
+ * @param found          which expected codes have been found
+ * @param expected_left  the number of expected codes yet to be found
+ */
+static void find_edge_markers( koki_t *koki, IplImage *frame,
+			       GPtrArray *markers, uint32_t first_id,
+			       float (*fp)(int), float marker_width,
+			       koki_camera_params_t *params, bool found[256],
+			       uint16_t *expected_left )
+{
+	uint32_t frame_id = koki->stats.frame_id;
+	GPtrArray *quads;
+
+	KOKI_TRACE_BEGIN( koki, "edge_quads", -1 );
+	KOKI_PERF_BEGIN( koki, KOKI_PERF_EDGE_QUADS );
+	quads = koki_edge_quads_find( koki, frame, NULL );
+	KOKI_PERF_END( koki, KOKI_PERF_EDGE_QUADS );
+	KOKI_TRACE_END( koki, "edge_quads", -1 );
+
+	koki->stats.edge_quads = quads->len;
+
+	for (guint q=0; q<quads->len; q++){
+
+		koki_quad_t *quad = g_ptr_array_index( quads, q );
+		uint32_t i = first_id + q;
+		koki_marker_t *marker;
+		bool nested = FALSE;
+
+		if (koki->num_expected_codes > 0 && !koki->reference
+		    && *expected_left == 0)
+			break;
+
+		marker = koki_marker_new( quad );
+		assert(marker != NULL);
+
+		for (guint m=0; m<markers->len && !nested; m++)
+			nested = marker_contains_point( g_ptr_array_index( markers, m ),
+							marker->centre.image.x,
+							marker->centre.image.y );
+
+		if (nested){
+			KOKI_PROBE3( candidate, frame_id, i, KOKI_PROBE_REJECT_NESTED );
+			koki->stats.nested_candidates++;
+			koki_marker_free( marker );
+			continue;
+		}
+
+		process_marker( koki, frame, markers, marker, i,
+				decode_candidate( koki, frame, marker, i ),
+				fp, marker_width, params, found,
+				expected_left );
+
+	}//for
+
+	koki_edge_quads_free( quads );
+}
+
 /**
  * @brief Find the markers in the given frame.  This function can
  *        take the physical size of the markers as a constant, or a
@@ -201,17 +795,56 @@ static GPtrArray* find_markers( koki_t *koki,
 	koki_quad_t *quad;
 	koki_marker_t *marker;
 	GPtrArray *markers = NULL;
+	GArray *candidates;
+	uint16_t expected_left;
+	bool found[256] = { FALSE };
+	uint32_t frame_id;
+	koki_alloc_scope_t scope;
 	IplImage *contours = NULL, *disc_contours = NULL;
+	decode_batch_t batch = { NULL };
 
 	assert(frame != NULL && frame->nChannels == 1);
 
 	koki_log( koki, "find_markers() input image\n", frame );
 
-	/* labelling */
-	labelled_image = koki_label_adaptive( koki, frame, 11, 5 );
+	koki_alloc_scope_enter( &scope, &koki->allocator,
+				koki->allocator_userdata );
 
-	if (labelled_image == NULL)
+	frame_id = ++koki->stats.frame_id;
+	KOKI_PROBE3( frame__start, frame_id, frame->width, frame->height );
+	KOKI_TRACE_BEGIN( koki, "find_markers", -1 );
+
+	if (koki->perf != NULL)
+		koki_perf_reset( koki->perf );
+	KOKI_PERF_BEGIN( koki, KOKI_PERF_FRAME );
+
+	/* labelling */
+	KOKI_TRACE_BEGIN( koki, "label", -1 );
+	KOKI_PERF_BEGIN( koki, KOKI_PERF_LABEL );
+	if (koki->reference)
+		labelled_image = koki_label_reference( koki, frame, 11, 5 );
+	else if (koki->label_stride > 1)
+		labelled_image = koki_label_sparse( koki, frame, 11, 5,
+						    koki->label_stride );
+	else
+		labelled_image = koki_label_adaptive( koki, frame, 11, 5 );
+	KOKI_PERF_END( koki, KOKI_PERF_LABEL );
+	KOKI_TRACE_END( koki, "label", -1 );
+
+	if (labelled_image == NULL){
+		/* nothing found, and nothing skipped */
+		KOKI_PROBE3( frame__end, frame_id, 0, 0 );
+		KOKI_PERF_END( koki, KOKI_PERF_FRAME );
+		KOKI_TRACE_END( koki, "find_markers", -1 );
+		koki_alloc_scope_leave( &scope );
 		return NULL;
+	}
+
+	if (koki->decode_cache != NULL)
+		koki_decode_cache_age( koki->decode_cache );
+
+	if (koki->accumulator != NULL)
+		koki_accumulator_age( koki->accumulator );
 
 	if (koki_is_logging(koki) ) {
 		/* Create images of contours and discarded contours */
@@ -229,20 +862,84 @@ static GPtrArray* find_markers( koki_t *koki,
 	/* init markers array */
 	markers = g_ptr_array_new();
 
-	/* loop though all regions */
-	for (label_t i=0; i<labelled_image->clips->len; i++){
+	/* gather the regions that are big enough, etc... */
+	candidates = g_array_new( FALSE, FALSE, sizeof(label_t) );
+
+	for (label_t i=0; i<labelled_image->clips->len; i++)
+		if (koki_label_useable(labelled_image, i))
+			g_array_append_val( candidates, i );
+
+	/* when we know what to look for, look at the biggest regions
+	   first, as they're the most likely to be markers (the reference
+	   mode looks at everything, in order) */
+	expected_left = koki->reference ? 0 : koki->num_expected_codes;
+	if (expected_left > 0)
+		g_array_sort_with_data( candidates, compare_region_mass,
+					labelled_image->clips );
+
+	/* and regions that may be part of a marker after the marker */
+	if (!koki->reference)
+		defer_nested_candidates( candidates, labelled_image->clips );
+
+	koki->stats.candidates = candidates->len;
+	koki->stats.skipped_candidates = 0;
+	koki->stats.nested_candidates = 0;
+	koki->stats.duplicate_markers = 0;
+	koki->stats.edge_quads = 0;
+	koki->stats.accumulated_markers = 0;
+
+	KOKI_PROBE3( label__done, frame_id, labelled_image->clips->len,
+		     candidates->len );
+
+	if (koki->batch_decode && !koki->reference)
+		batch.markers = g_ptr_array_sized_new( KOKI_CODE_BATCH_SIZE );
+
+	/* loop though all candidate regions */
+	for (guint c=0; c<candidates->len; c++){
+
+		label_t i = g_array_index( candidates, label_t, c );
+		const koki_clip_region_t *clip =
+			&g_array_index( labelled_image->clips,
+					koki_clip_region_t, i );
+
+		/* a candidate within one waiting to be decoded may well be
+		   one of its code cells, so see how that turns out first */
+		if (batch.markers != NULL && region_in_marker( batch.markers, clip ))
+			flush_batch( koki, frame, &batch, markers, fp,
+				     marker_width, params, found,
+				     &expected_left );
+
+		/* stop once everything we expected has been found */
+		if (koki->num_expected_codes > 0 && !koki->reference
+		    && expected_left == 0){
+			koki->stats.skipped_candidates = candidates->len - c;
+			break;
+		}
 
-		/* make sure it's big enough, etc... */
-		if (!koki_label_useable(labelled_image, i))
+		/* skip the code cells of markers already found, etc. */
+		if (!koki->reference && region_in_marker( markers, clip )){
+			KOKI_PROBE3( candidate, frame_id, i, KOKI_PROBE_REJECT_NESTED );
+			koki->stats.nested_candidates++;
 			continue;
+		}
 
 		/* get contour */
+		KOKI_TRACE_BEGIN( koki, "contour", i );
+		KOKI_PERF_BEGIN( koki, KOKI_PERF_CONTOUR );
 		contour = koki_contour_find(labelled_image, i);
+		KOKI_PERF_END( koki, KOKI_PERF_CONTOUR );
+		KOKI_TRACE_END( koki, "contour", i );
 
 		/* find vertices */
+		KOKI_TRACE_BEGIN( koki, "quad", i );
+		KOKI_PERF_BEGIN( koki, KOKI_PERF_QUAD );
 		quad = koki_quad_find_vertices(contour);
 
 		if (quad == NULL){
+			KOKI_PERF_END( koki, KOKI_PERF_QUAD );
+			KOKI_TRACE_END( koki, "quad", i );
+			KOKI_PROBE3( candidate, frame_id, i, KOKI_PROBE_REJECT_QUAD );
+
 			if( disc_contours != NULL )
 				koki_contour_draw( disc_contours, contour );
 
@@ -254,43 +951,64 @@ static GPtrArray* find_markers( koki_t *koki,
 			koki_contour_draw( contours, contour );
 
 		/* refine vertices */
+#ifdef KOKI_FIXED_POINT
+		if (!koki->reference)
+			koki_quad_refine_vertices_fixed(quad);
+		else
+#endif
 		koki_quad_refine_vertices(quad);
+		KOKI_PERF_END( koki, KOKI_PERF_QUAD );
+		KOKI_TRACE_END( koki, "quad", i );
 
 		/* create a base marker */
 		marker = koki_marker_new(quad);
 		assert(marker != NULL);
 
-		/* recover code */
-		if (koki_marker_recover_code(koki, marker, frame)){
-			float size;
-			assert(marker != NULL);
+		/* cleanup */
+		koki_contour_free(contour);
+		koki_quad_free(quad);
 
-			if( fp == NULL )
-				size = marker_width;
-			else
-				size = fp(marker->code);
+		if (batch.markers != NULL){
 
-			koki_pose_estimate(marker, size, params);
-			koki_rotation_estimate(marker);
-			koki_bearing_estimate(marker);
+			batch.ids[batch.markers->len] = i;
+			g_ptr_array_add( batch.markers, marker );
 
-			/* append the marker to the output array */
-			g_ptr_array_add(markers, marker);
+			if (batch.markers->len == KOKI_CODE_BATCH_SIZE)
+				flush_batch( koki, frame, &batch, markers, fp,
+					     marker_width, params, found,
+					     &expected_left );
 
 		} else {
 
-			/* not a useful marker, free it */
-			koki_marker_free(marker);
+			process_marker( koki, frame, markers, marker, i,
+					decode_candidate( koki, frame, marker, i ),
+					fp, marker_width, params, found,
+					&expected_left );
 
 		}
 
-		/* cleanup */
-		koki_contour_free(contour);
-		koki_quad_free(quad);
-
 	}//for
 
+	if (batch.markers != NULL){
+		flush_batch( koki, frame, &batch, markers, fp, marker_width,
+			     params, found, &expected_left );
+		g_ptr_array_free( batch.markers, TRUE );
+	}
+
+	/* look for quads whose blurred borders didn't threshold cleanly,
+	   numbering them after the labelled regions */
+	if ((koki->edge_quads == KOKI_EDGE_QUADS_ALWAYS
+	     || (koki->edge_quads == KOKI_EDGE_QUADS_FALLBACK
+		 && markers->len == 0))
+	    && !(koki->num_expected_codes > 0 && !koki->reference
+		 && expected_left == 0))
+		find_edge_markers( koki, frame, markers,
+				   labelled_image->clips->len, fp,
+				   marker_width, params, found,
+				   &expected_left );
+
 	/* clean up */
+	g_array_free(candidates, TRUE);
 	koki_labelled_image_free(labelled_image);
 
 	if( contours != NULL ) {
@@ -303,6 +1021,15 @@ static GPtrArray* find_markers( koki_t *koki,
 		cvReleaseImage( &disc_contours );
 	}
 
+	KOKI_PROBE3( frame__end, frame_id, markers->len,
+		     koki->stats.skipped_candidates );
+	KOKI_PERF_END( koki, KOKI_PERF_FRAME );
+	KOKI_TRACE_END( koki, "find_markers", -1 );
+
+	koki_alloc_scope_leave( &scope );
+	koki->stats.allocations = scope.allocations;
+	koki->stats.allocated_bytes = scope.bytes;
+
 	return markers;
 }
 
@@ -351,6 +1078,152 @@ GPtrArray* koki_find_markers_fp( koki_t *koki,
 	return find_markers( koki, frame, fp, 0, params );
 }
 
+/**
+ * @brief draws a frame for koki_prepare(): marker-like squares of a few
+ *        sizes on a lit background
+ *
+ * The squares have a marker's black border and a grid of cells, so they
+ * go through every stage up to decoding, which they fail.
+ *
+ * @param width   the frame's width
+ * @param height  the frame's height
+ * @param first   where to store the corners of the biggest square
+ * @return        the frame
+ */
+static IplImage* prepare_frame( uint16_t width, uint16_t height,
+				koki_point2Df_t first[4] )
+{
+	IplImage *frame = cvCreateImage( cvSize( width, height ), IPL_DEPTH_8U, 1 );
+	uint16_t side = MIN( width, height ) / 3, x0 = side / 4, y0 = side / 4;
+
+	cvSet( frame, cvScalarAll( 190 ), NULL );
+
+	first[0].x = x0;        first[0].y = y0;
+	first[1].x = x0 + side; first[1].y = y0;
+	first[2].x = x0 + side; first[2].y = y0 + side;
+	first[3].x = x0;        first[3].y = y0 + side;
+
+	/* ever smaller squares, left to right */
+	for (; side >= KOKI_MARKER_GRID_WIDTH * 2 && x0 + side < width;
+	     x0 += side + side / 4, side /= 2){
+
+		uint16_t cell = side / KOKI_MARKER_GRID_WIDTH;
+
+		for (uint16_t y=0; y<cell*KOKI_MARKER_GRID_WIDTH; y++)
+			for (uint16_t x=0; x<cell*KOKI_MARKER_GRID_WIDTH; x++){
+
+				uint8_t cx = x / cell, cy = y / cell;
+				uint8_t b = (KOKI_MARKER_GRID_WIDTH
+					     - KOKI_CODE_GRID_WIDTH) / 2;
+				bool border = cx < b || cy < b
+					|| cx >= KOKI_MARKER_GRID_WIDTH - b
+					|| cy >= KOKI_MARKER_GRID_WIDTH - b;
+
+				KOKI_IPLIMAGE_GS_ELEM( frame, x0 + x, y0 + y ) =
+					border || ((cx * 3 + cy) % 5) < 2 ? 25 : 200;
+
+			}//for
+
+	}//for
+
+	return frame;
+}
+
+/**
+ * @brief gets a context ready to process frames of a given size, so that
+ *        the first frame takes no longer than the rest
+ *
+ * The first frame otherwise pays for page faulting the memory behind the
+ * per-frame buffers (the labelled, thresholded and integral images among
+ * them), for the allocator settling on where to put buffers that big, for
+ * OpenCV's lazy initialisation, for choosing the pixel kernels and for
+ * cold caches.  This pays for all of that up front, by finding markers in
+ * a synthetic frame of the given size twice, and estimating the pose of
+ * one, with logging, tracing, performance counting, the decode cache,
+ * accumulation and expected codes put aside meanwhile.  The context's
+ * statistics are left as they were.
+ *
+ * @param koki    the libkoki context
+ * @param width   the width of the frames to come
+ * @param height  the height of the frames to come
+ */
+void koki_prepare( koki_t *koki, uint16_t width, uint16_t height )
+{
+	logger_callbacks_t logger = koki->logger;
+	struct koki_decode_cache *cache = koki->decode_cache;
+	struct koki_accumulator *acc = koki->accumulator;
+	struct koki_tracer *tracer = koki->tracer;
+	koki_perf_t *perf = koki->perf;
+	uint16_t num_expected = koki->num_expected_codes;
+	koki_frame_stats_t stats = koki->stats;
+	koki_camera_params_t params;
+	koki_alloc_scope_t scope;
+	koki_point2Df_t corners[4];
+	koki_quad_t quad;
+	koki_marker_t *marker;
+	IplImage *frame;
+
+	assert(koki != NULL && width > 0 && height > 0);
+
+	koki->logger = koki_null_logger;
+	koki->decode_cache = NULL;
+	koki->accumulator = NULL;
+	koki->tracer = NULL;
+	koki->perf = NULL;
+	koki->num_expected_codes = 0;
+
+	params.principal_point.x = width / 2.0;
+	params.principal_point.y = height / 2.0;
+	params.focal_length.x = params.focal_length.y = width;
+	params.size.x = width;
+	params.size.y = height;
+
+	frame = prepare_frame( width, height, corners );
+
+	/* the first pass sizes the allocator's heap, and the second faults
+	   in the memory that the real frames will reuse */
+	for (uint8_t pass=0; pass<2; pass++)
+		koki_markers_free( koki_find_markers( koki, frame, 0.1, &params ) );
+
+	cvReleaseImage( &frame );
+
+	/* none of the squares decode, so estimate a pose separately */
+	koki_alloc_scope_enter( &scope, &koki->allocator,
+				koki->allocator_userdata );
+
+	for (uint8_t i=0; i<4; i++){
+		quad.vertices[i] = corners[i];
+		quad.links[i] = NULL;
+	}
+
+	marker = koki_marker_new( &quad );
+
+#ifdef KOKI_FIXED_POINT
+	if (!koki->reference){
+		koki_pose_estimate_fixed( marker, 0.1, &params );
+		koki_rotation_estimate_fixed( marker );
+		koki_bearing_estimate_fixed( marker );
+	} else
+#endif
+	{
+		koki_pose_estimate( marker, 0.1, &params );
+		koki_rotation_estimate( marker );
+		koki_bearing_estimate( marker );
+	}
+
+	koki_marker_free( marker );
+
+	koki_alloc_scope_leave( &scope );
+
+	koki->logger = logger;
+	koki->decode_cache = cache;
+	koki->accumulator = acc;
+	koki->tracer = tracer;
+	koki->perf = perf;
+	koki->num_expected_codes = num_expected;
+	koki->stats = stats;
+}
+
 /**
  * @brief frees all the markers pointed to from the array, then frees the
  *        array itself
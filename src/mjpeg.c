@@ -0,0 +1,248 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/**
+ * @file  mjpeg.c
+ * @brief Implementation of decoding the luma of MJPEG camera frames
+ *
+ * Many UVC cameras only deliver their higher resolutions as MJPEG.  Fully
+ * decoding each frame to colour would take longer than finding the
+ * markers, but libjpeg only runs the inverse DCT and upsampling on the
+ * components the output colour space needs, so asking for greyscale
+ * leaves the chroma to be entropy-decoded and then skipped.  Its scaled
+ * inverse DCT can also produce a half, quarter or eighth size image
+ * directly, skipping most of the work on the luma too.
+ *
+ * UVC cameras usually leave the (standard) Huffman tables out of their
+ * frames; libjpeg-turbo fills them in, but the original libjpeg doesn't.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <setjmp.h>
+#include <assert.h>
+#include <cv.h>
+#include <glib.h>
+
+#ifdef KOKI_HAVE_JPEG
+#include <jpeglib.h>
+#endif
+
+#include "mjpeg.h"
+
+
+#ifdef KOKI_HAVE_JPEG
+
+/**
+ * @brief a decoder, reused from frame to frame
+ */
+struct koki_mjpeg {
+	struct jpeg_decompress_struct cinfo; /**< libjpeg's decoder */
+	struct jpeg_error_mgr jerr;          /**< libjpeg's error handler */
+	jmp_buf jump;                        /**< where to go on errors */
+	uint8_t scale_denom;                 /**< the scale to decode at */
+	IplImage *grey;                      /**< the last decoded frame */
+};
+
+
+
+/**
+ * @brief reports a fatal decoding error, and abandons the frame
+ */
+static void error_exit(j_common_ptr cinfo)
+{
+
+	/* the decoder is the first member, so its pointer is ours too */
+	koki_mjpeg_t *mjpeg = (koki_mjpeg_t*)cinfo;
+	char msg[JMSG_LENGTH_MAX];
+
+	cinfo->err->format_message(cinfo, msg);
+	fprintf(stderr, "koki_mjpeg: %s\n", msg);
+
+	longjmp(mjpeg->jump, 1);
+
+}
+
+
+
+/**
+ * @brief ignores warnings, which truncated or slightly corrupt frames from
+ *        cameras produce all the time
+ */
+static void emit_message(j_common_ptr cinfo, int msg_level)
+{
+
+	if (msg_level < 0)
+		cinfo->err->num_warnings++;
+
+}
+
+
+
+/**
+ * @brief creates an MJPEG decoder
+ *
+ * @param scale_denom  the denominator of the scale to decode frames at:
+ *                     1 for full size, or 2, 4 or 8 for smaller frames
+ *                     straight from the scaled inverse DCT
+ * @return             the decoder
+ */
+koki_mjpeg_t* koki_mjpeg_new(uint8_t scale_denom)
+{
+
+	koki_mjpeg_t *mjpeg;
+
+	assert(scale_denom == 1 || scale_denom == 2
+	       || scale_denom == 4 || scale_denom == 8);
+
+	mjpeg = g_malloc0(sizeof(koki_mjpeg_t));
+
+	mjpeg->cinfo.err = jpeg_std_error(&mjpeg->jerr);
+	mjpeg->jerr.error_exit = error_exit;
+	mjpeg->jerr.emit_message = emit_message;
+
+	jpeg_create_decompress(&mjpeg->cinfo);
+
+	mjpeg->scale_denom = scale_denom;
+
+	return mjpeg;
+
+}
+
+
+
+/**
+ * @brief frees an MJPEG decoder, and the last frame it decoded
+ *
+ * @param mjpeg  the decoder
+ */
+void koki_mjpeg_free(koki_mjpeg_t *mjpeg)
+{
+
+	if (mjpeg == NULL)
+		return;
+
+	jpeg_destroy_decompress(&mjpeg->cinfo);
+
+	if (mjpeg->grey != NULL)
+		cvReleaseImage(&mjpeg->grey);
+
+	g_free(mjpeg);
+
+}
+
+
+
+/**
+ * @brief decodes the luma of an MJPEG frame
+ *
+ * The image is reused for the next frame of the same size, so it's only
+ * valid until the next call.
+ *
+ * @param mjpeg   the decoder
+ * @param data    the frame, as recovered by \c koki_v4l_get_frame_array()
+ * @param length  the size of the frame's buffer; decoding stops at the
+ *                end of the JPEG data, so this may be the whole buffer
+ * @return        the greyscale frame, scaled down as the decoder was
+ *                asked to, or NULL if the frame couldn't be decoded
+ */
+IplImage* koki_mjpeg_decode(koki_mjpeg_t *mjpeg,
+			    const uint8_t *data, size_t length)
+{
+
+	struct jpeg_decompress_struct *cinfo = &mjpeg->cinfo;
+
+	assert(mjpeg != NULL && data != NULL);
+
+	if (setjmp(mjpeg->jump)){
+		jpeg_abort_decompress(cinfo);
+		return NULL;
+	}
+
+	jpeg_mem_src(cinfo, (unsigned char*)data, length);
+
+	if (jpeg_read_header(cinfo, TRUE) != JPEG_HEADER_OK){
+		jpeg_abort_decompress(cinfo);
+		return NULL;
+	}
+
+	/* only the luma is needed, at the requested scale, and the fast
+	   integer IDCT is plenty accurate enough for thresholding */
+	cinfo->out_color_space = JCS_GRAYSCALE;
+	cinfo->scale_num = 1;
+	cinfo->scale_denom = mjpeg->scale_denom;
+	cinfo->dct_method = JDCT_IFAST;
+
+	jpeg_start_decompress(cinfo);
+
+	if (mjpeg->grey != NULL
+	    && (mjpeg->grey->width != (int)cinfo->output_width
+		|| mjpeg->grey->height != (int)cinfo->output_height))
+		cvReleaseImage(&mjpeg->grey);
+
+	if (mjpeg->grey == NULL)
+		mjpeg->grey = cvCreateImage(cvSize(cinfo->output_width,
+						   cinfo->output_height),
+					    IPL_DEPTH_8U, 1);
+
+	/* decode straight into the image's rows */
+	while (cinfo->output_scanline < cinfo->output_height){
+
+		JSAMPROW rows[4];
+		uint8_t n = MIN(cinfo->rec_outbuf_height, 4);
+
+		for (uint8_t i=0; i<n; i++)
+			rows[i] = (JSAMPROW)(mjpeg->grey->imageData
+					     + mjpeg->grey->widthStep
+					     * MIN(cinfo->output_scanline + i,
+						   cinfo->output_height - 1));
+
+		jpeg_read_scanlines(cinfo, rows, n);
+
+	}
+
+	jpeg_finish_decompress(cinfo);
+
+	return mjpeg->grey;
+
+}
+
+#else /* !KOKI_HAVE_JPEG */
+
+koki_mjpeg_t* koki_mjpeg_new(uint8_t scale_denom)
+{
+
+	fprintf(stderr, "koki_mjpeg: libkoki was built without libjpeg\n");
+
+	return NULL;
+
+}
+
+void koki_mjpeg_free(koki_mjpeg_t *mjpeg)
+{
+}
+
+IplImage* koki_mjpeg_decode(koki_mjpeg_t *mjpeg,
+			    const uint8_t *data, size_t length)
+{
+
+	return NULL;
+
+}
+
+#endif /* KOKI_HAVE_JPEG */
@@ -25,6 +25,8 @@
 #include <stdint.h>
 
 #include "points.h"
+#include "allocator.h"
+#include "fixed.h"
 
 #include "pca.h"
 
@@ -45,7 +47,7 @@ int8_t koki_pca(GSList *start, GSList *end,
 		float eigen_values[2], koki_point2Df_t *averages)
 {
 
-	CvMat **data       = malloc(sizeof(CvMat));
+	CvMat **data       = koki_malloc(sizeof(CvMat*));
 	CvMat *covar       = cvCreateMat(2, 2, CV_64FC1);
 	CvMat *avg         = cvCreateMat(2, 1, CV_64FC1);
 	CvMat *eigen_vals  = cvCreateMat(2, 1, CV_64FC1);
@@ -106,7 +108,7 @@ int8_t koki_pca(GSList *start, GSList *end,
 
 	/* clean up */
 	cvReleaseMat(&data[0]);
-	free(data);
+	koki_free(data);
 	cvReleaseMat(&covar);
 	cvReleaseMat(&avg);
 	cvReleaseMat(&eigen_vects);
@@ -115,3 +117,99 @@ int8_t koki_pca(GSList *start, GSList *end,
 	return 0;
 
 }
+
+
+
+/**
+ * @brief performs Principal Component Analysis on a list of
+ *        \c koki_point2Di_t, using integer arithmetic
+ *
+ * The covariance matrix is built from 64 bit sums taken relative to the
+ * first point, and, being 2x2 and symmetric, its eigen decomposition has
+ * a closed form: the major axis lies at half the angle of the vector
+ * \c (cxx - cyy, 2 * cxy), and the eigen values are the mean of the
+ * variances plus or minus that vector's half-length.  As with \c
+ * cvEigenVV(), the eigen vectors are in descending order of eigen value.
+ *
+ * @param start          the start of the contour chain to use
+ * @param end            the end of the contour chain to use (NULL is
+ *                       essentially the end)
+ * @param eigen_vectors  the array that will have the (unit) eigen vectors
+ *                       written to
+ * @param eigen_values   the array that will have \c eigen_vector's
+ *                       corresponding eigen values written to, in Q16.16
+ * @param averages       where to write the mean point
+ * @return               \c 0 on success, anything else on failure
+ */
+int8_t koki_pca_fixed(GSList *start, GSList *end,
+		      koki_fixed_point2_t eigen_vectors[2],
+		      int64_t eigen_values[2], koki_fixed_point2_t *averages)
+{
+
+	int64_t sx = 0, sy = 0, sxx = 0, sxy = 0, syy = 0, n2;
+	int64_t cxx, cxy, cyy, r;
+	int32_t x0, y0, dx, dy;
+	koki_fixed_t theta, s, c;
+	uint16_t len = 1;
+	GSList *l;
+	koki_point2Di_t *p;
+
+	assert (start != NULL);
+
+	/* work out how many elements we're dealing with, exactly as
+	   koki_pca() does */
+	l = start;
+	while (l != end && l != NULL && l->next != NULL){
+		l = l->next;
+		len++;
+	}
+
+	if (len < 2)
+		return -1;
+
+	p = start->data;
+	x0 = p->x;
+	y0 = p->y;
+
+	l = start;
+	for (uint16_t i = 0; i < len; i++, l = l->next){
+
+		p = l->data;
+		dx = p->x - x0;
+		dy = p->y - y0;
+
+		sx += dx;
+		sy += dy;
+		sxx += (int64_t)dx * dx;
+		sxy += (int64_t)dx * dy;
+		syy += (int64_t)dy * dy;
+
+	}//for
+
+	/* scaled covariance: (n * sum(ab) - sum(a) * sum(b)) / n^2 */
+	n2 = (int64_t)len * len;
+	cxx = koki_fixed_div64(len * sxx - sx * sx, n2, KOKI_FIXED_SHIFT);
+	cxy = koki_fixed_div64(len * sxy - sx * sy, n2, KOKI_FIXED_SHIFT);
+	cyy = koki_fixed_div64(len * syy - sy * sy, n2, KOKI_FIXED_SHIFT);
+
+	averages->x = KOKI_FIXED_FROM_INT(x0)
+		+ koki_fixed_div64(sx, len, KOKI_FIXED_SHIFT);
+	averages->y = KOKI_FIXED_FROM_INT(y0)
+		+ koki_fixed_div64(sy, len, KOKI_FIXED_SHIFT);
+
+	/* eigen decomposition */
+	r = koki_fixed_hypot64((cxx - cyy) / 2, cxy);
+	eigen_values[0] = (cxx + cyy) / 2 + r;
+	eigen_values[1] = (cxx + cyy) / 2 - r;
+
+	theta = koki_fixed_atan2_64(2 * cxy, cxx - cyy) / 2;
+	koki_fixed_sincos(theta, &s, &c);
+
+	eigen_vectors[0].x = c;
+	eigen_vectors[0].y = s;
+	eigen_vectors[1].x = -s;
+	eigen_vectors[1].y = c;
+
+	return 0;
+
+}
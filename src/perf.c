@@ -0,0 +1,302 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/**
+ * @file  perf.c
+ * @brief Implementation of reading hardware performance counters around
+ *        the pipeline's stages
+ *
+ * The counters are opened with perf_event_open() as a single group, so
+ * that they're always scheduled onto the PMU together and can be read
+ * with one read().  They count for the opening thread only, and in user
+ * space only, which is what an unprivileged process is usually allowed
+ * (perf_event_paranoid of 2).  Where the kernel, the CPU or a hypervisor
+ * doesn't provide a counter, it's left out and reads as 0.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <glib.h>
+
+#include "perf.h"
+
+
+/* the hardware event behind each koki_perf_counter_t */
+static const uint64_t perf_configs[KOKI_PERF_NUM_COUNTERS] = {
+	[KOKI_PERF_CYCLES]        = PERF_COUNT_HW_CPU_CYCLES,
+	[KOKI_PERF_INSTRUCTIONS]  = PERF_COUNT_HW_INSTRUCTIONS,
+	[KOKI_PERF_CACHE_MISSES]  = PERF_COUNT_HW_CACHE_MISSES,
+	[KOKI_PERF_BRANCH_MISSES] = PERF_COUNT_HW_BRANCH_MISSES
+};
+
+static const char *stage_names[KOKI_PERF_NUM_STAGES] = {
+	[KOKI_PERF_FRAME]      = "find_markers",
+	[KOKI_PERF_LABEL]      = "label",
+	[KOKI_PERF_CONTOUR]    = "contour",
+	[KOKI_PERF_QUAD]       = "quad",
+	[KOKI_PERF_DECODE]     = "recover_code",
+	[KOKI_PERF_POSE]       = "pose",
+	[KOKI_PERF_EDGE_QUADS] = "edge_quads"
+};
+
+static const char *counter_names[KOKI_PERF_NUM_COUNTERS] = {
+	[KOKI_PERF_CYCLES]        = "cycles",
+	[KOKI_PERF_INSTRUCTIONS]  = "instructions",
+	[KOKI_PERF_CACHE_MISSES]  = "cache-misses",
+	[KOKI_PERF_BRANCH_MISSES] = "branch-misses"
+};
+
+
+
+/**
+ * @brief opens a counter for the calling thread
+ *
+ * @param config  the \c PERF_COUNT_HW_* event
+ * @param group   the group leader's file descriptor, or -1 to lead a new
+ *                group
+ * @return        the file descriptor, or -1 if the counter isn't
+ *                available
+ */
+static int open_counter(uint64_t config, int group)
+{
+
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = config;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP
+		| PERF_FORMAT_TOTAL_TIME_ENABLED
+		| PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+	return syscall(SYS_perf_event_open, &attr, 0, -1, group,
+		       PERF_FLAG_FD_CLOEXEC);
+
+}
+
+
+
+/**
+ * @brief opens the counters for the calling thread
+ *
+ * @return  the counters, or NULL if none of them are available (e.g. the
+ *          kernel lacks perf events, perf_event_paranoid forbids them, or
+ *          a virtual machine doesn't expose the PMU)
+ */
+koki_perf_t* koki_perf_new(void)
+{
+
+	koki_perf_t *perf = g_malloc0(sizeof(koki_perf_t));
+
+	perf->leader = -1;
+
+	for (uint8_t c=0; c<KOKI_PERF_NUM_COUNTERS; c++){
+
+		perf->fds[c] = open_counter(perf_configs[c], perf->leader);
+
+		if (perf->fds[c] < 0)
+			continue;
+
+		if (perf->leader < 0)
+			perf->leader = perf->fds[c];
+
+		perf->frame.available |= 1 << c;
+		perf->num_open++;
+
+	}//for
+
+	if (perf->num_open == 0){
+		g_free(perf);
+		return NULL;
+	}
+
+	return perf;
+
+}
+
+
+
+/**
+ * @brief closes the counters
+ *
+ * @param perf  the counters, or NULL
+ */
+void koki_perf_free(koki_perf_t *perf)
+{
+
+	if (perf == NULL)
+		return;
+
+	for (uint8_t c=0; c<KOKI_PERF_NUM_COUNTERS; c++)
+		if (perf->fds[c] >= 0)
+			close(perf->fds[c]);
+
+	g_free(perf);
+
+}
+
+
+
+/**
+ * @brief zeroes the counts, ready for a new frame
+ *
+ * @param perf  the counters
+ */
+void koki_perf_reset(koki_perf_t *perf)
+{
+
+	assert(perf != NULL);
+
+	memset(perf->frame.stages, 0, sizeof(perf->frame.stages));
+
+}
+
+
+
+/**
+ * @brief reads the current value of every counter
+ *
+ * If the group had to share the PMU with other events, the values are
+ * scaled up by the fraction of the time it was actually counting.
+ *
+ * @param perf    the counters
+ * @param values  where to store the values, by \c koki_perf_counter_t
+ * @return        FALSE if the counters couldn't be read
+ */
+static bool read_counters(koki_perf_t *perf,
+			  uint64_t values[KOKI_PERF_NUM_COUNTERS])
+{
+
+	/* nr, time enabled, time running, then the values in the order the
+	   counters joined the group */
+	uint64_t buf[3 + KOKI_PERF_NUM_COUNTERS];
+	uint8_t n = 0;
+
+	if (read(perf->leader, buf, sizeof(buf)) < (ssize_t)(3 * sizeof(uint64_t))
+	    || buf[0] != perf->num_open)
+		return FALSE;
+
+	for (uint8_t c=0; c<KOKI_PERF_NUM_COUNTERS; c++){
+
+		if (perf->fds[c] < 0){
+			values[c] = 0;
+			continue;
+		}
+
+		values[c] = buf[3 + n++];
+
+		if (buf[2] > 0 && buf[2] < buf[1])
+			values[c] = (double)values[c] * buf[1] / buf[2];
+
+	}//for
+
+	return TRUE;
+
+}
+
+
+
+/**
+ * @brief reads the counters at the start of a stage
+ *
+ * Stages may nest (every stage is within \c KOKI_PERF_FRAME), but a stage
+ * mustn't begin again before it ends.
+ *
+ * @param perf   the counters
+ * @param stage  the stage
+ */
+void koki_perf_begin(koki_perf_t *perf, koki_perf_stage_t stage)
+{
+
+	assert(perf != NULL && stage < KOKI_PERF_NUM_STAGES);
+
+	if (!read_counters(perf, perf->start[stage]))
+		memset(perf->start[stage], 0, sizeof(perf->start[stage]));
+
+}
+
+
+
+/**
+ * @brief reads the counters at the end of a stage, and adds the
+ *        difference to the stage's counts
+ *
+ * @param perf   the counters
+ * @param stage  the stage
+ */
+void koki_perf_end(koki_perf_t *perf, koki_perf_stage_t stage)
+{
+
+	koki_perf_stage_counts_t *counts;
+	uint64_t now[KOKI_PERF_NUM_COUNTERS];
+
+	assert(perf != NULL && stage < KOKI_PERF_NUM_STAGES);
+
+	if (!read_counters(perf, now))
+		return;
+
+	counts = &perf->frame.stages[stage];
+	counts->runs++;
+
+	for (uint8_t c=0; c<KOKI_PERF_NUM_COUNTERS; c++)
+		if (now[c] > perf->start[stage][c])
+			counts->counts[c] += now[c] - perf->start[stage][c];
+
+}
+
+
+
+/**
+ * @brief gets a stage's name, as used for tracing
+ *
+ * @param stage  the stage
+ * @return       the name
+ */
+const char* koki_perf_stage_name(koki_perf_stage_t stage)
+{
+
+	assert(stage < KOKI_PERF_NUM_STAGES);
+
+	return stage_names[stage];
+
+}
+
+
+
+/**
+ * @brief gets a counter's name, as used by perf(1)
+ *
+ * @param counter  the counter
+ * @return         the name
+ */
+const char* koki_perf_counter_name(koki_perf_counter_t counter)
+{
+
+	assert(counter < KOKI_PERF_NUM_COUNTERS);
+
+	return counter_names[counter];
+
+}
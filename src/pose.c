@@ -22,10 +22,12 @@
 
 #include <cv.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "points.h"
 #include "camera.h"
 #include "marker.h"
+#include "fixed.h"
 
 #include "pose.h"
 
@@ -186,3 +188,155 @@ void koki_pose_estimate(koki_marker_t *marker, float marker_width,
 				pow(marker->centre.world.z, 2));
 
 }
+
+
+
+/* fractional bits of the scale factors, and of their ratios to k3 */
+#define KOKI_POSE_K_SHIFT 32
+#define KOKI_POSE_RATIO_SHIFT 24
+
+
+
+/**
+ * @brief the fixed-point equivalent of koki_pose_estimate_arrays()
+ *
+ * Rather than inverting \c A, the last of the 3 equations (which, divided
+ * through by the focal length, reads \c -k0 + k1 + k2 = k3) is used to
+ * eliminate \c k2, leaving a 2x2 system in pixel differences that's
+ * solved exactly with 64 bit integers.
+ *
+ * @param img           the 2D image points of the 4 vertices of the square
+ * @param world         the destination 3D points to store the world
+ *                      co-ordinates in
+ * @param marker_width  the width, in meters, of the square
+ * @param focal_length  the camera's focal length, in pixels
+ */
+void koki_pose_estimate_arrays_fixed(const koki_fixed_point2_t img[4],
+				     koki_fixed_point3_t world[4],
+				     koki_fixed_t marker_width,
+				     koki_fixed_t focal_length)
+{
+
+	int64_t ax, ay, bx, by, cx, cy, det, ratio[3], k[4];
+	int64_t dx, dy, dz, tmp;
+
+	/* with r_i = k_i / k3:
+	     r0 * (x2 - x0) + r1 * (x1 - x2) = x3 - x2
+	     r0 * (y2 - y0) + r1 * (y1 - y2) = y3 - y2 */
+	ax = (int64_t)img[2].x - img[0].x;
+	ay = (int64_t)img[2].y - img[0].y;
+	bx = (int64_t)img[1].x - img[2].x;
+	by = (int64_t)img[1].y - img[2].y;
+	cx = (int64_t)img[3].x - img[2].x;
+	cy = (int64_t)img[3].y - img[2].y;
+
+	/* Q32 */
+	det = ax * by - bx * ay;
+
+	if (det == 0){
+		memset(world, 0, 4 * sizeof(koki_fixed_point3_t));
+		return;
+	}
+
+	ratio[0] = koki_fixed_div64(cx * by - bx * cy, det, KOKI_POSE_RATIO_SHIFT);
+	ratio[1] = koki_fixed_div64(ax * cy - cx * ay, det, KOKI_POSE_RATIO_SHIFT);
+	ratio[2] = ((int64_t)1 << KOKI_POSE_RATIO_SHIFT) + ratio[0] - ratio[1];
+
+	/* calculate k3 */
+	dx = -(ratio[0] * img[0].x >> KOKI_POSE_RATIO_SHIFT) - img[3].x;
+	dy = -(ratio[0] * img[0].y >> KOKI_POSE_RATIO_SHIFT) - img[3].y;
+	dz = -(ratio[0] * focal_length >> KOKI_POSE_RATIO_SHIFT) - focal_length;
+
+	tmp = koki_fixed_hypot64(koki_fixed_hypot64(dx, dy), dz);
+
+	if (tmp == 0){
+		memset(world, 0, 4 * sizeof(koki_fixed_point3_t));
+		return;
+	}
+
+	k[3] = koki_fixed_div64(marker_width, tmp, KOKI_POSE_K_SHIFT);
+	k[3] = k[3] < 0 ? -k[3] : k[3];
+
+	/* use k3 to calculate the others */
+	for (uint8_t i=0; i<3; i++)
+		k[i] = ((ratio[i] < 0 ? -ratio[i] : ratio[i]) * k[3])
+			>> KOKI_POSE_RATIO_SHIFT;
+
+	/* do pose estimation calculation */
+	for (uint8_t i=0; i<4; i++){
+
+		world[i].x = (img[i].x * k[i]) >> KOKI_POSE_K_SHIFT;
+		world[i].y = (img[i].y * k[i]) >> KOKI_POSE_K_SHIFT;
+		world[i].z = (focal_length * k[i]) >> KOKI_POSE_K_SHIFT;
+
+	}//for
+
+}
+
+
+
+/**
+ * @brief the fixed-point equivalent of koki_pose_estimate()
+ *
+ * @param marker        the marker to estimate the position of
+ * @param marker_width  the width, in meters, of the marker
+ * @param params        the camera params
+ */
+void koki_pose_estimate_fixed(koki_marker_t *marker, float marker_width,
+			      koki_camera_params_t *params)
+{
+
+	koki_fixed_point2_t image[4];
+	koki_fixed_point3_t world[4];
+	int64_t centre[3] = {0, 0, 0};
+	koki_fixed_t focal_length;
+
+	assert(marker != NULL);
+	assert(marker_width > 0);
+	assert(params != NULL);
+
+	focal_length = koki_fixed_from_float((params->focal_length.x +
+					      params->focal_length.y) / 2);
+
+	/* prepare array: use co-ordinates with origin being
+	   the principal point */
+	for (uint8_t i=0; i<4; i++){
+
+		image[i].x = koki_fixed_from_float(marker->vertices[i].image.x -
+						   params->principal_point.x);
+
+		image[i].y = koki_fixed_from_float(params->principal_point.y -
+						   marker->vertices[i].image.y);
+
+	}//for
+
+	koki_pose_estimate_arrays_fixed(image, world,
+					koki_fixed_from_float(marker_width),
+					focal_length);
+
+	/* copy results and calc centre point */
+	for (uint8_t i=0; i<4; i++){
+
+		marker->vertices[i].world.x = koki_fixed_to_float(world[i].x);
+		marker->vertices[i].world.y = koki_fixed_to_float(world[i].y);
+		marker->vertices[i].world.z = koki_fixed_to_float(world[i].z);
+
+		centre[0] += world[i].x;
+		centre[1] += world[i].y;
+		centre[2] += world[i].z;
+
+	}//for
+
+	for (uint8_t j=0; j<3; j++)
+		centre[j] /= 4;
+
+	marker->centre.world.x = koki_fixed_to_float(centre[0]);
+	marker->centre.world.y = koki_fixed_to_float(centre[1]);
+	marker->centre.world.z = koki_fixed_to_float(centre[2]);
+
+	/* calc straight line distance to centre */
+	marker->distance = koki_fixed_to_float(
+		koki_fixed_hypot64(koki_fixed_hypot64(centre[0], centre[1]),
+				   centre[2]));
+
+}
@@ -28,7 +28,9 @@
 #include "contour.h"
 #include "points.h"
 #include "pca.h"
+#include "fixed.h"
 #include "debug.h"
+#include "allocator.h"
 
 #include "quad.h"
 
@@ -379,8 +381,7 @@ static koki_quad_t* quad_from_vertices(GSList *v1, GSList *v2, GSList *v3,
 	uint8_t n = 1;
 	koki_point2Df_t centre;
 
-	quad = malloc(sizeof(koki_quad_t));
-	assert(quad != NULL);
+	quad = koki_malloc(sizeof(koki_quad_t));
 
 	assert(v1 == contour);
 
@@ -421,7 +422,7 @@ static koki_quad_t* quad_from_vertices(GSList *v1, GSList *v2, GSList *v3,
 
 	  /* it's a boomerang shape */
 
-	  free(quad);
+	  koki_free(quad);
 	  quad = NULL;
 
 	}
@@ -816,6 +817,100 @@ void koki_quad_refine_vertices(koki_quad_t *quad)
 
 
 
+/**
+ * @brief the fixed-point equivalent of point_of_intersection()
+ *
+ * @param a_mean  the mean of line A
+ * @param a_vect  the unit direction of line A
+ * @param b_mean  the mean of line B
+ * @param b_vect  the unit direction of line B
+ * @return        the point of intersection of lines A and B, or \c a_mean
+ *                if they're parallel
+ */
+static koki_fixed_point2_t point_of_intersection_fixed(koki_fixed_point2_t a_mean,
+						       koki_fixed_point2_t a_vect,
+						       koki_fixed_point2_t b_mean,
+						       koki_fixed_point2_t b_vect)
+{
+
+	int64_t num, den, a_k, x, y;
+	koki_fixed_point2_t p;
+
+	/* both Q32 */
+	num = (int64_t)b_vect.y * ((int64_t)b_mean.x - a_mean.x)
+		- (int64_t)b_vect.x * ((int64_t)b_mean.y - a_mean.y);
+	den = (int64_t)a_vect.x * b_vect.y - (int64_t)a_vect.y * b_vect.x;
+
+	if (den == 0)
+		return a_mean;
+
+	/* a_k is a length in pixels, so is small for anything that
+	   could be a marker's corner */
+	a_k = koki_fixed_div64(num, den, KOKI_FIXED_SHIFT);
+	a_k = CLAMP(a_k, INT32_MIN, INT32_MAX);
+
+	x = a_mean.x + ((a_vect.x * a_k + KOKI_FIXED_HALF) >> KOKI_FIXED_SHIFT);
+	y = a_mean.y + ((a_vect.y * a_k + KOKI_FIXED_HALF) >> KOKI_FIXED_SHIFT);
+
+	p.x = CLAMP(x, INT32_MIN, INT32_MAX);
+	p.y = CLAMP(y, INT32_MIN, INT32_MAX);
+
+	return p;
+
+}
+
+
+
+/**
+ * @brief the fixed-point equivalent of koki_quad_refine_vertices()
+ *
+ * The PCA is done with koki_pca_fixed(), whose first eigen vector is
+ * always the most significant.  If PCA fails for any side, the vertices
+ * are left as they were.
+ *
+ * @param quad  the \c koki_quad_t* that should be refined
+ */
+void koki_quad_refine_vertices_fixed(koki_quad_t *quad)
+{
+
+	koki_fixed_point2_t vects[4][2];
+	int64_t vals[4][2];
+	koki_fixed_point2_t avgs[4];
+	koki_fixed_point2_t p;
+	GSList *start, *end;
+
+	if (quad == NULL)
+		return;
+
+	for (uint8_t i=0; i<4; i++){
+
+		get_centre_section(quad->links[i],
+				   i < 3 ? quad->links[i + 1] : NULL,
+				   &start, &end);
+
+		if (start == NULL ||
+		    koki_pca_fixed(start, end, vects[i], vals[i], &avgs[i]) != 0)
+			return;
+
+	}//for
+
+	/* vertex i is the intersection of side i-1 and side i */
+	for (uint8_t i=0; i<4; i++){
+
+		uint8_t prev = (i + 3) % 4;
+
+		p = point_of_intersection_fixed(avgs[prev], vects[prev][0],
+						avgs[i], vects[i][0]);
+
+		quad->vertices[i].x = koki_fixed_to_float(p.x);
+		quad->vertices[i].y = koki_fixed_to_float(p.y);
+
+	}//for
+
+}
+
+
+
 /**
  * @brief frees an allocated \c koki_quad_t*
  *
@@ -824,7 +919,7 @@ void koki_quad_refine_vertices(koki_quad_t *quad)
 void koki_quad_free(koki_quad_t *quad)
 {
 
-	free(quad);
+	koki_free(quad);
 
 }
 
@@ -0,0 +1,423 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/**
+ * @file  resolution.c
+ * @brief Implementation of adapting the capture resolution to marker sizes
+ *
+ * Camera parameters are calibrated at a single resolution, but small
+ * markers only need the full resolution while they're far away.  The
+ * controller here watches the size of the markers found in each frame,
+ * drops to a lower resolution when they're all large enough to survive
+ * it, and climbs back up when they get small (or disappear).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include <glib.h>
+#include <cv.h>
+
+#include "camera.h"
+#include "marker.h"
+#include <sys/time.h> /* needed for videodev2.h */
+#include "v4l.h"
+
+#include "resolution.h"
+
+
+/* the default number of frames a condition must hold before switching */
+#define KOKI_RESOLUTION_HOLD_FRAMES 10
+
+/* the number of capture buffers to request */
+#define KOKI_RESOLUTION_NUM_BUFFERS 1
+
+
+
+/**
+ * @brief a comparison function for sorting modes by area, smallest first
+ */
+static int compare_mode_area(const void *a, const void *b)
+{
+
+	const koki_resolution_t *ma = a, *mb = b;
+
+	return (int)ma->width * ma->height - (int)mb->width * mb->height;
+
+}
+
+
+
+/**
+ * @brief (re)starts the camera streaming in the given mode
+ *
+ * @param ctrl  the controller
+ * @param mode  the index of the mode to switch to
+ * @return      FALSE if the camera couldn't be started, leaving it
+ *              stopped, TRUE otherwise
+ */
+static bool start_mode(koki_resolution_ctrl_t *ctrl, uint8_t mode)
+{
+
+	struct v4l2_format fmt;
+
+	assert(mode < ctrl->num_modes);
+
+	/* buffers can't be reallocated while streaming */
+	if (ctrl->buffers != NULL){
+		koki_v4l_stop_stream(ctrl->fd);
+		koki_v4l_free_buffers(ctrl->buffers, ctrl->num_buffers);
+		ctrl->buffers = NULL;
+	}
+
+	fmt = koki_v4l_create_YUYV_format(ctrl->modes[mode].width,
+					  ctrl->modes[mode].height);
+
+	if (koki_v4l_set_format(ctrl->fd, fmt) < 0)
+		return FALSE;
+
+	/* the driver may have picked the closest size it supports */
+	fmt = koki_v4l_get_format(ctrl->fd);
+	ctrl->size.width = fmt.fmt.pix.width;
+	ctrl->size.height = fmt.fmt.pix.height;
+	ctrl->current = mode;
+
+	koki_camera_params_scale(&ctrl->calibration,
+				 ctrl->size.width, ctrl->size.height,
+				 &ctrl->params);
+
+	ctrl->num_buffers = KOKI_RESOLUTION_NUM_BUFFERS;
+	ctrl->buffers = koki_v4l_prepare_buffers(ctrl->fd, &ctrl->num_buffers);
+	if (ctrl->buffers == NULL)
+		return FALSE;
+
+	if (koki_v4l_start_stream(ctrl->fd) < 0){
+		koki_v4l_free_buffers(ctrl->buffers, ctrl->num_buffers);
+		ctrl->buffers = NULL;
+		return FALSE;
+	}
+
+	ctrl->down_count = 0;
+	ctrl->empty_count = 0;
+	ctrl->up_count = G_MAXUINT16;
+
+	return TRUE;
+
+}
+
+
+
+/**
+ * @brief switches the camera to another mode, going back to the current
+ *        one if that fails
+ *
+ * @param ctrl  the controller
+ * @param mode  the index of the mode to switch to
+ * @return      \c KOKI_RESOLUTION_CHANGED on success, otherwise
+ *              \c KOKI_RESOLUTION_ERROR
+ */
+static koki_resolution_change_t switch_mode(koki_resolution_ctrl_t *ctrl,
+					    uint8_t mode)
+{
+
+	uint8_t previous = ctrl->current;
+
+	if (start_mode(ctrl, mode))
+		return KOKI_RESOLUTION_CHANGED;
+
+	fprintf(stderr, "couldn't switch camera to %ux%u\n",
+		ctrl->modes[mode].width, ctrl->modes[mode].height);
+
+	if (!start_mode(ctrl, previous))
+		fprintf(stderr, "couldn't restart camera\n");
+
+	/* wait a while before trying again */
+	ctrl->down_count = 0;
+	ctrl->empty_count = 0;
+	if (mode > previous)
+		ctrl->up_count = 0;
+
+	return KOKI_RESOLUTION_ERROR;
+
+}
+
+
+
+/**
+ * @brief creates a resolution controller and starts the camera streaming
+ *        at the highest of the given resolutions
+ *
+ * @param fd           the camera's file descriptor
+ * @param modes        the resolutions to switch between, in any order
+ * @param num_modes    the number of resolutions in \c modes
+ * @param calibration  the camera parameters, with \c size set to the
+ *                     resolution they were calibrated at
+ * @param min_side     the average marker side length, in pixels, below
+ *                     which a higher resolution is used
+ * @param max_side     the average marker side length, in pixels, that all
+ *                     markers must exceed at the next lower resolution
+ *                     before switching down to it.  This should be
+ *                     comfortably larger than \c min_side to avoid
+ *                     oscillating between modes.
+ * @return             the new controller, or NULL if the camera couldn't
+ *                     be started
+ */
+koki_resolution_ctrl_t* koki_resolution_ctrl_new(int fd,
+						 const koki_resolution_t *modes,
+						 uint8_t num_modes,
+						 const koki_camera_params_t *calibration,
+						 float min_side, float max_side)
+{
+
+	koki_resolution_ctrl_t *ctrl;
+
+	assert(modes != NULL && num_modes > 0);
+	assert(calibration != NULL);
+	assert(max_side > min_side);
+
+	ctrl = g_malloc(sizeof(koki_resolution_ctrl_t));
+
+	ctrl->fd = fd;
+	ctrl->buffers = NULL;
+	ctrl->num_buffers = 0;
+
+	ctrl->modes = g_malloc(num_modes * sizeof(koki_resolution_t));
+	memcpy(ctrl->modes, modes, num_modes * sizeof(koki_resolution_t));
+	ctrl->num_modes = num_modes;
+	qsort(ctrl->modes, num_modes, sizeof(koki_resolution_t),
+	      compare_mode_area);
+
+	ctrl->calibration = *calibration;
+	ctrl->min_side = min_side;
+	ctrl->max_side = max_side;
+	ctrl->hold_frames = KOKI_RESOLUTION_HOLD_FRAMES;
+
+	/* start at the top, where the most markers can be found */
+	if (!start_mode(ctrl, num_modes - 1)){
+		fprintf(stderr, "couldn't start camera\n");
+		koki_resolution_ctrl_free(ctrl);
+		return NULL;
+	}
+
+	return ctrl;
+
+}
+
+
+
+/**
+ * @brief stops the camera streaming and frees the controller
+ *
+ * The camera itself is left open.
+ *
+ * @param ctrl  the controller to free
+ */
+void koki_resolution_ctrl_free(koki_resolution_ctrl_t *ctrl)
+{
+
+	if (ctrl == NULL)
+		return;
+
+	if (ctrl->buffers != NULL){
+		koki_v4l_stop_stream(ctrl->fd);
+		koki_v4l_free_buffers(ctrl->buffers, ctrl->num_buffers);
+	}
+
+	g_free(ctrl->modes);
+	g_free(ctrl);
+
+}
+
+
+
+/**
+ * @brief grabs a greyscale frame at the current resolution
+ *
+ * @param ctrl  the controller
+ * @return      a new greyscale \c IplImage, or NULL on failure
+ */
+IplImage* koki_resolution_ctrl_get_frame(koki_resolution_ctrl_t *ctrl)
+{
+
+	uint8_t *yuyv;
+
+	assert(ctrl != NULL);
+
+	/* a failed mode switch that couldn't be undone leaves the camera
+	   stopped */
+	if (ctrl->buffers == NULL)
+		return NULL;
+
+	yuyv = koki_v4l_get_frame_array(ctrl->fd, ctrl->buffers);
+	if (yuyv == NULL)
+		return NULL;
+
+	return koki_v4l_YUYV_frame_to_grayscale_image(yuyv,
+						      ctrl->size.width,
+						      ctrl->size.height);
+
+}
+
+
+
+/**
+ * @brief returns the camera parameters for the current resolution
+ *
+ * The returned parameters change whenever koki_resolution_ctrl_update()
+ * switches resolution, so should be fetched for every frame.
+ *
+ * @param ctrl  the controller
+ * @return      the camera parameters, owned by the controller
+ */
+koki_camera_params_t* koki_resolution_ctrl_get_params(koki_resolution_ctrl_t *ctrl)
+{
+
+	assert(ctrl != NULL);
+
+	return &ctrl->params;
+
+}
+
+
+
+/**
+ * @brief calculates the average side length of a marker in the image
+ *
+ * @param marker  the marker
+ * @return        the average side length, in pixels
+ */
+static float marker_side_length(const koki_marker_t *marker)
+{
+
+	float sum = 0;
+
+	for (uint8_t i=0; i<4; i++){
+
+		const koki_point2Df_t *a = &marker->vertices[i].image;
+		const koki_point2Df_t *b = &marker->vertices[(i+1) % 4].image;
+
+		sum += sqrtf((a->x - b->x) * (a->x - b->x) +
+			     (a->y - b->y) * (a->y - b->y));
+
+	}
+
+	return sum / 4;
+
+}
+
+
+
+/**
+ * @brief considers the markers found in the latest frame, and switches
+ *        resolution if appropriate
+ *
+ * The resolution is increased straight away if any marker is smaller
+ * than \c min_side, or after \c hold_frames frames without any markers
+ * (as they may be too small to be found).  It's decreased once every
+ * marker would still be larger than \c max_side at the next lower
+ * resolution for \c hold_frames consecutive frames.
+ *
+ * The capture buffers are reallocated when the resolution changes, so any
+ * frame arrays previously grabbed become invalid.  If the camera won't
+ * switch, the previous resolution is restored, and the switch is tried
+ * again once its condition has held for another \c hold_frames frames.
+ * Should even the previous resolution fail to restart, the camera is
+ * left stopped, and koki_resolution_ctrl_get_frame() returns NULL.
+ *
+ * @param ctrl     the controller
+ * @param markers  the markers found in the latest frame (may be NULL)
+ * @return         whether the resolution was changed, or the camera
+ *                 failed to switch
+ */
+koki_resolution_change_t koki_resolution_ctrl_update(koki_resolution_ctrl_t *ctrl,
+						     const GPtrArray *markers)
+{
+
+	float smallest = INFINITY, scale;
+	uint8_t top = ctrl->num_modes - 1;
+
+	assert(ctrl != NULL);
+
+	if (markers == NULL || markers->len == 0){
+
+		ctrl->down_count = 0;
+		if (ctrl->up_count < ctrl->hold_frames)
+			ctrl->up_count = 0;
+
+		if (ctrl->current < top
+		    && ++ctrl->empty_count >= ctrl->hold_frames)
+			return switch_mode(ctrl, top);
+
+		return KOKI_RESOLUTION_UNCHANGED;
+
+	}
+
+	ctrl->empty_count = 0;
+
+	for (guint i=0; i<markers->len; i++){
+
+		float side = marker_side_length(g_ptr_array_index(markers, i));
+
+		if (side < smallest)
+			smallest = side;
+
+	}
+
+	if (smallest < ctrl->min_side){
+
+		ctrl->down_count = 0;
+
+		if (ctrl->current == top)
+			return KOKI_RESOLUTION_UNCHANGED;
+
+		/* after a failed switch, wait for the condition to hold */
+		if (ctrl->up_count < ctrl->hold_frames)
+			ctrl->up_count++;
+
+		if (ctrl->up_count >= ctrl->hold_frames)
+			return switch_mode(ctrl, ctrl->current + 1);
+
+		return KOKI_RESOLUTION_UNCHANGED;
+
+	}
+
+	if (ctrl->up_count < ctrl->hold_frames)
+		ctrl->up_count = 0;
+
+	if (ctrl->current == 0)
+		return KOKI_RESOLUTION_UNCHANGED;
+
+	/* how big would the smallest marker be one mode down? */
+	scale = (float)ctrl->modes[ctrl->current - 1].width / ctrl->size.width;
+
+	if (smallest * scale > ctrl->max_side){
+
+		if (++ctrl->down_count >= ctrl->hold_frames)
+			return switch_mode(ctrl, ctrl->current - 1);
+
+	} else {
+
+		ctrl->down_count = 0;
+
+	}
+
+	return KOKI_RESOLUTION_UNCHANGED;
+
+}
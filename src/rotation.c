@@ -27,6 +27,7 @@
 
 #include "points.h"
 #include "marker.h"
+#include "fixed.h"
 
 #include "rotation.h"
 
@@ -173,6 +174,38 @@ koki_marker_rotation_t koki_rotation_estimate_array(koki_point3Df_t points[4])
 
 
 
+/**
+ * @brief adds an estimated rotation to a marker's, normalising the result
+ *
+ * @param marker    the marker to store the rotation in
+ * @param rotation  the rotation, in degrees, of the marker's points
+ */
+static void add_rotation(koki_marker_t *marker, koki_marker_rotation_t rotation)
+{
+
+	/* add to marker rotation and normalise */
+	marker->rotation.x += rotation.x;
+	marker->rotation.x -= marker->rotation.x >= 360 ? 360 : 0;
+
+	marker->rotation.y += rotation.y;
+	marker->rotation.y -= marker->rotation.y >= 360 ? 360 : 0;
+
+	/* add code rotation offset */
+	marker->rotation.z += rotation.z + marker->rotation_offset;
+	marker->rotation.z -= marker->rotation.z >= 360 ? 360 : 0;
+
+	/* put in range -180 < angle <= 180 */
+	if (marker->rotation.z > 180.0)
+		marker->rotation.z = -(360.0 - marker->rotation.z);
+
+	/* negate so +ve rotation is anti-clockwise looking from (0, 0, 0)
+	   towards +ve Z (in the distance) */
+	marker->rotation.z = -marker->rotation.z;
+
+}
+
+
+
 /**
  * @brief estimates the rotation of the marker in 3D space about the 3 axes
  *        and stores the result in the given marker
@@ -204,23 +237,120 @@ void koki_rotation_estimate(koki_marker_t *marker)
 	/* estimate rotation */
 	rotation = koki_rotation_estimate_array(points);
 
-	/* add to marker rotation and normalise */
-	marker->rotation.x += rotation.x;
-	marker->rotation.x -= marker->rotation.x >= 360 ? 360 : 0;
+	add_rotation(marker, rotation);
 
-	marker->rotation.y += rotation.y;
-	marker->rotation.y -= marker->rotation.y >= 360 ? 360 : 0;
+}
 
-	/* add code rotation offset */
-	marker->rotation.z += rotation.z + marker->rotation_offset;
-	marker->rotation.z -= marker->rotation.z >= 360 ? 360 : 0;
 
-	/* put in range -180 < angle <= 180 */
-	if (marker->rotation.z > 180.0)
-		marker->rotation.z = -(360.0 - marker->rotation.z);
 
-	/* negate so +ve rotation is anti-clockwise looking from (0, 0, 0)
-	   towards +ve Z (in the distance) */
-	marker->rotation.z = -marker->rotation.z;
+/**
+ * @brief the fixed-point equivalent of koki_rotation_estimate_array()
+ *
+ * @param points  the array of points, centred about some centre (i.e. the
+ *                mean of the 4 points) to estimate the rotation of
+ * @return        an estimate of the rotation of the points about each
+ *                axis, in degrees
+ */
+koki_fixed_point3_t koki_rotation_estimate_array_fixed(const koki_fixed_point3_t points[4])
+{
+
+	const koki_fixed_point3_t *a = &points[0], *b = &points[1];
+	int64_t n[3], len, m[3], r[3], out;
+	koki_fixed_t rx, ry, rz, sin_x, sin_y, cos_x, cos_y;
+	koki_fixed_point3_t output;
+
+	assert(points != NULL);
+
+	/* calculate normal (Q32) -- Note that this assumes the centre of
+	   the points is \c (0, 0, 0) */
+	n[0] = (int64_t)a->y * b->z - (int64_t)a->z * b->y;
+	n[1] = (int64_t)a->z * b->x - (int64_t)a->x * b->z;
+	n[2] = (int64_t)a->x * b->y - (int64_t)a->y * b->x;
+
+	len = koki_fixed_hypot64(koki_fixed_hypot64(n[0], n[1]), n[2]);
+
+	if (len == 0){
+		output.x = output.y = output.z = 0;
+		return output;
+	}
+
+	/* rotation about Y --> atan2(n_x, n_z) */
+	ry = koki_fixed_atan2_64(n[0], n[2]);
+
+	/* rotation about X --> asin(n_y / |n|) */
+	rx = koki_fixed_asin(koki_fixed_div64(n[1], len, KOKI_FIXED_SHIFT));
+
+	/* re-jiggle the numbers to be between +/- 180 degrees, as the
+	   float version does */
+	ry = KOKI_FIXED_PI - ry;
+	rx -= rx >= KOKI_FIXED_PI ? 2 * KOKI_FIXED_PI : 0;
+	ry -= ry >= KOKI_FIXED_PI ? 2 * KOKI_FIXED_PI : 0;
+	ry = -ry;
+
+	/* rotation about Z -- unrotate the centre of the top edge about X
+	   and Y, then take its angle */
+	koki_fixed_sincos(-rx, &sin_x, &cos_x);
+	koki_fixed_sincos(-ry, &sin_y, &cos_y);
+
+	/* Q16 */
+	m[0] = ((int64_t)a->x + b->x) / 2;
+	m[1] = ((int64_t)a->y + b->y) / 2;
+	m[2] = ((int64_t)a->z + b->z) / 2;
+
+	/* the first two rows of R, applied to m (Q48) */
+	r[0] = (int64_t)cos_y * m[0] * KOKI_FIXED_ONE
+		+ (int64_t)sin_y * m[2] * KOKI_FIXED_ONE;
+	r[1] = (int64_t)sin_x * sin_y * m[0]
+		+ (int64_t)cos_x * m[1] * KOKI_FIXED_ONE
+		- (int64_t)sin_x * cos_y * m[2];
+
+	rz = koki_fixed_atan2_64(r[0], r[1]);
+
+	/* convert to degrees */
+	out = (int64_t)rx * KOKI_FIXED_DEG;
+	output.x = (out + KOKI_FIXED_HALF) >> KOKI_FIXED_SHIFT;
+	out = (int64_t)ry * KOKI_FIXED_DEG;
+	output.y = (out + KOKI_FIXED_HALF) >> KOKI_FIXED_SHIFT;
+	out = (int64_t)rz * KOKI_FIXED_DEG;
+	output.z = (out + KOKI_FIXED_HALF) >> KOKI_FIXED_SHIFT;
+
+	return output;
+
+}
+
+
+
+/**
+ * @brief the fixed-point equivalent of koki_rotation_estimate()
+ *
+ * @param marker  the marker that contains the vertices to estimate the
+ *                rotation of
+ */
+void koki_rotation_estimate_fixed(koki_marker_t *marker)
+{
+
+	koki_fixed_point3_t points[4], r;
+	koki_marker_rotation_t rotation;
+
+	assert(marker != NULL);
+
+	/* create (0, 0, 0) centred points array */
+	for (uint8_t i=0; i<4; i++){
+		points[i].x = koki_fixed_from_float(marker->vertices[i].world.x -
+						    marker->centre.world.x);
+		points[i].y = koki_fixed_from_float(marker->vertices[i].world.y -
+						    marker->centre.world.y);
+		points[i].z = koki_fixed_from_float(marker->vertices[i].world.z -
+						    marker->centre.world.z);
+	}
+
+	/* estimate rotation */
+	r = koki_rotation_estimate_array_fixed(points);
+
+	rotation.x = koki_fixed_to_float(r.x);
+	rotation.y = koki_fixed_to_float(r.y);
+	rotation.z = koki_fixed_to_float(r.z);
+
+	add_rotation(marker, rotation);
 
 }
@@ -0,0 +1,238 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/**
+ * @file  simd-neon.c
+ * @brief Implementation of the NEON pixel kernels
+ *
+ * NEON is always present on AArch64.  On 32-bit ARM these are only built
+ * when the compiler has been told the FPU has it, and are still only used
+ * if the kernel reports it in the hardware capabilities.
+ */
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+
+#include <stdint.h>
+#include <arm_neon.h>
+
+#include "simd.h"
+
+
+
+static void yuyv_to_grey_neon(const uint8_t *yuyv, uint8_t *grey, uint32_t n)
+{
+
+	uint32_t i = 0;
+
+	for (; i + 16 <= n; i += 16){
+
+		/* de-interleave into luma and chroma */
+		uint8x16x2_t v = vld2q_u8(yuyv + i * 2);
+
+		vst1q_u8(grey + i, v.val[0]);
+
+	}
+
+	for (; i < n; i++)
+		grey[i] = yuyv[i * 2];
+
+}
+
+
+
+static void threshold_neon(const uint8_t *src, uint8_t *dst, uint32_t n,
+			   uint8_t thresh)
+{
+
+	const uint8x16_t t = vdupq_n_u8(thresh);
+	uint32_t i = 0;
+
+	for (; i + 16 <= n; i += 16)
+		vst1q_u8(dst + i, vcgtq_u8(vld1q_u8(src + i), t));
+
+	for (; i < n; i++)
+		dst[i] = src[i] > thresh ? 255 : 0;
+
+}
+
+
+
+static void integral_row_neon(const uint8_t *src, uint32_t *col_sum,
+			      uint32_t *out, uint32_t n)
+{
+
+	const uint32x4_t zero = vdupq_n_u32(0);
+	uint32_t i = 0, total = 0;
+
+	for (; i + 8 <= n; i += 8){
+
+		uint16x8_t px = vmovl_u8(vld1_u8(src + i));
+		uint32x4_t q[2] = { vmovl_u16(vget_low_u16(px)),
+				    vmovl_u16(vget_high_u16(px)) };
+
+		for (uint8_t j=0; j<2; j++){
+
+			uint32_t *c = col_sum + i + j * 4;
+			uint32x4_t s = vaddq_u32(vld1q_u32(c), q[j]);
+
+			vst1q_u32(c, s);
+
+			/* prefix sum across the four lanes */
+			s = vaddq_u32(s, vextq_u32(zero, s, 3));
+			s = vaddq_u32(s, vextq_u32(zero, s, 2));
+			s = vaddq_u32(s, vdupq_n_u32(total));
+
+			vst1q_u32(out + i + j * 4, s);
+			total = vgetq_lane_u32(s, 3);
+
+		}
+
+	}
+
+	for (; i < n; i++){
+		col_sum[i] += src[i];
+		total += col_sum[i];
+		out[i] = total;
+	}
+
+}
+
+
+
+static void accumulate_row_neon(const uint8_t *src, uint16_t *acc, uint32_t n)
+{
+
+	uint32_t i = 0;
+
+	for (; i + 16 <= n; i += 16){
+
+		uint8x16_t v = vld1q_u8(src + i);
+
+		vst1q_u16(acc + i, vaddw_u8(vld1q_u16(acc + i),
+					    vget_low_u8(v)));
+		vst1q_u16(acc + i + 8, vaddw_u8(vld1q_u16(acc + i + 8),
+						vget_high_u8(v)));
+
+	}
+
+	for (; i < n; i++)
+		acc[i] += src[i];
+
+}
+
+
+
+static void bin_2x2_neon(const uint8_t *row0, const uint8_t *row1,
+			 uint8_t *dst, uint32_t n)
+{
+
+	uint32_t i = 0;
+
+	for (; i + 16 <= n; i += 16){
+
+		/* pairwise sums of one row, plus those of the other */
+		uint16x8_t lo = vpadalq_u8(vpaddlq_u8(vld1q_u8(row0 + i * 2)),
+					   vld1q_u8(row1 + i * 2));
+		uint16x8_t hi = vpadalq_u8(vpaddlq_u8(vld1q_u8(row0 + i * 2 + 16)),
+					   vld1q_u8(row1 + i * 2 + 16));
+
+		vst1q_u8(dst + i, vcombine_u8(vrshrn_n_u16(lo, 2),
+					      vrshrn_n_u16(hi, 2)));
+
+	}
+
+	for (; i < n; i++)
+		dst[i] = (row0[i * 2] + row0[i * 2 + 1]
+			  + row1[i * 2] + row1[i * 2 + 1] + 2) >> 2;
+
+}
+
+
+
+/* a / b, where 32-bit ARM has no vector division */
+static inline float32x4_t div_neon(float32x4_t a, float32x4_t b)
+{
+
+#ifdef __aarch64__
+	return vdivq_f32(a, b);
+#else
+	/* an estimate of 1/b, refined twice */
+	float32x4_t r = vrecpeq_f32(b);
+	r = vmulq_f32(vrecpsq_f32(b, r), r);
+	r = vmulq_f32(vrecpsq_f32(b, r), r);
+	return vmulq_f32(a, r);
+#endif
+
+}
+
+
+
+static void project_row_neon(const koki_homography_batch_t *H,
+			     float u0, float du, float v, uint32_t n,
+			     int32_t max_x, int32_t max_y,
+			     int32_t *xs, int32_t *ys)
+{
+
+	const float32x4_t half = vdupq_n_f32(0.5f), zero = vdupq_n_f32(0);
+	const float32x4_t mx = vdupq_n_f32(max_x), my = vdupq_n_f32(max_y);
+
+	/* four homographies at a time */
+	for (uint8_t j=0; j<KOKI_HOMOGRAPHY_BATCH; j+=4){
+
+		float32x4_t a = vld1q_f32(H->a + j), d = vld1q_f32(H->d + j);
+		float32x4_t g = vld1q_f32(H->g + j);
+		float32x4_t cx = vmlaq_n_f32(vld1q_f32(H->c + j), vld1q_f32(H->b + j), v);
+		float32x4_t cy = vmlaq_n_f32(vld1q_f32(H->f + j), vld1q_f32(H->e + j), v);
+		float32x4_t cw = vmlaq_n_f32(vdupq_n_f32(1), vld1q_f32(H->h + j), v);
+
+		for (uint32_t i=0; i<n; i++){
+
+			float u = u0 + i * du;
+			float32x4_t w = vmlaq_n_f32(cw, g, u);
+			float32x4_t x = div_neon(vmlaq_n_f32(cx, a, u), w);
+			float32x4_t y = div_neon(vmlaq_n_f32(cy, d, u), w);
+
+			/* NaNs fail the comparison, so end up at 0 */
+			x = vaddq_f32(x, half);
+			y = vaddq_f32(y, half);
+			x = vbslq_f32(vcgtq_f32(x, zero), vminq_f32(x, mx), zero);
+			y = vbslq_f32(vcgtq_f32(y, zero), vminq_f32(y, my), zero);
+
+			vst1q_s32(xs + i * KOKI_HOMOGRAPHY_BATCH + j,
+				  vcvtq_s32_f32(x));
+			vst1q_s32(ys + i * KOKI_HOMOGRAPHY_BATCH + j,
+				  vcvtq_s32_f32(y));
+
+		}//for i
+	}//for j
+
+}
+
+
+
+const koki_simd_kernels_t koki_simd_neon = {
+	.level = KOKI_SIMD_NEON,
+	.name = "neon",
+	.yuyv_to_grey = yuyv_to_grey_neon,
+	.threshold = threshold_neon,
+	.integral_row = integral_row_neon,
+	.accumulate_row = accumulate_row_neon,
+	.bin_2x2 = bin_2x2_neon,
+	.project_row = project_row_neon,
+};
+
+#endif /* NEON */
@@ -0,0 +1,509 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/**
+ * @file  simd-x86.c
+ * @brief Implementation of the SSE2 and AVX2 pixel kernels
+ *
+ * Every function here carries a target attribute, so that this file can
+ * be compiled with the same flags as the rest of the library.  None of
+ * them may be called before koki_simd_supported() has confirmed the CPU
+ * can run them.
+ */
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <stdint.h>
+#include <immintrin.h>
+
+#include "simd.h"
+
+#define SSE2 __attribute__((target("sse2")))
+#define AVX2 __attribute__((target("avx2")))
+
+
+
+/* ---------------------------------------------------------------- SSE2 */
+
+SSE2 static void yuyv_to_grey_sse2(const uint8_t *yuyv, uint8_t *grey,
+				   uint32_t n)
+{
+
+	const __m128i mask = _mm_set1_epi16(0x00ff);
+	uint32_t i = 0;
+
+	for (; i + 16 <= n; i += 16){
+
+		__m128i a = _mm_loadu_si128((const __m128i*)(yuyv + i * 2));
+		__m128i b = _mm_loadu_si128((const __m128i*)(yuyv + i * 2 + 16));
+
+		/* luma is in the even bytes */
+		a = _mm_and_si128(a, mask);
+		b = _mm_and_si128(b, mask);
+
+		_mm_storeu_si128((__m128i*)(grey + i), _mm_packus_epi16(a, b));
+
+	}
+
+	for (; i < n; i++)
+		grey[i] = yuyv[i * 2];
+
+}
+
+
+
+SSE2 static void threshold_sse2(const uint8_t *src, uint8_t *dst, uint32_t n,
+				uint8_t thresh)
+{
+
+	/* there's no unsigned byte comparison, so flip the sign bits */
+	const __m128i bias = _mm_set1_epi8((char)0x80);
+	const __m128i t = _mm_set1_epi8((char)(thresh ^ 0x80));
+	uint32_t i = 0;
+
+	for (; i + 16 <= n; i += 16){
+
+		__m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+
+		v = _mm_cmpgt_epi8(_mm_xor_si128(v, bias), t);
+		_mm_storeu_si128((__m128i*)(dst + i), v);
+
+	}
+
+	for (; i < n; i++)
+		dst[i] = src[i] > thresh ? 255 : 0;
+
+}
+
+
+
+/**
+ * @brief adds four pixels to their column sums, and returns the running
+ *        total of the column sums starting from \c carry
+ */
+SSE2 static inline __m128i integral_quad_sse2(__m128i px, uint32_t *col_sum,
+					      __m128i *carry)
+{
+
+	__m128i s = _mm_add_epi32(_mm_loadu_si128((__m128i*)col_sum), px);
+
+	_mm_storeu_si128((__m128i*)col_sum, s);
+
+	/* prefix sum across the four lanes */
+	s = _mm_add_epi32(s, _mm_slli_si128(s, 4));
+	s = _mm_add_epi32(s, _mm_slli_si128(s, 8));
+	s = _mm_add_epi32(s, *carry);
+
+	*carry = _mm_shuffle_epi32(s, _MM_SHUFFLE(3, 3, 3, 3));
+
+	return s;
+
+}
+
+
+
+SSE2 static void integral_row_sse2(const uint8_t *src, uint32_t *col_sum,
+				   uint32_t *out, uint32_t n)
+{
+
+	const __m128i zero = _mm_setzero_si128();
+	__m128i carry = zero;
+	uint32_t i = 0, total;
+
+	for (; i + 16 <= n; i += 16){
+
+		__m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+		__m128i lo = _mm_unpacklo_epi8(v, zero);
+		__m128i hi = _mm_unpackhi_epi8(v, zero);
+		__m128i q[4] = {
+			_mm_unpacklo_epi16(lo, zero), _mm_unpackhi_epi16(lo, zero),
+			_mm_unpacklo_epi16(hi, zero), _mm_unpackhi_epi16(hi, zero)
+		};
+
+		for (uint8_t j=0; j<4; j++){
+			__m128i s = integral_quad_sse2(q[j], col_sum + i + j * 4,
+						       &carry);
+			_mm_storeu_si128((__m128i*)(out + i + j * 4), s);
+		}
+
+	}
+
+	total = _mm_cvtsi128_si32(carry);
+
+	for (; i < n; i++){
+		col_sum[i] += src[i];
+		total += col_sum[i];
+		out[i] = total;
+	}
+
+}
+
+
+
+SSE2 static void accumulate_row_sse2(const uint8_t *src, uint16_t *acc,
+				     uint32_t n)
+{
+
+	const __m128i zero = _mm_setzero_si128();
+	uint32_t i = 0;
+
+	for (; i + 16 <= n; i += 16){
+
+		__m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+		__m128i *a = (__m128i*)(acc + i);
+
+		_mm_storeu_si128(a, _mm_add_epi16(_mm_loadu_si128(a),
+						  _mm_unpacklo_epi8(v, zero)));
+		_mm_storeu_si128(a + 1, _mm_add_epi16(_mm_loadu_si128(a + 1),
+						      _mm_unpackhi_epi8(v, zero)));
+
+	}
+
+	for (; i < n; i++)
+		acc[i] += src[i];
+
+}
+
+
+
+SSE2 static inline __m128i pair_sums_sse2(__m128i v)
+{
+
+	/* adds each even byte to the odd one after it */
+	return _mm_add_epi16(_mm_and_si128(v, _mm_set1_epi16(0x00ff)),
+			     _mm_srli_epi16(v, 8));
+
+}
+
+
+
+SSE2 static void bin_2x2_sse2(const uint8_t *row0, const uint8_t *row1,
+			      uint8_t *dst, uint32_t n)
+{
+
+	const __m128i two = _mm_set1_epi16(2);
+	uint32_t i = 0;
+
+	for (; i + 16 <= n; i += 16){
+
+		const __m128i *a = (const __m128i*)(row0 + i * 2);
+		const __m128i *b = (const __m128i*)(row1 + i * 2);
+		__m128i lo, hi;
+
+		lo = _mm_add_epi16(pair_sums_sse2(_mm_loadu_si128(a)),
+				   pair_sums_sse2(_mm_loadu_si128(b)));
+		hi = _mm_add_epi16(pair_sums_sse2(_mm_loadu_si128(a + 1)),
+				   pair_sums_sse2(_mm_loadu_si128(b + 1)));
+
+		lo = _mm_srli_epi16(_mm_add_epi16(lo, two), 2);
+		hi = _mm_srli_epi16(_mm_add_epi16(hi, two), 2);
+
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(lo, hi));
+
+	}
+
+	for (; i < n; i++)
+		dst[i] = (row0[i * 2] + row0[i * 2 + 1]
+			  + row1[i * 2] + row1[i * 2 + 1] + 2) >> 2;
+
+}
+
+
+
+SSE2 static void project_row_sse2(const koki_homography_batch_t *H,
+				  float u0, float du, float v, uint32_t n,
+				  int32_t max_x, int32_t max_y,
+				  int32_t *xs, int32_t *ys)
+{
+
+	const __m128 half = _mm_set1_ps(0.5f), zero = _mm_setzero_ps();
+	const __m128 mx = _mm_set1_ps(max_x), my = _mm_set1_ps(max_y);
+	const __m128 vv = _mm_set1_ps(v), one = _mm_set1_ps(1);
+
+	/* four homographies at a time */
+	for (uint8_t j=0; j<KOKI_HOMOGRAPHY_BATCH; j+=4){
+
+		__m128 a = _mm_loadu_ps(H->a + j), d = _mm_loadu_ps(H->d + j);
+		__m128 g = _mm_loadu_ps(H->g + j);
+		__m128 cx = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(H->b + j), vv),
+				       _mm_loadu_ps(H->c + j));
+		__m128 cy = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(H->e + j), vv),
+				       _mm_loadu_ps(H->f + j));
+		__m128 cw = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(H->h + j), vv),
+				       one);
+
+		for (uint32_t i=0; i<n; i++){
+
+			__m128 u = _mm_set1_ps(u0 + i * du);
+			__m128 w = _mm_add_ps(_mm_mul_ps(g, u), cw);
+			__m128 x = _mm_div_ps(_mm_add_ps(_mm_mul_ps(a, u), cx), w);
+			__m128 y = _mm_div_ps(_mm_add_ps(_mm_mul_ps(d, u), cy), w);
+
+			/* max returns its second operand for NaNs */
+			x = _mm_min_ps(_mm_max_ps(_mm_add_ps(x, half), zero), mx);
+			y = _mm_min_ps(_mm_max_ps(_mm_add_ps(y, half), zero), my);
+
+			_mm_storeu_si128((__m128i*)(xs + i * KOKI_HOMOGRAPHY_BATCH + j),
+					 _mm_cvttps_epi32(x));
+			_mm_storeu_si128((__m128i*)(ys + i * KOKI_HOMOGRAPHY_BATCH + j),
+					 _mm_cvttps_epi32(y));
+
+		}//for i
+	}//for j
+
+}
+
+
+
+const koki_simd_kernels_t koki_simd_sse2 = {
+	.level = KOKI_SIMD_SSE2,
+	.name = "sse2",
+	.yuyv_to_grey = yuyv_to_grey_sse2,
+	.threshold = threshold_sse2,
+	.integral_row = integral_row_sse2,
+	.accumulate_row = accumulate_row_sse2,
+	.bin_2x2 = bin_2x2_sse2,
+	.project_row = project_row_sse2,
+};
+
+
+
+/* ---------------------------------------------------------------- AVX2 */
+
+AVX2 static void yuyv_to_grey_avx2(const uint8_t *yuyv, uint8_t *grey,
+				   uint32_t n)
+{
+
+	const __m256i mask = _mm256_set1_epi16(0x00ff);
+	uint32_t i = 0;
+
+	for (; i + 32 <= n; i += 32){
+
+		__m256i a = _mm256_loadu_si256((const __m256i*)(yuyv + i * 2));
+		__m256i b = _mm256_loadu_si256((const __m256i*)(yuyv + i * 2 + 32));
+		__m256i v;
+
+		v = _mm256_packus_epi16(_mm256_and_si256(a, mask),
+					_mm256_and_si256(b, mask));
+
+		/* packing works within 128-bit lanes, so put them back in
+		   order */
+		v = _mm256_permute4x64_epi64(v, _MM_SHUFFLE(3, 1, 2, 0));
+
+		_mm256_storeu_si256((__m256i*)(grey + i), v);
+
+	}
+
+	for (; i < n; i++)
+		grey[i] = yuyv[i * 2];
+
+}
+
+
+
+AVX2 static void threshold_avx2(const uint8_t *src, uint8_t *dst, uint32_t n,
+				uint8_t thresh)
+{
+
+	const __m256i bias = _mm256_set1_epi8((char)0x80);
+	const __m256i t = _mm256_set1_epi8((char)(thresh ^ 0x80));
+	uint32_t i = 0;
+
+	for (; i + 32 <= n; i += 32){
+
+		__m256i v = _mm256_loadu_si256((const __m256i*)(src + i));
+
+		v = _mm256_cmpgt_epi8(_mm256_xor_si256(v, bias), t);
+		_mm256_storeu_si256((__m256i*)(dst + i), v);
+
+	}
+
+	for (; i < n; i++)
+		dst[i] = src[i] > thresh ? 255 : 0;
+
+}
+
+
+
+AVX2 static void integral_row_avx2(const uint8_t *src, uint32_t *col_sum,
+				   uint32_t *out, uint32_t n)
+{
+
+	const __m256i last = _mm256_set1_epi32(7);
+	__m256i carry = _mm256_setzero_si256();
+	uint32_t i = 0, total;
+
+	for (; i + 8 <= n; i += 8){
+
+		__m128i px8 = _mm_loadl_epi64((const __m128i*)(src + i));
+		__m256i s = _mm256_cvtepu8_epi32(px8);
+		__m256i low;
+
+		s = _mm256_add_epi32(_mm256_loadu_si256((__m256i*)(col_sum + i)), s);
+		_mm256_storeu_si256((__m256i*)(col_sum + i), s);
+
+		/* prefix sum within each 128-bit lane ... */
+		s = _mm256_add_epi32(s, _mm256_slli_si256(s, 4));
+		s = _mm256_add_epi32(s, _mm256_slli_si256(s, 8));
+
+		/* ... then carry the low lane's total into the high lane */
+		low = _mm256_permute2x128_si256(s, s, 0x08);
+		s = _mm256_add_epi32(s, _mm256_shuffle_epi32(low, 0xff));
+
+		s = _mm256_add_epi32(s, carry);
+		carry = _mm256_permutevar8x32_epi32(s, last);
+
+		_mm256_storeu_si256((__m256i*)(out + i), s);
+
+	}
+
+	total = _mm256_cvtsi256_si32(carry);
+
+	for (; i < n; i++){
+		col_sum[i] += src[i];
+		total += col_sum[i];
+		out[i] = total;
+	}
+
+}
+
+
+
+AVX2 static void accumulate_row_avx2(const uint8_t *src, uint16_t *acc,
+				     uint32_t n)
+{
+
+	uint32_t i = 0;
+
+	for (; i + 16 <= n; i += 16){
+
+		__m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+		__m256i *a = (__m256i*)(acc + i);
+
+		_mm256_storeu_si256(a, _mm256_add_epi16(_mm256_loadu_si256(a),
+							_mm256_cvtepu8_epi16(v)));
+
+	}
+
+	for (; i < n; i++)
+		acc[i] += src[i];
+
+}
+
+
+
+AVX2 static inline __m256i pair_sums_avx2(__m256i v)
+{
+
+	return _mm256_add_epi16(_mm256_and_si256(v, _mm256_set1_epi16(0x00ff)),
+				_mm256_srli_epi16(v, 8));
+
+}
+
+
+
+AVX2 static void bin_2x2_avx2(const uint8_t *row0, const uint8_t *row1,
+			      uint8_t *dst, uint32_t n)
+{
+
+	const __m256i two = _mm256_set1_epi16(2);
+	uint32_t i = 0;
+
+	for (; i + 32 <= n; i += 32){
+
+		const __m256i *a = (const __m256i*)(row0 + i * 2);
+		const __m256i *b = (const __m256i*)(row1 + i * 2);
+		__m256i lo, hi, v;
+
+		lo = _mm256_add_epi16(pair_sums_avx2(_mm256_loadu_si256(a)),
+				      pair_sums_avx2(_mm256_loadu_si256(b)));
+		hi = _mm256_add_epi16(pair_sums_avx2(_mm256_loadu_si256(a + 1)),
+				      pair_sums_avx2(_mm256_loadu_si256(b + 1)));
+
+		lo = _mm256_srli_epi16(_mm256_add_epi16(lo, two), 2);
+		hi = _mm256_srli_epi16(_mm256_add_epi16(hi, two), 2);
+
+		/* packing works within 128-bit lanes, so put them back in
+		   order */
+		v = _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi),
+					     _MM_SHUFFLE(3, 1, 2, 0));
+
+		_mm256_storeu_si256((__m256i*)(dst + i), v);
+
+	}
+
+	for (; i < n; i++)
+		dst[i] = (row0[i * 2] + row0[i * 2 + 1]
+			  + row1[i * 2] + row1[i * 2 + 1] + 2) >> 2;
+
+}
+
+
+
+AVX2 static void project_row_avx2(const koki_homography_batch_t *H,
+				  float u0, float du, float v, uint32_t n,
+				  int32_t max_x, int32_t max_y,
+				  int32_t *xs, int32_t *ys)
+{
+
+	const __m256 half = _mm256_set1_ps(0.5f), zero = _mm256_setzero_ps();
+	const __m256 mx = _mm256_set1_ps(max_x), my = _mm256_set1_ps(max_y);
+	const __m256 vv = _mm256_set1_ps(v), one = _mm256_set1_ps(1);
+
+	/* the whole batch at once */
+	__m256 a = _mm256_loadu_ps(H->a), d = _mm256_loadu_ps(H->d);
+	__m256 g = _mm256_loadu_ps(H->g);
+	__m256 cx = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(H->b), vv),
+				  _mm256_loadu_ps(H->c));
+	__m256 cy = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(H->e), vv),
+				  _mm256_loadu_ps(H->f));
+	__m256 cw = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(H->h), vv), one);
+
+	for (uint32_t i=0; i<n; i++){
+
+		__m256 u = _mm256_set1_ps(u0 + i * du);
+		__m256 w = _mm256_add_ps(_mm256_mul_ps(g, u), cw);
+		__m256 x = _mm256_div_ps(_mm256_add_ps(_mm256_mul_ps(a, u), cx), w);
+		__m256 y = _mm256_div_ps(_mm256_add_ps(_mm256_mul_ps(d, u), cy), w);
+
+		/* max returns its second operand for NaNs */
+		x = _mm256_min_ps(_mm256_max_ps(_mm256_add_ps(x, half), zero), mx);
+		y = _mm256_min_ps(_mm256_max_ps(_mm256_add_ps(y, half), zero), my);
+
+		_mm256_storeu_si256((__m256i*)(xs + i * KOKI_HOMOGRAPHY_BATCH),
+				    _mm256_cvttps_epi32(x));
+		_mm256_storeu_si256((__m256i*)(ys + i * KOKI_HOMOGRAPHY_BATCH),
+				    _mm256_cvttps_epi32(y));
+
+	}//for
+
+}
+
+
+
+const koki_simd_kernels_t koki_simd_avx2 = {
+	.level = KOKI_SIMD_AVX2,
+	.name = "avx2",
+	.yuyv_to_grey = yuyv_to_grey_avx2,
+	.threshold = threshold_avx2,
+	.integral_row = integral_row_avx2,
+	.accumulate_row = accumulate_row_avx2,
+	.bin_2x2 = bin_2x2_avx2,
+	.project_row = project_row_avx2,
+};
+
+#endif /* x86 */
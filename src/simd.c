@@ -0,0 +1,319 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/**
+ * @file  simd.c
+ * @brief Implementation of the scalar pixel kernels, and of choosing
+ *        which variant of the kernels to use
+ *
+ * The package is built for the baseline instruction set, so the faster
+ * variants (in simd-x86.c and simd-neon.c) are compiled with per-function
+ * target attributes and only called once the CPU has been checked for
+ * them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <glib.h>
+
+#if (defined(__ARM_NEON) || defined(__ARM_NEON__)) && !defined(__aarch64__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+#include "simd.h"
+
+
+/* the variants built for this architecture, indexed by level */
+static const koki_simd_kernels_t *variants[KOKI_SIMD_NUM_LEVELS] = {
+	[KOKI_SIMD_SCALAR] = &koki_simd_scalar,
+#if defined(__x86_64__) || defined(__i386__)
+	[KOKI_SIMD_SSE2] = &koki_simd_sse2,
+	[KOKI_SIMD_AVX2] = &koki_simd_avx2,
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+	[KOKI_SIMD_NEON] = &koki_simd_neon,
+#endif
+};
+
+/* the kernels in use */
+static const koki_simd_kernels_t *active = NULL;
+static gsize selected = 0;
+
+
+
+static void yuyv_to_grey(const uint8_t *yuyv, uint8_t *grey, uint32_t n)
+{
+
+	for (uint32_t i=0; i<n; i++)
+		grey[i] = yuyv[i * 2];
+
+}
+
+
+
+static void threshold(const uint8_t *src, uint8_t *dst, uint32_t n,
+		      uint8_t thresh)
+{
+
+	for (uint32_t i=0; i<n; i++)
+		dst[i] = src[i] > thresh ? 255 : 0;
+
+}
+
+
+
+static void integral_row(const uint8_t *src, uint32_t *col_sum,
+			 uint32_t *out, uint32_t n)
+{
+
+	uint32_t total = 0;
+
+	for (uint32_t i=0; i<n; i++){
+
+		col_sum[i] += src[i];
+		total += col_sum[i];
+		out[i] = total;
+
+	}
+
+}
+
+
+
+static void accumulate_row(const uint8_t *src, uint16_t *acc, uint32_t n)
+{
+
+	for (uint32_t i=0; i<n; i++)
+		acc[i] += src[i];
+
+}
+
+
+
+static void bin_2x2(const uint8_t *row0, const uint8_t *row1, uint8_t *dst,
+		    uint32_t n)
+{
+
+	for (uint32_t i=0; i<n; i++)
+		dst[i] = (row0[i * 2] + row0[i * 2 + 1]
+			  + row1[i * 2] + row1[i * 2 + 1] + 2) >> 2;
+
+}
+
+
+
+static void project_row(const koki_homography_batch_t *H,
+			float u0, float du, float v, uint32_t n,
+			int32_t max_x, int32_t max_y,
+			int32_t *xs, int32_t *ys)
+{
+
+	for (uint8_t j=0; j<KOKI_HOMOGRAPHY_BATCH; j++){
+
+		/* the parts that are the same along the row */
+		float cx = H->b[j] * v + H->c[j];
+		float cy = H->e[j] * v + H->f[j];
+		float cw = H->h[j] * v + 1;
+
+		for (uint32_t i=0; i<n; i++){
+
+			float u = u0 + i * du;
+			float w = H->g[j] * u + cw;
+			float x = (H->a[j] * u + cx) / w + 0.5f;
+			float y = (H->d[j] * u + cy) / w + 0.5f;
+
+			/* (NaNs end up at 0) */
+			if (!(x > 0))
+				x = 0;
+			if (x > max_x)
+				x = max_x;
+			if (!(y > 0))
+				y = 0;
+			if (y > max_y)
+				y = max_y;
+
+			xs[i * KOKI_HOMOGRAPHY_BATCH + j] = (int32_t)x;
+			ys[i * KOKI_HOMOGRAPHY_BATCH + j] = (int32_t)y;
+
+		}//for i
+	}//for j
+
+}
+
+
+
+const koki_simd_kernels_t koki_simd_scalar = {
+	.level = KOKI_SIMD_SCALAR,
+	.name = "scalar",
+	.yuyv_to_grey = yuyv_to_grey,
+	.threshold = threshold,
+	.integral_row = integral_row,
+	.accumulate_row = accumulate_row,
+	.bin_2x2 = bin_2x2,
+	.project_row = project_row,
+};
+
+
+
+/**
+ * @brief checks whether a variant of the kernels can be used on this CPU
+ *
+ * @param level  the instruction set
+ * @return       TRUE if the variant was built and the CPU supports it
+ */
+bool koki_simd_supported( koki_simd_level_t level )
+{
+
+	if (level >= KOKI_SIMD_NUM_LEVELS || variants[level] == NULL)
+		return FALSE;
+
+	switch (level){
+
+#if defined(__x86_64__) || defined(__i386__)
+	case KOKI_SIMD_SSE2:
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("sse2");
+
+	case KOKI_SIMD_AVX2:
+		/* this also checks the OS saves the AVX state */
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2");
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+	case KOKI_SIMD_NEON:
+#ifdef __aarch64__
+		return TRUE;
+#else
+		return (getauxval(AT_HWCAP) & HWCAP_NEON) != 0;
+#endif
+#endif
+
+	default:
+		return level == KOKI_SIMD_SCALAR;
+
+	}
+
+}
+
+
+
+/**
+ * @brief picks the best supported kernels, or those named by the
+ *        \c KOKI_SIMD environment variable
+ */
+static const koki_simd_kernels_t* choose( void )
+{
+
+	const koki_simd_kernels_t *best = &koki_simd_scalar;
+	const char *forced = getenv("KOKI_SIMD");
+
+	for (int level=0; level<KOKI_SIMD_NUM_LEVELS; level++)
+		if (koki_simd_supported(level))
+			best = variants[level];
+
+	if (forced == NULL || *forced == '\0')
+		return best;
+
+	for (int level=0; level<KOKI_SIMD_NUM_LEVELS; level++){
+
+		if (variants[level] == NULL
+		    || strcmp(variants[level]->name, forced) != 0)
+			continue;
+
+		if (koki_simd_supported(level))
+			return variants[level];
+
+		fprintf(stderr, "KOKI_SIMD: %s isn't supported by this CPU, "
+			"using %s\n", forced, best->name);
+		return best;
+
+	}
+
+	fprintf(stderr, "KOKI_SIMD: no '%s' kernels in this build, using %s\n",
+		forced, best->name);
+
+	return best;
+
+}
+
+
+
+/**
+ * @brief chooses the kernels to use, if that hasn't been done already
+ *
+ * This is called by koki_new(), and the choice then holds for the rest of
+ * the process.
+ *
+ * @return  the chosen kernels
+ */
+const koki_simd_kernels_t* koki_simd_select( void )
+{
+
+	if (g_once_init_enter(&selected)){
+		active = choose();
+		g_once_init_leave(&selected, 1);
+	}
+
+	return active;
+
+}
+
+
+
+/**
+ * @brief returns the kernels in use
+ *
+ * @return  the kernels chosen by koki_simd_select(), choosing them now if
+ *          necessary
+ */
+const koki_simd_kernels_t* koki_simd_kernels( void )
+{
+
+	return koki_simd_select();
+
+}
+
+
+
+/**
+ * @brief overrides the choice of kernels, for testing and benchmarking
+ *
+ * The kernels are looked up as each stage runs, so this affects every
+ * context, including those created already.  It shouldn't be called
+ * while frames are being processed.
+ *
+ * @param level  the instruction set to use
+ * @return       FALSE if the variant isn't supported, TRUE otherwise
+ */
+bool koki_simd_set_level( koki_simd_level_t level )
+{
+
+	koki_simd_select();
+
+	if (!koki_simd_supported(level))
+		return FALSE;
+
+	active = variants[level];
+
+	return TRUE;
+
+}
@@ -0,0 +1,156 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/**
+ * @file  threads.c
+ * @brief Implementation of configuring the scheduling of libkoki's threads
+ *
+ * Real-time scheduling usually needs privileges (CAP_SYS_NICE, or an
+ * RLIMIT_RTPRIO above zero) that a robot's control process may not have.
+ * Rather than failing, a thread that isn't permitted its policy falls
+ * back to the normal policy with the configured nice value, or as near to
+ * it as RLIMIT_NICE allows, and the caller is told so.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <glib.h>
+
+#include "threads.h"
+
+
+/**
+ * @brief sets the calling thread's nice value, or the nearest to it that's
+ *        permitted
+ *
+ * @param nice  the nice value
+ * @return      TRUE if the nice value was set exactly
+ */
+static bool set_nice( int nice )
+{
+	pid_t tid = syscall( SYS_gettid );
+	struct rlimit lim;
+	int lowest;
+
+	/* on Linux, this applies to just the one thread */
+	if (setpriority( PRIO_PROCESS, tid, nice ) == 0)
+		return TRUE;
+
+	/* RLIMIT_NICE allows nice values down to 20 - rlim_cur */
+	if (nice < 0 && getrlimit( RLIMIT_NICE, &lim ) == 0){
+
+		lowest = 20 - (int)MIN( lim.rlim_cur, 40 );
+
+		if (lowest > nice)
+			setpriority( PRIO_PROCESS, tid, MIN( lowest, 0 ) );
+
+	}
+
+	return FALSE;
+}
+
+/**
+ * @brief restricts the calling thread to some CPUs
+ *
+ * @param cpus    the CPUs, as a bit per CPU
+ * @param spread  whether to use just one of them, chosen by \c index
+ * @param index   the thread's number within its role
+ * @return        TRUE on success
+ */
+static bool set_cpus( uint64_t cpus, bool spread, uint16_t index )
+{
+	cpu_set_t set;
+	uint8_t n = 0, seen = 0, pick;
+
+	for (uint8_t c=0; c<64; c++)
+		if (cpus & ((uint64_t)1 << c))
+			n++;
+
+	pick = index % n;
+
+	CPU_ZERO( &set );
+
+	for (uint8_t c=0; c<64; c++)
+		if ((cpus & ((uint64_t)1 << c)) && (!spread || seen++ == pick))
+			CPU_SET( c, &set );
+
+	return sched_setaffinity( 0, sizeof(set), &set ) == 0;
+}
+
+
+
+/**
+ * @brief applies a thread configuration to the calling thread
+ *
+ * Call this from the start of a capture or logging thread with the
+ * context's configuration for that role (see koki_set_thread_config());
+ * the detection workers call it themselves.
+ *
+ * @param config  the configuration
+ * @param index   the thread's number within its role, for spreading
+ *                threads over the configured CPUs
+ * @return        a bitwise OR of \c koki_thread_status_t flags for the
+ *                parts that couldn't be applied, or 0 if all of it was
+ */
+uint8_t koki_thread_config_apply( const koki_thread_config_t *config,
+				  uint16_t index )
+{
+	struct sched_param param = { 0 };
+	uint8_t status = 0;
+
+	assert(config != NULL);
+
+	if (config->cpus != 0 && !set_cpus( config->cpus, config->spread, index ))
+		status |= KOKI_THREAD_CPUS_FAILED;
+
+	switch (config->policy){
+
+	case KOKI_SCHED_FIFO:
+		param.sched_priority = CLAMP( config->priority,
+					      sched_get_priority_min( SCHED_FIFO ),
+					      sched_get_priority_max( SCHED_FIFO ) );
+
+		if (pthread_setschedparam( pthread_self(), SCHED_FIFO, &param ) == 0)
+			break;
+
+		status |= KOKI_THREAD_SCHED_FALLBACK;
+		param.sched_priority = 0;
+		/* fall through */
+
+	case KOKI_SCHED_OTHER:
+		pthread_setschedparam( pthread_self(), SCHED_OTHER, &param );
+
+		if (!set_nice( config->nice ))
+			status |= KOKI_THREAD_NICE_FAILED;
+		break;
+
+	case KOKI_SCHED_INHERIT:
+		break;
+
+	}
+
+	return status;
+}
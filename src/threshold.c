@@ -30,6 +30,7 @@
 
 #include "threshold.h"
 #include "integral-image.h"
+#include "simd.h"
 
 #define KOKI_RGB_SUM(frame, x, y)					\
 	( KOKI_IPLIMAGE_ELEM(frame, x, y, 0) +				\
@@ -56,18 +57,14 @@ IplImage* koki_threshold_frame(IplImage *frame, uint16_t threshold)
 	assert(frame != NULL && frame->nChannels == 1);
 	assert(threshold >= 0 && threshold <= 255);
 
-	uint8_t v;
+	const koki_simd_kernels_t *simd = koki_simd_kernels();
 	IplImage *ret = cvCreateImage(cvSize(frame->width, frame->height),
 				      IPL_DEPTH_8U, 1);
 
-	for (uint16_t y=0; y<frame->height; y++){
-		for (uint16_t x=0; x<frame->width; x++){
-
-			v = KOKI_IPLIMAGE_GS_ELEM(frame, x, y);
-			KOKI_IPLIMAGE_GS_ELEM(ret, x, y) = v > threshold ? 255 : 0;
-
-		}//for
-	}//for
+	for (uint16_t y=0; y<frame->height; y++)
+		simd->threshold((uint8_t*)frame->imageData + frame->widthStep * y,
+				(uint8_t*)ret->imageData + ret->widthStep * y,
+				frame->width, threshold);
 
 	return ret;
 
@@ -376,19 +373,16 @@ static void threshold_window(IplImage *frame,
  *                     are small, perhaps no greater than 10.
  * @param method       the method to use when thresholding a window, choose from
  *                     { KOKI_ADAPTIVE_MEAN, KOKI_ADAPTIVE_MEDIAN }
+ * @return             a new \c IplImage containing the thresholded image
  */
 IplImage* koki_threshold_adaptive(IplImage *frame, uint16_t window_size,
 				  int16_t c, uint8_t method)
 {
 
 	IplImage *output = NULL;
-	koki_integral_image_t *iimg = NULL;
 
 	assert(frame != NULL && frame->nChannels == 1);
 
-	/* create the integral image to accelerate window summation */
-	iimg = koki_integral_image_new( frame, true );
-
 	/* create output image */
 	output = cvCreateImage(cvGetSize(frame),
 			       frame->depth,
@@ -396,6 +390,38 @@ IplImage* koki_threshold_adaptive(IplImage *frame, uint16_t window_size,
 
 	assert(output != NULL);
 
+	koki_threshold_adaptive_to(frame, output, window_size, c, method);
+
+	return output;
+
+}
+
+/**
+ * @brief thresholds an image in the same way as koki_threshold_adaptive(),
+ *        into an existing image
+ *
+ * @param frame        the frame to threshold
+ * @param output       the image to store the result in, of the frame's size,
+ *                     depth and channels
+ * @param window_size  the size of the window to use
+ * @param c            a constant to subtract from the threshold
+ * @param method       the method to use when thresholding a window
+ */
+void koki_threshold_adaptive_to(IplImage *frame, IplImage *output,
+				uint16_t window_size, int16_t c, uint8_t method)
+{
+
+	koki_integral_image_t *iimg = NULL;
+
+	assert(frame != NULL && frame->nChannels == 1);
+	assert(output != NULL && output->width == frame->width
+	       && output->height == frame->height
+	       && output->depth == frame->depth
+	       && output->nChannels == frame->nChannels);
+
+	/* create the integral image to accelerate window summation */
+	iimg = koki_integral_image_new( frame, true );
+
 	if (method == 0) /* default */
 		method = KOKI_ADAPTIVE_MEAN;
 
@@ -412,8 +438,6 @@ IplImage* koki_threshold_adaptive(IplImage *frame, uint16_t window_size,
 
 	koki_integral_image_free( iimg );
 
-	return output;
-
 }
 
 void koki_threshold_adaptive_calc_window( const IplImage *frame,
@@ -0,0 +1,245 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/**
+ * @file  trace.c
+ * @brief Implementation of recording per-stage timelines in Chrome's
+ *        trace-event format
+ *
+ * Each thread that records an event gets its own fixed-size ring, so
+ * recording never takes a lock and memory use is bounded.  The rings are
+ * written out as JSON that chrome://tracing and Perfetto can load.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <glib.h>
+
+#include "trace.h"
+
+
+/* the source of tracer IDs */
+static uint32_t next_tracer_id = 1;
+
+/* the ring the current thread last wrote to, and the tracer it belongs to */
+static __thread uint32_t cached_tracer_id = 0;
+static __thread koki_trace_ring_t *cached_ring = NULL;
+
+
+
+/**
+ * @brief creates a tracer
+ *
+ * @param capacity  the number of events to keep per thread (rounded up to
+ *                  a power of two); older events are discarded
+ * @return          the new tracer
+ */
+koki_tracer_t* koki_tracer_new(uint32_t capacity)
+{
+
+	koki_tracer_t *tracer;
+	uint32_t c = 1;
+
+	assert(capacity > 0);
+
+	while (c < capacity)
+		c <<= 1;
+
+	tracer = g_malloc(sizeof(koki_tracer_t));
+
+	tracer->id = __atomic_fetch_add(&next_tracer_id, 1, __ATOMIC_RELAXED);
+	tracer->capacity = c;
+	tracer->rings = NULL;
+
+	return tracer;
+
+}
+
+
+
+/**
+ * @brief frees a tracer and all of its events
+ *
+ * No thread may be recording events with the tracer at the time.
+ *
+ * @param tracer  the tracer to free
+ */
+void koki_tracer_free(koki_tracer_t *tracer)
+{
+
+	koki_trace_ring_t *ring, *next;
+
+	if (tracer == NULL)
+		return;
+
+	for (ring = tracer->rings; ring != NULL; ring = next){
+		next = ring->next;
+		g_free(ring->events);
+		g_free(ring);
+	}
+
+	g_free(tracer);
+
+}
+
+
+
+/**
+ * @brief finds (or creates) the calling thread's ring
+ *
+ * @param tracer  the tracer
+ * @return        the ring
+ */
+static koki_trace_ring_t* thread_ring(koki_tracer_t *tracer)
+{
+
+	koki_trace_ring_t *ring;
+	uint32_t tid;
+
+	if (cached_tracer_id == tracer->id)
+		return cached_ring;
+
+	tid = syscall(SYS_gettid);
+
+	/* the thread may have used this tracer before switching to another */
+	for (ring = __atomic_load_n(&tracer->rings, __ATOMIC_ACQUIRE);
+	     ring != NULL; ring = ring->next)
+		if (ring->tid == tid)
+			break;
+
+	if (ring == NULL){
+
+		ring = g_malloc(sizeof(koki_trace_ring_t));
+		ring->events = g_malloc(tracer->capacity
+					* sizeof(koki_trace_event_t));
+		ring->mask = tracer->capacity - 1;
+		ring->head = 0;
+		ring->tid = tid;
+		ring->next = __atomic_load_n(&tracer->rings, __ATOMIC_RELAXED);
+
+		/* push it on to the list */
+		while (!__atomic_compare_exchange_n(&tracer->rings, &ring->next,
+						    ring, TRUE,
+						    __ATOMIC_RELEASE,
+						    __ATOMIC_RELAXED))
+			;
+
+	}
+
+	cached_tracer_id = tracer->id;
+	cached_ring = ring;
+
+	return ring;
+
+}
+
+
+
+/**
+ * @brief records an event in the calling thread's ring
+ *
+ * Use the \c KOKI_TRACE_BEGIN and \c KOKI_TRACE_END macros rather than
+ * calling this directly.
+ *
+ * @param tracer  the tracer
+ * @param name    the stage name, which must outlive the tracer
+ * @param phase   'B' for the start of the stage, 'E' for its end
+ * @param arg     the candidate's label, or -1
+ */
+void koki_tracer_event(koki_tracer_t *tracer, const char *name,
+		       char phase, int32_t arg)
+{
+
+	koki_trace_ring_t *ring = thread_ring(tracer);
+	koki_trace_event_t *ev = &ring->events[ring->head & ring->mask];
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	ev->name = name;
+	ev->ts = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+	ev->arg = arg;
+	ev->phase = phase;
+
+	/* publish the event to koki_tracer_write_json() */
+	__atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+
+}
+
+
+
+/**
+ * @brief writes all of the recorded events as Chrome trace-event JSON
+ *
+ * Events being recorded while this runs may or may not be included.  End
+ * events whose begin event has been overwritten are dropped.
+ *
+ * @param tracer  the tracer
+ * @param f       the file to write to
+ */
+void koki_tracer_write_json(const koki_tracer_t *tracer, FILE *f)
+{
+
+	const char *sep = "";
+	int pid = getpid();
+
+	assert(tracer != NULL && f != NULL);
+
+	fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+	for (koki_trace_ring_t *ring = __atomic_load_n(&tracer->rings,
+						       __ATOMIC_ACQUIRE);
+	     ring != NULL; ring = ring->next){
+
+		/* leave out the oldest slot, which may be being overwritten */
+		uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		uint32_t first = head > ring->mask ? head - ring->mask : 0;
+		uint32_t depth = 0;
+
+		for (uint32_t i=first; i<head; i++){
+
+			const koki_trace_event_t *ev = &ring->events[i & ring->mask];
+
+			if (ev->phase == 'B')
+				depth++;
+			else if (depth == 0)
+				continue;
+			else
+				depth--;
+
+			fprintf(f, "%s\n{\"name\":\"%s\",\"ph\":\"%c\","
+				"\"ts\":%.3f,\"pid\":%d,\"tid\":%u",
+				sep, ev->name, ev->phase, ev->ts / 1000.0,
+				pid, ring->tid);
+
+			if (ev->arg >= 0)
+				fprintf(f, ",\"args\":{\"label\":%d}", ev->arg);
+
+			fprintf(f, "}");
+			sep = ",";
+
+		}//for
+	}//for
+
+	fprintf(f, "\n]}\n");
+
+}
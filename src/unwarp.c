@@ -21,10 +21,13 @@
  */
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <cv.h>
 
 #include "points.h"
 #include "marker.h"
+#include "fixed.h"
+#include "homography.h"
 
 #include "unwarp.h"
 
@@ -74,24 +77,125 @@ static CvRect get_clip_rectangle(koki_marker_t *marker)
 
 
 /**
- * @brief returns an \c IplImage of the provided marker, unwarped
+ * @brief unwarps the provided marker into an image, using fixed-point
+ *        arithmetic
+ *
+ * This samples the frame through a \c koki_homography_fixed_t rather than
+ * using \c cvWarpPerspective().  As with koki_unwarp_marker(), the
+ * vertices are truncated to whole pixels first.
+ *
+ * @param marker  the marker to unwarp
+ * @param frame   the original image to unwarp using
+ * @param dst     the square, single channel, 8-bit image to unwarp into
+ * @return        FALSE if the marker couldn't be unwarped
+ */
+bool koki_unwarp_marker_fixed_to(koki_marker_t *marker, IplImage *frame,
+				 IplImage *dst)
+{
+
+	koki_fixed_point2_t quad[4];
+	koki_homography_fixed_t H;
+	uint16_t unwarped_width;
+
+	assert(marker != NULL);
+	assert(frame != NULL && frame->nChannels == 1);
+	assert(dst != NULL && dst->nChannels == 1 && dst->depth == IPL_DEPTH_8U);
+	assert(dst->width > 0 && dst->width == dst->height);
+
+	unwarped_width = dst->width;
+
+	for (uint8_t i=0; i<4; i++){
+
+		if (marker->vertices[i].image.x < 0 ||
+		    marker->vertices[i].image.y < 0 ||
+		    marker->vertices[i].image.x >= frame->width ||
+		    marker->vertices[i].image.y >= frame->height)
+			return FALSE;
+
+		quad[i].x = KOKI_FIXED_FROM_INT((int)marker->vertices[i].image.x);
+		quad[i].y = KOKI_FIXED_FROM_INT((int)marker->vertices[i].image.y);
+
+	}//for
+
+	if (!koki_homography_fixed_from_quad(quad, &H))
+		return FALSE;
+
+	for (uint16_t y=0; y<unwarped_width; y++){
+
+		koki_fixed_t v = KOKI_FIXED_FROM_INT(y) / unwarped_width;
+		uint8_t *row = (uint8_t*)(dst->imageData + y * dst->widthStep);
+
+		for (uint16_t x=0; x<unwarped_width; x++){
+			koki_fixed_t u = KOKI_FIXED_FROM_INT(x) / unwarped_width;
+			row[x] = koki_homography_fixed_sample(&H, frame, u, v);
+		}
+
+	}//for
+
+	return TRUE;
+
+}
+
+
+
+/**
+ * @brief returns an \c IplImage of the provided marker, unwarped, using
+ *        fixed-point arithmetic
+ *
+ * See koki_unwarp_marker_fixed_to().
  *
  * @param marker          the marker to unwarp
  * @param frame           the original image to unwarp using
  * @param unwarped_width  the width, in pixels, of the unwarped square image
- * @return                an image of the marker unwarped
+ * @return                an image of the marker unwarped, or NULL if it
+ *                        couldn't be
  */
-IplImage* koki_unwarp_marker( koki_t* koki, koki_marker_t *marker, IplImage *frame,
-			      uint16_t unwarped_width )
+IplImage* koki_unwarp_marker_fixed(koki_marker_t *marker, IplImage *frame,
+				   uint16_t unwarped_width)
 {
 
-	CvRect clip_rect;
-	CvPoint2D32f src[4], dst[4];
-	CvMat *map_matrix;
 	IplImage *ret;
 
+	assert(unwarped_width > 0);
+
+	ret = cvCreateImage(cvSize(unwarped_width, unwarped_width),
+			    IPL_DEPTH_8U, 1);
+
+	if (!koki_unwarp_marker_fixed_to(marker, frame, ret))
+		cvReleaseImage(&ret);
+
+	return ret;
+
+}
+
+
+
+/**
+ * @brief unwarps the provided marker into an image
+ *
+ * @param marker  the marker to unwarp
+ * @param frame   the original image to unwarp using
+ * @param dst     the square image to unwarp into, with the frame's depth
+ *                and channels, and a width that's a multiple of 10
+ * @return        FALSE if the marker couldn't be unwarped
+ */
+bool koki_unwarp_marker_to( koki_t* koki, koki_marker_t *marker, IplImage *frame,
+			    IplImage *dst )
+{
+
+	CvRect clip_rect;
+	CvPoint2D32f src[4], dst_points[4];
+	double map_data[9];
+	CvMat map_matrix = cvMat(3, 3, CV_64FC1, map_data);
+	uint16_t unwarped_width;
+
 	assert(marker != NULL);
 	assert(frame != NULL);
+	assert(dst != NULL && dst->depth == frame->depth
+	       && dst->nChannels == frame->nChannels);
+	assert(dst->width == dst->height);
+
+	unwarped_width = dst->width;
 	assert(unwarped_width > 0 && unwarped_width % 10 == 0);
 
 	/* make sure we're within bounds */
@@ -101,23 +205,18 @@ IplImage* koki_unwarp_marker( koki_t* koki, koki_marker_t *marker, IplImage *fra
 		    marker->vertices[i].image.x >= frame->width ||
 		    marker->vertices[i].image.y >= frame->height){
 
-			return NULL;
+			return FALSE;
 
 		}//if
 	}//for
 
-	/* create map mat */
-	map_matrix = cvCreateMat(3, 3, CV_64FC1);
-
 	/* get clip region */
 	clip_rect = get_clip_rectangle(marker);
 
 	/* ensure there is actually something to unwarp -- this
 	   may happen with shapes that aren't actually quads */
-	if (clip_rect.width == 0 || clip_rect.height == 0){
-		cvReleaseMat(&map_matrix);
-		return NULL;
-	}
+	if (clip_rect.width == 0 || clip_rect.height == 0)
+		return FALSE;
 
 	/* use the clip rect as region of interest */
 	cvSetImageROI(frame, clip_rect);
@@ -130,28 +229,54 @@ IplImage* koki_unwarp_marker( koki_t* koki, koki_marker_t *marker, IplImage *fra
 	}
 
 	/* set destination array */
-	dst[0].x = 0;
-	dst[0].y = 0;
-	dst[1].x = unwarped_width;
-	dst[1].y = 0;
-	dst[2].x = unwarped_width;
-	dst[2].y = unwarped_width;
-	dst[3].x = 0;
-	dst[3].y = unwarped_width;
+	dst_points[0].x = 0;
+	dst_points[0].y = 0;
+	dst_points[1].x = unwarped_width;
+	dst_points[1].y = 0;
+	dst_points[2].x = unwarped_width;
+	dst_points[2].y = unwarped_width;
+	dst_points[3].x = 0;
+	dst_points[3].y = unwarped_width;
 
 	/* calc image transform */
-	cvGetPerspectiveTransform(src, dst, map_matrix);
+	cvGetPerspectiveTransform(src, dst_points, &map_matrix);
 
 	/* unwarp the marker */
-	ret = cvCreateImage(cvSize(unwarped_width, unwarped_width),
-			    frame->depth, frame->nChannels);
-
-	cvWarpPerspective(frame, ret, map_matrix, CV_WARP_FILL_OUTLIERS,
+	cvWarpPerspective(frame, dst, &map_matrix, CV_WARP_FILL_OUTLIERS,
 			  cvScalarAll(0));
 
 	/* clean up */
 	cvResetImageROI(frame);
-	cvReleaseMat(&map_matrix);
+
+	return TRUE;
+
+}
+
+
+
+/**
+ * @brief returns an \c IplImage of the provided marker, unwarped
+ *
+ * @param marker          the marker to unwarp
+ * @param frame           the original image to unwarp using
+ * @param unwarped_width  the width, in pixels, of the unwarped square image
+ * @return                an image of the marker unwarped, or NULL if it
+ *                        couldn't be
+ */
+IplImage* koki_unwarp_marker( koki_t* koki, koki_marker_t *marker, IplImage *frame,
+			      uint16_t unwarped_width )
+{
+
+	IplImage *ret;
+
+	assert(frame != NULL);
+	assert(unwarped_width > 0 && unwarped_width % 10 == 0);
+
+	ret = cvCreateImage(cvSize(unwarped_width, unwarped_width),
+			    frame->depth, frame->nChannels);
+
+	if (!koki_unwarp_marker_to(koki, marker, frame, ret))
+		cvReleaseImage(&ret);
 
 	return ret;
 
@@ -33,6 +33,7 @@
 #include <cv.h>
 
 #include "labelling.h" /* for KOKI_IPLIMAGE_ELEM */
+#include "simd.h"
 
 #include "v4l.h"
 
@@ -160,6 +161,100 @@ struct v4l2_format koki_v4l_create_YUYV_format(unsigned int w, unsigned int h)
 
 
 
+/**
+ * @brief returns an MJPEG format structure ready to send to the camera
+ *
+ * Decode the frames with koki_mjpeg_decode().
+ *
+ * @param w  the desired width of the image
+ * @param h  the desired height of the image
+ * @return   an MJPEG V4L2 format structure
+ */
+struct v4l2_format koki_v4l_create_MJPEG_format(unsigned int w, unsigned int h)
+{
+
+	struct v4l2_format fmt;
+
+	CLEAR(fmt);
+
+	/* the driver decides how big the compressed frames can get */
+	fmt.type                 = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	fmt.fmt.pix.width        = w;
+	fmt.fmt.pix.height       = h;
+	fmt.fmt.pix.pixelformat  = V4L2_PIX_FMT_MJPEG;
+
+	return fmt;
+
+}
+
+
+
+/**
+ * @brief returns an 8-bit Bayer format structure ready to send to the
+ *        camera
+ *
+ * @param w        the desired width of the image
+ * @param h        the desired height of the image
+ * @param pattern  the desired mosaic pattern
+ * @return         a Bayer V4L2 format structure
+ */
+struct v4l2_format koki_v4l_create_bayer_format(unsigned int w, unsigned int h,
+						koki_bayer_pattern_t pattern)
+{
+
+	static const uint32_t fourcc[] = {
+		[KOKI_BAYER_RGGB] = V4L2_PIX_FMT_SRGGB8,
+		[KOKI_BAYER_GRBG] = V4L2_PIX_FMT_SGRBG8,
+		[KOKI_BAYER_GBRG] = V4L2_PIX_FMT_SGBRG8,
+		[KOKI_BAYER_BGGR] = V4L2_PIX_FMT_SBGGR8,
+	};
+	struct v4l2_format fmt;
+
+	CLEAR(fmt);
+
+	fmt.type                 = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	fmt.fmt.pix.width        = w;
+	fmt.fmt.pix.height       = h;
+	fmt.fmt.pix.pixelformat  = fourcc[pattern];
+	fmt.fmt.pix.bytesperline = w;
+	fmt.fmt.pix.sizeimage    = w * h;
+
+	return fmt;
+
+}
+
+
+
+/**
+ * @brief works out the mosaic pattern of an 8-bit Bayer pixel format
+ *
+ * Cameras may not give the pattern asked for, so check the format they
+ * actually set (see koki_v4l_get_format()).
+ *
+ * @param pixelformat  the V4L2 pixel format
+ * @return             the \c koki_bayer_pattern_t, or -1 if the format
+ *                     isn't 8-bit Bayer
+ */
+int koki_v4l_bayer_pattern(uint32_t pixelformat)
+{
+
+	switch (pixelformat){
+	case V4L2_PIX_FMT_SRGGB8:
+		return KOKI_BAYER_RGGB;
+	case V4L2_PIX_FMT_SGRBG8:
+		return KOKI_BAYER_GRBG;
+	case V4L2_PIX_FMT_SGBRG8:
+		return KOKI_BAYER_GBRG;
+	case V4L2_PIX_FMT_SBGGR8:
+		return KOKI_BAYER_BGGR;
+	default:
+		return -1;
+	}
+
+}
+
+
+
 /**
  * @brief tries to set the format of the camera to the format specified
  *
@@ -284,6 +379,39 @@ int koki_v4l_set_control(int fd, unsigned int id, unsigned int value)
 
 
 
+/**
+ * @brief queries the range and default of the specified V4L2 control
+ *
+ * Nothing is printed on failure, as this is how unsupported controls are
+ * discovered.
+ *
+ * @param fd     the camera's file descriptor
+ * @param id     the V4L2 control ID
+ * @param query  where to store the control's details
+ * @return       a negative value if the control isn't supported
+ */
+int koki_v4l_query_control(int fd, unsigned int id,
+			   struct v4l2_queryctrl *query)
+{
+
+	int ret;
+
+	assert(query != NULL);
+
+	CLEAR(*query);
+
+	query->id = id;
+
+	ret = ioctl(fd, VIDIOC_QUERYCTRL, query);
+	if (ret == 0 && (query->flags & V4L2_CTRL_FLAG_DISABLED))
+		ret = -1;
+
+	return ret;
+
+}
+
+
+
 /**
  * @brief allocates all of the buffers required for memory mapped IO with
  *        the camera
@@ -577,6 +705,7 @@ IplImage *koki_v4l_YUYV_frame_to_grayscale_image(uint8_t *frame,
 {
 
 	IplImage *output;
+	const koki_simd_kernels_t *simd = koki_simd_kernels();
 
 	assert(frame != NULL);
 
@@ -584,15 +713,10 @@ IplImage *koki_v4l_YUYV_frame_to_grayscale_image(uint8_t *frame,
 
 	assert(output != NULL);
 
-	for (uint16_t y=0; y<h; y++){
-		for (uint16_t x=0; x<w; x++){
-
-			uint8_t Y;
-			GET_Y(frame, x, y, w, h, Y);
-			((uint8_t*)(output->imageData + output->widthStep*y))[x] = Y;
-
-		}//for
-	}//for
+	for (uint16_t y=0; y<h; y++)
+		simd->yuyv_to_grey(&frame[w * 2 * y],
+				   (uint8_t*)(output->imageData + output->widthStep*y),
+				   w);
 
 	return output;
 
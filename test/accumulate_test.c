@@ -0,0 +1,244 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/*
+ * Tests decoding small markers from samples accumulated over frames (see
+ * koki_set_accumulation()) on synthetic sequences.  Each sequence is a
+ * single marker, a few pixels per cell, drawn in heavy noise and moving
+ * slightly from frame to frame, and is given to an accumulator as
+ * koki_find_markers() would:
+ *
+ *  - the marker's code and rotation must be recovered within MAX_FRAMES
+ *    frames, and no other code ever reported;
+ *  - when the quad's vertices come in a different order (as they do when
+ *    a marker turns through 45 degrees) the track must carry on, and the
+ *    rotation offset follow the new first vertex;
+ *  - a track must survive KOKI_ACCUMULATE_MAX_AGE frames without the
+ *    marker, be forgotten on the next, and start afresh when the marker
+ *    comes back.
+ *
+ * The exit status is non-zero if any sequence failed.
+ *
+ * Usage: accumulate_test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <cv.h>
+#include <glib.h>
+
+#include "koki.h"
+#include "accumulate.h"
+
+#include "synthetic.h"
+
+#define NUM_SEQUENCES 50
+
+#define WIDTH   64
+#define HEIGHT  64
+#define SIDE    20.0  /* pixels, so two per cell */
+#define NOISE   40.0  /* the grey levels' standard deviation */
+#define JITTER  0.7   /* the standard deviation of the marker's centre */
+#define VERTEX_NOISE 0.3 /* and of the vertices found */
+
+/* the most frames it may take to recover a code */
+#define MAX_FRAMES 10
+
+static double gaussian(void)
+{
+	double u = 1 - g_random_double(), v = g_random_double();
+
+	return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+/* draws the next frame of a sequence, and fills in the quad found in it,
+   its vertices starting from the marker's corner 'shift' */
+static void next_frame(IplImage *frame, double turn, uint8_t shift,
+		       uint8_t cells[KOKI_CODE_GRID_WIDTH][KOKI_CODE_GRID_WIDTH],
+		       koki_marker_t *marker)
+{
+	koki_point2Df_t corners[4];
+
+	synthetic_corners(WIDTH / 2 + JITTER * gaussian(),
+			  HEIGHT / 2 + JITTER * gaussian(), SIDE, turn, corners);
+
+	/* over a white background, with noise */
+	memset(frame->imageData, 190, frame->imageSize);
+	synthetic_draw_marker(frame, corners, cells, 50, 190);
+
+	for (uint32_t y=0; y<HEIGHT; y++)
+		for (uint32_t x=0; x<WIDTH; x++){
+			uint8_t *pixel = (uint8_t*)frame->imageData
+				+ y * frame->widthStep + x;
+			double grey = *pixel + NOISE * gaussian();
+
+			*pixel = CLAMP(grey, 0, 255);
+		}
+
+	memset(marker, 0, sizeof(koki_marker_t));
+	for (uint8_t v=0; v<4; v++){
+		marker->vertices[v].image.x = corners[(v + shift) % 4].x
+			+ VERTEX_NOISE * gaussian();
+		marker->vertices[v].image.y = corners[(v + shift) % 4].y
+			+ VERTEX_NOISE * gaussian();
+	}
+}
+
+/* the rotation offset of a marker drawn upright whose vertices start
+   from its corner 'shift' */
+static float expected_rotation(uint8_t shift)
+{
+	return (4 - shift) % 4 * 90.0;
+}
+
+/* runs one sequence, returning the number of failed checks */
+static uint32_t test_sequence(IplImage *frame, uint32_t n)
+{
+	uint8_t cells[KOKI_CODE_GRID_WIDTH][KOKI_CODE_GRID_WIDTH];
+	koki_accumulator_t *acc = koki_accumulator_new();
+	double turn = g_random_double_range(-0.3, 0.3);
+	uint8_t raw, shift = n % 4;
+	koki_marker_t marker;
+	uint32_t errors = 0;
+	int16_t code;
+	bool decoded = FALSE;
+
+	raw = synthetic_random_code();
+	code = koki_code_translation(raw);
+	synthetic_code_cells(raw, cells);
+
+	/* recovering the code */
+	for (uint32_t f=0; f<MAX_FRAMES && !decoded; f++){
+
+		koki_accumulator_age(acc);
+		next_frame(frame, turn, shift, cells, &marker);
+
+		if (!koki_accumulator_decode(acc, &marker, frame))
+			continue;
+
+		decoded = TRUE;
+
+		if (f + 1 < KOKI_ACCUMULATE_MIN_FRAMES){
+			printf("sequence %u: decoded from %u frames\n", n, f + 1);
+			errors++;
+		}
+
+		if (marker.code != code
+		    || marker.rotation_offset != expected_rotation(shift)){
+			printf("sequence %u: decoded as %u (%.0f), not %d (%.0f)\n",
+			       n, marker.code, marker.rotation_offset, code,
+			       expected_rotation(shift));
+			errors++;
+		}
+
+	}//for
+
+	if (!decoded){
+		printf("sequence %u: %d not decoded in %u frames\n", n, code,
+		       MAX_FRAMES);
+		koki_accumulator_free(acc);
+		return errors + 1;
+	}
+
+	/* the vertices coming in another order, which must carry on the same
+	   track (a noisy frame can still leave a cell in doubt for a while) */
+	shift = (shift + 1 + n % 3) % 4;
+	decoded = FALSE;
+
+	for (uint32_t f=0; f<MAX_FRAMES && !decoded; f++){
+
+		koki_accumulator_age(acc);
+		next_frame(frame, turn, shift, cells, &marker);
+		decoded = koki_accumulator_decode(acc, &marker, frame);
+
+		if (acc->tracks->len != 1){
+			printf("sequence %u: lost the track when its vertices "
+			       "shifted\n", n);
+			errors++;
+			break;
+		}
+
+	}//for
+
+	if (!decoded)
+		printf("sequence %u: not decoded in %u frames once its vertices "
+		       "shifted\n", n, MAX_FRAMES);
+
+	if (!decoded || marker.code != code
+	    || marker.rotation_offset != expected_rotation(shift)){
+		if (decoded)
+			printf("sequence %u: decoded as %u (%.0f) once its vertices "
+			       "shifted, not %d (%.0f)\n", n, marker.code,
+			       marker.rotation_offset, code,
+			       expected_rotation(shift));
+		errors++;
+	}
+
+	/* the marker going out of sight */
+	for (uint32_t f=0; f<KOKI_ACCUMULATE_MAX_AGE; f++)
+		koki_accumulator_age(acc);
+
+	if (acc->tracks->len != 1){
+		printf("sequence %u: the track was forgotten after %u frames\n",
+		       n, KOKI_ACCUMULATE_MAX_AGE);
+		errors++;
+	}
+
+	koki_accumulator_age(acc);
+
+	if (acc->tracks->len != 0){
+		printf("sequence %u: the track was kept for %u frames\n",
+		       n, KOKI_ACCUMULATE_MAX_AGE + 1);
+		errors++;
+	}
+
+	/* and coming back, as a new track */
+	koki_accumulator_age(acc);
+	next_frame(frame, turn, shift, cells, &marker);
+
+	if ((koki_accumulator_decode(acc, &marker, frame)
+	     && KOKI_ACCUMULATE_MIN_FRAMES > 1) || acc->tracks->len != 1){
+		printf("sequence %u: the track didn't start afresh\n", n);
+		errors++;
+	}
+
+	koki_accumulator_free(acc);
+
+	return errors;
+}
+
+
+int main(void)
+{
+	IplImage *frame = cvCreateImage(cvSize(WIDTH, HEIGHT), IPL_DEPTH_8U, 1);
+	uint32_t failed = 0;
+
+	g_random_set_seed(1);
+
+	for (uint32_t n=0; n<NUM_SEQUENCES; n++)
+		failed += test_sequence(frame, n) > 0;
+
+	printf("%u of %u sequences failed\n", failed, NUM_SEQUENCES);
+
+	cvReleaseImage(&frame);
+
+	return failed > 0;
+}
@@ -0,0 +1,317 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/*
+ * Tests koki_set_allocator() with a counting allocator, which checks that
+ * each alignment asked for is a power of two of at least 16 bytes, and
+ * that each block is freed once, with the size it was allocated with.
+ * Over a few frames of synthetic markers, decoded one at a time and in
+ * batches:
+ *
+ *  - every block the markers are made of comes from the allocator, and
+ *    is aligned to 16 bytes;
+ *  - the frame statistics agree with what the allocator saw during
+ *    koki_find_markers(): the same number of blocks, and no more bytes
+ *    than it was asked for, the rest being libkoki's per-block header;
+ *  - freeing the markers after koki_find_markers() has returned, from
+ *    outside any allocation scope, returns them to the allocator, and
+ *    nothing else is left allocated once the context is destroyed.
+ *
+ * The exit status is non-zero if any check failed.
+ *
+ * Usage: alloc_test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <cv.h>
+#include <glib.h>
+
+#include "koki.h"
+
+#include "synthetic.h"
+
+#define MARKER_WIDTH  0.11
+#define FOCAL_LENGTH  571.0
+
+#define WIDTH   640
+#define HEIGHT  480
+#define NUM_MARKERS 4  /* in a row across the frame */
+#define NUM_FRAMES  5
+
+/* the most libkoki may add to each block: its header, padded out to the
+   block's alignment */
+#define MAX_OVERHEAD(alignment) ((alignment) + 64)
+
+#define BLOCK_MAGIC 0x6b6f6b69
+
+
+/* what the counting allocator has seen */
+typedef struct {
+	uint32_t allocations;
+	uint32_t frees;
+	uint64_t bytes;        /* asked for, in all */
+	uint64_t live_bytes;   /* not yet freed */
+	size_t max_alignment;
+	uint32_t errors;
+} counts_t;
+
+/* stored in front of each block, in the padding that aligns it */
+typedef struct {
+	uint32_t magic;
+	size_t size;
+	void *base;    /* what posix_memalign() returned */
+} block_t;
+
+
+
+static void* counting_alloc(size_t size, size_t alignment, void *userdata)
+{
+	counts_t *counts = userdata;
+	/* a whole number of alignments, to keep the block aligned */
+	size_t pad = (sizeof(block_t) + alignment - 1) & ~(alignment - 1);
+	block_t *block;
+	uint8_t *base;
+
+	if (alignment < 16 || (alignment & (alignment - 1)) != 0){
+		printf("asked for an alignment of %zu\n", alignment);
+		counts->errors++;
+		return NULL;
+	}
+
+	if (posix_memalign((void**)&base, alignment, pad + size) != 0)
+		return NULL;
+
+	block = (block_t*)(base + pad) - 1;
+	block->magic = BLOCK_MAGIC;
+	block->size = size;
+	block->base = base;
+
+	counts->allocations++;
+	counts->bytes += size;
+	counts->live_bytes += size;
+	counts->max_alignment = MAX(counts->max_alignment, alignment);
+
+	return base + pad;
+}
+
+static void counting_free(void *ptr, size_t size, void *userdata)
+{
+	counts_t *counts = userdata;
+	block_t *block = (block_t*)ptr - 1;
+
+	if (block->magic != BLOCK_MAGIC){
+		printf("freed a block that wasn't allocated, or twice\n");
+		counts->errors++;
+		return;
+	}
+
+	if (block->size != size){
+		printf("freed a block of %zu bytes as %zu\n", block->size, size);
+		counts->errors++;
+	}
+
+	block->magic = 0;
+	counts->frees++;
+	counts->live_bytes -= block->size;
+
+	free(block->base);
+}
+
+static const koki_allocator_t counting_allocator = {
+	.alloc = counting_alloc,
+	.free = counting_free,
+};
+
+
+
+/* a frame of markers in a row, turned a little, and their codes */
+static IplImage* synthetic_frame(int16_t codes[NUM_MARKERS])
+{
+	IplImage *frame = cvCreateImage(cvSize(WIDTH, HEIGHT), IPL_DEPTH_8U, 1);
+	const double pitch = WIDTH / NUM_MARKERS;
+
+	memset(frame->imageData, 200, frame->imageSize);
+
+	for (uint8_t m=0; m<NUM_MARKERS; m++){
+
+		uint8_t cells[KOKI_CODE_GRID_WIDTH][KOKI_CODE_GRID_WIDTH];
+		koki_point2Df_t corners[4];
+		uint8_t raw = synthetic_random_code();
+
+		synthetic_corners((m + 0.5) * pitch, HEIGHT / 2,
+				  g_random_double_range(60, 100),
+				  g_random_double_range(-0.5, 0.5), corners);
+		synthetic_code_cells(raw, cells);
+		synthetic_draw_marker(frame, corners, cells, 30, 220);
+
+		codes[m] = koki_code_translation(raw);
+
+	}//for
+
+	return frame;
+}
+
+
+
+/* finds the markers in a frame and frees them, returning the number of
+   failed checks */
+static uint32_t test_frame(koki_t *koki, counts_t *counts, IplImage *frame,
+			   const int16_t codes[NUM_MARKERS],
+			   koki_camera_params_t *params, const char *what)
+{
+	const koki_frame_stats_t *stats;
+	uint32_t allocations = counts->allocations, frees = counts->frees;
+	uint64_t bytes = counts->bytes;
+	uint32_t errors = 0, found = 0;
+	GPtrArray *markers;
+
+	markers = koki_find_markers(koki, frame, MARKER_WIDTH, params);
+	stats = koki_get_frame_stats(koki);
+
+	allocations = counts->allocations - allocations;
+	frees = counts->frees - frees;
+	bytes = counts->bytes - bytes;
+
+	if (markers != NULL)
+		found = markers->len;
+
+	if (found != NUM_MARKERS){
+		printf("%s: found %u markers, not %u\n", what, found,
+		       NUM_MARKERS);
+		errors++;
+	}
+
+	for (uint32_t i=0; i<found; i++){
+
+		koki_marker_t *marker = g_ptr_array_index(markers, i);
+		bool drawn = FALSE;
+
+		if ((uintptr_t)marker % 16 != 0){
+			printf("%s: marker %u isn't aligned\n", what, i);
+			errors++;
+		}
+
+		for (uint8_t m=0; m<NUM_MARKERS; m++)
+			drawn = drawn || marker->code == codes[m];
+
+		if (!drawn){
+			printf("%s: found code %u, which wasn't drawn\n", what,
+			       marker->code);
+			errors++;
+		}
+
+	}//for
+
+	if (stats->allocations != allocations){
+		printf("%s: the stats count %u allocations, the allocator %u\n",
+		       what, stats->allocations, allocations);
+		errors++;
+	}
+
+	if (stats->allocated_bytes > bytes
+	    || bytes - stats->allocated_bytes
+	       > (uint64_t)allocations * MAX_OVERHEAD(counts->max_alignment)){
+		printf("%s: the stats count %llu bytes, the allocator %llu\n",
+		       what, (unsigned long long)stats->allocated_bytes,
+		       (unsigned long long)bytes);
+		errors++;
+	}
+
+	/* out of koki_find_markers()'s scope, each marker's blocks must still
+	   go back to the allocator they came from */
+	allocations = counts->allocations;
+	frees = counts->frees;
+	koki_markers_free(markers);
+
+	if (counts->allocations != allocations){
+		printf("%s: freeing the markers allocated %u blocks\n", what,
+		       counts->allocations - allocations);
+		errors++;
+	}
+
+	if (counts->frees - frees < found){
+		printf("%s: freeing %u markers freed %u blocks\n", what, found,
+		       counts->frees - frees);
+		errors++;
+	}
+
+	return errors;
+}
+
+
+
+int main(void)
+{
+	counts_t counts = { 0 };
+	koki_camera_params_t params;
+	uint32_t errors = 0;
+	char what[64];
+
+	g_random_set_seed(1);
+
+	params.size.x = WIDTH;
+	params.size.y = HEIGHT;
+	params.principal_point.x = WIDTH / 2;
+	params.principal_point.y = HEIGHT / 2;
+	params.focal_length.x = params.focal_length.y = FOCAL_LENGTH;
+
+	for (uint8_t batch=0; batch<2; batch++){
+
+		koki_t *koki = koki_new();
+
+		koki_set_allocator(koki, &counting_allocator, &counts);
+		koki_set_batch_decode(koki, batch);
+
+		for (uint32_t f=0; f<NUM_FRAMES; f++){
+
+			int16_t codes[NUM_MARKERS];
+			IplImage *frame = synthetic_frame(codes);
+
+			snprintf(what, sizeof(what), "frame %u%s", f,
+				 batch ? ", in batches" : "");
+			errors += test_frame(koki, &counts, frame, codes, &params,
+					     what);
+
+			cvReleaseImage(&frame);
+
+		}//for
+
+		koki_destroy(koki);
+
+		if (counts.frees != counts.allocations || counts.live_bytes != 0){
+			printf("%s: %u blocks allocated, %u freed, %llu bytes "
+			       "left\n", batch ? "in batches" : "one at a time",
+			       counts.allocations, counts.frees,
+			       (unsigned long long)counts.live_bytes);
+			errors++;
+		}
+
+	}//for
+
+	errors += counts.errors;
+
+	printf("%u blocks, %llu bytes, allocated and freed\n",
+	       counts.allocations, (unsigned long long)counts.bytes);
+	printf("%u failed checks\n", errors);
+
+	return errors > 0;
+}
@@ -0,0 +1,273 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/*
+ * Tests koki_find_markers_async() driven the way an event loop would
+ * drive it: frames are submitted until the pool refuses one, and results
+ * are collected with koki_async_poll() whenever the pool's eventfd is
+ * readable.  Every frame must come back exactly once, with its own
+ * userdata, submission number and markers (compared against
+ * koki_find_markers() on the same frame), and the eventfd must only be
+ * readable while a result is waiting.  The exit status is non-zero if any
+ * of that doesn't hold.
+ *
+ * The frames are synthetic unless images are given.
+ *
+ * Usage: async_test [IMAGE...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include <poll.h>
+#include <cv.h>
+#include <highgui.h>
+#include <glib.h>
+
+#include "koki.h"
+
+#define MARKER_WIDTH  0.11
+#define FOCAL_LENGTH  571.0
+
+#define NUM_WORKERS   4
+#define MAX_IN_FLIGHT 8
+#define NUM_FRAMES    10000
+#define NUM_SYNTHETIC 4
+
+/* how long to wait for a result before giving up, in milliseconds */
+#define TIMEOUT 5000
+
+
+typedef struct {
+	IplImage *frame;
+	uint32_t markers;     /* what koki_find_markers() found */
+	uint32_t candidates;
+} frame_t;
+
+
+/* a frame of a few dark, white-bordered squares, so there's something
+   to label and look at */
+static IplImage* synthetic_frame(uint8_t squares)
+{
+	const int w = 320, h = 240;
+	IplImage *frame = cvCreateImage(cvSize(w, h), IPL_DEPTH_8U, 1);
+
+	for (int y=0; y<h; y++)
+		for (int x=0; x<w; x++)
+			((uint8_t*)frame->imageData)[y * frame->widthStep + x] =
+				180 + g_random_int_range(-6, 6);
+
+	for (uint8_t s=0; s<squares; s++){
+
+		int side = g_random_int_range(20, 60);
+		int x0 = g_random_int_range(0, w - side);
+		int y0 = g_random_int_range(0, h - side);
+
+		for (int y=y0; y<y0 + side; y++)
+			for (int x=x0; x<x0 + side; x++){
+				bool border = x < x0 + side / 10 || y < y0 + side / 10
+					|| x >= x0 + side - side / 10
+					|| y >= y0 + side - side / 10;
+				((uint8_t*)frame->imageData)[y * frame->widthStep + x] =
+					border ? 30 : 230;
+			}
+
+	}//for
+
+	return frame;
+}
+
+static bool fd_readable(int fd, int timeout)
+{
+	struct pollfd pfd = { fd, POLLIN, 0 };
+
+	return poll(&pfd, 1, timeout) > 0 && (pfd.revents & POLLIN);
+}
+
+
+int main(int argc, const char *argv[])
+{
+	koki_t *koki = koki_new();
+	koki_camera_params_t params;
+	koki_async_t *async;
+	uint8_t *seen = g_malloc0(NUM_FRAMES);
+	uint32_t num_frames = 0, submitted = 0, received = 0, refused = 0;
+	uint32_t errors = 0, empty_wakeups = 0;
+	frame_t frames[NUM_SYNTHETIC + argc];
+	int fd;
+
+	g_random_set_seed(1);
+
+	for (int i=1; i<argc; i++){
+		frames[num_frames].frame = cvLoadImage(argv[i],
+						       CV_LOAD_IMAGE_GRAYSCALE);
+		if (frames[num_frames].frame == NULL){
+			fprintf(stderr, "couldn't load %s\n", argv[i]);
+			return 1;
+		}
+		num_frames++;
+	}
+
+	for (uint8_t i=0; i<NUM_SYNTHETIC; i++)
+		frames[num_frames++].frame = synthetic_frame(i * 3);
+
+	/* what each frame should give */
+	for (uint32_t f=0; f<num_frames; f++){
+
+		IplImage *frame = frames[f].frame;
+		GPtrArray *markers;
+
+		params.size.x = frame->width;
+		params.size.y = frame->height;
+		params.principal_point.x = frame->width / 2;
+		params.principal_point.y = frame->height / 2;
+		params.focal_length.x = params.focal_length.y = FOCAL_LENGTH;
+
+		markers = koki_find_markers(koki, frame, MARKER_WIDTH, &params);
+		frames[f].markers = markers->len;
+		frames[f].candidates = koki->stats.candidates;
+		koki_markers_free(markers);
+
+	}//for
+
+	async = koki_async_new(koki, NUM_WORKERS, MAX_IN_FLIGHT);
+	if (async == NULL){
+		fprintf(stderr, "couldn't start the pool\n");
+		return 1;
+	}
+	fd = koki_async_get_fd(async);
+
+	while (received < NUM_FRAMES){
+
+		koki_async_result_t result;
+		uint32_t polled = 0;
+
+		/* submit until the pool is full */
+		while (submitted < NUM_FRAMES){
+
+			IplImage *frame = frames[submitted % num_frames].frame;
+
+			params.size.x = frame->width;
+			params.size.y = frame->height;
+			params.principal_point.x = frame->width / 2;
+			params.principal_point.y = frame->height / 2;
+
+			if (!koki_find_markers_async(async, frame, MARKER_WIDTH,
+						     &params, NULL,
+						     GUINT_TO_POINTER(submitted + 1))){
+				refused++;
+				break;
+			}
+
+			submitted++;
+
+		}//while
+
+		if (!fd_readable(fd, TIMEOUT)){
+			printf("no result within %u ms, with %u in flight\n",
+			       TIMEOUT, koki_async_in_flight(async));
+			errors++;
+			break;
+		}
+
+		while (koki_async_poll(async, &result)){
+
+			uint32_t i = GPOINTER_TO_UINT(result.userdata) - 1;
+			const frame_t *f = &frames[i % num_frames];
+
+			polled++;
+
+			if (i >= NUM_FRAMES){
+				printf("result with unknown userdata %p\n",
+				       result.userdata);
+				errors++;
+				continue;
+			}
+
+			if (seen[i]++ > 0){
+				printf("frame %u delivered again\n", i);
+				errors++;
+			}
+
+			if (result.frame != f->frame || result.stats.frame_id != i + 1){
+				printf("frame %u came back as submission %u, "
+				       "with the wrong frame\n", i,
+				       result.stats.frame_id);
+				errors++;
+			}
+
+			if (result.markers == NULL
+			    || result.markers->len != f->markers
+			    || result.stats.candidates != f->candidates){
+				printf("frame %u: %d markers from %u candidates, "
+				       "expected %u from %u\n", i,
+				       result.markers == NULL ? -1
+				       : (int)result.markers->len,
+				       result.stats.candidates, f->markers,
+				       f->candidates);
+				errors++;
+			}
+
+			if (result.markers != NULL)
+				koki_markers_free(result.markers);
+
+			received++;
+
+		}//while
+
+		/* it was readable, so there must have been a result */
+		if (polled == 0)
+			empty_wakeups++;
+
+	}//while
+
+	if (empty_wakeups > 0){
+		printf("the eventfd was readable without a result %u times\n",
+		       empty_wakeups);
+		errors++;
+	}
+
+	if (koki_async_in_flight(async) != 0){
+		printf("%u frames still in flight\n", koki_async_in_flight(async));
+		errors++;
+	}
+
+	if (fd_readable(fd, 0)){
+		printf("the eventfd is readable with nothing left to poll\n");
+		errors++;
+	}
+
+	for (uint32_t i=0; i<submitted; i++)
+		if (seen[i] != 1){
+			printf("frame %u delivered %u times\n", i, seen[i]);
+			errors++;
+		}
+
+	printf("%u frames submitted (%u refusals while full), %u received, "
+	       "%u errors\n", submitted, refused, received, errors);
+
+	koki_async_free(async);
+	koki_destroy(koki);
+
+	for (uint32_t f=0; f<num_frames; f++)
+		cvReleaseImage(&frames[f].frame);
+	g_free(seen);
+
+	return errors > 0 || received != NUM_FRAMES;
+}
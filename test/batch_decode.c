@@ -0,0 +1,461 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/*
+ * Tests batch decoding (see koki_set_batch_decode()) against the decoding
+ * of one marker at a time:
+ *
+ *  - koki_code_recover_from_grid(), which works on packed cells with table
+ *    lookups, is compared with a straightforward decode of each rotation
+ *    on random grids and on valid ones with up to one flipped cell;
+ *  - koki_code_recover_batch() is given the true quads of synthetic
+ *    markers, in perspective, and must recover every code and rotation
+ *    with each kernel this CPU supports, but nothing for quads with a
+ *    vertex outside the frame;
+ *  - koki_find_markers() must find the same markers, with the same codes
+ *    and rotations, with batch decoding as without it, and with every
+ *    supported kernel.
+ *
+ * The exit status is non-zero if there were any differences.
+ *
+ * Usage: batch_decode
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <cv.h>
+#include <glib.h>
+
+#include "koki.h"
+#include "code_batch.h"
+#include "crc12.h"
+
+#include "synthetic.h"
+
+#define MARKER_WIDTH  0.11
+#define FOCAL_LENGTH  571.0
+
+#define NUM_GRIDS   20000
+#define NUM_FRAMES  20
+
+/* the frame is split into a 4 x 2 grid of places for markers */
+#define WIDTH   640
+#define HEIGHT  480
+#define PLACES_X 4
+#define PLACES_Y 2
+#define NUM_PLACES (PLACES_X * PLACES_Y)
+
+#define TOL_CENTRE  1.0 /* pixels, for pairing up markers */
+
+#define CODE_BORDER ((KOKI_MARKER_GRID_WIDTH - KOKI_CODE_GRID_WIDTH) / 2)
+
+
+/* a marker drawn in a frame */
+typedef struct {
+	koki_point2Df_t corners[4]; /* the corners of the unit square's
+				       (0,0), (1,0), (1,1) and (0,1) */
+	uint8_t raw;                /* the code drawn, before translation */
+	uint8_t cells[KOKI_CODE_GRID_WIDTH][KOKI_CODE_GRID_WIDTH];
+} drawn_t;
+
+
+
+/* the data bits of a Hamming (7,4) block, after correcting a single
+   error, parity bit i covering the positions with bit i set */
+static uint8_t hamming_decode(uint8_t r)
+{
+	uint8_t syndrome = 0;
+
+	for (uint8_t i=0; i<7; i++)
+		if ((r >> i) & 1)
+			syndrome ^= i + 1;
+
+	if (syndrome != 0)
+		r ^= 1 << (syndrome - 1);
+
+	return ((r >> 2) & 1) | ((r >> 4) & 1) << 1 | ((r >> 5) & 1) << 2
+		| ((r >> 6) & 1) << 3;
+}
+
+/* decodes a grid one rotation at a time, as libkoki used to */
+static int16_t reference_recover(const koki_grid_t *grid, float *rotation)
+{
+	const uint8_t w = KOKI_CODE_GRID_WIDTH, b = CODE_BORDER;
+
+	for (uint8_t r=0; r<4; r++){
+
+		uint8_t blocks[5] = { 0 };
+		uint32_t data = 0;
+
+		for (uint8_t k=0; k<w * w - 1; k++){
+
+			uint8_t x = k % w, y = k / w, val;
+
+			switch (r){
+			case 0:  val = grid->data[b+y][b+x].val; break;
+			case 1:  val = grid->data[b+x][b+(w-1)-y].val; break;
+			case 2:  val = grid->data[b+(w-1)-y][b+(w-1)-x].val; break;
+			default: val = grid->data[b+(w-1)-x][b+y].val; break;
+			}
+
+			/* black is a set bit */
+			blocks[k % 5] |= !val << (k / 5);
+
+		}//for
+
+		for (uint8_t j=0; j<5; j++)
+			data |= (uint32_t)hamming_decode(blocks[j]) << (4 * j);
+
+		if (koki_crc12((data & 0xFF) + 1) == ((data >> 8) & 0xFFF)){
+			*rotation = 90.0 * r;
+			return data & 0xFF;
+		}
+
+	}//for
+
+	return -1;
+}
+
+static uint32_t test_grids(void)
+{
+	uint32_t mismatches = 0, valid = 0;
+
+	for (uint32_t t=0; t<NUM_GRIDS; t++){
+
+		koki_grid_t grid;
+		float r1 = -1, r2 = -1;
+		int16_t c1, c2;
+
+		memset(&grid, 0, sizeof(grid));
+
+		for (uint8_t y=0; y<KOKI_MARKER_GRID_WIDTH; y++)
+			for (uint8_t x=0; x<KOKI_MARKER_GRID_WIDTH; x++)
+				grid.data[y][x].val = g_random_int_range(0, 2);
+
+		/* every other one valid, with every other one of those
+		   damaged */
+		if (t % 2 == 1){
+
+			uint8_t cells[KOKI_CODE_GRID_WIDTH][KOKI_CODE_GRID_WIDTH];
+
+			synthetic_code_cells(g_random_int_range(0, 256), cells);
+			for (uint8_t y=0; y<KOKI_CODE_GRID_WIDTH; y++)
+				for (uint8_t x=0; x<KOKI_CODE_GRID_WIDTH; x++)
+					grid.data[CODE_BORDER+y][CODE_BORDER+x].val =
+						cells[y][x];
+
+			if (t % 4 == 3)
+				grid.data[CODE_BORDER + g_random_int_range(0, 6)]
+					[CODE_BORDER + g_random_int_range(0, 6)].val ^= 1;
+
+		}//if
+
+		c1 = reference_recover(&grid, &r1);
+		c2 = koki_code_recover_from_grid(&grid, &r2);
+		valid += c1 >= 0;
+
+		if (c1 != c2 || (c1 >= 0 && r1 != r2)){
+			if (mismatches++ < 10)
+				printf("grid %u: decoded as %d (%.0f), but the reference "
+				       "gives %d (%.0f)\n", t, c2, r2, c1, r1);
+		}
+
+	}//for
+
+	printf("grids: %u compared (%u with a code), %u mismatches\n",
+	       NUM_GRIDS, valid, mismatches);
+
+	return mismatches;
+}
+
+
+
+/* a frame of a marker in each place, turned, in perspective, and with
+   a random code */
+static IplImage* synthetic_frame(drawn_t markers[NUM_PLACES])
+{
+	IplImage *frame = cvCreateImage(cvSize(WIDTH, HEIGHT), IPL_DEPTH_8U, 1);
+	const double pw = WIDTH / PLACES_X, ph = HEIGHT / PLACES_Y;
+
+	for (uint32_t y=0; y<HEIGHT; y++)
+		for (uint32_t x=0; x<WIDTH; x++)
+			((uint8_t*)frame->imageData)[y * frame->widthStep + x] =
+				200 + g_random_int_range(-5, 6);
+
+	for (uint8_t p=0; p<NUM_PLACES; p++){
+
+		drawn_t *s = &markers[p];
+		double side = g_random_double_range(50, 100);
+
+		synthetic_corners((p % PLACES_X + 0.5) * pw,
+				  (p / PLACES_X + 0.5) * ph, side,
+				  g_random_double_range(0, 2 * M_PI), s->corners);
+
+		/* in perspective */
+		for (uint8_t c=0; c<4; c++){
+			s->corners[c].x += g_random_double_range(-0.06, 0.06) * side;
+			s->corners[c].y += g_random_double_range(-0.06, 0.06) * side;
+		}
+
+		s->raw = synthetic_random_code();
+		synthetic_code_cells(s->raw, s->cells);
+		synthetic_draw_marker(frame, s->corners, s->cells, 30, 220);
+
+	}//for
+
+	return frame;
+}
+
+
+
+/* decodes the true quads of a frame's markers in one batch, starting
+   each quad at a different corner, and then again in a copy of the frame
+   moved left until the markers in the first column cross its edge */
+static uint32_t test_batch(IplImage *frame, const drawn_t s[NUM_PLACES],
+			   const char *level)
+{
+	koki_marker_t quads[NUM_PLACES], *ptrs[NUM_PLACES];
+	int16_t codes[NUM_PLACES];
+	float rotations[NUM_PLACES];
+	IplImage *moved;
+	uint32_t errors = 0;
+	int shift = 0;
+
+	for (uint8_t p=0; p<NUM_PLACES; p++){
+
+		memset(&quads[p], 0, sizeof(quads[p]));
+		for (uint8_t v=0; v<4; v++)
+			quads[p].vertices[v].image = s[p].corners[(v + p) % 4];
+		ptrs[p] = &quads[p];
+
+	}//for
+
+	koki_code_recover_batch(frame, ptrs, NUM_PLACES, codes, rotations, NULL);
+
+	for (uint8_t p=0; p<NUM_PLACES; p++){
+
+		/* starting at the next corner turns the marker a quarter */
+		float expected = (4 - p % 4) % 4 * 90.0;
+
+		if (codes[p] != s[p].raw || rotations[p] != expected){
+			printf("%s: quad %u decoded as %d (%.0f), not %u (%.0f)\n",
+			       level, p, codes[p], codes[p] < 0 ? 0 : rotations[p],
+			       s[p].raw, expected);
+			errors++;
+		}
+
+	}//for
+
+	/* far enough to put a vertex of each marker in the first column
+	   just outside the frame */
+	for (uint8_t p=0; p<NUM_PLACES; p+=PLACES_X){
+
+		float left = WIDTH;
+
+		for (uint8_t v=0; v<4; v++)
+			left = MIN(left, s[p].corners[v].x);
+
+		shift = MAX(shift, (int)floor(left) + 1);
+
+	}//for
+
+	moved = cvCreateImage(cvSize(WIDTH, HEIGHT), IPL_DEPTH_8U, 1);
+	for (uint32_t y=0; y<HEIGHT; y++){
+		uint8_t *row = (uint8_t*)moved->imageData + y * moved->widthStep;
+		memcpy(row, frame->imageData + y * frame->widthStep + shift,
+		       WIDTH - shift);
+		memset(row + WIDTH - shift, 200, shift);
+	}
+
+	for (uint8_t p=0; p<NUM_PLACES; p++)
+		for (uint8_t v=0; v<4; v++)
+			quads[p].vertices[v].image.x -= shift;
+
+	koki_code_recover_batch(moved, ptrs, NUM_PLACES, codes, rotations, NULL);
+
+	for (uint8_t p=0; p<NUM_PLACES; p++){
+
+		bool outside = p % PLACES_X == 0;
+
+		if (outside ? codes[p] != -1 : codes[p] != s[p].raw){
+			printf("%s: quad %u decoded as %d with%s a vertex outside "
+			       "the frame\n", level, p, codes[p],
+			       outside ? "" : "out");
+			errors++;
+		}
+
+	}//for
+
+	cvReleaseImage(&moved);
+
+	return errors;
+}
+
+/* the marker in a set found within TOL_CENTRE of a point, or NULL */
+static const koki_marker_t* find_near(GPtrArray *markers,
+				      const koki_point2Df_t *p)
+{
+	for (guint i=0; i<markers->len; i++){
+		const koki_marker_t *m = g_ptr_array_index(markers, i);
+		if (hypot(m->centre.image.x - p->x, m->centre.image.y - p->y)
+		    < TOL_CENTRE)
+			return m;
+	}
+
+	return NULL;
+}
+
+/* compares two sets of markers found in the same frame */
+static uint32_t compare_markers(GPtrArray *a, GPtrArray *b,
+				const char *what)
+{
+	uint32_t errors = 0;
+
+	if (a->len != b->len){
+		printf("%s: %u markers, against %u\n", what, a->len, b->len);
+		errors++;
+	}
+
+	for (guint i=0; i<b->len; i++){
+
+		const koki_marker_t *mb = g_ptr_array_index(b, i);
+		const koki_marker_t *ma = find_near(a, &mb->centre.image);
+
+		if (ma == NULL || ma->code != mb->code
+		    || ma->rotation_offset != mb->rotation_offset){
+			printf("%s: marker %u at (%.1f, %.1f) %s\n", what,
+			       mb->code, mb->centre.image.x, mb->centre.image.y,
+			       ma == NULL ? "not found" : "decoded differently");
+			errors++;
+		}
+
+	}//for
+
+	return errors;
+}
+
+static uint32_t count_found(GPtrArray *markers, const drawn_t s[NUM_PLACES])
+{
+	uint32_t found = 0;
+
+	for (uint8_t p=0; p<NUM_PLACES; p++)
+		for (guint i=0; i<markers->len; i++){
+
+			const koki_marker_t *m = g_ptr_array_index(markers, i);
+			bool inside = TRUE;
+
+			/* it's inside the marker's bounding box */
+			for (uint8_t v=0; v<4; v++){
+				const koki_point2Df_t *c = &s[p].corners[v];
+				const koki_point2Df_t *o = &s[p].corners[(v+2) % 4];
+				inside = inside
+					&& fabs(m->centre.image.x - c->x) <= fabs(o->x - c->x)
+					&& fabs(m->centre.image.y - c->y) <= fabs(o->y - c->y);
+			}
+
+			if (inside && m->code == koki_code_translation(s[p].raw)){
+				found++;
+				break;
+			}
+
+		}//for
+
+	return found;
+}
+
+
+int main(void)
+{
+	koki_simd_level_t initial = koki_simd_kernels()->level;
+	koki_t *single = koki_new(), *batch = koki_new();
+	koki_camera_params_t params;
+	uint32_t errors = 0, found_single = 0, found_batch = 0;
+	char what[128];
+
+	g_random_set_seed(1);
+
+	koki_set_batch_decode(batch, TRUE);
+
+	params.size.x = WIDTH;
+	params.size.y = HEIGHT;
+	params.principal_point.x = WIDTH / 2;
+	params.principal_point.y = HEIGHT / 2;
+	params.focal_length.x = params.focal_length.y = FOCAL_LENGTH;
+
+	errors += test_grids();
+
+	for (uint32_t f=0; f<NUM_FRAMES; f++){
+
+		drawn_t s[NUM_PLACES];
+		IplImage *frame = synthetic_frame(s);
+		GPtrArray *first = NULL;
+
+		for (koki_simd_level_t l=0; l<KOKI_SIMD_NUM_LEVELS; l++){
+
+			const char *level;
+			GPtrArray *ms, *mb;
+
+			if (!koki_simd_supported(l))
+				continue;
+
+			koki_simd_set_level(l);
+			level = koki_simd_kernels()->name;
+
+			errors += test_batch(frame, s, level);
+
+			ms = koki_find_markers(single, frame, MARKER_WIDTH, &params);
+			mb = koki_find_markers(batch, frame, MARKER_WIDTH, &params);
+
+			snprintf(what, sizeof(what), "frame %u, %s, batch vs single",
+				 f, level);
+			errors += compare_markers(ms, mb, what);
+
+			if (first == NULL){
+				found_single += count_found(ms, s);
+				found_batch += count_found(mb, s);
+				first = mb;
+			} else {
+				snprintf(what, sizeof(what), "frame %u, %s vs %s", f,
+					 level, koki_simd_scalar.name);
+				errors += compare_markers(first, mb, what);
+				koki_markers_free(mb);
+			}
+
+			koki_markers_free(ms);
+
+		}//for
+
+		koki_markers_free(first);
+		cvReleaseImage(&frame);
+
+	}//for
+
+	koki_simd_set_level(initial);
+
+	printf("markers: %u of %u found decoding one at a time, %u in "
+	       "batches\n", found_single, NUM_FRAMES * NUM_PLACES, found_batch);
+	printf("%u differences\n", errors);
+
+	koki_destroy(single);
+	koki_destroy(batch);
+
+	return errors > 0;
+}
@@ -0,0 +1,419 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/*
+ * Tests finding markers in Bayer mosaics (see koki_find_markers_bayer()):
+ *
+ *  - each bin_2x2 kernel this CPU supports must match the scalar one on
+ *    random rows of every odd width up to MAX_WIDTH, without writing past
+ *    the end of its output;
+ *  - koki_bayer_to_grey() must give the mean of each block, and with
+ *    KOKI_BAYER_GREEN the mean of its two greens, for every pattern, on a
+ *    hand-built mosaic of odd size whose rows are padded;
+ *  - markers drawn in a mosaic must be found, for every pattern and way
+ *    of making luma, with their corners and centres within a pixel of
+ *    where they were drawn, and with the positions the full-resolution
+ *    greyscale image gives with an off-centre principal point.
+ *
+ * The exit status is non-zero if any check failed.
+ *
+ * Usage: bayer_test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <cv.h>
+#include <glib.h>
+
+#include "koki.h"
+
+#include "synthetic.h"
+
+#define MAX_WIDTH  257  /* of the rows given to bin_2x2 */
+#define NUM_ROWS   20   /* tried at each width */
+#define GUARD      0xA5 /* filling the bytes after a kernel's output */
+
+/* the hand-built mosaic, of odd size so that the last column and row are
+   dropped */
+#define MOSAIC_WIDTH   37
+#define MOSAIC_HEIGHT  23
+#define MOSAIC_STRIDE  40
+
+#define MARKER_WIDTH  0.11
+#define FOCAL_LENGTH  571.0
+
+#define WIDTH   640
+#define HEIGHT  480
+#define NUM_MARKERS 2     /* side by side */
+
+#define TOL_VERTEX  1.0  /* pixels, at full resolution */
+#define TOL_WORLD   0.03 /* of the distance to the marker */
+
+/* the colours of each pattern's 2x2 blocks, in reading order */
+static const char *pattern_colours[] = {
+	[KOKI_BAYER_RGGB] = "RGGB",
+	[KOKI_BAYER_GRBG] = "GRBG",
+	[KOKI_BAYER_GBRG] = "GBRG",
+	[KOKI_BAYER_BGGR] = "BGGR",
+};
+
+#define NUM_PATTERNS 4
+
+
+
+/* compares a kernel's bin_2x2 with the scalar one */
+static uint32_t test_bin_2x2(const koki_simd_kernels_t *simd)
+{
+	uint8_t row0[MAX_WIDTH * 2], row1[MAX_WIDTH * 2];
+	uint8_t expected[MAX_WIDTH], dst[MAX_WIDTH + 32];
+	uint32_t errors = 0;
+
+	for (uint32_t n=1; n<=MAX_WIDTH; n+=2)
+		for (uint32_t r=0; r<NUM_ROWS; r++){
+
+			for (uint32_t i=0; i<n * 2; i++){
+				row0[i] = g_random_int_range(0, 256);
+				row1[i] = g_random_int_range(0, 256);
+			}
+
+			memset(dst, GUARD, sizeof(dst));
+
+			koki_simd_scalar.bin_2x2(row0, row1, expected, n);
+			simd->bin_2x2(row0, row1, dst, n);
+
+			for (uint32_t i=0; i<n; i++)
+				if (dst[i] != expected[i]){
+					printf("bin_2x2, %s, width %u: pixel %u is %u, "
+					       "not %u\n", simd->name, n, i, dst[i],
+					       expected[i]);
+					errors++;
+					break;
+				}
+
+			for (uint32_t i=n; i<sizeof(dst); i++)
+				if (dst[i] != GUARD){
+					printf("bin_2x2, %s, width %u: wrote byte %u\n",
+					       simd->name, n, i);
+					errors++;
+					break;
+				}
+
+		}//for
+
+	return errors;
+}
+
+
+
+/* converts a hand-built mosaic, whose blocks have random colours */
+static uint32_t test_to_grey(koki_bayer_pattern_t pattern,
+			     koki_bayer_luma_t luma, const char *level)
+{
+	const char *colours = pattern_colours[pattern];
+	uint8_t mosaic[MOSAIC_HEIGHT * MOSAIC_STRIDE];
+	uint8_t expected[MOSAIC_HEIGHT / 2][MOSAIC_WIDTH / 2];
+	uint32_t errors = 0;
+	IplImage *grey;
+
+	/* the padding, the last column and the last row are junk */
+	for (uint32_t i=0; i<sizeof(mosaic); i++)
+		mosaic[i] = g_random_int_range(0, 256);
+
+	for (uint32_t by=0; by<MOSAIC_HEIGHT / 2; by++)
+		for (uint32_t bx=0; bx<MOSAIC_WIDTH / 2; bx++){
+
+			uint32_t sum = 0, greens = 0;
+
+			for (uint8_t k=0; k<4; k++){
+
+				uint8_t v = mosaic[(by * 2 + k / 2) * MOSAIC_STRIDE
+						   + bx * 2 + k % 2];
+
+				sum += v;
+				if (colours[k] == 'G')
+					greens += v;
+
+			}//for
+
+			expected[by][bx] = luma == KOKI_BAYER_GREEN
+				? (greens + 1) >> 1 : (sum + 2) >> 2;
+
+		}//for
+
+	grey = koki_bayer_to_grey(mosaic, MOSAIC_WIDTH, MOSAIC_HEIGHT,
+				  MOSAIC_STRIDE, pattern, luma);
+
+	if (grey->width != MOSAIC_WIDTH / 2 || grey->height != MOSAIC_HEIGHT / 2){
+		printf("to_grey, %s, %s: the image is %u x %u\n", colours, level,
+		       grey->width, grey->height);
+		cvReleaseImage(&grey);
+		return 1;
+	}
+
+	for (uint32_t y=0; y<MOSAIC_HEIGHT / 2; y++)
+		for (uint32_t x=0; x<MOSAIC_WIDTH / 2; x++){
+
+			uint8_t v = ((uint8_t*)grey->imageData)
+				[y * grey->widthStep + x];
+
+			if (v != expected[y][x]){
+				printf("to_grey, %s, %s, %s: pixel (%u, %u) is %u, "
+				       "not %u\n", colours,
+				       luma == KOKI_BAYER_GREEN ? "green" : "bin",
+				       level, x, y, v, expected[y][x]);
+				errors++;
+			}
+
+		}//for
+
+	cvReleaseImage(&grey);
+
+	return errors;
+}
+
+
+
+/* a full-resolution greyscale frame of markers, and their corners */
+static IplImage* synthetic_frame(koki_point2Df_t corners[NUM_MARKERS][4])
+{
+	IplImage *frame = cvCreateImage(cvSize(WIDTH, HEIGHT), IPL_DEPTH_8U, 1);
+
+	memset(frame->imageData, 200, frame->imageSize);
+
+	for (uint8_t m=0; m<NUM_MARKERS; m++){
+
+		uint8_t cells[KOKI_CODE_GRID_WIDTH][KOKI_CODE_GRID_WIDTH];
+
+		synthetic_corners((m + 0.5) * WIDTH / NUM_MARKERS,
+				  HEIGHT / 2 + g_random_double_range(-40, 40),
+				  g_random_double_range(120, 180),
+				  g_random_double_range(0, 2 * M_PI), corners[m]);
+		synthetic_code_cells(synthetic_random_code(), cells);
+		synthetic_draw_marker(frame, corners[m], cells, 30, 220);
+
+	}//for
+
+	return frame;
+}
+
+/* mosaics a greyscale frame, the luma being kept in whichever channels
+   make it, and the others filled with junk */
+static uint8_t* mosaic_frame(const IplImage *frame,
+			     koki_bayer_pattern_t pattern,
+			     koki_bayer_luma_t luma)
+{
+	const char *colours = pattern_colours[pattern];
+	uint8_t *mosaic = malloc(WIDTH * HEIGHT);
+
+	for (uint32_t y=0; y<HEIGHT; y++)
+		for (uint32_t x=0; x<WIDTH; x++){
+
+			uint8_t v = ((uint8_t*)frame->imageData)
+				[y * frame->widthStep + x];
+
+			if (luma == KOKI_BAYER_GREEN
+			    && colours[(y % 2) * 2 + x % 2] != 'G')
+				v = g_random_int_range(0, 256);
+
+			mosaic[y * WIDTH + x] = v;
+
+		}//for
+
+	return mosaic;
+}
+
+static double point_distance(koki_point2Df_t a, koki_point2Df_t b)
+{
+	return hypot(a.x - b.x, a.y - b.y);
+}
+
+/* the marker in a set whose centre is nearest a point, or NULL */
+static const koki_marker_t* find_near(GPtrArray *markers, koki_point2Df_t p)
+{
+	const koki_marker_t *nearest = NULL;
+
+	for (guint i=0; i<markers->len; i++){
+
+		const koki_marker_t *m = g_ptr_array_index(markers, i);
+
+		if (nearest == NULL || point_distance(m->centre.image, p)
+		    < point_distance(nearest->centre.image, p))
+			nearest = m;
+
+	}//for
+
+	return nearest;
+}
+
+/* finds the markers in a mosaic of a frame, and compares them with those
+   drawn and those found in the frame itself */
+static uint32_t test_find(koki_t *koki, IplImage *frame,
+			  koki_point2Df_t corners[NUM_MARKERS][4],
+			  GPtrArray *full, koki_camera_params_t *params,
+			  koki_bayer_pattern_t pattern, koki_bayer_luma_t luma)
+{
+	uint8_t *mosaic = mosaic_frame(frame, pattern, luma);
+	uint32_t errors = 0;
+	GPtrArray *markers;
+	char what[64];
+
+	snprintf(what, sizeof(what), "find, %s, %s", pattern_colours[pattern],
+		 luma == KOKI_BAYER_GREEN ? "green" : "bin");
+
+	markers = koki_find_markers_bayer(koki, mosaic, WIDTH, HEIGHT, WIDTH,
+					  pattern, luma, MARKER_WIDTH, params);
+	free(mosaic);
+
+	if (markers == NULL || markers->len != NUM_MARKERS){
+		printf("%s: found %u markers, not %u\n", what,
+		       markers == NULL ? 0 : markers->len, NUM_MARKERS);
+		if (markers != NULL)
+			koki_markers_free(markers);
+		return 1;
+	}
+
+	for (uint8_t m=0; m<NUM_MARKERS; m++){
+
+		koki_point2Df_t centre = { 0, 0 };
+		const koki_marker_t *found, *truth;
+
+		for (uint8_t c=0; c<4; c++){
+			centre.x += corners[m][c].x / 4;
+			centre.y += corners[m][c].y / 4;
+		}
+
+		found = find_near(markers, centre);
+		truth = find_near(full, centre);
+
+		if (point_distance(found->centre.image, centre) > TOL_VERTEX){
+			printf("%s: marker %u's centre is %.2f pixels out\n", what,
+			       m, point_distance(found->centre.image, centre));
+			errors++;
+		}
+
+		/* the vertices may start from any corner */
+		for (uint8_t v=0; v<4; v++){
+
+			double nearest = INFINITY;
+
+			for (uint8_t c=0; c<4; c++)
+				nearest = MIN(nearest, point_distance(
+						      found->vertices[v].image,
+						      corners[m][c]));
+
+			if (nearest > TOL_VERTEX){
+				printf("%s: marker %u's vertex %u is %.2f pixels "
+				       "out\n", what, m, v, nearest);
+				errors++;
+			}
+
+		}//for
+
+		/* the principal point and focal length having been halved */
+		if (truth == NULL
+		    || fabs(found->centre.world.x - truth->centre.world.x)
+		       > TOL_WORLD * truth->distance
+		    || fabs(found->centre.world.y - truth->centre.world.y)
+		       > TOL_WORLD * truth->distance
+		    || fabs(found->centre.world.z - truth->centre.world.z)
+		       > TOL_WORLD * truth->distance){
+			printf("%s: marker %u is at (%.3f, %.3f, %.3f), not (%.3f, "
+			       "%.3f, %.3f)\n", what, m, found->centre.world.x,
+			       found->centre.world.y, found->centre.world.z,
+			       truth ? truth->centre.world.x : NAN,
+			       truth ? truth->centre.world.y : NAN,
+			       truth ? truth->centre.world.z : NAN);
+			errors++;
+		}
+
+	}//for
+
+	koki_markers_free(markers);
+
+	return errors;
+}
+
+
+
+int main(void)
+{
+	koki_simd_level_t initial = koki_simd_kernels()->level;
+	koki_point2Df_t corners[NUM_MARKERS][4];
+	koki_t *koki = koki_new();
+	koki_camera_params_t params;
+	uint32_t errors = 0;
+	IplImage *frame;
+	GPtrArray *full;
+
+	g_random_set_seed(1);
+
+	for (koki_simd_level_t l=0; l<KOKI_SIMD_NUM_LEVELS; l++){
+
+		if (!koki_simd_supported(l))
+			continue;
+
+		koki_simd_set_level(l);
+
+		errors += test_bin_2x2(koki_simd_kernels());
+
+		for (uint8_t p=0; p<NUM_PATTERNS; p++){
+			errors += test_to_grey(p, KOKI_BAYER_BIN,
+					       koki_simd_kernels()->name);
+			errors += test_to_grey(p, KOKI_BAYER_GREEN,
+					       koki_simd_kernels()->name);
+		}
+
+	}//for
+
+	koki_simd_set_level(initial);
+
+	/* off-centre, so that the mapping of the principal point shows */
+	params.size.x = WIDTH;
+	params.size.y = HEIGHT;
+	params.principal_point.x = WIDTH / 2 + 37.5;
+	params.principal_point.y = HEIGHT / 2 - 21.5;
+	params.focal_length.x = params.focal_length.y = FOCAL_LENGTH;
+
+	frame = synthetic_frame(corners);
+	full = koki_find_markers(koki, frame, MARKER_WIDTH, &params);
+
+	if (full == NULL || full->len != NUM_MARKERS){
+		printf("found %u markers at full resolution, not %u\n",
+		       full == NULL ? 0 : full->len, NUM_MARKERS);
+		errors++;
+	} else
+		for (uint8_t p=0; p<NUM_PATTERNS; p++){
+			errors += test_find(koki, frame, corners, full, &params,
+					    p, KOKI_BAYER_BIN);
+			errors += test_find(koki, frame, corners, full, &params,
+					    p, KOKI_BAYER_GREEN);
+		}
+
+	if (full != NULL)
+		koki_markers_free(full);
+
+	cvReleaseImage(&frame);
+	koki_destroy(koki);
+
+	printf("%u failed checks\n", errors);
+
+	return errors > 0;
+}
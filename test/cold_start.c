@@ -0,0 +1,216 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/*
+ * Measures the latency of the first frame a fresh process handles, with
+ * and without koki_prepare() having been called beforehand, against the
+ * steady-state latency.  Each run is made in a newly forked child, so
+ * that nothing is warm beyond what the child does itself; the image is
+ * loaded before any timing starts.  The minor page faults taken by the
+ * first frame are reported too, as they're most of the difference.
+ *
+ * Usage: ./cold_start <filename> [runs]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <cv.h>
+#include <highgui.h>
+#include <glib.h>
+
+#include "koki.h"
+
+#define MARKER_WIDTH 0.11
+#define DEFAULT_RUNS 15
+#define STEADY_FRAMES 30
+
+
+/* what a child reports back to its parent */
+typedef struct {
+	double prepare_ms;   /* time spent in koki_prepare(), if called */
+	double first_ms;     /* latency of the first frame */
+	long first_faults;   /* minor page faults during the first frame */
+	double steady_ms;    /* median latency of the frames that follow */
+} run_result_t;
+
+
+static double now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+
+static long minor_faults(void)
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_minflt;
+}
+
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double*)a, y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+
+static double median(double *v, int n)
+{
+	qsort(v, n, sizeof(double), cmp_double);
+	return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+
+/* runs in the child: everything from creating the context onwards */
+static void child_run(const char *filename, int prepare, run_result_t *r)
+{
+	IplImage *frame = cvLoadImage(filename, CV_LOAD_IMAGE_GRAYSCALE);
+	koki_camera_params_t params;
+	double times[STEADY_FRAMES], start;
+	long faults;
+	koki_t *koki;
+
+	assert(frame != NULL);
+
+	params.size.x = frame->width;
+	params.size.y = frame->height;
+	params.principal_point.x = params.size.x / 2;
+	params.principal_point.y = params.size.y / 2;
+	params.focal_length.x = 571.0;
+	params.focal_length.y = 571.0;
+
+	koki = koki_new();
+
+	r->prepare_ms = 0;
+	if (prepare){
+		start = now_ms();
+		koki_prepare(koki, frame->width, frame->height);
+		r->prepare_ms = now_ms() - start;
+	}
+
+	faults = minor_faults();
+	start = now_ms();
+	koki_markers_free(koki_find_markers(koki, frame, MARKER_WIDTH, &params));
+	r->first_ms = now_ms() - start;
+	r->first_faults = minor_faults() - faults;
+
+	for (int i=0; i<STEADY_FRAMES; i++){
+		start = now_ms();
+		koki_markers_free(koki_find_markers(koki, frame, MARKER_WIDTH,
+						    &params));
+		times[i] = now_ms() - start;
+	}
+
+	r->steady_ms = median(times, STEADY_FRAMES);
+
+	koki_destroy(koki);
+	cvReleaseImage(&frame);
+}
+
+
+/* forks a child to make a run, and collects its result */
+static int run(const char *filename, int prepare, run_result_t *r)
+{
+	int fds[2], status;
+	pid_t pid;
+
+	if (pipe(fds) < 0)
+		return -1;
+
+	pid = fork();
+	if (pid < 0)
+		return -1;
+
+	if (pid == 0){
+		close(fds[0]);
+		child_run(filename, prepare, r);
+		_exit(write(fds[1], r, sizeof(*r)) == sizeof(*r) ? 0 : 1);
+	}
+
+	close(fds[1]);
+	if (read(fds[0], r, sizeof(*r)) != sizeof(*r))
+		status = -1;
+	else
+		status = 0;
+	close(fds[0]);
+
+	waitpid(pid, NULL, 0);
+
+	return status;
+}
+
+
+int main(int argc, const char *argv[])
+{
+	int runs = DEFAULT_RUNS;
+
+	if (argc < 2 || argc > 3){
+		printf("Usage: ./cold_start <filename> [runs]\n");
+		return 1;
+	}
+
+	if (argc == 3)
+		runs = atoi(argv[2]);
+
+	assert(runs > 0);
+
+	double first[2][runs], faults[2][runs], steady[2][runs], prep[runs];
+
+	/* alternate, so that any drift affects both equally */
+	for (int i=0; i<runs; i++){
+		for (int prepare=0; prepare<2; prepare++){
+
+			run_result_t r;
+
+			if (run(argv[1], prepare, &r) < 0){
+				fprintf(stderr, "run %d failed\n", i);
+				return 1;
+			}
+
+			first[prepare][i] = r.first_ms;
+			faults[prepare][i] = r.first_faults;
+			steady[prepare][i] = r.steady_ms;
+			if (prepare)
+				prep[i] = r.prepare_ms;
+
+		}
+	}
+
+	printf("%d runs, medians:\n", runs);
+	printf("%-22s %10s %14s %10s\n", "", "first/ms", "first faults",
+	       "steady/ms");
+
+	for (int prepare=0; prepare<2; prepare++)
+		printf("%-22s %10.2f %14.0f %10.2f\n",
+		       prepare ? "with koki_prepare()" : "cold",
+		       median(first[prepare], runs),
+		       median(faults[prepare], runs),
+		       median(steady[prepare], runs));
+
+	printf("koki_prepare() itself: %.2f ms\n", median(prep, runs));
+
+	return 0;
+}
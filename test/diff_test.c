@@ -0,0 +1,511 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/*
+ * Differential test of the optimised pipeline against the reference one
+ * (see koki_set_reference_mode()).  Each frame is processed by both, and
+ * any difference in the labels, the refined quads, the decoded codes or
+ * the poses beyond a small tolerance is reported, and makes the exit
+ * status non-zero.  The reference keeps the markers lying within bigger
+ * ones (code cells, and second quads around the same marker), which the
+ * optimised pipeline drops, so those are left out of the comparison.
+ *
+ * The frames are the given images, several variants of each (brightness,
+ * contrast, noise, blur, scale, a half turn), and a number of synthetic
+ * frames of randomly placed dark quads.  The reference runs with the
+ * scalar pixel kernels; the optimised one with whatever this CPU
+ * supports, the decode cache enabled, and (when built with fixed=1) the
+ * fixed-point geometry.
+ *
+ * Usage: diff_test [IMAGE...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include <cv.h>
+#include <highgui.h>
+#include <glib.h>
+
+#include "koki.h"
+
+#define MARKER_WIDTH  0.11
+#define FOCAL_LENGTH  571.0
+
+#define NUM_SYNTHETIC 50
+
+/* tolerances -- the labels and codes must match exactly */
+#define TOL_VERTEX    0.05  /* pixels */
+#define TOL_CENTRE    1.0   /* pixels, for pairing up markers */
+#define TOL_DISTANCE  0.005 /* relative */
+#define TOL_ANGLE     1.0   /* degrees */
+
+
+typedef struct {
+	uint32_t frames;
+	uint32_t label_mismatches;
+	uint32_t quad_mismatches;
+	uint32_t code_mismatches;
+	uint32_t pose_mismatches;
+	uint32_t quads;
+	uint32_t markers;
+} results_t;
+
+/* the kernels the optimised context runs with; the reference runs with
+   the scalar ones */
+static koki_simd_level_t opt_level;
+
+
+/* ------------------------------------------------------------- frames */
+
+static IplImage* new_frame(int w, int h)
+{
+	return cvCreateImage(cvSize(w, h), IPL_DEPTH_8U, 1);
+}
+
+static uint8_t clamp_grey(double v)
+{
+	return v < 0 ? 0 : v > 255 ? 255 : (uint8_t)(v + 0.5);
+}
+
+/* applies grey' = grey * gain + offset + noise */
+static IplImage* variant_levels(const IplImage *src, double gain,
+				double offset, double noise)
+{
+	IplImage *dst = new_frame(src->width, src->height);
+
+	for (int y=0; y<src->height; y++)
+		for (int x=0; x<src->width; x++)
+			KOKI_IPLIMAGE_GS_ELEM(dst, x, y) = clamp_grey(
+				KOKI_IPLIMAGE_GS_ELEM(src, x, y) * gain + offset
+				+ (noise > 0 ? g_random_double_range(-noise, noise) : 0));
+
+	return dst;
+}
+
+/* a 3x3 box blur */
+static IplImage* variant_blur(const IplImage *src)
+{
+	IplImage *dst = new_frame(src->width, src->height);
+
+	for (int y=0; y<src->height; y++)
+		for (int x=0; x<src->width; x++){
+
+			uint16_t sum = 0, n = 0;
+
+			for (int dy=-1; dy<=1; dy++)
+				for (int dx=-1; dx<=1; dx++){
+					int sx = x + dx, sy = y + dy;
+					if (sx < 0 || sy < 0 ||
+					    sx >= src->width || sy >= src->height)
+						continue;
+					sum += KOKI_IPLIMAGE_GS_ELEM(src, sx, sy);
+					n++;
+				}
+
+			KOKI_IPLIMAGE_GS_ELEM(dst, x, y) = (sum + n / 2) / n;
+
+		}
+
+	return dst;
+}
+
+static IplImage* variant_half_turn(const IplImage *src)
+{
+	IplImage *dst = new_frame(src->width, src->height);
+
+	for (int y=0; y<src->height; y++)
+		for (int x=0; x<src->width; x++)
+			KOKI_IPLIMAGE_GS_ELEM(dst, src->width - 1 - x,
+					      src->height - 1 - y) =
+				KOKI_IPLIMAGE_GS_ELEM(src, x, y);
+
+	return dst;
+}
+
+static IplImage* variant_scale(const IplImage *src, double scale)
+{
+	IplImage *dst = new_frame(src->width * scale, src->height * scale);
+
+	cvResize(src, dst, CV_INTER_LINEAR);
+
+	return dst;
+}
+
+/* dark convex quads on a lit gradient, with a little noise */
+static IplImage* synthetic_frame(void)
+{
+	const int w = 640, h = 480;
+	IplImage *frame = new_frame(w, h);
+	double gx = g_random_double_range(-0.2, 0.2);
+	double gy = g_random_double_range(-0.2, 0.2);
+	uint8_t nquads = g_random_int_range(1, 12);
+	double quads[12][4][2];
+
+	for (uint8_t q=0; q<nquads; q++){
+
+		double cx = g_random_double_range(20, w - 20);
+		double cy = g_random_double_range(20, h - 20);
+		double r = g_random_double_range(8, 80);
+		double a = g_random_double_range(0, M_PI / 2);
+
+		for (uint8_t i=0; i<4; i++){
+			double t = a + i * M_PI / 2
+				+ g_random_double_range(-0.3, 0.3);
+			quads[q][i][0] = cx + r * cos(t);
+			quads[q][i][1] = cy + r * sin(t);
+		}
+
+	}//for
+
+	for (int y=0; y<h; y++)
+		for (int x=0; x<w; x++){
+
+			double v = 180 + gx * (x - w / 2) + gy * (y - h / 2);
+
+			for (uint8_t q=0; q<nquads; q++){
+
+				bool inside = TRUE;
+
+				for (uint8_t i=0; i<4 && inside; i++){
+					const double *p0 = quads[q][i];
+					const double *p1 = quads[q][(i + 1) % 4];
+					inside = (p1[0] - p0[0]) * (y - p0[1])
+						- (p1[1] - p0[1]) * (x - p0[0]) >= 0;
+				}
+
+				if (inside)
+					v = 30;
+
+			}//for
+
+			KOKI_IPLIMAGE_GS_ELEM(frame, x, y) =
+				clamp_grey(v + g_random_double_range(-8, 8));
+
+		}//for
+
+	return frame;
+}
+
+
+/* ---------------------------------------------------------- comparison */
+
+static label_t canonical(const koki_labelled_image_t *lmg, uint16_t x,
+			 uint16_t y)
+{
+	label_t l = KOKI_LABELLED_IMAGE_LABEL(lmg, x, y);
+
+	return l == 0 ? 0 : g_array_index(lmg->aliases, label_t, l - 1);
+}
+
+/* the refinement the optimised pipeline uses */
+static void refine_optimised(koki_quad_t *quad)
+{
+#ifdef KOKI_FIXED_POINT
+	koki_quad_refine_vertices_fixed(quad);
+#else
+	koki_quad_refine_vertices(quad);
+#endif
+}
+
+static void compare_labels(koki_t *opt, koki_t *ref, IplImage *frame,
+			   const char *name, results_t *res)
+{
+	koki_labelled_image_t *lo, *lr;
+	uint32_t bad = 0;
+
+	lo = koki_label_adaptive(opt, frame, 11, 5);
+
+	koki_simd_set_level(KOKI_SIMD_SCALAR);
+	lr = koki_label_reference(ref, frame, 11, 5);
+	koki_simd_set_level(opt_level);
+
+	for (uint16_t y=0; y<frame->height; y++)
+		for (uint16_t x=0; x<frame->width; x++)
+			if (canonical(lo, x, y) != canonical(lr, x, y))
+				bad++;
+
+	if (bad > 0 || lo->clips->len != lr->clips->len){
+		printf("%s: %u pixels labelled differently (%u vs %u regions)\n",
+		       name, bad, lo->clips->len, lr->clips->len);
+		res->label_mismatches++;
+		goto out;
+	}
+
+	/* with identical labels, the quads only differ by refinement */
+	for (label_t i=0; i<lr->clips->len; i++){
+
+		GSList *contour;
+		koki_quad_t *qo, *qr;
+
+		if (!koki_label_useable(lr, i))
+			continue;
+
+		contour = koki_contour_find(lr, i);
+		qr = koki_quad_find_vertices(contour);
+
+		if (qr == NULL){
+			koki_contour_free(contour);
+			continue;
+		}
+
+		qo = koki_quad_find_vertices(contour);
+		koki_quad_refine_vertices(qr);
+		refine_optimised(qo);
+		res->quads++;
+
+		for (uint8_t v=0; v<4; v++){
+
+			double d = hypot(qo->vertices[v].x - qr->vertices[v].x,
+					 qo->vertices[v].y - qr->vertices[v].y);
+
+			if (d > TOL_VERTEX){
+				printf("%s: region %u vertex %u differs by %.3f px\n",
+				       name, i, v, d);
+				res->quad_mismatches++;
+				break;
+			}
+
+		}//for
+
+		koki_quad_free(qo);
+		koki_quad_free(qr);
+		koki_contour_free(contour);
+
+	}//for
+
+out:
+	koki_labelled_image_free(lo);
+	koki_labelled_image_free(lr);
+}
+
+static double angle_diff(double a, double b)
+{
+	double d = fmod(fabs(a - b), 360);
+	return d > 180 ? 360 - d : d;
+}
+
+static double quad_area(const koki_marker_t *m)
+{
+	double area = 0;
+
+	for (int v=0; v<4; v++){
+		const koki_point2Df_t *a = &m->vertices[v].image;
+		const koki_point2Df_t *b = &m->vertices[(v+1) % 4].image;
+		area += a->x * b->y - b->x * a->y;
+	}
+
+	return fabs(area) / 2;
+}
+
+/* whether a reference marker lies within a bigger one -- either a code
+   cell decoded as a marker or a second quad around the same marker, both
+   of which the reference mode keeps and the optimised pipeline drops */
+static bool within_bigger(GPtrArray *markers, const koki_marker_t *r)
+{
+	for (guint j=0; j<markers->len; j++){
+
+		const koki_marker_t *m = g_ptr_array_index(markers, j);
+		double min_x = m->vertices[0].image.x, max_x = min_x;
+		double min_y = m->vertices[0].image.y, max_y = min_y;
+
+		if (m == r || quad_area(m) <= quad_area(r))
+			continue;
+
+		for (int v=1; v<4; v++){
+			min_x = fmin(min_x, m->vertices[v].image.x);
+			max_x = fmax(max_x, m->vertices[v].image.x);
+			min_y = fmin(min_y, m->vertices[v].image.y);
+			max_y = fmax(max_y, m->vertices[v].image.y);
+		}
+
+		if (r->centre.image.x >= min_x && r->centre.image.x <= max_x
+		    && r->centre.image.y >= min_y && r->centre.image.y <= max_y)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+static void compare_markers(koki_t *opt, koki_t *ref, IplImage *frame,
+			    const char *name, results_t *res)
+{
+	koki_camera_params_t params;
+	GPtrArray *mo, *mr;
+	guint expected = 0;
+
+	params.size.x = frame->width;
+	params.size.y = frame->height;
+	params.principal_point.x = frame->width / 2;
+	params.principal_point.y = frame->height / 2;
+	params.focal_length.x = params.focal_length.y = FOCAL_LENGTH;
+
+	mo = koki_find_markers(opt, frame, MARKER_WIDTH, &params);
+
+	koki_simd_set_level(KOKI_SIMD_SCALAR);
+	mr = koki_find_markers(ref, frame, MARKER_WIDTH, &params);
+	koki_simd_set_level(opt_level);
+
+	for (guint i=0; i<mr->len; i++)
+		if (!within_bigger(mr, g_ptr_array_index(mr, i)))
+			expected++;
+
+	if (mo->len != expected){
+		printf("%s: %u markers found, but the reference found %u\n",
+		       name, mo->len, expected);
+		res->code_mismatches++;
+	}
+
+	for (guint i=0; i<mr->len; i++){
+
+		koki_marker_t *r = g_ptr_array_index(mr, i), *o = NULL;
+
+		if (within_bigger(mr, r))
+			continue;
+
+		res->markers++;
+
+		for (guint j=0; j<mo->len && o == NULL; j++){
+			koki_marker_t *m = g_ptr_array_index(mo, j);
+			if (hypot(m->centre.image.x - r->centre.image.x,
+				  m->centre.image.y - r->centre.image.y) < TOL_CENTRE)
+				o = m;
+		}
+
+		if (o == NULL || o->code != r->code){
+			printf("%s: reference marker %u at (%.1f, %.1f) %s\n",
+			       name, r->code, r->centre.image.x, r->centre.image.y,
+			       o == NULL ? "not found" : "decoded differently");
+			res->code_mismatches++;
+			continue;
+		}
+
+		if (fabs(o->distance - r->distance) > TOL_DISTANCE * r->distance
+		    || angle_diff(o->rotation.x, r->rotation.x) > TOL_ANGLE
+		    || angle_diff(o->rotation.y, r->rotation.y) > TOL_ANGLE
+		    || angle_diff(o->rotation.z, r->rotation.z) > TOL_ANGLE
+		    || angle_diff(o->bearing.x, r->bearing.x) > TOL_ANGLE
+		    || angle_diff(o->bearing.y, r->bearing.y) > TOL_ANGLE){
+			printf("%s: marker %u pose differs: distance %.4f vs %.4f, "
+			       "rotation (%.2f, %.2f, %.2f) vs (%.2f, %.2f, %.2f), "
+			       "bearing (%.2f, %.2f) vs (%.2f, %.2f)\n",
+			       name, r->code, o->distance, r->distance,
+			       o->rotation.x, o->rotation.y, o->rotation.z,
+			       r->rotation.x, r->rotation.y, r->rotation.z,
+			       o->bearing.x, o->bearing.y,
+			       r->bearing.x, r->bearing.y);
+			res->pose_mismatches++;
+		}
+
+	}//for
+
+	koki_markers_free(mo);
+	koki_markers_free(mr);
+}
+
+static void test_frame(koki_t *opt, koki_t *ref, IplImage *frame,
+		       const char *name, results_t *res)
+{
+	res->frames++;
+	compare_labels(opt, ref, frame, name, res);
+	compare_markers(opt, ref, frame, name, res);
+}
+
+
+int main(int argc, const char *argv[])
+{
+	koki_t *opt = koki_new(), *ref = koki_new();
+	results_t res = { 0 };
+	char name[256];
+
+	koki_set_decode_cache(opt, TRUE);
+	koki_set_reference_mode(ref, TRUE);
+
+	g_random_set_seed(1);
+
+	opt_level = koki_simd_kernels()->level;
+
+	printf("optimised: %s kernels%s\n", koki_simd_kernels()->name,
+#ifdef KOKI_FIXED_POINT
+	       ", fixed-point geometry"
+#else
+	       ""
+#endif
+		);
+
+	for (int i=1; i<argc; i++){
+
+		IplImage *frame = cvLoadImage(argv[i], CV_LOAD_IMAGE_GRAYSCALE);
+		IplImage *variants[7];
+		const char *variant_names[7] = {
+			"original", "dark", "bright", "low contrast", "noisy",
+			"blurred", "half turn"
+		};
+
+		if (frame == NULL){
+			fprintf(stderr, "couldn't load %s\n", argv[i]);
+			return 1;
+		}
+
+		variants[0] = cvCloneImage(frame);
+		variants[1] = variant_levels(frame, 0.5, 0, 0);
+		variants[2] = variant_levels(frame, 1.3, 20, 0);
+		variants[3] = variant_levels(frame, 0.4, 80, 0);
+		variants[4] = variant_levels(frame, 1, 0, 12);
+		variants[5] = variant_blur(frame);
+		variants[6] = variant_half_turn(frame);
+
+		for (uint8_t v=0; v<7; v++){
+			snprintf(name, sizeof(name), "%s (%s)", argv[i],
+				 variant_names[v]);
+			test_frame(opt, ref, variants[v], name, &res);
+			cvReleaseImage(&variants[v]);
+		}
+
+		for (double scale = 0.5; scale < 1; scale += 0.25){
+			IplImage *scaled = variant_scale(frame, scale);
+			snprintf(name, sizeof(name), "%s (scaled %.2f)", argv[i],
+				 scale);
+			test_frame(opt, ref, scaled, name, &res);
+			cvReleaseImage(&scaled);
+		}
+
+		cvReleaseImage(&frame);
+
+	}//for
+
+	for (uint32_t i=0; i<NUM_SYNTHETIC; i++){
+		IplImage *frame = synthetic_frame();
+		snprintf(name, sizeof(name), "synthetic %u", i);
+		test_frame(opt, ref, frame, name, &res);
+		cvReleaseImage(&frame);
+	}
+
+	printf("%u frames, %u quads, %u markers compared\n",
+	       res.frames, res.quads, res.markers);
+	printf("mismatches: %u labels, %u quads, %u codes, %u poses\n",
+	       res.label_mismatches, res.quad_mismatches,
+	       res.code_mismatches, res.pose_mismatches);
+
+	koki_destroy(opt);
+	koki_destroy(ref);
+
+	return res.label_mismatches + res.quad_mismatches
+		+ res.code_mismatches + res.pose_mismatches > 0;
+}
@@ -0,0 +1,333 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/*
+ * Checks the corners of the quads found from image gradients (see
+ * koki_set_edge_quads()) against synthetic markers, blurred as a moving
+ * camera or a defocused lens would blur them.  Each marker is put in a
+ * frame of its own, in perspective, and one of the quads found must have
+ * all four corners within 1.5 pixels of the marker's.  The exit status is
+ * non-zero if any marker isn't found that well.
+ *
+ * The blur is given relative to the width of the marker's black border,
+ * as that's what limits the accuracy: once the blur spreads across the
+ * border, the border's outer and inner edges pull on each other.  The
+ * corners stay within 1.5 pixels up to a motion of about three quarters
+ * of the border's width, or a Gaussian blur (standard deviation) of about
+ * a quarter of it.
+ *
+ * Usage: edge_accuracy
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include <cv.h>
+#include <glib.h>
+
+#include "koki.h"
+#include "edge_quads.h"
+
+#define WIDTH  320
+#define HEIGHT 240
+
+#define MARKERS_PER_BLUR 20
+
+/* the sub-samples per pixel, in each direction, when rendering */
+#define SUPERSAMPLE 4
+
+/* the number of positions a moving marker is rendered at */
+#define MOTION_STEPS 16
+
+#define TOL_CORNER  1.5 /* pixels */
+
+
+/* the blurs, in widths of the marker's border (a tenth of its side) */
+typedef struct {
+	const char *name;
+	double sigma;   /* the Gaussian blur's standard deviation */
+	double motion;  /* the distance moved while exposed */
+} blur_t;
+
+static const blur_t blurs[] = {
+	{ "sharp",                     0,    0    },
+	{ "gaussian 0.1 border",       0.1,  0    },
+	{ "gaussian 0.2 border",       0.2,  0    },
+	{ "gaussian 0.25 border",      0.25, 0    },
+	{ "motion 0.5 border",         0,    0.5  },
+	{ "motion 0.75 border",        0,    0.75 },
+	{ "motion 0.5 + gaussian 0.1", 0.1,  0.5  },
+};
+
+
+/* the homography mapping the unit square's corners (0,0), (1,0), (1,1)
+   and (0,1) onto a quad's, after Heckbert's "Fundamentals of Texture
+   Mapping and Image Warping" */
+static void square_to_quad(const koki_point2Df_t q[4], double h[9])
+{
+	double dx1 = q[1].x - q[2].x, dx2 = q[3].x - q[2].x;
+	double dy1 = q[1].y - q[2].y, dy2 = q[3].y - q[2].y;
+	double sx = q[0].x - q[1].x + q[2].x - q[3].x;
+	double sy = q[0].y - q[1].y + q[2].y - q[3].y;
+	double det = dx1 * dy2 - dx2 * dy1;
+	double g = (sx * dy2 - dx2 * sy) / det;
+	double k = (dx1 * sy - sx * dy1) / det;
+
+	h[0] = q[1].x - q[0].x + g * q[1].x;
+	h[1] = q[3].x - q[0].x + k * q[3].x;
+	h[2] = q[0].x;
+	h[3] = q[1].y - q[0].y + g * q[1].y;
+	h[4] = q[3].y - q[0].y + k * q[3].y;
+	h[5] = q[0].y;
+	h[6] = g;
+	h[7] = k;
+	h[8] = 1;
+}
+
+static void invert3(const double m[9], double r[9])
+{
+	double det = m[0] * (m[4] * m[8] - m[5] * m[7])
+		- m[1] * (m[3] * m[8] - m[5] * m[6])
+		+ m[2] * (m[3] * m[7] - m[4] * m[6]);
+
+	r[0] = (m[4] * m[8] - m[5] * m[7]) / det;
+	r[1] = (m[2] * m[7] - m[1] * m[8]) / det;
+	r[2] = (m[1] * m[5] - m[2] * m[4]) / det;
+	r[3] = (m[5] * m[6] - m[3] * m[8]) / det;
+	r[4] = (m[0] * m[8] - m[2] * m[6]) / det;
+	r[5] = (m[2] * m[3] - m[0] * m[5]) / det;
+	r[6] = (m[3] * m[7] - m[4] * m[6]) / det;
+	r[7] = (m[1] * m[6] - m[0] * m[7]) / det;
+	r[8] = (m[0] * m[4] - m[1] * m[3]) / det;
+}
+
+/* whether a point in the marker's unit square is dark: the border, and
+   some of the 6x6 code cells inside the white margin */
+static bool marker_dark(double u, double v, uint64_t cells)
+{
+	int cx, cy;
+
+	if (u < 0 || v < 0 || u >= 1 || v >= 1)
+		return FALSE;
+
+	if (u < 0.1 || v < 0.1 || u >= 0.9 || v >= 0.9)
+		return TRUE;
+
+	if (u < 0.2 || v < 0.2 || u >= 0.8 || v >= 0.8)
+		return FALSE;
+
+	cx = (u - 0.2) * 10;
+	cy = (v - 0.2) * 10;
+
+	return (cells >> (cy * 6 + cx)) & 1;
+}
+
+/* renders the marker into a buffer of coverage, the fraction of each
+   pixel (sampled at its centre) that's dark, averaged over the motion */
+static void render(float *dark, const koki_point2Df_t corners[4],
+		   uint64_t cells, double mx, double my)
+{
+	const uint8_t steps = mx != 0 || my != 0 ? MOTION_STEPS : 1;
+	const float weight = 1.0 / (steps * SUPERSAMPLE * SUPERSAMPLE);
+
+	for (uint32_t i=0; i<WIDTH * HEIGHT; i++)
+		dark[i] = 0;
+
+	for (uint8_t s=0; s<steps; s++){
+
+		/* from -1/2 to +1/2 of the motion, so the corners given are
+		   those in the middle of the exposure */
+		double t = steps > 1 ? (s + 0.5) / steps - 0.5 : 0;
+		koki_point2Df_t q[4];
+		double h[9], inv[9];
+
+		for (uint8_t c=0; c<4; c++){
+			q[c].x = corners[c].x + mx * t;
+			q[c].y = corners[c].y + my * t;
+		}
+
+		square_to_quad(q, h);
+		invert3(h, inv);
+
+		for (uint32_t y=0; y<HEIGHT; y++)
+			for (uint32_t x=0; x<WIDTH; x++)
+				for (uint8_t sy=0; sy<SUPERSAMPLE; sy++)
+					for (uint8_t sx=0; sx<SUPERSAMPLE; sx++){
+
+						double px = x + (sx + 0.5) / SUPERSAMPLE - 0.5;
+						double py = y + (sy + 0.5) / SUPERSAMPLE - 0.5;
+						double w = inv[6] * px + inv[7] * py + inv[8];
+						double u = (inv[0] * px + inv[1] * py + inv[2]) / w;
+						double v = (inv[3] * px + inv[4] * py + inv[5]) / w;
+
+						if (marker_dark(u, v, cells))
+							dark[y * WIDTH + x] += weight;
+
+					}//for
+
+	}//for
+}
+
+/* blurs the buffer in place with a separable Gaussian */
+static void gaussian(float *buf, double sigma)
+{
+	int r = ceil(sigma * 3);
+	float kernel[2 * r + 1], sum = 0;
+	float *tmp = malloc(WIDTH * HEIGHT * sizeof(float));
+
+	for (int k=-r; k<=r; k++)
+		sum += kernel[k + r] = exp(-k * k / (2 * sigma * sigma));
+	for (int k=-r; k<=r; k++)
+		kernel[k + r] /= sum;
+
+	for (int pass=0; pass<2; pass++){
+
+		float *src = pass == 0 ? buf : tmp, *dst = pass == 0 ? tmp : buf;
+
+		for (int y=0; y<HEIGHT; y++)
+			for (int x=0; x<WIDTH; x++){
+
+				float acc = 0;
+
+				/* clamping at the edges of the frame */
+				for (int k=-r; k<=r; k++){
+					int sx = pass == 0 ? CLAMP(x + k, 0, WIDTH - 1) : x;
+					int sy = pass == 1 ? CLAMP(y + k, 0, HEIGHT - 1) : y;
+					acc += kernel[k + r] * src[sy * WIDTH + sx];
+				}
+
+				dst[y * WIDTH + x] = acc;
+
+			}//for
+
+	}//for
+
+	free(tmp);
+}
+
+/* the largest distance between the quad's corners and the marker's,
+   going round the quad from whichever corner matches best */
+static double corner_error(const koki_quad_t *quad,
+			   const koki_point2Df_t corners[4])
+{
+	double best = G_MAXDOUBLE;
+
+	for (uint8_t s=0; s<4; s++){
+
+		double worst = 0;
+
+		for (uint8_t c=0; c<4; c++){
+			const koki_point2Df_t *v = &quad->vertices[(c + s) % 4];
+			worst = MAX(worst, hypot(v->x - corners[c].x,
+						 v->y - corners[c].y));
+		}
+
+		best = MIN(best, worst);
+
+	}//for
+
+	return best;
+}
+
+
+int main(void)
+{
+	koki_t *koki = koki_new();
+	IplImage *frame = cvCreateImage(cvSize(WIDTH, HEIGHT), IPL_DEPTH_8U, 1);
+	float *dark = malloc(WIDTH * HEIGHT * sizeof(float));
+	uint32_t failures = 0;
+
+	g_random_set_seed(1);
+
+	for (guint b=0; b<G_N_ELEMENTS(blurs); b++){
+
+		const blur_t *blur = &blurs[b];
+		double worst = 0;
+		uint32_t found = 0;
+
+		for (uint32_t m=0; m<MARKERS_PER_BLUR; m++){
+
+			/* a square 40-130 pixels across, turned, with each corner
+			   moved a little to put it in perspective */
+			double side = g_random_double_range(40, 130);
+			double border = side / 10;
+			double turn = g_random_double_range(0, 2 * M_PI);
+			/* far enough in for the corners to stay in the frame */
+			double margin = side * (M_SQRT1_2 + 0.08 * M_SQRT2) + 2;
+			double cx = g_random_double_range(margin, WIDTH - margin);
+			double cy = g_random_double_range(margin, HEIGHT - margin);
+			double heading = g_random_double_range(0, 2 * M_PI);
+			uint64_t cells = ((uint64_t)g_random_int() << 32)
+				| g_random_int();
+			koki_point2Df_t corners[4];
+			GPtrArray *quads;
+			double err = G_MAXDOUBLE;
+
+			for (uint8_t c=0; c<4; c++){
+				double a = turn + c * M_PI / 2 - 3 * M_PI / 4;
+				corners[c].x = cx + side / M_SQRT2 * cos(a)
+					+ g_random_double_range(-0.08, 0.08) * side;
+				corners[c].y = cy + side / M_SQRT2 * sin(a)
+					+ g_random_double_range(-0.08, 0.08) * side;
+			}
+
+			render(dark, corners, cells,
+			       blur->motion * border * cos(heading),
+			       blur->motion * border * sin(heading));
+			if (blur->sigma > 0)
+				gaussian(dark, blur->sigma * border);
+
+			for (uint32_t y=0; y<HEIGHT; y++)
+				for (uint32_t x=0; x<WIDTH; x++){
+					double v = 210 - 170 * dark[y * WIDTH + x]
+						+ g_random_double_range(-4, 4);
+					((uint8_t*)frame->imageData)[y * frame->widthStep + x] =
+						CLAMP(v + 0.5, 0, 255);
+				}
+
+			quads = koki_edge_quads_find(koki, frame, NULL);
+			for (guint q=0; q<quads->len; q++)
+				err = MIN(err, corner_error(g_ptr_array_index(quads, q),
+							    corners));
+			koki_edge_quads_free(quads);
+
+			if (err <= TOL_CORNER){
+				found++;
+				worst = MAX(worst, err);
+			} else {
+				printf("%s: marker %u not found within %.1f pixels "
+				       "(the nearest quad is %.2f away)\n",
+				       blur->name, m, TOL_CORNER,
+				       err == G_MAXDOUBLE ? INFINITY : err);
+				failures++;
+			}
+
+		}//for
+
+		printf("%-28s %2u/%u markers, worst corner %.2f pixels\n",
+		       blur->name, found, MARKERS_PER_BLUR, worst);
+
+	}//for
+
+	free(dark);
+	cvReleaseImage(&frame);
+	koki_destroy(koki);
+
+	return failures > 0;
+}
@@ -0,0 +1,314 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/**
+ * @file  energy.c
+ * @brief Implementation of reading the energy counters exposed by Linux's
+ *        powercap framework
+ *
+ * Intel's (and AMD's) RAPL counters appear as powercap zones named
+ * \c intel-rapl:N, with sub-zones \c intel-rapl:N:M, each with a running
+ * count of microjoules in \c energy_uj.  The counters are only updated
+ * every millisecond or so, so they're good for measuring many frames
+ * rather than a single stage of a single frame.  Since Linux 5.10,
+ * \c energy_uj is only readable by root, in which case the counters
+ * aren't available.
+ *
+ * This is only built into the benchmarks (speed_test and stage_bench),
+ * not the library.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <glib.h>
+
+#include "energy.h"
+
+
+/* where the powercap zones live */
+#ifndef ENERGY_POWERCAP
+#define ENERGY_POWERCAP "/sys/class/powercap"
+#endif
+
+/* the prefix of the RAPL zones' names */
+#define ENERGY_RAPL_PREFIX "intel-rapl:"
+
+
+
+/**
+ * @brief reads a counter from its open file
+ *
+ * @param fd     the file descriptor
+ * @param value  where to store the value
+ * @return       FALSE if it couldn't be read
+ */
+static bool read_counter(int fd, uint64_t *value)
+{
+
+	char buf[32];
+	ssize_t n;
+
+	n = pread(fd, buf, sizeof(buf) - 1, 0);
+
+	if (n <= 0)
+		return FALSE;
+
+	buf[n] = '\0';
+	*value = strtoull(buf, NULL, 10);
+
+	return TRUE;
+
+}
+
+
+
+/**
+ * @brief reads a small text file from a zone's directory
+ *
+ * @param zone  the zone's directory name
+ * @param file  the file's name
+ * @return      the contents, without trailing whitespace, or NULL if it
+ *              couldn't be read (free with \c g_free())
+ */
+static gchar* read_zone_file(const gchar *zone, const gchar *file)
+{
+
+	gchar *path, *contents = NULL;
+
+	path = g_build_filename(ENERGY_POWERCAP, zone, file, NULL);
+
+	if (!g_file_get_contents(path, &contents, NULL, NULL))
+		contents = NULL;
+	else
+		g_strchomp(contents);
+
+	g_free(path);
+
+	return contents;
+
+}
+
+
+
+/**
+ * @brief opens a single zone's counter
+ *
+ * @param zone    the zone's directory name
+ * @param domain  the domain to fill in
+ * @return        FALSE if the zone's counter can't be read
+ */
+static bool open_domain(const gchar *zone, energy_domain_t *domain)
+{
+
+	gchar *path, *name, *range;
+
+	path = g_build_filename(ENERGY_POWERCAP, zone, "energy_uj", NULL);
+	domain->fd = open(path, O_RDONLY | O_CLOEXEC);
+	g_free(path);
+
+	if (domain->fd < 0)
+		return FALSE;
+
+	if (!read_counter(domain->fd, &domain->last)){
+		close(domain->fd);
+		return FALSE;
+	}
+
+	name = read_zone_file(zone, "name");
+	g_strlcpy(domain->name, name != NULL ? name : zone,
+		  sizeof(domain->name));
+	g_free(name);
+
+	range = read_zone_file(zone, "max_energy_range_uj");
+	domain->max_range = range != NULL ? strtoull(range, NULL, 10) : 0;
+	g_free(range);
+
+	/* sub-zones have a second number */
+	domain->top = strchr(zone + strlen(ENERGY_RAPL_PREFIX), ':') == NULL;
+	domain->total = 0;
+
+	return TRUE;
+
+}
+
+
+
+/**
+ * @brief compares two zone names, for a stable domain order
+ */
+static gint compare_zones(gconstpointer a, gconstpointer b)
+{
+
+	return strcmp(*(const gchar* const*)a, *(const gchar* const*)b);
+
+}
+
+
+
+/**
+ * @brief opens the energy counters of every RAPL domain
+ *
+ * @return  the counters, or NULL if there are none that can be read (e.g.
+ *          the CPU or kernel doesn't provide them, the process isn't
+ *          privileged enough, or it's running in a virtual machine)
+ */
+energy_t* energy_new(void)
+{
+
+	energy_t *energy;
+	GPtrArray *zones;
+	const gchar *entry;
+	GDir *dir;
+
+	dir = g_dir_open(ENERGY_POWERCAP, 0, NULL);
+
+	if (dir == NULL)
+		return NULL;
+
+	zones = g_ptr_array_new_with_free_func(g_free);
+
+	while ((entry = g_dir_read_name(dir)) != NULL)
+		if (g_str_has_prefix(entry, ENERGY_RAPL_PREFIX))
+			g_ptr_array_add(zones, g_strdup(entry));
+
+	g_dir_close(dir);
+	g_ptr_array_sort(zones, compare_zones);
+
+	energy = g_malloc0(sizeof(energy_t));
+	energy->platform = -1;
+
+	for (guint i=0; i<zones->len
+		     && energy->num_domains < ENERGY_MAX_DOMAINS; i++){
+
+		energy_domain_t *d = &energy->domains[energy->num_domains];
+
+		if (!open_domain(g_ptr_array_index(zones, i), d))
+			continue;
+
+		if (d->top && strcmp(d->name, "psys") == 0)
+			energy->platform = energy->num_domains;
+
+		energy->num_domains++;
+
+	}//for
+
+	g_ptr_array_free(zones, TRUE);
+
+	if (energy->num_domains == 0){
+		g_free(energy);
+		return NULL;
+	}
+
+	return energy;
+
+}
+
+
+
+/**
+ * @brief closes the energy counters
+ *
+ * @param energy  the counters, or NULL
+ */
+void energy_free(energy_t *energy)
+{
+
+	if (energy == NULL)
+		return;
+
+	for (uint16_t i=0; i<energy->num_domains; i++)
+		close(energy->domains[i].fd);
+
+	g_free(energy);
+
+}
+
+
+
+/**
+ * @brief reads the counters, and starts every domain's total from 0
+ *
+ * @param energy  the counters
+ */
+void energy_reset(energy_t *energy)
+{
+
+	assert(energy != NULL);
+
+	energy_read(energy);
+
+	for (uint16_t i=0; i<energy->num_domains; i++)
+		energy->domains[i].total = 0;
+
+}
+
+
+
+/**
+ * @brief reads the counters, adding the energy used since they were last
+ *        read to each domain's total
+ *
+ * The counters wrap every few minutes under load, so they need reading
+ * at least that often.  The energy returned is that of the "psys" domain
+ * where there is one, as it covers the whole platform, and otherwise the
+ * sum of the top-level domains (the packages, and DRAM on some systems).
+ * Sub-domains are only included in the per-domain totals, as their
+ * energy is already counted by their package.
+ *
+ * @param energy  the counters
+ * @return        the energy used since the counters were opened or last
+ *                reset, in microjoules
+ */
+uint64_t energy_read(energy_t *energy)
+{
+
+	uint64_t sum = 0;
+
+	assert(energy != NULL);
+
+	for (uint16_t i=0; i<energy->num_domains; i++){
+
+		energy_domain_t *d = &energy->domains[i];
+		uint64_t now;
+
+		if (!read_counter(d->fd, &now))
+			continue;
+
+		if (now >= d->last)
+			d->total += now - d->last;
+		else if (d->max_range > d->last)
+			d->total += d->max_range - d->last + now;
+
+		d->last = now;
+
+		if (d->top && energy->platform < 0)
+			sum += d->total;
+
+	}//for
+
+	if (energy->platform >= 0)
+		return energy->domains[energy->platform].total;
+
+	return sum;
+
+}
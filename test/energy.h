@@ -0,0 +1,71 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+#ifndef _ENERGY_H_
+#define _ENERGY_H_
+
+/**
+ * @file  energy.h
+ * @brief Header file for reading the energy counters exposed by Linux's
+ *        powercap framework
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+/* the most powercap zones that are read */
+#define ENERGY_MAX_DOMAINS 16
+
+
+/**
+ * @brief a single RAPL domain (a powercap zone)
+ */
+typedef struct {
+	char name[32];      /**< the domain's name, e.g. "package-0",
+			         "core", "dram" or "psys" */
+	bool top;           /**< whether it's a top-level zone, rather than
+			         part of another */
+	int fd;             /**< the zone's \c energy_uj file */
+	uint64_t max_range; /**< the value the counter wraps at, in uJ */
+	uint64_t last;      /**< the counter when it was last read, in uJ */
+	uint64_t total;     /**< the energy used since the counters were
+			         opened or reset, in uJ */
+} energy_domain_t;
+
+
+/**
+ * @brief the energy counters of every RAPL domain that could be opened
+ */
+typedef struct {
+	energy_domain_t domains[ENERGY_MAX_DOMAINS];
+	                      /**< the domains */
+	uint16_t num_domains; /**< the number of domains */
+	int platform;         /**< the index of the domain covering the
+			           whole platform ("psys"), or -1 if there
+			           isn't one */
+} energy_t;
+
+
+energy_t* energy_new(void);
+
+void energy_free(energy_t *energy);
+
+void energy_reset(energy_t *energy);
+
+uint64_t energy_read(energy_t *energy);
+
+#endif /* _ENERGY_H_ */
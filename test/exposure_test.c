@@ -0,0 +1,342 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/*
+ * Tests the exposure controller, with the camera controls it uses stubbed
+ * out here (these definitions take the place of libkoki's own), so that
+ * no camera is needed.  Synthetic markers are drawn with chosen border and
+ * surround grey levels to check that:
+ *
+ *  - koki_exposure_stats() measures the contrast between a marker's
+ *    border and its surround, taking the least of several markers, as
+ *    well as the frame's mean and how much of it is clipped;
+ *  - koki_exposure_ctrl_update() only acts every few frames, shortens the
+ *    exposure while the contrast is more than half as much again as the
+ *    target, leaves it alone between the two, and makes up for too little
+ *    contrast with gain before lengthening the exposure;
+ *  - heavy clipping always darkens the frame, however little contrast
+ *    the markers have, cutting the gain once the exposure is at its
+ *    shortest;
+ *  - without markers, the frame's mean is kept within range;
+ *  - freeing the controller restores the camera's auto exposure mode.
+ *
+ * The exit status is non-zero if any check failed.
+ *
+ * Usage: exposure_test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <cv.h>
+#include <glib.h>
+
+#include "koki.h"
+#include "exposure.h"
+
+#include "synthetic.h"
+
+#define FD 3
+
+#define WIDTH   320
+#define HEIGHT  240
+#define SIDE    80.0
+
+#define TARGET  40   /* the border contrast markers need */
+#define MAX_STEPS 50 /* to take a control from one end to the other */
+#define TOL_CONTRAST 2.0
+
+/* a stubbed camera control */
+typedef struct {
+	unsigned int id;
+	int32_t value, min, max, step;
+} control_t;
+
+static control_t controls[] = {
+	{ V4L2_CID_EXPOSURE_AUTO, V4L2_EXPOSURE_APERTURE_PRIORITY, 0, 3, 1 },
+	{ V4L2_CID_EXPOSURE_ABSOLUTE, 500, 10, 2000, 1 },
+	{ V4L2_CID_GAIN, 50, 0, 100, 1 },
+};
+
+#define NUM_CONTROLS (sizeof(controls) / sizeof(controls[0]))
+
+#define AUTO     (&controls[0])
+#define EXPOSURE (&controls[1])
+#define GAIN     (&controls[2])
+
+static uint32_t failures = 0;
+
+#define CHECK(cond, ...) do {					\
+		if (!(cond)){					\
+			printf("line %d: ", __LINE__);		\
+			printf(__VA_ARGS__);			\
+			printf("\n");				\
+			failures++;				\
+		}						\
+	} while (0)
+
+
+
+static control_t* find_control(unsigned int id)
+{
+	for (uint8_t i=0; i<NUM_CONTROLS; i++)
+		if (controls[i].id == id)
+			return &controls[i];
+
+	return NULL;
+}
+
+int koki_v4l_query_control(int fd, unsigned int id,
+			   struct v4l2_queryctrl *query)
+{
+	control_t *c = find_control(id);
+
+	if (c == NULL)
+		return -1;
+
+	memset(query, 0, sizeof(*query));
+	query->id = id;
+	query->minimum = c->min;
+	query->maximum = c->max;
+	query->step = c->step;
+
+	return 0;
+}
+
+int koki_v4l_get_control(int fd, unsigned int id)
+{
+	control_t *c = find_control(id);
+
+	return c == NULL ? -1 : c->value;
+}
+
+int koki_v4l_set_control(int fd, unsigned int id, unsigned int value)
+{
+	control_t *c = find_control(id);
+
+	if (c == NULL || (int32_t)value < c->min || (int32_t)value > c->max)
+		return -1;
+
+	c->value = value;
+
+	return 0;
+}
+
+
+
+/* a frame of markers side by side, each with its own border grey level,
+   over a surround of another */
+static IplImage* marker_frame(uint8_t surround, const uint8_t *blacks,
+			      uint8_t n, GPtrArray **markers)
+{
+	IplImage *frame = cvCreateImage(cvSize(WIDTH, HEIGHT), IPL_DEPTH_8U, 1);
+
+	memset(frame->imageData, surround, frame->imageSize);
+	*markers = g_ptr_array_new();
+
+	for (uint8_t m=0; m<n; m++){
+
+		uint8_t cells[KOKI_CODE_GRID_WIDTH][KOKI_CODE_GRID_WIDTH];
+		koki_marker_t *marker = g_malloc0(sizeof(koki_marker_t));
+		koki_point2Df_t corners[4];
+
+		synthetic_corners((m + 0.5) * WIDTH / n, HEIGHT / 2, SIDE,
+				  0.2 * m, corners);
+		synthetic_code_cells(synthetic_random_code(), cells);
+		synthetic_draw_marker(frame, corners, cells, blacks[m], surround);
+
+		for (uint8_t c=0; c<4; c++)
+			marker->vertices[c].image = corners[c];
+
+		g_ptr_array_add(*markers, marker);
+
+	}//for
+
+	return frame;
+}
+
+static void free_markers(GPtrArray *markers)
+{
+	for (guint i=0; i<markers->len; i++)
+		g_free(g_ptr_array_index(markers, i));
+	g_ptr_array_free(markers, TRUE);
+}
+
+/* feeds the controller enough frames of a marker (or none, for a border
+   of 0) to make one adjustment, returning whether it made it */
+static bool adjust(koki_exposure_ctrl_t *ctrl, uint8_t surround,
+		   uint8_t black)
+{
+	GPtrArray *markers;
+	IplImage *frame = marker_frame(surround, &black, black > 0 ? 1 : 0,
+				       &markers);
+	bool changed = FALSE;
+
+	for (uint16_t f=1; f<=ctrl->interval; f++){
+
+		changed = koki_exposure_ctrl_update(ctrl, frame, markers);
+
+		CHECK(f == ctrl->interval || !changed,
+		      "adjusted after %u frames", f);
+
+	}//for
+
+	free_markers(markers);
+	cvReleaseImage(&frame);
+
+	return changed;
+}
+
+
+
+static void test_stats(void)
+{
+	static const uint8_t one[] = { 40 }, two[] = { 40, 120 };
+	koki_exposure_stats_t stats;
+	GPtrArray *markers;
+	IplImage *frame;
+
+	/* no markers */
+	frame = marker_frame(100, NULL, 0, &markers);
+	koki_exposure_stats(frame, NULL, &stats);
+	CHECK(stats.contrast < 0, "contrast %f without markers", stats.contrast);
+	CHECK(stats.mean == 100, "mean %f, not 100", stats.mean);
+	CHECK(stats.clipped == 0, "%f clipped, not 0", stats.clipped);
+	free_markers(markers);
+	cvReleaseImage(&frame);
+
+	frame = marker_frame(255, NULL, 0, &markers);
+	koki_exposure_stats(frame, markers, &stats);
+	CHECK(stats.clipped == 1, "%f clipped, not 1", stats.clipped);
+	free_markers(markers);
+	cvReleaseImage(&frame);
+
+	/* the border against the surround */
+	frame = marker_frame(180, one, 1, &markers);
+	koki_exposure_stats(frame, markers, &stats);
+	CHECK(fabs(stats.contrast - (180 - 40)) <= TOL_CONTRAST,
+	      "contrast %f, not %u", stats.contrast, 180 - 40);
+	CHECK(stats.mean > 40 && stats.mean < 180, "mean %f", stats.mean);
+	free_markers(markers);
+	cvReleaseImage(&frame);
+
+	/* the least of two */
+	frame = marker_frame(180, two, 2, &markers);
+	koki_exposure_stats(frame, markers, &stats);
+	CHECK(fabs(stats.contrast - (180 - 120)) <= TOL_CONTRAST,
+	      "contrast %f, not the lesser %u", stats.contrast, 180 - 120);
+	free_markers(markers);
+	cvReleaseImage(&frame);
+}
+
+static void test_ctrl(void)
+{
+	koki_exposure_ctrl_t *ctrl = koki_exposure_ctrl_new(FD, TARGET);
+	int32_t exposure, gain;
+
+	assert(ctrl != NULL);
+
+	CHECK(AUTO->value == V4L2_EXPOSURE_MANUAL,
+	      "auto exposure mode %d, not manual", AUTO->value);
+	CHECK(ctrl->exposure.value == EXPOSURE->value && ctrl->gain.supported
+	      && ctrl->gain.value == GAIN->value, "the controls weren't read");
+
+	/* well over 1.5 x the target: shorter */
+	exposure = EXPOSURE->value;
+	gain = GAIN->value;
+	CHECK(adjust(ctrl, 200, 200 - 2 * TARGET), "didn't shorten");
+	CHECK(EXPOSURE->value < exposure && GAIN->value == gain,
+	      "exposure %d -> %d, gain %d -> %d", exposure, EXPOSURE->value,
+	      gain, GAIN->value);
+
+	/* between the target and 1.5 x: left alone */
+	exposure = EXPOSURE->value;
+	CHECK(!adjust(ctrl, 200, 200 - TARGET * 5 / 4),
+	      "adjusted between the target and 1.5 x it");
+	CHECK(EXPOSURE->value == exposure && GAIN->value == gain,
+	      "exposure %d -> %d, gain %d -> %d", exposure, EXPOSURE->value,
+	      gain, GAIN->value);
+
+	/* under the target: gain first */
+	CHECK(adjust(ctrl, 120, 120 - TARGET / 2), "didn't brighten");
+	CHECK(GAIN->value > gain && EXPOSURE->value == exposure,
+	      "exposure %d -> %d, gain %d -> %d", exposure, EXPOSURE->value,
+	      gain, GAIN->value);
+
+	/* and then a longer exposure, once the gain's exhausted */
+	for (uint16_t i=0; i<MAX_STEPS && GAIN->value < GAIN->max; i++)
+		adjust(ctrl, 120, 120 - TARGET / 2);
+	CHECK(GAIN->value == GAIN->max && EXPOSURE->value == exposure,
+	      "gain stuck at %d, exposure %d -> %d", GAIN->value, exposure,
+	      EXPOSURE->value);
+	gain = GAIN->value;
+	CHECK(adjust(ctrl, 120, 120 - TARGET / 2), "didn't lengthen");
+	CHECK(EXPOSURE->value > exposure && GAIN->value == gain,
+	      "exposure %d -> %d, gain %d -> %d", exposure, EXPOSURE->value,
+	      gain, GAIN->value);
+
+	/* clipping darkens, even with too little contrast */
+	exposure = EXPOSURE->value;
+	CHECK(adjust(ctrl, 255, 255 - TARGET / 2), "didn't darken when clipped");
+	CHECK(EXPOSURE->value < exposure && GAIN->value == gain,
+	      "exposure %d -> %d, gain %d -> %d", exposure, EXPOSURE->value,
+	      gain, GAIN->value);
+
+	/* cutting the gain once the exposure's at its shortest */
+	for (uint16_t i=0; i<MAX_STEPS && EXPOSURE->value > EXPOSURE->min; i++)
+		adjust(ctrl, 255, 255 - TARGET / 2);
+	CHECK(EXPOSURE->value == EXPOSURE->min && GAIN->value == gain,
+	      "exposure stuck at %d, gain %d -> %d", EXPOSURE->value, gain,
+	      GAIN->value);
+	CHECK(adjust(ctrl, 255, 255 - TARGET / 2),
+	      "didn't darken at the shortest exposure");
+	CHECK(GAIN->value < gain, "gain %d -> %d", gain, GAIN->value);
+
+	/* no markers: the mean */
+	exposure = EXPOSURE->value;
+	gain = GAIN->value;
+	CHECK(adjust(ctrl, 30, 0), "didn't brighten a dark frame");
+	CHECK(GAIN->value > gain, "gain %d -> %d", gain, GAIN->value);
+	CHECK(!adjust(ctrl, 110, 0), "adjusted a well exposed frame");
+	gain = GAIN->value;
+	CHECK(adjust(ctrl, 200, 0), "didn't darken a bright frame");
+	CHECK(EXPOSURE->value < exposure || GAIN->value < gain,
+	      "exposure %d -> %d, gain %d -> %d", exposure, EXPOSURE->value,
+	      gain, GAIN->value);
+
+	koki_exposure_ctrl_free(ctrl);
+
+	CHECK(AUTO->value == V4L2_EXPOSURE_APERTURE_PRIORITY,
+	      "auto exposure mode %d wasn't restored", AUTO->value);
+}
+
+
+int main(void)
+{
+	g_random_set_seed(1);
+
+	test_stats();
+	test_ctrl();
+
+	printf("%u checks failed\n", failures);
+
+	return failures > 0;
+}
@@ -0,0 +1,468 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/*
+ * Measures how far the fixed-point geometry path (KOKI_FIXED_POINT)
+ * strays from the float one, over randomly posed synthetic markers, and
+ * checks the results against the bounds documented in fixed.h.  Exits
+ * with a non-zero status if any bound is exceeded.
+ *
+ * Usage: fixed_accuracy [TRIALS]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include <cv.h>
+#include <glib.h>
+
+#include "koki.h"
+#include "pca.h"
+
+#define DEFAULT_TRIALS 1000
+
+#define MARKER_WIDTH 0.1
+#define FOCAL_LENGTH 600.0
+#define IMG_WIDTH    640
+#define IMG_HEIGHT   480
+
+#define UNWARP_WIDTH 100
+
+
+/* --------------------------------------------------------- bookkeeping */
+
+typedef struct {
+	const char *name;
+	const char *unit;
+	double bound;
+	double max;
+} check_t;
+
+enum {
+	CHECK_ATAN2, CHECK_ASIN, CHECK_SINCOS, CHECK_SQRT,
+	CHECK_REFINE, CHECK_HOMOGRAPHY, CHECK_UNWARP,
+	CHECK_POSE, CHECK_DISTANCE, CHECK_ROTATION, CHECK_BEARING,
+	NUM_CHECKS
+};
+
+static check_t checks[NUM_CHECKS] = {
+	[CHECK_ATAN2]      = { "atan2",            "rad",   1.0 / 16384 },
+	[CHECK_ASIN]       = { "asin",             "rad",   1.0 / 16384 },
+	[CHECK_SINCOS]     = { "sin/cos",          "",      1.0 / 16384 },
+	[CHECK_SQRT]       = { "sqrt",             "",      1.0 / 65536 },
+	[CHECK_REFINE]     = { "refined vertices", "px",    1.0 / 64 },
+	[CHECK_HOMOGRAPHY] = { "homography map",   "px",    1.0 / 64 },
+	[CHECK_UNWARP]     = { "unwarped pixels",  "grey",  1 },
+	[CHECK_POSE]       = { "pose world",       "rel",   0.001 },
+	[CHECK_DISTANCE]   = { "distance",         "rel",   0.001 },
+	[CHECK_ROTATION]   = { "rotation",         "deg",   0.05 },
+	[CHECK_BEARING]    = { "bearing",          "deg",   0.05 },
+};
+
+static void record(int check, double err)
+{
+	err = fabs(err);
+	if (err > checks[check].max)
+		checks[check].max = err;
+}
+
+static double rand_range(double lo, double hi)
+{
+	return lo + (hi - lo) * g_random_double();
+}
+
+/* the difference between two angles in degrees, allowing for wrap */
+static double angle_diff(double a, double b)
+{
+	double d = fmod(fabs(a - b), 360);
+	return d > 180 ? 360 - d : d;
+}
+
+
+/* ------------------------------------------------------ synthetic scene */
+
+typedef struct {
+	koki_point2Df_t image[4];  /* relative to the image's top-left */
+	koki_point2Df_t centred[4];/* relative to the principal point, Y up */
+} scene_t;
+
+
+/* projects a randomly posed marker in front of the camera, returning
+   FALSE if it didn't land comfortably within the image */
+static bool make_scene(scene_t *s)
+{
+	const double h = MARKER_WIDTH / 2;
+	const double corners[4][2] = { {-h, h}, {h, h}, {h, -h}, {-h, -h} };
+	double rx = rand_range(-1, 1), ry = rand_range(-1, 1),
+		rz = rand_range(-M_PI, M_PI);
+	double tz = rand_range(0.3, 2.0);
+	double tx = rand_range(-0.3, 0.3) * tz, ty = rand_range(-0.2, 0.2) * tz;
+
+	for (uint8_t i=0; i<4; i++){
+
+		double x = corners[i][0], y = corners[i][1], z = 0, t;
+
+		/* rotate about Z, then X, then Y */
+		t = x * cos(rz) - y * sin(rz);
+		y = x * sin(rz) + y * cos(rz);
+		x = t;
+
+		t = y * cos(rx) - z * sin(rx);
+		z = y * sin(rx) + z * cos(rx);
+		y = t;
+
+		t = x * cos(ry) + z * sin(ry);
+		z = -x * sin(ry) + z * cos(ry);
+		x = t;
+
+		x += tx;
+		y += ty;
+		z += tz;
+
+		s->centred[i].x = FOCAL_LENGTH * x / z;
+		s->centred[i].y = FOCAL_LENGTH * y / z;
+
+		s->image[i].x = IMG_WIDTH / 2 + s->centred[i].x;
+		s->image[i].y = IMG_HEIGHT / 2 - s->centred[i].y;
+
+		if (s->image[i].x < 5 || s->image[i].x > IMG_WIDTH - 6 ||
+		    s->image[i].y < 5 || s->image[i].y > IMG_HEIGHT - 6)
+			return FALSE;
+
+	}//for
+
+	/* anything smaller won't have enough edge points for PCA */
+	for (uint8_t i=0; i<4; i++){
+		koki_point2Df_t a = s->image[i], b = s->image[(i + 1) % 4];
+		if (hypot(a.x - b.x, a.y - b.y) < 40)
+			return FALSE;
+	}
+
+	return TRUE;
+
+}
+
+
+/* rasterises the quad's outline into a contour-like chain, recording
+   the link at each vertex */
+static GSList* make_contour(const scene_t *s, koki_quad_t *quad)
+{
+
+	GSList *contour = NULL;
+
+	for (uint8_t i=0; i<4; i++){
+
+		koki_point2Df_t a = s->image[i], b = s->image[(i + 1) % 4];
+		uint16_t n = ceil(fmax(fabs(b.x - a.x), fabs(b.y - a.y)));
+
+		for (uint16_t j=0; j<n; j++){
+
+			koki_point2Di_t *p = g_new(koki_point2Di_t, 1);
+			double t = (double)j / n;
+
+			p->x = lrint(a.x + (b.x - a.x) * t);
+			p->y = lrint(a.y + (b.y - a.y) * t);
+
+			contour = g_slist_prepend(contour, p);
+
+			if (j == 0)
+				quad->links[i] = contour;
+
+		}//for
+
+	}//for
+
+	/* the links were recorded as nodes, which survive the reverse */
+	return g_slist_reverse(contour);
+
+}
+
+
+/* a smooth test pattern, so that interpolation differences stay small */
+static IplImage* make_frame(void)
+{
+
+	IplImage *frame = cvCreateImage(cvSize(IMG_WIDTH, IMG_HEIGHT),
+					IPL_DEPTH_8U, 1);
+
+	for (uint16_t y=0; y<IMG_HEIGHT; y++)
+		for (uint16_t x=0; x<IMG_WIDTH; x++)
+			KOKI_IPLIMAGE_GS_ELEM(frame, x, y) =
+				127.5 + 127 * sin(x / 7.0) * cos(y / 11.0);
+
+	return frame;
+
+}
+
+
+/* --------------------------------------------------------------- checks */
+
+static void check_trig(void)
+{
+
+	for (uint32_t i=0; i<10000; i++){
+
+		float y = rand_range(-1000, 1000) * pow(10, -g_random_int_range(0, 4));
+		float x = rand_range(-1000, 1000) * pow(10, -g_random_int_range(0, 4));
+		float a = rand_range(-10, 10), v = rand_range(-1, 1);
+		float r = rand_range(0, 10000);
+		koki_fixed_t fy = koki_fixed_from_float(y), fx = koki_fixed_from_float(x);
+		koki_fixed_t fa = koki_fixed_from_float(a), fv = koki_fixed_from_float(v);
+		koki_fixed_t fr = koki_fixed_from_float(r);
+		koki_fixed_t s, c;
+		double e;
+
+		/* compare against libm on the quantised inputs */
+		e = koki_fixed_to_float(koki_fixed_atan2(fy, fx))
+			- atan2(koki_fixed_to_float(fy), koki_fixed_to_float(fx));
+		record(CHECK_ATAN2, fabs(e) > M_PI ? 2 * M_PI - fabs(e) : e);
+
+		record(CHECK_ASIN, koki_fixed_to_float(koki_fixed_asin(fv))
+		       - asin(koki_fixed_to_float(fv)));
+
+		koki_fixed_sincos(fa, &s, &c);
+		record(CHECK_SINCOS, koki_fixed_to_float(s)
+		       - sin(koki_fixed_to_float(fa)));
+		record(CHECK_SINCOS, koki_fixed_to_float(c)
+		       - cos(koki_fixed_to_float(fa)));
+
+		record(CHECK_SQRT, koki_fixed_to_float(koki_fixed_sqrt(fr))
+		       - sqrt(koki_fixed_to_float(fr)));
+
+	}//for
+
+}
+
+
+static void check_refine(const scene_t *s)
+{
+
+	koki_quad_t q_float, q_fixed;
+	GSList *contour = make_contour(s, &q_float);
+
+	q_fixed = q_float;
+
+	koki_quad_refine_vertices(&q_float);
+	koki_quad_refine_vertices_fixed(&q_fixed);
+
+	for (uint8_t i=0; i<4; i++)
+		record(CHECK_REFINE, hypot(q_float.vertices[i].x - q_fixed.vertices[i].x,
+					   q_float.vertices[i].y - q_fixed.vertices[i].y));
+
+	for (GSList *l = contour; l != NULL; l = l->next)
+		g_free(l->data);
+	g_slist_free(contour);
+
+}
+
+
+static void check_homography(const scene_t *s, IplImage *frame)
+{
+
+	koki_homography_t H;
+	koki_homography_fixed_t Hf;
+	koki_fixed_point2_t quad[4];
+	koki_point2Df_t truncated[4];
+	koki_marker_t marker;
+	IplImage *unwarped;
+
+	for (uint8_t i=0; i<4; i++){
+		quad[i].x = koki_fixed_from_float(s->image[i].x);
+		quad[i].y = koki_fixed_from_float(s->image[i].y);
+	}
+
+	if (!koki_homography_from_quad(s->image, &H) ||
+	    !koki_homography_fixed_from_quad(quad, &Hf))
+		return;
+
+	for (uint8_t j=0; j<=10; j++){
+		for (uint8_t i=0; i<=10; i++){
+
+			koki_point2Df_t p = koki_homography_map(&H, i / 10.0, j / 10.0);
+			koki_fixed_point2_t pf =
+				koki_homography_fixed_map(&Hf, KOKI_FIXED_ONE * i / 10,
+							  KOKI_FIXED_ONE * j / 10);
+
+			record(CHECK_HOMOGRAPHY, hypot(p.x - koki_fixed_to_float(pf.x),
+						       p.y - koki_fixed_to_float(pf.y)));
+
+		}//for
+	}//for
+
+	/* the unwarp truncates the vertices, so the float homography used
+	   to compare against must too */
+	for (uint8_t i=0; i<4; i++){
+		marker.vertices[i].image = s->image[i];
+		truncated[i].x = (int)s->image[i].x;
+		truncated[i].y = (int)s->image[i].y;
+	}
+
+	if (!koki_homography_from_quad(truncated, &H))
+		return;
+
+	unwarped = koki_unwarp_marker_fixed(&marker, frame, UNWARP_WIDTH);
+	if (unwarped == NULL)
+		return;
+
+	for (uint16_t y=0; y<UNWARP_WIDTH; y++)
+		for (uint16_t x=0; x<UNWARP_WIDTH; x++)
+			record(CHECK_UNWARP,
+			       (int)KOKI_IPLIMAGE_GS_ELEM(unwarped, x, y)
+			       - koki_homography_sample(&H, frame,
+							(float)x / UNWARP_WIDTH,
+							(float)y / UNWARP_WIDTH));
+
+	cvReleaseImage(&unwarped);
+
+}
+
+
+static void check_pose(const scene_t *s)
+{
+
+	koki_camera_params_t params;
+	koki_point2Df_t img[4];
+	koki_point3Df_t world[4], points[4], centre = {0, 0, 0};
+	koki_fixed_point2_t img_f[4];
+	koki_fixed_point3_t world_f[4], points_f[4], centre_f, rot_f, bearing_f;
+	koki_marker_rotation_t rot;
+	koki_bearing_t bearing;
+	double dist, dist_f;
+
+	params.focal_length.x = params.focal_length.y = FOCAL_LENGTH;
+
+	for (uint8_t i=0; i<4; i++){
+		img[i] = s->centred[i];
+		img_f[i].x = koki_fixed_from_float(img[i].x);
+		img_f[i].y = koki_fixed_from_float(img[i].y);
+	}
+
+	koki_pose_estimate_arrays(img, world, MARKER_WIDTH, &params);
+	koki_pose_estimate_arrays_fixed(img_f, world_f,
+					koki_fixed_from_float(MARKER_WIDTH),
+					koki_fixed_from_float(FOCAL_LENGTH));
+
+	for (uint8_t i=0; i<4; i++){
+
+		double len = sqrt(world[i].x * world[i].x + world[i].y * world[i].y
+				  + world[i].z * world[i].z);
+
+		record(CHECK_POSE, fabs(world[i].x - koki_fixed_to_float(world_f[i].x)) / len);
+		record(CHECK_POSE, fabs(world[i].y - koki_fixed_to_float(world_f[i].y)) / len);
+		record(CHECK_POSE, fabs(world[i].z - koki_fixed_to_float(world_f[i].z)) / len);
+
+		centre.x += world[i].x / 4;
+		centre.y += world[i].y / 4;
+		centre.z += world[i].z / 4;
+
+	}//for
+
+	centre_f.x = (world_f[0].x + world_f[1].x + world_f[2].x + world_f[3].x) / 4;
+	centre_f.y = (world_f[0].y + world_f[1].y + world_f[2].y + world_f[3].y) / 4;
+	centre_f.z = (world_f[0].z + world_f[1].z + world_f[2].z + world_f[3].z) / 4;
+
+	dist = sqrt(centre.x * centre.x + centre.y * centre.y + centre.z * centre.z);
+	dist_f = koki_fixed_to_float(
+		koki_fixed_hypot64(koki_fixed_hypot64(centre_f.x, centre_f.y),
+				   centre_f.z));
+	record(CHECK_DISTANCE, (dist - dist_f) / dist);
+
+	/* rotation and bearing, each from the same (float) world points, so
+	   that only their own error is measured */
+	for (uint8_t i=0; i<4; i++){
+
+		points[i].x = world[i].x - centre.x;
+		points[i].y = world[i].y - centre.y;
+		points[i].z = world[i].z - centre.z;
+
+		points_f[i].x = koki_fixed_from_float(points[i].x);
+		points_f[i].y = koki_fixed_from_float(points[i].y);
+		points_f[i].z = koki_fixed_from_float(points[i].z);
+
+	}//for
+
+	rot = koki_rotation_estimate_array(points);
+	rot_f = koki_rotation_estimate_array_fixed(points_f);
+
+	record(CHECK_ROTATION, angle_diff(rot.x, koki_fixed_to_float(rot_f.x)));
+	record(CHECK_ROTATION, angle_diff(rot.y, koki_fixed_to_float(rot_f.y)));
+	record(CHECK_ROTATION, angle_diff(rot.z, koki_fixed_to_float(rot_f.z)));
+
+	centre_f.x = koki_fixed_from_float(centre.x);
+	centre_f.y = koki_fixed_from_float(centre.y);
+	centre_f.z = koki_fixed_from_float(centre.z);
+
+	bearing = koki_bearing_estimate_point(centre);
+	bearing_f = koki_bearing_estimate_point_fixed(centre_f);
+
+	record(CHECK_BEARING, (bearing.x - koki_fixed_to_float(bearing_f.x))
+	       * 180 / M_PI);
+	record(CHECK_BEARING, (bearing.y - koki_fixed_to_float(bearing_f.y))
+	       * 180 / M_PI);
+
+}
+
+
+int main(int argc, char **argv)
+{
+
+	uint32_t trials = argc > 1 ? atoi(argv[1]) : DEFAULT_TRIALS;
+	IplImage *frame;
+	bool ok = TRUE;
+
+	g_random_set_seed(1);
+
+	frame = make_frame();
+
+	check_trig();
+
+	for (uint32_t t=0; t<trials; ){
+
+		scene_t s;
+
+		if (!make_scene(&s))
+			continue;
+
+		check_refine(&s);
+		check_homography(&s, frame);
+		check_pose(&s);
+
+		t++;
+
+	}//for
+
+	printf("%-18s %12s %12s\n", "", "max error", "bound");
+
+	for (uint8_t i=0; i<NUM_CHECKS; i++){
+
+		bool pass = checks[i].max <= checks[i].bound;
+
+		printf("%-18s %12.3g %12.3g %-4s %s\n", checks[i].name,
+		       checks[i].max, checks[i].bound, checks[i].unit,
+		       pass ? "ok" : "FAIL");
+
+		ok = ok && pass;
+
+	}//for
+
+	cvReleaseImage(&frame);
+
+	return ok ? 0 : 1;
+
+}
@@ -0,0 +1,214 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/*
+ * Tests the kokidetect GStreamer element, without needing a camera.
+ *
+ * Frames from videotestsrc, in both GRAY8 and YUY2, must all come out of
+ * the element carrying a GstKokiMeta.  Each image given on the command
+ * line is decoded with filesrc, frozen into a short stream and run
+ * through the element in both formats too, and must give the same,
+ * non-empty, set of markers in every frame.
+ *
+ * The element is found through GST_PLUGIN_PATH, which ./shell sets up.
+ *
+ * Usage: gst_test [IMAGE...]
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <gst/gst.h>
+
+#include "koki.h"
+#include "gstkokimeta.h"
+
+#define NUM_FRAMES 10
+
+static const char *formats[] = { "GRAY8", "YUY2" };
+
+
+typedef struct {
+	GType meta_api;
+	guint frames;         /* frames that reached the sink */
+	guint missing_meta;   /* of those, how many had no GstKokiMeta */
+	guint markers;        /* markers in the first frame */
+	guint64 codes;        /* a checksum of the first frame's codes */
+	guint inconsistent;   /* frames whose markers differed from the first */
+} results_t;
+
+
+static GstPadProbeReturn check_buffer(GstPad *pad, GstPadProbeInfo *info,
+				      gpointer data)
+{
+	results_t *res = data;
+	GstBuffer *buf = GST_PAD_PROBE_INFO_BUFFER(info);
+	GstKokiMeta *meta;
+	guint64 codes = 0;
+
+	/* the plugin registered the API, so it's looked up by name rather
+	   than linking another copy of gstkokimeta.c */
+	meta = (GstKokiMeta*)gst_buffer_get_meta(buf, res->meta_api);
+
+	if (meta == NULL){
+		res->missing_meta++;
+		res->frames++;
+		return GST_PAD_PROBE_OK;
+	}
+
+	for (guint i=0; i<meta->markers->len; i++)
+		codes = codes * 257 + g_array_index(meta->markers,
+						    koki_marker_t, i).code + 1;
+
+	if (res->frames == 0){
+		res->markers = meta->markers->len;
+		res->codes = codes;
+	} else if (meta->markers->len != res->markers || codes != res->codes){
+		res->inconsistent++;
+	}
+
+	res->frames++;
+
+	return GST_PAD_PROBE_OK;
+}
+
+/* runs a pipeline ending in a fakesink called "sink" to completion */
+static gboolean run_pipeline(const char *desc, results_t *res)
+{
+	GError *err = NULL;
+	GstElement *pipeline, *sink;
+	GstPad *pad;
+	GstBus *bus;
+	GstMessage *msg;
+	gboolean ok;
+
+	pipeline = gst_parse_launch(desc, &err);
+	if (pipeline == NULL){
+		fprintf(stderr, "couldn't create \"%s\": %s\n", desc, err->message);
+		g_error_free(err);
+		return FALSE;
+	}
+
+	sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+	pad = gst_element_get_static_pad(sink, "sink");
+	gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, check_buffer, res, NULL);
+	gst_object_unref(pad);
+	gst_object_unref(sink);
+
+	gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+	bus = gst_element_get_bus(pipeline);
+	msg = gst_bus_timed_pop_filtered(bus, 30 * GST_SECOND,
+					 GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+
+	ok = msg != NULL && GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS;
+
+	if (msg == NULL){
+		fprintf(stderr, "\"%s\" timed out\n", desc);
+	} else if (!ok){
+		gst_message_parse_error(msg, &err, NULL);
+		fprintf(stderr, "\"%s\" failed: %s\n", desc, err->message);
+		g_error_free(err);
+	}
+
+	if (msg != NULL)
+		gst_message_unref(msg);
+	gst_object_unref(bus);
+	gst_element_set_state(pipeline, GST_STATE_NULL);
+	gst_object_unref(pipeline);
+
+	return ok;
+}
+
+static gboolean check(const char *name, results_t *res, gboolean want_markers)
+{
+	gboolean ok = res->frames == NUM_FRAMES && res->missing_meta == 0
+		&& res->inconsistent == 0 && (!want_markers || res->markers > 0);
+
+	printf("%-40s %s: %u frames, %u without metadata, %u markers, "
+	       "%u inconsistent\n", name, ok ? "ok  " : "FAIL",
+	       res->frames, res->missing_meta, res->markers, res->inconsistent);
+
+	return ok;
+}
+
+
+int main(int argc, char *argv[])
+{
+	GstElementFactory *factory;
+	GType meta_api;
+	gboolean ok = TRUE;
+	char desc[1024], name[256];
+
+	gst_init(&argc, &argv);
+
+	factory = gst_element_factory_find("kokidetect");
+	if (factory == NULL){
+		fprintf(stderr, "kokidetect isn't available -- "
+			"build with gst=1 and run this from ./shell\n");
+		return 1;
+	}
+	gst_object_unref(factory);
+
+	meta_api = GST_KOKI_META_API_TYPE;
+
+	for (guint f=0; f<2; f++){
+
+		results_t res = { meta_api };
+
+		snprintf(desc, sizeof(desc),
+			 "videotestsrc num-buffers=%u pattern=checkers-8 "
+			 "! video/x-raw,format=%s,width=640,height=480 "
+			 "! kokidetect ! fakesink name=sink",
+			 NUM_FRAMES, formats[f]);
+		snprintf(name, sizeof(name), "videotestsrc (%s)", formats[f]);
+
+		ok &= run_pipeline(desc, &res) && check(name, &res, FALSE);
+
+	}
+
+	for (int i=1; i<argc; i++){
+
+		guint markers[2] = { 0, 0 };
+
+		for (guint f=0; f<2; f++){
+
+			results_t res = { meta_api };
+
+			snprintf(desc, sizeof(desc),
+				 "filesrc location=\"%s\" ! decodebin ! videoconvert "
+				 "! video/x-raw,format=%s "
+				 "! imagefreeze num-buffers=%u "
+				 "! kokidetect decode-cache=true "
+				 "! fakesink name=sink",
+				 argv[i], formats[f], NUM_FRAMES);
+			snprintf(name, sizeof(name), "%s (%s)", argv[i], formats[f]);
+
+			ok &= run_pipeline(desc, &res) && check(name, &res, TRUE);
+			markers[f] = res.markers;
+
+		}
+
+		if (markers[0] != markers[1]){
+			printf("%s: %u markers in GRAY8, but %u in YUY2\n",
+			       argv[i], markers[0], markers[1]);
+			ok = FALSE;
+		}
+
+	}
+
+	return ok ? 0 : 1;
+}
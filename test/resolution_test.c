@@ -0,0 +1,271 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/*
+ * Tests the resolution controller's decisions, with the camera calls it
+ * makes stubbed out here (these definitions take the place of libkoki's
+ * own), so that no camera is needed.  Markers of chosen sizes are fed to
+ * koki_resolution_ctrl_update() to check that:
+ *
+ *  - the resolution drops after hold_frames frames of large markers, and
+ *    climbs straight away for a small one;
+ *  - a switch up that the camera refuses restores the previous mode, and
+ *    isn't retried until a marker has been too small for another
+ *    hold_frames frames, any frame without one restarting the wait;
+ *  - the resolution climbs to the top after hold_frames empty frames.
+ *
+ * The exit status is non-zero if any check failed.
+ *
+ * Usage: resolution_test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+#include <glib.h>
+
+#include "koki.h"
+#include "resolution.h"
+
+#define FD 3
+
+#define MIN_SIDE 20
+#define MAX_SIDE 60
+
+static const koki_resolution_t modes[] = {
+	{ 320, 240 }, { 640, 480 }, { 1280, 960 }
+};
+
+/* the width the stubbed camera refuses, or 0 */
+static uint32_t refused_width = 0;
+
+/* the number of times the format was set */
+static uint32_t num_set_format = 0;
+
+static struct v4l2_format current_format;
+static bool streaming = FALSE;
+
+static uint32_t failures = 0;
+
+#define CHECK(cond, ...) do {					\
+		if (!(cond)){					\
+			printf("line %d: ", __LINE__);		\
+			printf(__VA_ARGS__);			\
+			printf("\n");				\
+			failures++;				\
+		}						\
+	} while (0)
+
+
+
+int koki_v4l_set_format(int fd, struct v4l2_format fmt)
+{
+	num_set_format++;
+
+	if (streaming || fmt.fmt.pix.width == refused_width)
+		return -1;
+
+	current_format = fmt;
+
+	return 0;
+}
+
+struct v4l2_format koki_v4l_get_format(int fd)
+{
+	return current_format;
+}
+
+koki_buffer_t* koki_v4l_prepare_buffers(int fd, int *count)
+{
+	return g_malloc0(*count * sizeof(koki_buffer_t));
+}
+
+void koki_v4l_free_buffers(koki_buffer_t *buffers, int count)
+{
+	g_free(buffers);
+}
+
+int koki_v4l_start_stream(int fd)
+{
+	streaming = TRUE;
+
+	return 0;
+}
+
+int koki_v4l_stop_stream(int fd)
+{
+	streaming = FALSE;
+
+	return 0;
+}
+
+
+
+/* a marker whose sides are all the given length */
+static GPtrArray* markers_of_side(float side)
+{
+	GPtrArray *markers = g_ptr_array_new();
+	koki_marker_t *m = g_malloc0(sizeof(koki_marker_t));
+
+	m->vertices[0].image.x = 10;
+	m->vertices[0].image.y = 10;
+	m->vertices[1].image.x = 10 + side;
+	m->vertices[1].image.y = 10;
+	m->vertices[2].image.x = 10 + side;
+	m->vertices[2].image.y = 10 + side;
+	m->vertices[3].image.x = 10;
+	m->vertices[3].image.y = 10 + side;
+
+	g_ptr_array_add(markers, m);
+
+	return markers;
+}
+
+static void free_markers(GPtrArray *markers)
+{
+	for (guint i=0; i<markers->len; i++)
+		g_free(g_ptr_array_index(markers, i));
+	g_ptr_array_free(markers, TRUE);
+}
+
+/* feeds one frame's markers (or none, for a side of 0) */
+static koki_resolution_change_t update(koki_resolution_ctrl_t *ctrl,
+				       float side)
+{
+	GPtrArray *markers = side > 0 ? markers_of_side(side) : NULL;
+	koki_resolution_change_t ret;
+
+	ret = koki_resolution_ctrl_update(ctrl, markers);
+
+	if (markers != NULL)
+		free_markers(markers);
+
+	return ret;
+}
+
+/* feeds a frame of large markers until the resolution drops, which must
+   take exactly hold_frames frames */
+static void drop(koki_resolution_ctrl_t *ctrl)
+{
+	uint16_t width = ctrl->size.width;
+
+	for (uint16_t f=1; f<ctrl->hold_frames; f++)
+		CHECK(update(ctrl, 4 * MAX_SIDE) == KOKI_RESOLUTION_UNCHANGED,
+		      "dropped after %u frames", f);
+
+	CHECK(update(ctrl, 4 * MAX_SIDE) == KOKI_RESOLUTION_CHANGED,
+	      "didn't drop after %u frames", ctrl->hold_frames);
+	CHECK(ctrl->size.width < width, "still %u wide", ctrl->size.width);
+}
+
+
+int main(void)
+{
+	koki_camera_params_t calibration;
+	koki_resolution_ctrl_t *ctrl;
+	uint16_t hold;
+	uint32_t sets;
+
+	calibration.size.x = 1280;
+	calibration.size.y = 960;
+	calibration.principal_point.x = 640;
+	calibration.principal_point.y = 480;
+	calibration.focal_length.x = calibration.focal_length.y = 1142;
+
+	ctrl = koki_resolution_ctrl_new(FD, modes, 3, &calibration,
+					MIN_SIDE, MAX_SIDE);
+	assert(ctrl != NULL);
+	hold = ctrl->hold_frames;
+
+	CHECK(ctrl->size.width == 1280, "started %u wide", ctrl->size.width);
+	CHECK(ctrl->params.focal_length.x == 1142, "focal length %f",
+	      ctrl->params.focal_length.x);
+
+	/* down, and straight back up */
+	drop(ctrl);
+	CHECK(ctrl->size.width == 640, "dropped to %u", ctrl->size.width);
+	CHECK(ctrl->params.focal_length.x == 571, "focal length %f",
+	      ctrl->params.focal_length.x);
+
+	CHECK(update(ctrl, MIN_SIDE / 2) == KOKI_RESOLUTION_CHANGED,
+	      "didn't climb for a small marker");
+	CHECK(ctrl->size.width == 1280, "climbed to %u", ctrl->size.width);
+
+	/* a refused switch up */
+	drop(ctrl);
+	refused_width = 1280;
+
+	CHECK(update(ctrl, MIN_SIDE / 2) == KOKI_RESOLUTION_ERROR,
+	      "the refused switch wasn't reported");
+	CHECK(ctrl->size.width == 640 && ctrl->buffers != NULL && streaming,
+	      "the previous mode wasn't restored");
+
+	/* no retry until the marker's been small for hold_frames frames,
+	   with a frame of a larger marker restarting the wait */
+	sets = num_set_format;
+
+	for (uint16_t f=1; f<hold - 1; f++)
+		CHECK(update(ctrl, MIN_SIDE / 2) == KOKI_RESOLUTION_UNCHANGED,
+		      "retried after %u frames", f);
+	CHECK(update(ctrl, MIN_SIDE * 2) == KOKI_RESOLUTION_UNCHANGED,
+	      "switched for a mid-sized marker");
+
+	for (uint16_t f=1; f<hold; f++)
+		CHECK(update(ctrl, MIN_SIDE / 2) == KOKI_RESOLUTION_UNCHANGED,
+		      "retried %u frames after the wait restarted", f);
+	CHECK(num_set_format == sets, "the format was set %u times meanwhile",
+	      num_set_format - sets);
+
+	CHECK(update(ctrl, MIN_SIDE / 2) == KOKI_RESOLUTION_ERROR,
+	      "didn't retry after %u frames", hold);
+
+	/* the camera relents */
+	refused_width = 0;
+
+	for (uint16_t f=1; f<hold; f++)
+		CHECK(update(ctrl, MIN_SIDE / 2) == KOKI_RESOLUTION_UNCHANGED,
+		      "retried after %u frames", f);
+	CHECK(update(ctrl, MIN_SIDE / 2) == KOKI_RESOLUTION_CHANGED,
+	      "didn't switch once the camera allowed it");
+	CHECK(ctrl->size.width == 1280, "climbed to %u", ctrl->size.width);
+
+	/* having succeeded, a switch up is immediate again */
+	drop(ctrl);
+	CHECK(update(ctrl, MIN_SIDE / 2) == KOKI_RESOLUTION_CHANGED,
+	      "didn't climb straight away after a successful switch");
+
+	/* to the top after losing sight of the markers */
+	drop(ctrl);
+	drop(ctrl);
+	CHECK(ctrl->size.width == 320, "dropped to %u", ctrl->size.width);
+
+	for (uint16_t f=1; f<hold; f++)
+		CHECK(update(ctrl, 0) == KOKI_RESOLUTION_UNCHANGED,
+		      "climbed after %u empty frames", f);
+	CHECK(update(ctrl, 0) == KOKI_RESOLUTION_CHANGED,
+	      "didn't climb after %u empty frames", hold);
+	CHECK(ctrl->size.width == 1280, "climbed to %u", ctrl->size.width);
+
+	koki_resolution_ctrl_free(ctrl);
+
+	printf("%u checks failed\n", failures);
+
+	return failures > 0;
+}
@@ -0,0 +1,251 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/*
+ * Checks that thread scheduling configurations are applied, or fall back
+ * sensibly when they aren't permitted.  Detection workers are started
+ * with SCHED_FIFO, a nice value for the fallback and one CPU each, and a
+ * frame is passed through each worker to see how it's really scheduled.
+ * A capture thread then applies its role's configuration itself.
+ *
+ * Run it both as a normal user, which should report the fallback, and
+ * with CAP_SYS_NICE (or under sudo), which shouldn't.
+ *
+ * Usage: sched_test
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <cv.h>
+#include <glib.h>
+
+#include "koki.h"
+
+#define NUM_WORKERS   2
+#define FIFO_PRIORITY 10
+#define FALLBACK_NICE 5
+
+
+/* how a thread was really scheduled */
+typedef struct {
+	int policy;
+	int priority;
+	int nice;
+	cpu_set_t cpus;
+} observed_t;
+
+static GMutex lock;
+static observed_t seen[NUM_WORKERS];
+static bool seen_ok[NUM_WORKERS];
+
+
+static void observe(observed_t *o)
+{
+	struct sched_param param;
+
+	o->policy = sched_getscheduler(0);
+	sched_getparam(0, &param);
+	o->priority = param.sched_priority;
+	o->nice = getpriority(PRIO_PROCESS, syscall(SYS_gettid));
+	sched_getaffinity(0, sizeof(o->cpus), &o->cpus);
+}
+
+/* called on the worker, which is found from its thread */
+static void done(koki_async_result_t *result)
+{
+	koki_async_t *async = result->userdata;
+	uint16_t w = 0;
+
+	while (async->workers[w].thread != g_thread_self())
+		w++;
+
+	g_mutex_lock(&lock);
+	observe(&seen[w]);
+	seen_ok[w] = TRUE;
+	g_mutex_unlock(&lock);
+
+	koki_markers_free(result->markers);
+}
+
+/* whether a thread's scheduling matches its configuration and status */
+static bool check(const char *name, const koki_thread_config_t *config,
+		  uint8_t status, const observed_t *o, uint16_t index)
+{
+	bool ok = TRUE;
+
+	printf("%s: status 0x%x, policy %s, priority %d, nice %d, %d CPU(s)\n",
+	       name, status, o->policy == SCHED_FIFO ? "FIFO" : "OTHER",
+	       o->priority, o->nice, CPU_COUNT(&o->cpus));
+
+	if (status & KOKI_THREAD_SCHED_FALLBACK){
+
+		/* the fallback must leave the thread time-shared */
+		ok &= o->policy == SCHED_OTHER;
+		if (!(status & KOKI_THREAD_NICE_FAILED))
+			ok &= o->nice == config->nice;
+
+	} else {
+
+		ok &= o->policy == SCHED_FIFO
+			&& o->priority == config->priority;
+
+	}
+
+	if (!(status & KOKI_THREAD_CPUS_FAILED) && config->cpus != 0){
+
+		uint8_t n = 0, pick;
+
+		/* spread threads get exactly their one CPU */
+		for (uint8_t c=0; c<64; c++)
+			n += (config->cpus >> c) & 1;
+		pick = index % n;
+
+		for (uint8_t c=0; c<64; c++)
+			if ((config->cpus >> c) & 1){
+				if (pick-- == 0)
+					ok &= CPU_ISSET(c, &o->cpus)
+						&& CPU_COUNT(&o->cpus) == 1;
+			} else {
+				ok &= !CPU_ISSET(c, &o->cpus);
+			}
+
+	}
+
+	if (!ok)
+		printf("%s: FAIL\n", name);
+
+	return ok;
+}
+
+typedef struct {
+	const koki_thread_config_t *config;
+	uint8_t status;
+	observed_t o;
+} capture_t;
+
+static gpointer capture_main(gpointer data)
+{
+	capture_t *c = data;
+
+	c->status = koki_thread_config_apply(c->config, 0);
+	observe(&c->o);
+
+	return NULL;
+}
+
+int main(int argc, const char *argv[])
+{
+	koki_t *koki = koki_new();
+	koki_camera_params_t params;
+	koki_thread_config_t config = { 0 };
+	koki_async_t *async;
+	IplImage *frame;
+	cpu_set_t avail;
+	capture_t capture;
+	bool ok = TRUE;
+	uint16_t n = 0;
+
+	/* up to one CPU per worker from those we may use */
+	sched_getaffinity(0, sizeof(avail), &avail);
+	for (uint8_t c=0; c<64 && n<NUM_WORKERS; c++)
+		if (CPU_ISSET(c, &avail)){
+			config.cpus |= (uint64_t)1 << c;
+			n++;
+		}
+
+	config.policy = KOKI_SCHED_FIFO;
+	config.priority = FIFO_PRIORITY;
+	config.nice = FALLBACK_NICE;
+	config.spread = TRUE;
+
+	koki_set_thread_config(koki, KOKI_THREAD_WORKER, &config);
+	koki_set_thread_config(koki, KOKI_THREAD_CAPTURE, &config);
+
+	params.principal_point.x = 32;
+	params.principal_point.y = 24;
+	params.focal_length.x = params.focal_length.y = 100;
+	params.size.x = 64;
+	params.size.y = 48;
+
+	frame = cvCreateImage(cvSize(64, 48), IPL_DEPTH_8U, 1);
+	cvSetZero(frame);
+
+	g_mutex_init(&lock);
+
+	async = koki_async_new(koki, NUM_WORKERS, 1);
+	assert(async != NULL);
+
+	/* one frame at a time, until every worker has had one */
+	for (int tries=0; tries<1000; tries++){
+
+		bool all = TRUE;
+
+		while (koki_async_in_flight(async) > 0)
+			g_usleep(1000);
+
+		g_mutex_lock(&lock);
+		for (uint16_t w=0; w<NUM_WORKERS; w++)
+			all &= seen_ok[w];
+		g_mutex_unlock(&lock);
+
+		if (all)
+			break;
+
+		koki_find_markers_async(async, frame, 0.1, &params, done, async);
+
+	}//for
+
+	for (uint16_t w=0; w<NUM_WORKERS; w++){
+
+		char name[32];
+
+		if (!seen_ok[w]){
+			printf("worker %u: never ran\n", w);
+			ok = FALSE;
+			continue;
+		}
+
+		snprintf(name, sizeof(name), "worker %u", w);
+		ok &= check(name, &config, async->workers[w].sched_status,
+			    &seen[w], w);
+
+	}
+
+	koki_async_free(async);
+
+	capture.config = &koki->threads[KOKI_THREAD_CAPTURE];
+	g_thread_join(g_thread_new("capture", capture_main, &capture));
+	ok &= check("capture", capture.config, capture.status, &capture.o, 0);
+
+	cvReleaseImage(&frame);
+	koki_destroy(koki);
+
+	printf("%s\n", ok ? "PASS" : "FAIL");
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,222 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/*
+ * Compares sparse labelling (see koki_set_sparse_labelling()) with full
+ * labelling over the given images, for a range of scanline strides.  For
+ * each stride, it reports how many of the useable regions and of the
+ * decoded markers the sparse labelling still finds, and how long the
+ * labelling takes compared with koki_label_adaptive().
+ *
+ * Usage: sparse_recall IMAGE...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <cv.h>
+#include <highgui.h>
+#include <glib.h>
+
+#include "koki.h"
+
+#define MARKER_WIDTH  0.11
+#define FOCAL_LENGTH  571.0
+#define REPS          9
+
+static const uint16_t strides[] = { 2, 4, 6, 8, 12, 16, 24, 32 };
+#define NUM_STRIDES (sizeof(strides) / sizeof(strides[0]))
+
+
+typedef struct {
+	uint32_t regions, regions_found;
+	uint32_t markers, markers_found;
+	double ns;
+} totals_t;
+
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+/* the median time to label the frame, with the given stride (0 for full) */
+static double time_labelling(koki_t *koki, IplImage *frame, uint16_t stride)
+{
+	uint64_t t[REPS];
+
+	for (int i=0; i<REPS; i++){
+
+		koki_labelled_image_t *lmg;
+		uint64_t t0 = now_ns();
+
+		if (stride == 0)
+			lmg = koki_label_adaptive(koki, frame, 11, 5);
+		else
+			lmg = koki_label_sparse(koki, frame, 11, 5, stride);
+
+		t[i] = now_ns() - t0;
+		koki_labelled_image_free(lmg);
+
+	}
+
+	qsort(t, REPS, sizeof(uint64_t), cmp_u64);
+
+	return t[REPS / 2];
+}
+
+static bool same_clip(const koki_clip_region_t *a, const koki_clip_region_t *b)
+{
+	return a->mass == b->mass
+		&& a->min.x == b->min.x && a->min.y == b->min.y
+		&& a->max.x == b->max.x && a->max.y == b->max.y;
+}
+
+/* counts the useable regions of full that sparse has too */
+static void compare_regions(koki_labelled_image_t *full,
+			    koki_labelled_image_t *sparse, totals_t *tot)
+{
+	for (label_t i=0; i<full->clips->len; i++){
+
+		koki_clip_region_t *c;
+
+		if (!koki_label_useable(full, i))
+			continue;
+
+		tot->regions++;
+		c = &g_array_index(full->clips, koki_clip_region_t, i);
+
+		for (label_t j=0; j<sparse->clips->len; j++)
+			if (same_clip(c, &g_array_index(sparse->clips,
+							koki_clip_region_t, j))){
+				tot->regions_found++;
+				break;
+			}
+
+	}//for
+}
+
+/* counts the markers of full that sparse has too */
+static void compare_markers(GPtrArray *full, GPtrArray *sparse, totals_t *tot)
+{
+	for (guint i=0; i<full->len; i++){
+
+		koki_marker_t *m = g_ptr_array_index(full, i);
+
+		tot->markers++;
+
+		for (guint j=0; j<sparse->len; j++)
+			if (((koki_marker_t*)g_ptr_array_index(sparse, j))->code
+			    == m->code){
+				tot->markers_found++;
+				break;
+			}
+
+	}//for
+}
+
+
+int main(int argc, const char *argv[])
+{
+	koki_t *koki = koki_new();
+	totals_t totals[NUM_STRIDES] = { { 0 } };
+	double full_ns = 0;
+
+	if (argc < 2){
+		fprintf(stderr, "Usage: %s IMAGE...\n", argv[0]);
+		return 1;
+	}
+
+	for (int i=1; i<argc; i++){
+
+		IplImage *frame = cvLoadImage(argv[i], CV_LOAD_IMAGE_GRAYSCALE);
+		koki_camera_params_t params;
+		koki_labelled_image_t *full;
+		GPtrArray *full_markers;
+
+		if (frame == NULL){
+			fprintf(stderr, "couldn't load %s\n", argv[i]);
+			return 1;
+		}
+
+		params.size.x = frame->width;
+		params.size.y = frame->height;
+		params.principal_point.x = frame->width / 2;
+		params.principal_point.y = frame->height / 2;
+		params.focal_length.x = params.focal_length.y = FOCAL_LENGTH;
+
+		koki_set_sparse_labelling(koki, 0);
+		full = koki_label_adaptive(koki, frame, 11, 5);
+		full_markers = koki_find_markers(koki, frame, MARKER_WIDTH, &params);
+		full_ns += time_labelling(koki, frame, 0);
+
+		for (uint8_t s=0; s<NUM_STRIDES; s++){
+
+			koki_labelled_image_t *sparse;
+			GPtrArray *markers;
+
+			sparse = koki_label_sparse(koki, frame, 11, 5, strides[s]);
+			compare_regions(full, sparse, &totals[s]);
+			koki_labelled_image_free(sparse);
+
+			koki_set_sparse_labelling(koki, strides[s]);
+			markers = koki_find_markers(koki, frame, MARKER_WIDTH,
+						    &params);
+			compare_markers(full_markers, markers, &totals[s]);
+			koki_markers_free(markers);
+
+			totals[s].ns += time_labelling(koki, frame, strides[s]);
+
+		}//for
+
+		koki_labelled_image_free(full);
+		koki_markers_free(full_markers);
+		cvReleaseImage(&frame);
+
+	}//for
+
+	printf("%d images; full labelling takes %.3f ms/frame\n\n",
+	       argc - 1, full_ns / (argc - 1) / 1e6);
+	printf("stride   regions found   markers found   ms/frame   speed-up\n");
+
+	for (uint8_t s=0; s<NUM_STRIDES; s++){
+
+		totals_t *t = &totals[s];
+
+		printf("%6u   %6u/%-6u   %6u/%-6u   %8.3f   %7.2fx\n",
+		       strides[s], t->regions_found, t->regions,
+		       t->markers_found, t->markers,
+		       t->ns / (argc - 1) / 1e6, full_ns / t->ns);
+
+	}//for
+
+	koki_destroy(koki);
+
+	return 0;
+}
@@ -15,24 +15,206 @@
    You should have received a copy of the GNU General Public License
    along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
 
+/*
+ * Times koki_find_markers() over the same image for a number of
+ * iterations, and reports the frame rate.  Where the powercap RAPL
+ * counters can be read (usually as root), the energy used per frame is
+ * reported too, both in total and per RAPL domain.  The counters are
+ * system-wide, so the machine should otherwise be idle.
+ *
+ * With "perf", hardware counters are read around each stage and
+ * reported per frame, along with each stage's share of the energy,
+ * estimated from its share of the cycles.  Reading them slows the
+ * per-candidate stages down, so the frame rate and energy are marked as
+ * measured with the counters on.  With "workers=N", frames are
+ * passed through a pool of N workers, keeping N frames in flight.  The
+ * pixel kernels can be chosen with KOKI_SIMD, so the energy cost of the
+ * threading and SIMD options can be compared.
+ */
+
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
 #include <assert.h>
+#include <time.h>
+#include <poll.h>
 #include <cv.h>
 #include <highgui.h>
 #include <glib.h>
 
 #include "koki.h"
 
+#include "energy.h"
+
+#define MARKER_WIDTH 0.11
+
+
+static void add_perf(koki_perf_frame_t *total, const koki_perf_frame_t *p)
+{
+	total->available |= p->available;
+	for (int s=0; s<KOKI_PERF_NUM_STAGES; s++){
+		total->stages[s].runs += p->stages[s].runs;
+		for (int c=0; c<KOKI_PERF_NUM_COUNTERS; c++)
+			total->stages[s].counts[c] += p->stages[s].counts[c];
+	}
+}
+
+
+/* finds the markers in the frame over and over, one frame at a time */
+static void run_serial(koki_t *koki, IplImage *frame, int iters,
+		       koki_camera_params_t *params, bool perf,
+		       koki_perf_frame_t *perf_total)
+{
+	for (int iteration=0; iteration<iters; iteration++){
+
+		/* get markers */
+		GPtrArray *markers = koki_find_markers(koki, frame,
+						       MARKER_WIDTH, params);
+
+		koki_markers_free(markers);
+
+		if (perf)
+			add_perf(perf_total, koki_get_perf_counters(koki));
+
+	}
+}
+
+
+/* finds the markers in copies of the frame on a pool of workers, each
+   copy being in flight at most once at a time */
+static void run_async(koki_async_t *async, IplImage **copies,
+		      uint16_t num_copies, int iters,
+		      koki_camera_params_t *params,
+		      koki_perf_frame_t *perf_total)
+{
+	IplImage *free_frames[num_copies];
+	int num_free = 0, submitted = 0, done = 0;
+
+	for (uint16_t i=0; i<num_copies; i++)
+		free_frames[num_free++] = copies[i];
+
+	while (done < iters){
+
+		koki_async_result_t result;
+		struct pollfd pfd;
+
+		while (submitted < iters && num_free > 0
+		       && koki_find_markers_async(async,
+						  free_frames[num_free - 1],
+						  MARKER_WIDTH, params,
+						  NULL, NULL)){
+			num_free--;
+			submitted++;
+		}
+
+		pfd.fd = koki_async_get_fd(async);
+		pfd.events = POLLIN;
+		poll(&pfd, 1, -1);
+
+		while (koki_async_poll(async, &result)){
+			koki_markers_free(result.markers);
+			add_perf(perf_total, &result.perf);
+			free_frames[num_free++] = result.frame;
+			done++;
+		}
+
+	}
+}
+
+
+static void print_perf(const koki_perf_frame_t *perf_total, int iters,
+		       uint64_t energy_uj)
+{
+	uint64_t frame_cycles =
+		perf_total->stages[KOKI_PERF_FRAME].counts[KOKI_PERF_CYCLES];
+
+	printf("%-14s %8s", "per frame", "runs");
+	for (int c=0; c<KOKI_PERF_NUM_COUNTERS; c++)
+		printf(" %14s", koki_perf_counter_name(c));
+	printf(" %6s %10s\n", "IPC", "est. mJ");
+
+	for (int s=0; s<KOKI_PERF_NUM_STAGES; s++){
+
+		const koki_perf_stage_counts_t *t = &perf_total->stages[s];
+		uint64_t cycles = t->counts[KOKI_PERF_CYCLES];
+
+		printf("%-14s %8.1f", koki_perf_stage_name(s),
+		       (double)t->runs / iters);
+
+		for (int c=0; c<KOKI_PERF_NUM_COUNTERS; c++){
+			if (perf_total->available & (1 << c))
+				printf(" %14.0f",
+				       (double)t->counts[c] / iters);
+			else
+				printf(" %14s", "-");
+		}
+
+		if (cycles > 0 && (perf_total->available
+				   & (1 << KOKI_PERF_INSTRUCTIONS)))
+			printf(" %6.2f", (double)t->counts[KOKI_PERF_INSTRUCTIONS]
+			       / cycles);
+		else
+			printf(" %6s", "-");
+
+		/* the frame's energy, split by share of the cycles */
+		if (energy_uj > 0 && frame_cycles > 0)
+			printf(" %10.3f\n", (double)energy_uj * cycles
+			       / frame_cycles / iters / 1000);
+		else
+			printf(" %10s\n", "-");
+
+	}//for
+}
+
 
 int main(int argc, const char *argv[])
 {
 	koki_t* koki = koki_new();
+	koki_perf_frame_t perf_total;
+	koki_async_t *async = NULL;
+	IplImage **copies = NULL;
+	energy_t *energy;
+	struct timespec start, end;
+	uint64_t energy_uj = 0;
+	uint16_t workers = 0;
+	bool perf = FALSE;
+	double secs;
 
-	if (argc != 3){
-		printf("Usage: ./speed_test <iterations> <filename>\n");
+	if (argc < 3){
+		printf("Usage: ./speed_test <iterations> <filename> [perf] [workers=N]\n");
 		return 1;
 	}
 
+	for (int i=3; i<argc; i++){
+		if (strcmp(argv[i], "perf") == 0)
+			perf = TRUE;
+		else if (strncmp(argv[i], "workers=", 8) == 0
+			 && atoi(argv[i] + 8) > 0)
+			workers = atoi(argv[i] + 8);
+		else {
+			printf("Usage: ./speed_test <iterations> <filename> [perf] [workers=N]\n");
+			return 1;
+		}
+	}
+
+	/* with "perf", hardware counters are read around each stage, which
+	   slows the per-candidate stages down, so the frame rate and energy
+	   are marked as measured with them */
+	if (perf){
+		perf = koki_set_perf_counters(koki, TRUE);
+		if (!perf)
+			fprintf(stderr, "performance counters unavailable\n");
+	}
+	memset(&perf_total, 0, sizeof(perf_total));
+
+	energy = energy_new();
+	if (energy == NULL)
+		fprintf(stderr, "energy counters unavailable\n");
+
+	/* KOKI_SIMD can be used to compare the kernel variants */
+	fprintf(stderr, "using %s kernels\n", koki_simd_kernels()->name);
+
 	const char *iters_str = argv[1];
 	int iters = atoi(iters_str);
 	const char *filename = argv[2];
@@ -48,17 +230,69 @@ int main(int argc, const char *argv[])
 	params.focal_length.x = 571.0;
 	params.focal_length.y = 571.0;
 
+	/* the pool, and the copies of the frame it needs (each frame in
+	   flight needs pixels of its own), are set up before timing */
+	if (workers > 0){
+		async = koki_async_new(koki, workers, workers);
+		assert(async != NULL);
 
-	for (int iteration=0; iteration<iters; iteration++){
+		copies = g_new(IplImage*, workers);
+		for (uint16_t i=0; i<workers; i++)
+			copies[i] = cvCloneImage(frame);
+	}
 
-		/* get markers */
-		GPtrArray *markers = koki_find_markers(koki, frame, 0.11, &params);
 
-		koki_markers_free(markers);
+	if (energy != NULL)
+		energy_reset(energy);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	if (workers > 0)
+		run_async(async, copies, workers, iters, &params, &perf_total);
+	else
+		run_serial(koki, frame, iters, &params, perf, &perf_total);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (energy != NULL)
+		energy_uj = energy_read(energy);
+
+	secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	if (async != NULL){
+		koki_async_free(async);
+		for (uint16_t i=0; i<workers; i++)
+			cvReleaseImage(&copies[i]);
+		g_free(copies);
+	}
+
+	if (iters > 0){
+
+		const char *note = perf ? " (with perf counters on)" : "";
+
+		printf("%d frames in %.3f s (%u worker%s): %.1f frames/s%s\n",
+		       iters, secs, workers > 0 ? workers : 1,
+		       workers > 1 ? "s" : "", iters / secs, note);
+
+		if (energy != NULL){
+
+			printf("%.3f mJ/frame, %.2f W%s\n",
+			       (double)energy_uj / iters / 1000,
+			       secs > 0 ? energy_uj / secs / 1e6 : 0, note);
+
+			for (uint16_t d=0; d<energy->num_domains; d++)
+				printf("  %-12s %10.3f mJ/frame\n",
+				       energy->domains[d].name,
+				       (double)energy->domains[d].total
+				       / iters / 1000);
+
+		}
 
 	}
 
+	if (perf && iters > 0)
+		print_perf(&perf_total, iters, energy_uj);
+
 
+	energy_free(energy);
 	cvReleaseImage(&frame);
 
 	return 0;
@@ -0,0 +1,451 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/*
+ * Benchmarks each stage of the pipeline in isolation.  The inputs to each
+ * stage (regions, contours, quads, markers, grids) are captured by running
+ * the pipeline once over the given image, and every stage is then timed
+ * over those same inputs.  For each stage, after a warm-up, a number of
+ * timed repetitions are made, and the median and minimum ns/op, the
+ * median cycles/op (on x86) and the allocations/op are reported.  Batch
+ * decoding is timed over full batches, and reported per marker.
+ *
+ * Allocations are counted by wrapping glibc's malloc, calloc and realloc,
+ * along with posix_memalign and aligned_alloc, which the default allocator
+ * uses for aligned buffers.
+ *
+ * Where the powercap RAPL counters can be read (usually as root), the
+ * energy/op over all of a stage's timed repetitions is reported too.  The
+ * counters only update every millisecond or so, which the repetitions
+ * are long enough to make up for, but they're system-wide, so the
+ * machine should otherwise be idle.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <errno.h>
+#include <time.h>
+#include <cv.h>
+#include <highgui.h>
+#include <glib.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#else
+#define HAVE_TSC 0
+#endif
+
+#include "koki.h"
+#include "integral-image.h"
+#include "pca.h"
+
+#include "energy.h"
+
+#define MARKER_WIDTH 0.11
+#define DEFAULT_REPS 15
+#define REP_NS 10000000   /* aim for each repetition to take 10ms */
+
+
+/* --------------------------------------------------- allocation counting */
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+static uint64_t num_allocs = 0;
+
+/* the energy counters, or NULL if they're unavailable */
+static energy_t *energy = NULL;
+
+void *malloc(size_t size)
+{
+	__atomic_add_fetch(&num_allocs, 1, __ATOMIC_RELAXED);
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+	__atomic_add_fetch(&num_allocs, 1, __ATOMIC_RELAXED);
+	return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	__atomic_add_fetch(&num_allocs, 1, __ATOMIC_RELAXED);
+	return __libc_realloc(ptr, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size)
+{
+	void *p;
+
+	if (alignment % sizeof(void*) != 0
+	    || (alignment & (alignment - 1)) != 0)
+		return EINVAL;
+
+	__atomic_add_fetch(&num_allocs, 1, __ATOMIC_RELAXED);
+
+	p = __libc_memalign(alignment, size);
+	if (p == NULL)
+		return ENOMEM;
+
+	*ptr = p;
+	return 0;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+	__atomic_add_fetch(&num_allocs, 1, __ATOMIC_RELAXED);
+	return __libc_memalign(alignment, size);
+}
+
+
+/* ---------------------------------------------------------------- inputs */
+
+typedef struct {
+	koki_t *koki;
+	IplImage *frame;
+	koki_camera_params_t params;
+
+	koki_integral_image_t *iimg;
+	koki_labelled_image_t *labelled;
+	GArray *regions;       /* label_t of the useable regions */
+	GPtrArray *contours;   /* the contours of those regions */
+	GPtrArray *quads;      /* the quads that could be found */
+	GPtrArray *markers;    /* markers made from the quads that decoded */
+	GArray *grids;         /* the grids of the decoded markers */
+	uint8_t *yuyv;         /* the frame, as YUYV */
+} inputs_t;
+
+
+static void capture_inputs(inputs_t *in)
+{
+
+	in->iimg = koki_integral_image_new(in->frame, FALSE);
+	in->labelled = koki_label_adaptive(in->koki, in->frame, 11, 5);
+
+	in->regions = g_array_new(FALSE, FALSE, sizeof(label_t));
+	in->contours = g_ptr_array_new();
+	in->quads = g_ptr_array_new();
+	in->markers = g_ptr_array_new();
+	in->grids = g_array_new(FALSE, FALSE, sizeof(koki_grid_t));
+
+	for (label_t i=0; i<in->labelled->clips->len; i++){
+
+		GSList *contour;
+		koki_quad_t *quad;
+		koki_marker_t *marker;
+
+		if (!koki_label_useable(in->labelled, i))
+			continue;
+
+		contour = koki_contour_find(in->labelled, i);
+		g_array_append_val(in->regions, i);
+		g_ptr_array_add(in->contours, contour);
+
+		quad = koki_quad_find_vertices(contour);
+		if (quad == NULL)
+			continue;
+
+		koki_quad_refine_vertices(quad);
+		g_ptr_array_add(in->quads, quad);
+
+		marker = koki_marker_new(quad);
+
+		IplImage *unwarped = koki_unwarp_marker(in->koki, marker,
+							in->frame, 100);
+		if (unwarped == NULL){
+			koki_marker_free(marker);
+			continue;
+		}
+
+		IplImage *res = koki_threshold_adaptive(unwarped, 21, 3,
+							KOKI_ADAPTIVE_MEAN);
+		koki_grid_t grid;
+		koki_grid_from_image(res, 127, &grid);
+
+		cvReleaseImage(&unwarped);
+		cvReleaseImage(&res);
+
+		if (koki_code_recover_from_grid(&grid, NULL) < 0){
+			koki_marker_free(marker);
+			continue;
+		}
+
+		g_ptr_array_add(in->markers, marker);
+		g_array_append_val(in->grids, grid);
+
+	}//for
+
+	/* make a YUYV frame with neutral chroma */
+	in->yuyv = g_malloc(in->frame->width * in->frame->height * 2);
+	for (int y=0; y<in->frame->height; y++)
+		for (int x=0; x<in->frame->width; x++){
+			uint8_t *p = &in->yuyv[(y * in->frame->width + x) * 2];
+			p[0] = KOKI_IPLIMAGE_GS_ELEM(in->frame, x, y);
+			p[1] = 128;
+		}
+
+}
+
+
+/* ---------------------------------------------------------------- stages */
+
+static void bench_integral(inputs_t *in, uint32_t i)
+{
+	/* rewind, rather than reallocate, the integral image */
+	in->iimg->complete_x = 0;
+	in->iimg->complete_y = 0;
+	memset(in->iimg->sum, 0, in->iimg->w * sizeof(uint32_t));
+
+	koki_integral_image_advance(in->iimg, in->iimg->w - 1, in->iimg->h - 1);
+}
+
+static void bench_label(inputs_t *in, uint32_t i)
+{
+	koki_labelled_image_free(koki_label_adaptive(in->koki, in->frame, 11, 5));
+}
+
+static void bench_contour(inputs_t *in, uint32_t i)
+{
+	label_t region = g_array_index(in->regions, label_t, i % in->regions->len);
+
+	koki_contour_free(koki_contour_find(in->labelled, region));
+}
+
+static void bench_quad(inputs_t *in, uint32_t i)
+{
+	koki_quad_t *quad;
+
+	quad = koki_quad_find_vertices(g_ptr_array_index(in->contours,
+							 i % in->contours->len));
+	if (quad != NULL)
+		koki_quad_free(quad);
+}
+
+static void bench_pca(inputs_t *in, uint32_t i)
+{
+	koki_quad_t *quad = g_ptr_array_index(in->quads, i % in->quads->len);
+	koki_point2Df_t vects[2], avg;
+	float vals[2];
+
+	/* one side of the quad */
+	koki_pca(quad->links[0], quad->links[1], vects, vals, &avg);
+}
+
+static void bench_unwarp(inputs_t *in, uint32_t i)
+{
+	IplImage *img;
+
+	img = koki_unwarp_marker(in->koki,
+				 g_ptr_array_index(in->markers, i % in->markers->len),
+				 in->frame, 100);
+	cvReleaseImage(&img);
+}
+
+static void bench_recover(inputs_t *in, uint32_t i)
+{
+	float rotation;
+
+	koki_code_recover_from_grid(&g_array_index(in->grids, koki_grid_t,
+						   i % in->grids->len),
+				    &rotation);
+}
+
+/* each call decodes a full batch, wrapping round the markers */
+static void bench_recover_batch(inputs_t *in, uint32_t i)
+{
+	koki_marker_t *batch[KOKI_CODE_BATCH_SIZE];
+	int16_t codes[KOKI_CODE_BATCH_SIZE];
+	float rotations[KOKI_CODE_BATCH_SIZE];
+
+	for (uint8_t k=0; k<KOKI_CODE_BATCH_SIZE; k++)
+		batch[k] = g_ptr_array_index(in->markers,
+					     (i * KOKI_CODE_BATCH_SIZE + k)
+					     % in->markers->len);
+
+	koki_code_recover_batch(in->frame, batch, KOKI_CODE_BATCH_SIZE,
+				codes, rotations, NULL);
+}
+
+static void bench_pose(inputs_t *in, uint32_t i)
+{
+	koki_pose_estimate(g_ptr_array_index(in->markers, i % in->markers->len),
+			   MARKER_WIDTH, &in->params);
+}
+
+static void bench_yuyv_grey(inputs_t *in, uint32_t i)
+{
+	IplImage *img;
+
+	img = koki_v4l_YUYV_frame_to_grayscale_image(in->yuyv, in->frame->width,
+						     in->frame->height);
+	cvReleaseImage(&img);
+}
+
+static void bench_yuyv_rgb(inputs_t *in, uint32_t i)
+{
+	IplImage *img;
+
+	img = koki_v4l_YUYV_frame_to_RGB_image(in->yuyv, in->frame->width,
+					       in->frame->height);
+	cvReleaseImage(&img);
+}
+
+
+/* ------------------------------------------------------------- harness */
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t cycles(void)
+{
+#if HAVE_TSC
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double da = *(const double*)a, db = *(const double*)b;
+
+	return da < db ? -1 : da > db;
+}
+
+/* times a stage, each call of which does 'per_call' operations */
+static void bench(const char *name, void (*fn)(inputs_t*, uint32_t),
+		  inputs_t *in, uint32_t num_inputs, uint32_t per_call,
+		  int reps)
+{
+	double ns[reps], cyc[reps], allocs = 0;
+	uint64_t t, iters, uj = 0;
+
+	if (num_inputs == 0){
+		printf("%-24s  (no inputs in this image)\n", name);
+		return;
+	}
+
+	/* warm up, and work out how many iterations fill a repetition */
+	t = now_ns();
+	iters = 0;
+	while (now_ns() - t < REP_NS / 10 || iters < num_inputs)
+		fn(in, iters++);
+	iters = iters * 10;
+
+	if (energy != NULL)
+		energy_reset(energy);
+
+	for (int r=0; r<reps; r++){
+
+		uint64_t a0 = num_allocs, c0 = cycles(), t0 = now_ns();
+
+		for (uint64_t i=0; i<iters; i++)
+			fn(in, i);
+
+		ns[r] = (double)(now_ns() - t0) / (iters * per_call);
+		cyc[r] = (double)(cycles() - c0) / (iters * per_call);
+		allocs += (double)(num_allocs - a0) / (iters * per_call);
+
+	}
+
+	if (energy != NULL)
+		uj = energy_read(energy);
+
+	qsort(ns, reps, sizeof(double), cmp_double);
+	qsort(cyc, reps, sizeof(double), cmp_double);
+
+	printf("%-24s %12.1f %12.1f %12.0f %10.2f", name,
+	       ns[reps / 2], ns[0], HAVE_TSC ? cyc[reps / 2] : 0,
+	       allocs / reps);
+
+	if (energy != NULL)
+		printf(" %10.3f\n", (double)uj / (iters * reps * per_call));
+	else
+		printf(" %10s\n", "-");
+}
+
+
+int main(int argc, const char *argv[])
+{
+	inputs_t in;
+	int reps = DEFAULT_REPS;
+
+	if (argc < 2 || argc > 3){
+		printf("Usage: ./stage_bench <filename> [repetitions]\n");
+		return 1;
+	}
+
+	if (argc == 3)
+		reps = atoi(argv[2]);
+	assert(reps > 0);
+
+	in.koki = koki_new();
+	in.frame = cvLoadImage(argv[1], CV_LOAD_IMAGE_GRAYSCALE);
+	assert(in.frame != NULL);
+
+	in.params.size.x = in.frame->width;
+	in.params.size.y = in.frame->height;
+	in.params.principal_point.x = in.params.size.x / 2;
+	in.params.principal_point.y = in.params.size.y / 2;
+	in.params.focal_length.x = 571.0;
+	in.params.focal_length.y = 571.0;
+
+	capture_inputs(&in);
+
+	energy = energy_new();
+	if (energy == NULL)
+		fprintf(stderr, "energy counters unavailable\n");
+
+	printf("%s: %dx%d, %u candidates, %u quads, %u markers, %s kernels\n\n",
+	       argv[1], in.frame->width, in.frame->height,
+	       in.regions->len, in.quads->len, in.markers->len,
+	       koki_simd_kernels()->name);
+
+	printf("%-24s %12s %12s %12s %10s %10s\n", "stage",
+	       "ns/op", "min ns/op", "cycles/op", "allocs/op", "uJ/op");
+
+	bench("integral_image_advance", bench_integral, &in, 1, 1, reps);
+	bench("label_adaptive", bench_label, &in, 1, 1, reps);
+	bench("contour_find", bench_contour, &in, in.regions->len, 1, reps);
+	bench("quad_find_vertices", bench_quad, &in, in.contours->len, 1, reps);
+	bench("pca", bench_pca, &in, in.quads->len, 1, reps);
+	bench("unwarp_marker", bench_unwarp, &in, in.markers->len, 1, reps);
+	bench("code_recover_from_grid", bench_recover, &in, in.grids->len, 1,
+	      reps);
+	bench("code_recover_batch", bench_recover_batch, &in,
+	      (in.markers->len + KOKI_CODE_BATCH_SIZE - 1) / KOKI_CODE_BATCH_SIZE,
+	      KOKI_CODE_BATCH_SIZE, reps);
+	bench("pose_estimate", bench_pose, &in, in.markers->len, 1, reps);
+	bench("YUYV_to_grayscale", bench_yuyv_grey, &in, 1, 1, reps);
+	bench("YUYV_to_RGB", bench_yuyv_rgb, &in, 1, 1, reps);
+
+	energy_free(energy);
+
+	return 0;
+}
@@ -0,0 +1,225 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/**
+ * @file  synthetic.c
+ * @brief Implementation of drawing synthetic markers in the tests
+ *
+ * A marker is a 10x10 grid of cells: a black border two cells wide around
+ * the 6x6 code cells.  The code's 8-bit number and its 12-bit CRC are
+ * spread over five Hamming (7,4) blocks, cell k holding bit k / 5 of block
+ * k % 5, with the last cell unused.
+ *
+ * This is only built into the tests that need it, not the library.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include <cv.h>
+#include <glib.h>
+
+#include "koki.h"
+#include "crc12.h"
+
+#include "synthetic.h"
+
+/* the sub-samples per pixel, in each direction, when drawing */
+#define SYNTHETIC_SUPERSAMPLE 4
+
+#define CODE_BORDER ((KOKI_MARKER_GRID_WIDTH - KOKI_CODE_GRID_WIDTH) / 2)
+
+
+/* the Hamming (7,4) encoding of a nibble, with the data in bits 2, 4, 5
+   and 6 and parity bit i covering the positions with bit i set */
+static uint8_t hamming_encode(uint8_t d)
+{
+	uint8_t d0 = d & 1, d1 = (d >> 1) & 1, d2 = (d >> 2) & 1, d3 = (d >> 3) & 1;
+	uint8_t p0 = d0 ^ d1 ^ d3, p1 = d0 ^ d2 ^ d3, p2 = d1 ^ d2 ^ d3;
+
+	return p0 | p1 << 1 | d0 << 2 | p2 << 3 | d1 << 4 | d2 << 5 | d3 << 6;
+}
+
+/**
+ * @brief works out the code cells of a raw code (before translation)
+ *
+ * @param raw    the raw code
+ * @param cells  where to store the cells, \c 1 for white
+ */
+void synthetic_code_cells(uint8_t raw,
+			  uint8_t cells[KOKI_CODE_GRID_WIDTH][KOKI_CODE_GRID_WIDTH])
+{
+	uint32_t data = raw | (uint32_t)koki_crc12(raw + 1) << 8;
+	uint8_t blocks[5];
+
+	for (uint8_t b=0; b<5; b++)
+		blocks[b] = hamming_encode((data >> (4 * b)) & 0xF);
+
+	for (uint8_t k=0; k<KOKI_CODE_GRID_WIDTH * KOKI_CODE_GRID_WIDTH; k++){
+		uint8_t y = k / KOKI_CODE_GRID_WIDTH, x = k % KOKI_CODE_GRID_WIDTH;
+		cells[y][x] = k == 35 ? 1 : !((blocks[k % 5] >> (k / 5)) & 1);
+	}
+}
+
+/**
+ * @brief picks a random raw code that's in use
+ *
+ * @return  the raw code, which koki_code_translation() maps to a marker
+ *          number
+ */
+uint8_t synthetic_random_code(void)
+{
+	uint8_t raw;
+
+	do
+		raw = g_random_int_range(0, 256);
+	while (koki_code_translation(raw) < 0);
+
+	return raw;
+}
+
+/**
+ * @brief places a square marker
+ *
+ * @param cx       the x coordinate of the marker's centre
+ * @param cy       the y coordinate of the marker's centre
+ * @param side     the length of the marker's sides, in pixels
+ * @param turn     how far the marker's turned clockwise, in radians
+ * @param corners  where to store the marker's corners, those of the unit
+ *                 square's (0,0), (1,0), (1,1) and (0,1) in turn
+ */
+void synthetic_corners(double cx, double cy, double side, double turn,
+		       koki_point2Df_t corners[4])
+{
+	for (uint8_t c=0; c<4; c++){
+		double a = turn + c * M_PI / 2 - 3 * M_PI / 4;
+		corners[c].x = cx + side / M_SQRT2 * cos(a);
+		corners[c].y = cy + side / M_SQRT2 * sin(a);
+	}
+}
+
+/* the inverse of the homography from the unit square on to a quad */
+static void unit_square_inverse(const koki_point2Df_t q[4], double inv[9])
+{
+	koki_homography_t h;
+	double m[9], det;
+
+	koki_homography_from_quad(q, &h);
+
+	m[0] = h.a; m[1] = h.b; m[2] = h.c;
+	m[3] = h.d; m[4] = h.e; m[5] = h.f;
+	m[6] = h.g; m[7] = h.h; m[8] = 1;
+
+	det = m[0] * (m[4] * m[8] - m[5] * m[7])
+		- m[1] * (m[3] * m[8] - m[5] * m[6])
+		+ m[2] * (m[3] * m[7] - m[4] * m[6]);
+
+	inv[0] = (m[4] * m[8] - m[5] * m[7]) / det;
+	inv[1] = (m[2] * m[7] - m[1] * m[8]) / det;
+	inv[2] = (m[1] * m[5] - m[2] * m[4]) / det;
+	inv[3] = (m[5] * m[6] - m[3] * m[8]) / det;
+	inv[4] = (m[0] * m[8] - m[2] * m[6]) / det;
+	inv[5] = (m[2] * m[3] - m[0] * m[5]) / det;
+	inv[6] = (m[3] * m[7] - m[4] * m[6]) / det;
+	inv[7] = (m[1] * m[6] - m[0] * m[7]) / det;
+	inv[8] = (m[0] * m[4] - m[1] * m[3]) / det;
+}
+
+/* whether a point in the marker's unit square is white, or -1 if it's
+   outside the marker */
+static int marker_white(double u, double v,
+			uint8_t cells[KOKI_CODE_GRID_WIDTH][KOKI_CODE_GRID_WIDTH])
+{
+	int col = floor(u * KOKI_MARKER_GRID_WIDTH);
+	int row = floor(v * KOKI_MARKER_GRID_WIDTH);
+
+	if (u < 0 || v < 0 || u >= 1 || v >= 1)
+		return -1;
+
+	if (row < CODE_BORDER || col < CODE_BORDER
+	    || row >= CODE_BORDER + KOKI_CODE_GRID_WIDTH
+	    || col >= CODE_BORDER + KOKI_CODE_GRID_WIDTH)
+		return 0;
+
+	return cells[row - CODE_BORDER][col - CODE_BORDER];
+}
+
+/**
+ * @brief draws a marker over a greyscale frame, blending the pixels its
+ *        edges partly cover
+ *
+ * @param frame    the frame
+ * @param corners  the marker's corners, as from synthetic_corners()
+ * @param cells    the code cells, as from synthetic_code_cells()
+ * @param black    the grey level of the border and black cells
+ * @param white    the grey level of the white cells
+ */
+void synthetic_draw_marker(IplImage *frame, const koki_point2Df_t corners[4],
+			   uint8_t cells[KOKI_CODE_GRID_WIDTH][KOKI_CODE_GRID_WIDTH],
+			   uint8_t black, uint8_t white)
+{
+	const uint8_t ss = SYNTHETIC_SUPERSAMPLE;
+	double inv[9];
+	int x0 = frame->width, y0 = frame->height, x1 = 0, y1 = 0;
+
+	assert(frame->nChannels == 1 && frame->depth == IPL_DEPTH_8U);
+
+	unit_square_inverse(corners, inv);
+
+	for (uint8_t c=0; c<4; c++){
+		x0 = MIN(x0, floor(corners[c].x));
+		y0 = MIN(y0, floor(corners[c].y));
+		x1 = MAX(x1, ceil(corners[c].x) + 1);
+		y1 = MAX(y1, ceil(corners[c].y) + 1);
+	}
+
+	x0 = MAX(x0, 0);
+	y0 = MAX(y0, 0);
+	x1 = MIN(x1, frame->width);
+	y1 = MIN(y1, frame->height);
+
+	for (int y=y0; y<y1; y++)
+		for (int x=x0; x<x1; x++){
+
+			uint8_t *pixel = (uint8_t*)frame->imageData
+				+ y * frame->widthStep + x;
+			int sum = 0, n = 0;
+
+			for (uint8_t sy=0; sy<ss; sy++)
+				for (uint8_t sx=0; sx<ss; sx++){
+
+					double px = x + (sx + 0.5) / ss - 0.5;
+					double py = y + (sy + 0.5) / ss - 0.5;
+					double w = inv[6] * px + inv[7] * py + inv[8];
+					int val = marker_white(
+						(inv[0] * px + inv[1] * py + inv[2]) / w,
+						(inv[3] * px + inv[4] * py + inv[5]) / w,
+						cells);
+
+					if (val >= 0){
+						sum += val ? white : black;
+						n++;
+					}
+
+				}//for
+
+			if (n > 0)
+				*pixel = (*pixel * (ss * ss - n) + sum + ss * ss / 2)
+					/ (ss * ss);
+
+		}//for
+}
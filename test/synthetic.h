@@ -0,0 +1,44 @@
+/* Copyright 2013 libkoki contributors
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+#ifndef _SYNTHETIC_H_
+#define _SYNTHETIC_H_
+
+/**
+ * @file  synthetic.h
+ * @brief Header file for drawing synthetic markers in the tests
+ */
+
+#include <stdint.h>
+#include <cv.h>
+
+#include "points.h"
+#include "code_grid.h"
+
+
+void synthetic_code_cells(uint8_t raw,
+			  uint8_t cells[KOKI_CODE_GRID_WIDTH][KOKI_CODE_GRID_WIDTH]);
+
+uint8_t synthetic_random_code(void);
+
+void synthetic_corners(double cx, double cy, double side, double turn,
+		       koki_point2Df_t corners[4]);
+
+void synthetic_draw_marker(IplImage *frame, const koki_point2Df_t corners[4],
+			   uint8_t cells[KOKI_CODE_GRID_WIDTH][KOKI_CODE_GRID_WIDTH],
+			   uint8_t black, uint8_t white);
+
+#endif /* _SYNTHETIC_H_ */